@@ -0,0 +1,322 @@
+/**
+ * Calibration.cpp
+ *  See Calibration.h.
+ */
+#include "Calibration.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// solves a * x = b for n <= 3 unknowns (Gaussian elimination with partial pivoting).
+bool solve(double a[3][3], double b[3], uint8_t n, double x[3])
+{
+  for (uint8_t col = 0; col < n; col++)
+  {
+    uint8_t pivot = col;
+    for (uint8_t row = col + 1; row < n; row++)
+    {
+      if (std::fabs(a[row][col]) > std::fabs(a[pivot][col]))
+      {
+        pivot = row;
+      }
+    }
+    if (std::fabs(a[pivot][col]) < 1e-12)
+    {
+      return false;
+    }
+    for (uint8_t k = 0; k < n; k++)
+    {
+      const double t = a[col][k];
+      a[col][k] = a[pivot][k];
+      a[pivot][k] = t;
+    }
+    const double t = b[col];
+    b[col] = b[pivot];
+    b[pivot] = t;
+    for (uint8_t row = col + 1; row < n; row++)
+    {
+      const double factor = a[row][col] / a[col][col];
+      for (uint8_t k = col; k < n; k++)
+      {
+        a[row][k] -= factor * a[col][k];
+      }
+      b[row] -= factor * b[col];
+    }
+  }
+  for (int row = n - 1; row >= 0; row--)
+  {
+    double sum = b[row];
+    for (uint8_t k = static_cast<uint8_t>(row + 1); k < n; k++)
+    {
+      sum -= a[row][k] * x[k];
+    }
+    x[row] = sum / a[row][row];
+  }
+  return true;
+}
+
+uint32_t crc32(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return ~crc;
+}
+
+}  // namespace
+
+CalibrationError fitCalibration(const CalibrationPoint *points, uint8_t count, bool withTemperature,
+                                float minTemperatureSpanC, CalibrationResult &result)
+{
+  if (count < 2)
+  {
+    return CalibrationError::TooFewPoints;
+  }
+  float minGrams = points[0].grams, maxGrams = points[0].grams;
+  float minTemp = points[0].temperatureC, maxTemp = points[0].temperatureC;
+  double meanTemp = 0.0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    minGrams = points[i].grams < minGrams ? points[i].grams : minGrams;
+    maxGrams = points[i].grams > maxGrams ? points[i].grams : maxGrams;
+    minTemp = points[i].temperatureC < minTemp ? points[i].temperatureC : minTemp;
+    maxTemp = points[i].temperatureC > maxTemp ? points[i].temperatureC : maxTemp;
+    meanTemp += points[i].temperatureC;
+  }
+  meanTemp /= count;
+  if (maxGrams - minGrams < 1.0f)
+  {
+    return CalibrationError::TooFewPoints;   // all the points have the same weight
+  }
+  // the drift needs a third point and a real temperature change.
+  const uint8_t n = (withTemperature && count >= 3 && maxTemp - minTemp >= minTemperatureSpanC) ? 3 : 2;
+
+  // normal equations of counts = zero + countsPerGram * grams + countsPerDegree * (t - mean t).
+  double a[3][3] = {};
+  double b[3] = {};
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const double row[3] = {1.0, points[i].grams, points[i].temperatureC - meanTemp};
+    for (uint8_t j = 0; j < n; j++)
+    {
+      for (uint8_t k = 0; k < n; k++)
+      {
+        a[j][k] += row[j] * row[k];
+      }
+      b[j] += row[j] * points[i].counts;
+    }
+  }
+  double x[3] = {0.0, 0.0, 0.0};
+  if (!solve(a, b, n, x) || !std::isfinite(x[1]) || std::fabs(x[1]) < 1e-3)
+  {
+    return CalibrationError::BadFit;
+  }
+
+  double squares = 0.0;
+  double maxError = 0.0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const double predicted = x[0] + x[1] * points[i].grams + x[2] * (points[i].temperatureC - meanTemp);
+    const double errorG = std::fabs((points[i].counts - predicted) / x[1]);
+    squares += errorG * errorG;
+    maxError = errorG > maxError ? errorG : maxError;
+  }
+  result.zeroCounts = static_cast<float>(x[0]);
+  result.countsPerGram = static_cast<float>(x[1]);
+  result.countsPerDegree = static_cast<float>(x[2]);
+  result.refTemperatureC = static_cast<float>(meanTemp);
+  result.rmsErrorG = static_cast<float>(std::sqrt(squares / count));
+  result.maxErrorG = static_cast<float>(maxError);
+  result.points = count;
+  return CalibrationError::None;
+}
+
+void Calibrator::start()
+{
+  state_ = CalibrationState::WaitingForLoad;
+  error_ = CalibrationError::None;
+  count_ = 0;
+  resultPending_ = false;
+}
+
+bool Calibrator::addPoint(float grams)
+{
+  if (state_ == CalibrationState::Idle || state_ == CalibrationState::Done)
+  {
+    error_ = CalibrationError::NotStarted;
+    return false;
+  }
+  if (state_ == CalibrationState::Sampling)
+  {
+    error_ = CalibrationError::Busy;
+    return false;
+  }
+  if (count_ >= CALIBRATION_MAX_POINTS)
+  {
+    error_ = CalibrationError::TooManyPoints;
+    return false;
+  }
+  error_ = CalibrationError::None;
+  pendingGrams_ = grams;
+  tried_ = 0;
+  restartWindow();
+  state_ = CalibrationState::Sampling;
+  return true;
+}
+
+bool Calibrator::finish()
+{
+  if (state_ != CalibrationState::WaitingForLoad)
+  {
+    error_ = state_ == CalibrationState::Sampling ? CalibrationError::Busy : CalibrationError::NotStarted;
+    return false;
+  }
+  error_ = fitCalibration(points_, count_, config_.temperatureCompensation, config_.minTemperatureSpanC, result_);
+  if (error_ != CalibrationError::None)
+  {
+    return false;
+  }
+  state_ = CalibrationState::Done;
+  resultPending_ = true;
+  return true;
+}
+
+void Calibrator::cancel()
+{
+  state_ = CalibrationState::Idle;
+  error_ = CalibrationError::None;
+  count_ = 0;
+  resultPending_ = false;
+}
+
+void Calibrator::onSample(int32_t counts, float temperatureC)
+{
+  if (state_ != CalibrationState::Sampling)
+  {
+    return;
+  }
+  if (window_ == 0)
+  {
+    first_ = counts;
+  }
+  const int32_t delta = counts - first_;
+  sum_ += delta;
+  sumSquares_ += static_cast<double>(delta) * delta;
+  temperatureSum_ += temperatureC;
+  window_++;
+  tried_++;
+  if (window_ < config_.samplesPerPoint)
+  {
+    return;
+  }
+  const double mean = static_cast<double>(sum_) / window_;
+  const double variance = sumSquares_ / window_ - mean * mean;
+  const double noise = std::sqrt(variance > 0.0 ? variance : 0.0);
+  if (noise <= config_.maxNoiseCounts)
+  {
+    CalibrationPoint &point = points_[count_++];
+    point.grams = pendingGrams_;
+    point.counts = static_cast<float>(first_ + mean);
+    point.temperatureC = temperatureSum_ / window_;
+    point.noiseCounts = static_cast<float>(noise);
+    state_ = CalibrationState::WaitingForLoad;
+  }
+  else if (tried_ >= config_.timeoutSamples)
+  {
+    error_ = CalibrationError::Unstable;
+    state_ = CalibrationState::WaitingForLoad;
+  }
+  else
+  {
+    restartWindow();   // still moving: try the next window
+  }
+}
+
+bool Calibrator::takeResult(CalibrationResult &result)
+{
+  if (!resultPending_)
+  {
+    return false;
+  }
+  result = result_;
+  resultPending_ = false;
+  return true;
+}
+
+uint8_t Calibrator::progress() const
+{
+  if (state_ != CalibrationState::Sampling || config_.samplesPerPoint == 0)
+  {
+    return state_ == CalibrationState::Done ? 100 : 0;
+  }
+  return static_cast<uint8_t>(window_ * 100u / config_.samplesPerPoint);
+}
+
+void Calibrator::restartWindow()
+{
+  window_ = 0;
+  sum_ = 0;
+  sumSquares_ = 0.0;
+  temperatureSum_ = 0.0f;
+}
+
+void sealCalibrationRecord(CalibrationRecord &record)
+{
+  record.magic = CALIBRATION_MAGIC;
+  record.version = CALIBRATION_VERSION;
+  record.crc = crc32(reinterpret_cast<const uint8_t *>(&record), offsetof(CalibrationRecord, crc));
+}
+
+bool calibrationRecordValid(const CalibrationRecord &record, uint8_t channels)
+{
+  return record.magic == CALIBRATION_MAGIC && record.version == CALIBRATION_VERSION && record.channels == channels &&
+         record.countsPerGram != 0.0f && std::isfinite(record.countsPerGram) &&
+         record.crc == crc32(reinterpret_cast<const uint8_t *>(&record), offsetof(CalibrationRecord, crc));
+}
+
+const char *calibrationStateName(CalibrationState state)
+{
+  switch (state)
+  {
+  case CalibrationState::Idle:
+    return "idle";
+  case CalibrationState::WaitingForLoad:
+    return "waiting";
+  case CalibrationState::Sampling:
+    return "sampling";
+  case CalibrationState::Done:
+    return "done";
+  }
+  return "?";
+}
+
+const char *calibrationErrorName(CalibrationError error)
+{
+  switch (error)
+  {
+  case CalibrationError::None:
+    return "";
+  case CalibrationError::NotStarted:
+    return "not started";
+  case CalibrationError::Busy:
+    return "busy";
+  case CalibrationError::TooManyPoints:
+    return "too many points";
+  case CalibrationError::Unstable:
+    return "load not stable";
+  case CalibrationError::TooFewPoints:
+    return "need two different weights";
+  case CalibrationError::BadFit:
+    return "no usable fit";
+  }
+  return "?";
+}
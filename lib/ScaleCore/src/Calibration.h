@@ -0,0 +1,193 @@
+/**
+ * Calibration.h
+ *  Multi-point calibration of the platform, driven from the web page, without blocking any task:
+ *
+ *    start -> [put a known weight on, "point <grams>"] x N -> finish
+ *
+ *  For every point the Calibrator averages the combined samples Task1 feeds it (onSample()), as soon as
+ *  samplesPerPoint of them in a row are quiet enough (standard deviation <= maxNoiseCounts); a load that does
+ *  not settle within timeoutSamples is reported as unstable and the point can be taken again. finish() fits
+ *
+ *      counts = zero + countsPerGram * grams [+ countsPerDegree * (temperature - refTemperature)]
+ *
+ *  by least squares over all the points (two at least, an empty platform counts as a point like any other).
+ *  The temperature term (drift of the zero) is only fitted when it is enabled and the points were taken over
+ *  at least minTemperatureSpanC.
+ *
+ *  The result (offsets, factor, drift) is kept in a CalibrationRecord that the firmware stores in NVS, so
+ *  a reboot weighs with the stored zero at once instead of taring the platform again.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "LoadCellArray.h"
+
+#define CALIBRATION_MAX_POINTS   8
+#define CALIBRATION_MAGIC        0x4C414353u   // "SCAL"
+#define CALIBRATION_VERSION      1
+
+enum class CalibrationState : uint8_t
+{
+  Idle,            // not calibrating
+  WaitingForLoad,  // waiting for the next known weight (or finish)
+  Sampling,        // averaging the samples of a point
+  Done,            // fitted, see result()
+};
+
+enum class CalibrationError : uint8_t
+{
+  None,
+  NotStarted,      // a command that needs start() first
+  Busy,            // a point is still being sampled
+  TooManyPoints,   // CALIBRATION_MAX_POINTS already taken
+  Unstable,        // the load did not settle within timeoutSamples
+  TooFewPoints,    // finish() needs two points with different weights
+  BadFit,          // no usable slope (e.g. the load cell is not connected)
+};
+
+struct CalibrationConfig
+{
+  uint8_t  samplesPerPoint = 16;        // averaged per point (1.6 s at 10 SPS)
+  float    maxNoiseCounts = 300.0f;     // standard deviation of a quiet window
+  uint16_t timeoutSamples = 300;        // give up on a point after this many samples (30 s at 10 SPS)
+  bool     temperatureCompensation = false;
+  float    minTemperatureSpanC = 3.0f;  // smaller spans do not tell the drift from the noise
+};
+
+struct CalibrationPoint
+{
+  float grams;          // the known weight
+  float counts;         // mean of the combined samples
+  float temperatureC;   // mean temperature while sampling
+  float noiseCounts;    // standard deviation of the samples
+};
+
+struct CalibrationResult
+{
+  float   zeroCounts;        // combined counts with an empty platform (at refTemperatureC)
+  float   countsPerGram;
+  float   countsPerDegree;   // drift of the zero, 0 when not fitted
+  float   refTemperatureC;
+  float   rmsErrorG;         // residuals of the points, grams
+  float   maxErrorG;
+  uint8_t points;
+};
+
+/**
+ * @brief Least-squares fit of the points (see above).
+ * @return CalibrationError::None, TooFewPoints or BadFit.
+ */
+CalibrationError fitCalibration(const CalibrationPoint *points, uint8_t count, bool withTemperature,
+                                float minTemperatureSpanC, CalibrationResult &result);
+
+class Calibrator
+{
+public:
+  explicit Calibrator(const CalibrationConfig &config = CalibrationConfig()) : config_(config) {}
+
+  void configure(const CalibrationConfig &config) { config_ = config; }
+  const CalibrationConfig &config() const { return config_; }
+
+  /**
+   * @brief Starts a new calibration (the points of an earlier one are dropped).
+   */
+  void start();
+
+  /**
+   * @brief Takes a point: the known weight is on the platform, the next samples are averaged.
+   * @return false (see error()) if not started, busy or full.
+   */
+  bool addPoint(float grams);
+
+  /**
+   * @brief Fits the points taken so far. On success the state is Done and takeResult() returns the result once.
+   * @return false (see error()) if the points are not enough; more points can be added then.
+   */
+  bool finish();
+
+  void cancel();
+
+  /**
+   * @brief One combined sample (offsets removed) and the temperature at that time (Task1, every sample).
+   */
+  void onSample(int32_t counts, float temperatureC);
+
+  /**
+   * @brief The result of a successful finish(), once (the task that applies it).
+   */
+  bool takeResult(CalibrationResult &result);
+
+  CalibrationState state() const { return state_; }
+  CalibrationError error() const { return error_; }
+  uint8_t pointCount() const { return count_; }
+  const CalibrationPoint &point(uint8_t i) const { return points_[i]; }
+  /**
+   * @brief Progress of the point being sampled, 0..100 %.
+   */
+  uint8_t progress() const;
+  const CalibrationResult &result() const { return result_; }
+
+private:
+  void restartWindow();
+
+  CalibrationConfig config_;
+  CalibrationState state_ = CalibrationState::Idle;
+  CalibrationError error_ = CalibrationError::None;
+  CalibrationPoint points_[CALIBRATION_MAX_POINTS] = {};
+  uint8_t count_ = 0;
+  float pendingGrams_ = 0.0f;
+  uint16_t tried_ = 0;       // samples looked at for the current point
+  uint8_t window_ = 0;       // samples in the current window
+  int64_t sum_ = 0;
+  double sumSquares_ = 0.0;
+  int32_t first_ = 0;        // the window is summed relative to its first sample (keeps the squares small)
+  float temperatureSum_ = 0.0f;
+  CalibrationResult result_ = {};
+  bool resultPending_ = false;
+};
+
+/**
+ * @brief The temperature drift of the zero, applied to every combined sample.
+ */
+struct ZeroDrift
+{
+  float countsPerDegree = 0.0f;
+  float refTemperatureC = 25.0f;
+
+  int32_t correction(float temperatureC) const
+  {
+    const float counts = countsPerDegree * (temperatureC - refTemperatureC);
+    return static_cast<int32_t>(counts + (counts >= 0.0f ? 0.5f : -0.5f));
+  }
+};
+
+/**
+ * @brief What is stored in NVS: everything needed to weigh right after a reboot.
+ */
+struct CalibrationRecord
+{
+  uint32_t magic;
+  uint16_t version;
+  uint8_t  channels;
+  uint8_t  fitted;                              // 1: countsPerGram comes from a calibration
+  int32_t  offsets[LOAD_CELL_MAX_CHANNELS];     // per load cell, as LoadCellArray uses them
+  float    countsPerGram;                       // of the combined signal
+  float    countsPerDegree;
+  float    refTemperatureC;
+  uint32_t crc;                                 // CRC-32 of everything above
+};
+
+/**
+ * @brief Fills magic, version and crc.
+ */
+void sealCalibrationRecord(CalibrationRecord &record);
+
+/**
+ * @brief true if the record is intact and made for this number of load cells.
+ */
+bool calibrationRecordValid(const CalibrationRecord &record, uint8_t channels);
+
+const char *calibrationStateName(CalibrationState state);
+const char *calibrationErrorName(CalibrationError error);
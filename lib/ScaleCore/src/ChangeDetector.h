@@ -0,0 +1,89 @@
+/**
+ * ChangeDetector.h
+ *  Decides when a new scale state is worth sending to the network subscribers (web clients):
+ *    - the weight moved more than the deadband since the last published state,
+ *    - the weight became stable (or stopped being stable),
+ *    - the status changed (overload, HX711 not ready),
+ *    - nothing happened for heartbeatUs (a slow "still alive" message).
+ *  Task1 runs it for every sample and wakes the subscribers only when it says so, instead of the
+ *  subscribers polling the weight on a fixed period. The display follows every change of its digits
+ *  instead (DisplayChangeDetector, DisplayStage.h).
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "ScaleState.h"
+
+enum class ChangeReason : uint8_t
+{
+  None,
+  Weight,     // moved past the deadband
+  Status,     // stable / overload / not ready changed
+  Heartbeat,  // nothing changed for heartbeatUs
+};
+
+class ChangeDetector
+{
+public:
+  /**
+   * @param deadbandMg: smallest weight change that is published.
+   * @param heartbeatUs: longest time without a publication.
+   */
+  ChangeDetector(int32_t deadbandMg = 1000, uint32_t heartbeatUs = 10000000u)
+      : deadbandMg_(deadbandMg), heartbeatUs_(heartbeatUs)
+  {
+  }
+
+  void configure(int32_t deadbandMg, uint32_t heartbeatUs)
+  {
+    deadbandMg_ = deadbandMg;
+    heartbeatUs_ = heartbeatUs;
+  }
+
+  /**
+   * @brief Checks a new state. When the answer is not None, the state counts as published.
+   */
+  ChangeReason check(const ScaleState &state, uint32_t nowUs)
+  {
+    ChangeReason reason = ChangeReason::None;
+    if (!primed_ || state.flags != lastFlags_)
+    {
+      reason = ChangeReason::Status;
+    }
+    else if (std::abs(state.weightMg - lastWeightMg_) > deadbandMg_)
+    {
+      reason = ChangeReason::Weight;
+    }
+    else if (nowUs - lastPublishUs_ >= heartbeatUs_)
+    {
+      reason = ChangeReason::Heartbeat;
+    }
+    if (reason != ChangeReason::None)
+    {
+      primed_ = true;
+      lastFlags_ = state.flags;
+      lastWeightMg_ = state.weightMg;
+      lastPublishUs_ = nowUs;
+    }
+    return reason;
+  }
+
+  /**
+   * @brief Microseconds until the next heartbeat is due (how long a subscriber may sleep).
+   */
+  uint32_t timeToHeartbeatUs(uint32_t nowUs) const
+  {
+    const uint32_t elapsed = nowUs - lastPublishUs_;
+    return elapsed >= heartbeatUs_ ? 0 : heartbeatUs_ - elapsed;
+  }
+
+private:
+  int32_t deadbandMg_;
+  uint32_t heartbeatUs_;
+  int32_t lastWeightMg_ = 0;
+  uint32_t lastPublishUs_ = 0;
+  uint8_t lastFlags_ = 0;
+  bool primed_ = false;
+};
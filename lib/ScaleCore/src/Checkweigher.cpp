@@ -0,0 +1,140 @@
+/**
+ * Checkweigher.cpp
+ *  See Checkweigher.h.
+ */
+#include "Checkweigher.h"
+
+void PeakDetector::configure(const PeakConfig &config)
+{
+  config_ = config;
+  if (config_.window < 2)
+  {
+    config_.window = 2;
+  }
+  if (config_.window > maxWindow)
+  {
+    config_.window = maxWindow;
+  }
+  state_ = State::Idle;
+  zeroSet_ = false;
+}
+
+bool PeakDetector::onSample(const StreamSample &sample, CheckweighResult &result)
+{
+  if (!zeroSet_)
+  {
+    zeroMg_ = sample.weightMg;   // the belt is assumed empty at the start
+    zeroSet_ = true;
+  }
+  const int32_t mg = sample.weightMg - zeroMg_;
+
+  if (state_ == State::Idle)
+  {
+    if (mg < config_.triggerMg)
+    {
+      if (config_.zeroShift != 0)
+      {
+        zeroMg_ += (sample.weightMg - zeroMg_) / (1 << config_.zeroShift);
+      }
+      return false;
+    }
+    // an item came on.
+    state_ = State::Item;
+    startUs_ = sample.timestampUs;
+    samples_ = 0;
+    peakMg_ = mg;
+    windowFill_ = 0;
+    windowPos_ = 0;
+    runSum_ = 0;
+    runCount_ = 0;
+    bestSum_ = 0;
+    bestCount_ = 0;
+  }
+  else if (state_ == State::Stuck)
+  {
+    if (mg < config_.releaseMg)
+    {
+      state_ = State::Idle;
+    }
+    return false;
+  }
+
+  if (mg < config_.releaseMg)
+  {
+    closeRun();
+    finish(sample.timestampUs, bestCount_ >= config_.minPlateauSamples ? CHECKWEIGH_PLATEAU : 0, result);
+    state_ = State::Idle;
+    return true;
+  }
+
+  samples_ = samples_ < 0xFFFFu ? static_cast<uint16_t>(samples_ + 1) : samples_;
+  peakMg_ = mg > peakMg_ ? mg : peakMg_;
+  window_[windowPos_] = mg;
+  windowPos_ = static_cast<uint8_t>((windowPos_ + 1) % config_.window);
+  windowFill_ = windowFill_ < config_.window ? static_cast<uint8_t>(windowFill_ + 1) : windowFill_;
+  if (windowFill_ == config_.window)
+  {
+    int32_t low = window_[0];
+    int32_t high = window_[0];
+    for (uint8_t i = 1; i < config_.window; i++)
+    {
+      low = window_[i] < low ? window_[i] : low;
+      high = window_[i] > high ? window_[i] : high;
+    }
+    if (high - low <= config_.toleranceMg)
+    {
+      if (runCount_ == 0)
+      {
+        // a plateau starts: the whole window belongs to it.
+        for (uint8_t i = 0; i < config_.window; i++)
+        {
+          runSum_ += window_[i];
+        }
+        runCount_ = config_.window;
+      }
+      else
+      {
+        runSum_ += mg;
+        runCount_++;
+      }
+    }
+    else
+    {
+      closeRun();
+    }
+  }
+
+  if (sample.timestampUs - startUs_ > config_.maxItemUs)
+  {
+    closeRun();
+    finish(sample.timestampUs, static_cast<uint8_t>(CHECKWEIGH_TIMEOUT |
+                                                    (bestCount_ >= config_.minPlateauSamples ? CHECKWEIGH_PLATEAU : 0)),
+           result);
+    state_ = State::Stuck;
+    return true;
+  }
+  return false;
+}
+
+void PeakDetector::closeRun()
+{
+  if (runCount_ > bestCount_)
+  {
+    bestSum_ = runSum_;
+    bestCount_ = runCount_;
+  }
+  runSum_ = 0;
+  runCount_ = 0;
+}
+
+void PeakDetector::finish(uint32_t nowUs, uint8_t flags, CheckweighResult &result)
+{
+  result.item = ++items_;
+  result.weightMg = (flags & CHECKWEIGH_PLATEAU) != 0 ? static_cast<int32_t>(bestSum_ / bestCount_) : peakMg_;
+  result.peakMg = peakMg_;
+  result.startUs = startUs_;
+  result.durationUs = nowUs - startUs_;
+  result.samples = samples_;
+  result.plateauSamples = (flags & CHECKWEIGH_PLATEAU) != 0 ? bestCount_ : 0;
+  result.flags = flags;
+}
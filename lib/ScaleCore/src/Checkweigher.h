@@ -0,0 +1,104 @@
+/**
+ * Checkweigher.h
+ *  Dynamic weighing: items pass over the load cell on a conveyor, each one is on the platform for a
+ *  fraction of a second. The HX711 runs at 80 SPS and every sample is looked at (no averaging to 2 Hz).
+ *
+ *  The PeakDetector follows the weight of every sample (milligrams, offsets removed, not filtered):
+ *
+ *      idle --(above zero + triggerMg)--> on the platform --(below zero + releaseMg)--> result
+ *
+ *  While an item is on the platform it looks for plateaus: windows of `window` samples whose spread
+ *  (max - min) is within toleranceMg, i.e. the ringing after the item came on has died down. The weight of the
+ *  item is the mean of the longest plateau; an item that never settled (too fast for the belt speed) is
+ *  reported with its peak and without CHECKWEIGH_PLATEAU. Between items the zero of the empty belt is
+ *  tracked slowly, so a drifting belt does not end up in the item weights.
+ *
+ *  Not thread-safe: the acquisition task feeds it and publishes the results.
+ */
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief One sample of the stream: the weight of a single conversion, not filtered.
+ */
+struct StreamSample
+{
+  int32_t  weightMg;     // milligrams, offsets removed
+  uint32_t timestampUs;  // data ready of the conversion
+  uint32_t seq;          // sample number
+};
+
+#define CHECKWEIGH_PLATEAU   0x01   // the weight is the mean of a plateau (else the peak)
+#define CHECKWEIGH_TIMEOUT   0x02   // the item stayed longer than maxItemUs (stuck on the belt)
+
+struct CheckweighResult
+{
+  uint32_t item;             // running number, starts at 1
+  int32_t  weightMg;         // plateau mean (or peak), zero of the belt removed
+  int32_t  peakMg;           // highest sample, zero removed
+  uint32_t startUs;          // first sample above the trigger
+  uint32_t durationUs;       // on the platform
+  uint16_t samples;          // samples on the platform
+  uint16_t plateauSamples;   // samples of the plateau the weight comes from
+  uint8_t  flags;            // CHECKWEIGH_*
+};
+
+struct PeakConfig
+{
+  int32_t  triggerMg = 20000;       // an item is on the platform above zero + 20 g
+  int32_t  releaseMg = 10000;       // ... and left it below zero + 10 g (hysteresis)
+  uint8_t  window = 8;              // samples of a plateau window (100 ms at 80 SPS), up to 32
+  int32_t  toleranceMg = 2000;      // max - min inside a plateau window
+  uint16_t minPlateauSamples = 8;   // shorter plateaus are not trusted, the peak is reported
+  uint32_t maxItemUs = 5000000;     // longer on the platform: reported as stuck
+  uint8_t  zeroShift = 5;           // zero tracking between items: EMA 1/32 (0 = off)
+};
+
+class PeakDetector
+{
+public:
+  static constexpr uint8_t maxWindow = 32;
+
+  explicit PeakDetector(const PeakConfig &config = PeakConfig()) { configure(config); }
+
+  void configure(const PeakConfig &config);
+
+  /**
+   * @brief Looks at one sample.
+   * @return true when an item left the platform (or got stuck): result holds its weight.
+   */
+  bool onSample(const StreamSample &sample, CheckweighResult &result);
+
+  bool itemOnPlatform() const { return state_ == State::Item; }
+  int32_t zeroMg() const { return zeroMg_; }
+  uint32_t items() const { return items_; }
+
+private:
+  enum class State : uint8_t
+  {
+    Idle,
+    Item,
+    Stuck,   // reported as stuck, waiting for it to leave
+  };
+
+  void closeRun();
+  void finish(uint32_t nowUs, uint8_t flags, CheckweighResult &result);
+
+  PeakConfig config_;
+  State state_ = State::Idle;
+  bool zeroSet_ = false;
+  int32_t zeroMg_ = 0;
+  uint32_t items_ = 0;
+  // the item on the platform.
+  uint32_t startUs_ = 0;
+  uint16_t samples_ = 0;
+  int32_t peakMg_ = 0;
+  int32_t window_[maxWindow] = {};
+  uint8_t windowFill_ = 0;
+  uint8_t windowPos_ = 0;
+  int64_t runSum_ = 0;       // the plateau being followed
+  uint16_t runCount_ = 0;
+  int64_t bestSum_ = 0;      // the longest plateau so far
+  uint16_t bestCount_ = 0;
+};
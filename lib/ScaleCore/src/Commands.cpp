@@ -0,0 +1,360 @@
+/**
+ * Commands.cpp
+ *  See Commands.h.
+ */
+#include "Commands.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "RawTrace.h"
+#include "Subscriptions.h"
+
+namespace
+{
+
+// the words of a message, without copying it.
+struct Tokens
+{
+  const char *start[5];
+  size_t length[5];
+  uint8_t count = 0;
+};
+
+bool split(const char *text, size_t length, Tokens &tokens)
+{
+  size_t i = 0;
+  while (i < length)
+  {
+    while (i < length && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n'))
+    {
+      i++;
+    }
+    if (i == length)
+    {
+      break;
+    }
+    if (tokens.count == 5)
+    {
+      return false;   // too many words
+    }
+    tokens.start[tokens.count] = text + i;
+    while (i < length && text[i] != ' ' && text[i] != '\t' && text[i] != '\r' && text[i] != '\n')
+    {
+      i++;
+    }
+    tokens.length[tokens.count] = static_cast<size_t>(text + i - tokens.start[tokens.count]);
+    tokens.count++;
+  }
+  return tokens.count > 0;
+}
+
+bool is(const Tokens &tokens, uint8_t index, const char *word)
+{
+  return index < tokens.count && std::strlen(word) == tokens.length[index] &&
+         std::memcmp(tokens.start[index], word, tokens.length[index]) == 0;
+}
+
+// a whole number, optionally negative.
+bool parseInt(const Tokens &tokens, uint8_t index, int32_t &value)
+{
+  if (index >= tokens.count)
+  {
+    return false;
+  }
+  const char *p = tokens.start[index];
+  const char *end = p + tokens.length[index];
+  const bool negative = *p == '-';
+  p += negative ? 1 : 0;
+  if (p == end)
+  {
+    return false;
+  }
+  int64_t result = 0;
+  for (; p < end; p++)
+  {
+    if (*p < '0' || *p > '9' || result > 0x7FFFFFFF)
+    {
+      return false;
+    }
+    result = result * 10 + (*p - '0');
+  }
+  value = static_cast<int32_t>(negative ? -result : result);
+  return result <= 0x7FFFFFFF;
+}
+
+// a decimal number in thousandths ("500.25" -> 500250), up to 3 decimals.
+bool parseMilli(const Tokens &tokens, uint8_t index, int32_t &value)
+{
+  if (index >= tokens.count)
+  {
+    return false;
+  }
+  const char *p = tokens.start[index];
+  const char *end = p + tokens.length[index];
+  const bool negative = *p == '-';
+  p += negative ? 1 : 0;
+  int64_t result = 0;
+  int decimals = -1;   // -1: no decimal point yet
+  bool digits = false;
+  for (; p < end; p++)
+  {
+    if (*p == '.' && decimals < 0)
+    {
+      decimals = 0;
+      continue;
+    }
+    if (*p < '0' || *p > '9' || decimals == 3 || result > 0x7FFFFFFF)
+    {
+      return false;
+    }
+    result = result * 10 + (*p - '0');
+    decimals += decimals >= 0 ? 1 : 0;
+    digits = true;
+  }
+  for (int i = decimals < 0 ? 0 : decimals; i < 3; i++)
+  {
+    result *= 10;
+  }
+  if (!digits || result > 0x7FFFFFFF)
+  {
+    return false;
+  }
+  value = static_cast<int32_t>(negative ? -result : result);
+  return true;
+}
+
+bool parseFilter(const Tokens &tokens, Command &out)
+{
+  struct Name
+  {
+    const char *word;
+    FilterParam param;
+    bool needsValue;
+  };
+  static const Name names[] = {
+      {"median", FilterParam::Median, true},       {"ema", FilterParam::Ema, true},
+      {"avg", FilterParam::Average, true},         {"kalman", FilterParam::Kalman, false},
+      {"none", FilterParam::None, false},          {"tolerance", FilterParam::Tolerance, true},
+      {"settle", FilterParam::Settle, true},
+  };
+  for (const Name &name : names)
+  {
+    if (is(tokens, 2, name.word))
+    {
+      out.argument = static_cast<uint8_t>(name.param);
+      out.value = 0;
+      if (tokens.count > 3)
+      {
+        return tokens.count == 4 && parseInt(tokens, 3, out.value);
+      }
+      return !name.needsValue;
+    }
+  }
+  return false;
+}
+
+bool parseCalibration(const Tokens &tokens, Command &out)
+{
+  static const char *const words[] = {"start", "point", "finish", "cancel", "status"};
+  for (uint8_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+  {
+    if (is(tokens, 2, words[i]))
+    {
+      out.argument = i;
+      out.value = 0;
+      if (static_cast<CalibrationCommand>(i) == CalibrationCommand::Point)
+      {
+        return tokens.count == 4 && parseMilli(tokens, 3, out.value) && out.value >= 0;
+      }
+      return tokens.count == 3;
+    }
+  }
+  return false;
+}
+
+bool parseSubscribe(const Tokens &tokens, Command &out)
+{
+  if (tokens.count == 3)
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Topics);
+    return parseInt(tokens, 2, out.value) && out.value >= 0 && out.value <= 0xFF;
+  }
+  if (tokens.count != 4)
+  {
+    return false;
+  }
+  if (is(tokens, 2, "rate"))
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Rate);
+    return parseInt(tokens, 3, out.value) && out.value >= 0 && out.value <= 100;
+  }
+  if (is(tokens, 2, "deadband"))
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Deadband);
+    return parseMilli(tokens, 3, out.value) && out.value >= 0;
+  }
+  if (is(tokens, 2, "alarm"))
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Alarm);
+    out.value = SUBSCRIPTION_NO_ALARM;
+    return is(tokens, 3, "off") || parseMilli(tokens, 3, out.value);
+  }
+  if (is(tokens, 2, "format"))
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Format);
+    out.value = is(tokens, 3, "bin") ? SUBSCRIPTION_BINARY : SUBSCRIPTION_JSON;
+    return is(tokens, 3, "bin") || is(tokens, 3, "json");
+  }
+  if (is(tokens, 2, "fields"))
+  {
+    out.argument = static_cast<uint8_t>(SubscribeParam::Fields);
+    return parseInt(tokens, 3, out.value) && out.value > 0 && out.value <= TELEMETRY_FIELD_ALL;
+  }
+  return false;
+}
+
+bool parseTrace(const Tokens &tokens, Command &out)
+{
+  out.value = 0;
+  if (is(tokens, 2, "start") || is(tokens, 2, "stop"))
+  {
+    out.argument = static_cast<uint8_t>(is(tokens, 2, "start") ? TraceCommand::Start : TraceCommand::Stop);
+    return tokens.count == 3;
+  }
+  if (is(tokens, 2, "mark") && tokens.count == 4)
+  {
+    out.argument = static_cast<uint8_t>(TraceCommand::Mark);
+    out.value = TRACE_NO_REFERENCE;
+    return is(tokens, 3, "off") || (parseMilli(tokens, 3, out.value) && out.value >= 0);
+  }
+  return false;
+}
+
+}  // namespace
+
+bool parseCommand(const char *text, size_t length, uint8_t client, Command &out)
+{
+  out = Command();
+  out.client = client;
+  // the tare button of older pages: {"rand":"Taring the Scale"}.
+  if (length > 0 && text[0] == '{')
+  {
+    static const char legacy[] = "\"rand\"";
+    for (size_t i = 0; i + sizeof(legacy) - 1 <= length; i++)
+    {
+      if (std::memcmp(text + i, legacy, sizeof(legacy) - 1) == 0)
+      {
+        out.type = CommandType::Tare;
+        return true;
+      }
+    }
+    return false;
+  }
+  Tokens tokens;
+  int32_t id = 0;
+  if (!split(text, length, tokens) || tokens.count < 2 || !parseInt(tokens, 0, id) || id < 0)
+  {
+    return false;
+  }
+  out.id = static_cast<uint32_t>(id);
+  if (is(tokens, 1, "tare"))
+  {
+    out.type = CommandType::Tare;
+    return tokens.count == 2;
+  }
+  if (is(tokens, 1, "zero"))
+  {
+    out.type = CommandType::ZeroTrack;
+    out.value = is(tokens, 2, "on") || is(tokens, 2, "1") ? 1 : 0;
+    return tokens.count == 3 && (out.value == 1 || is(tokens, 2, "off") || is(tokens, 2, "0"));
+  }
+  if (is(tokens, 1, "rate"))
+  {
+    out.type = CommandType::SetRate;
+    return tokens.count == 3 && parseInt(tokens, 2, out.value);
+  }
+  if (is(tokens, 1, "filter"))
+  {
+    out.type = CommandType::SetFilter;
+    return parseFilter(tokens, out);
+  }
+  if (is(tokens, 1, "cal"))
+  {
+    out.type = CommandType::Calibrate;
+    return parseCalibration(tokens, out);
+  }
+  if (is(tokens, 1, "sub"))
+  {
+    out.type = CommandType::Subscribe;
+    return parseSubscribe(tokens, out);
+  }
+  if (is(tokens, 1, "trace"))
+  {
+    out.type = CommandType::Trace;
+    return parseTrace(tokens, out);
+  }
+  return false;
+}
+
+CommandAck makeAck(const Command &command, CommandStatus status, int32_t value, uint32_t doneUs)
+{
+  CommandAck ack;
+  ack.id = command.id;
+  ack.queuedUs = command.queuedUs;
+  ack.doneUs = doneUs;
+  ack.value = value;
+  ack.type = command.type;
+  ack.status = status;
+  ack.client = command.client;
+  return ack;
+}
+
+size_t encodeAckJson(const CommandAck &ack, char *buffer, size_t size)
+{
+  const int length = std::snprintf(buffer, size, "{\"ack\":{\"id\":%lu,\"cmd\":\"%s\",\"status\":\"%s\",\"value\":%ld,\"us\":%lu}}",
+                                   static_cast<unsigned long>(ack.id), commandName(ack.type),
+                                   commandStatusName(ack.status), static_cast<long>(ack.value),
+                                   static_cast<unsigned long>(ack.doneUs - ack.queuedUs));
+  return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+const char *commandName(CommandType type)
+{
+  switch (type)
+  {
+    case CommandType::Tare:
+      return "tare";
+    case CommandType::ZeroTrack:
+      return "zero";
+    case CommandType::SetRate:
+      return "rate";
+    case CommandType::SetFilter:
+      return "filter";
+    case CommandType::Calibrate:
+      return "cal";
+    case CommandType::Subscribe:
+      return "sub";
+    case CommandType::Trace:
+      return "trace";
+  }
+  return "?";
+}
+
+const char *commandStatusName(CommandStatus status)
+{
+  switch (status)
+  {
+    case CommandStatus::Ok:
+      return "ok";
+    case CommandStatus::Busy:
+      return "busy";
+    case CommandStatus::Invalid:
+      return "invalid";
+    case CommandStatus::Unsupported:
+      return "unsupported";
+    case CommandStatus::Failed:
+      return "failed";
+  }
+  return "?";
+}
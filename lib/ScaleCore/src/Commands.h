@@ -0,0 +1,144 @@
+/**
+ * Commands.h
+ *  Typed control commands from the web clients: parsed by the network task with a fixed-format decoder,
+ *  queued (SpscQueue, never blocks) and executed by the acquisition task between two samples, which
+ *  answers every command with an acknowledgement. Nothing that waits for the load cells runs in the
+ *  network task anymore.
+ *
+ *  A command is one text message, space separated:
+ *
+ *      <id> <verb> [argument] [value]
+ *
+ *      7 tare                     new zero: the average of the next conversions (Task1 keeps weighing)
+ *      8 zero on|off              automatic zero tracking
+ *      9 rate 10|80               HX711 output rate (RATE pin driven by the firmware)
+ *     10 filter median 5          median window; also: ema <shift>, avg <window>, kalman [noise], none,
+ *                                 tolerance <mg>, settle <ms>
+ *     11 cal start                calibration: start, point <grams>, finish, cancel, status
+ *     12 sub 3                    topics this client wants (bit mask, see the firmware)
+ *     13 sub rate 10              its weight messages: at most 10 per second (0 = every change),
+ *                                 also: deadband <g>, alarm <g>|off, format json|bin, fields <mask>
+ *                                 (see Subscriptions.h)
+ *     14 trace start              raw HX711 trace to flash (see RawTrace.h): start, stop,
+ *                                 mark <grams>|off (the known weight on the platform from now on)
+ *
+ *  The id is chosen by the client and comes back in the acknowledgement:
+ *
+ *      {"ack":{"id":7,"cmd":"tare","status":"ok","value":0,"us":1012345}}
+ *
+ *  with the time from queuing to done in us. The legacy tare message of older pages ({"rand":...}) is
+ *  understood as "0 tare".
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SpscQueue.h"
+
+enum class CommandType : uint8_t
+{
+  Tare,
+  ZeroTrack,
+  SetRate,
+  SetFilter,
+  Calibrate,
+  Subscribe,
+  Trace,
+};
+
+// argument of SetFilter.
+enum class FilterParam : uint8_t
+{
+  Median,      // window
+  Ema,         // shift (alpha = 1 / 2^shift)
+  Average,     // window
+  Kalman,      // measurement noise (0 = keep)
+  None,        // no smoothing
+  Tolerance,   // stability band, mg
+  Settle,      // settle time, ms
+};
+
+// argument of Subscribe.
+enum class SubscribeParam : uint8_t
+{
+  Topics,      // bit mask
+  Rate,        // messages per second, 0 = no limit
+  Deadband,    // milligrams
+  Alarm,       // threshold in milligrams, SUBSCRIPTION_NO_ALARM = off
+  Format,      // SUBSCRIPTION_JSON / SUBSCRIPTION_BINARY
+  Fields,      // TELEMETRY_FIELD_* mask
+};
+
+// argument of Calibrate.
+enum class CalibrationCommand : uint8_t
+{
+  Start,
+  Point,       // value: the known weight in milligrams
+  Finish,
+  Cancel,
+  Status,
+};
+
+// argument of Trace.
+enum class TraceCommand : uint8_t
+{
+  Start,
+  Stop,
+  Mark,        // value: the known weight in milligrams, TRACE_NO_REFERENCE = not known
+};
+
+enum class CommandStatus : uint8_t
+{
+  Ok,
+  Busy,          // the queue is full or the same operation is still running
+  Invalid,       // malformed, or a value out of range
+  Unsupported,   // not possible with this build or board
+  Failed,        // accepted but did not work (e.g. a calibration step)
+};
+
+struct Command
+{
+  uint32_t    id;         // chosen by the client, echoed in the acknowledgement
+  uint32_t    queuedUs;   // when the network task queued it
+  int32_t     value;      // on/off, SPS, filter value, milligrams, topic mask
+  CommandType type;
+  uint8_t     argument;   // FilterParam, CalibrationCommand, SubscribeParam or TraceCommand
+  uint8_t     client;
+};
+
+struct CommandAck
+{
+  uint32_t      id;
+  uint32_t      queuedUs;
+  uint32_t      doneUs;
+  int32_t       value;    // result, e.g. the new offset of a tare
+  CommandType   type;
+  CommandStatus status;
+  uint8_t       client;
+};
+
+// network task -> acquisition task, and back.
+using CommandQueue = SpscQueue<Command, 16>;
+using AckQueue = SpscQueue<CommandAck, 16>;
+
+/**
+ * @brief Decodes a command message (see above). No allocation, no floating point.
+ * @param client: stored in the command, for the acknowledgement.
+ * @return false if the message is not a valid command (out is not usable).
+ */
+bool parseCommand(const char *text, size_t length, uint8_t client, Command &out);
+
+/**
+ * @brief The acknowledgement of a command.
+ */
+CommandAck makeAck(const Command &command, CommandStatus status, int32_t value, uint32_t doneUs);
+
+/**
+ * @brief Writes the JSON acknowledgement (see above).
+ * @return the length of the message, 0 if the buffer is too small (112 bytes are always enough).
+ */
+size_t encodeAckJson(const CommandAck &ack, char *buffer, size_t size);
+
+const char *commandName(CommandType type);
+const char *commandStatusName(CommandStatus status);
@@ -0,0 +1,120 @@
+/**
+ * Connectivity.cpp
+ *  See Connectivity.h.
+ */
+#include "Connectivity.h"
+
+int8_t ConnectivityManager::addLink(NetworkLink &link, const LinkConfig &config, int8_t dependsOn)
+{
+  if (count_ >= CONNECTIVITY_MAX_LINKS || dependsOn >= static_cast<int8_t>(count_))
+  {
+    return -1;
+  }
+  Supervised &s = links_[count_];
+  s.link = &link;
+  s.config = config;
+  s.dependsOn = dependsOn;
+  s.state = LinkState::Backoff;   // with no wait: the first service() tries it
+  s.waitMs = 0;
+  s.backoffMs = config.backoffMinMs;
+  return static_cast<int8_t>(count_++);
+}
+
+uint8_t ConnectivityManager::service(uint32_t nowMs)
+{
+  uint8_t changed = 0;
+  // in the order of addLink(): a link is looked at after the one it depends on.
+  for (uint8_t i = 0; i < count_; i++)
+  {
+    Supervised &s = links_[i];
+    const bool parentUp = s.dependsOn < 0 || links_[s.dependsOn].state == LinkState::Up;
+    if (!parentUp)
+    {
+      if (s.state == LinkState::Up || s.state == LinkState::Connecting)
+      {
+        s.link->disconnect();
+      }
+      if (s.state == LinkState::Up)
+      {
+        s.drops++;
+        changed |= static_cast<uint8_t>(1u << i);
+      }
+      s.state = LinkState::Blocked;
+      continue;
+    }
+    if (s.state == LinkState::Blocked)
+    {
+      // the link below came (back) up: try at once, with a fresh backoff.
+      s.backoffMs = s.config.backoffMinMs;
+      startAttempt(s, nowMs);
+    }
+    else if (s.state == LinkState::Backoff && nowMs - s.sinceMs >= s.waitMs)
+    {
+      startAttempt(s, nowMs);
+    }
+    else if (s.state == LinkState::Up && !s.link->connected())
+    {
+      s.drops++;
+      changed |= static_cast<uint8_t>(1u << i);
+      s.backoffMs = s.config.backoffMinMs;
+      startAttempt(s, nowMs);   // it was up a moment ago: retry at once
+    }
+    if (s.state == LinkState::Connecting)
+    {
+      if (s.link->connected())
+      {
+        s.state = LinkState::Up;
+        s.sinceMs = nowMs;
+        s.backoffMs = s.config.backoffMinMs;
+        changed |= static_cast<uint8_t>(1u << i);
+      }
+      else if (nowMs - s.sinceMs >= s.config.attemptTimeoutMs)
+      {
+        s.link->disconnect();
+        startBackoff(s, nowMs);
+      }
+    }
+  }
+  return changed;
+}
+
+void ConnectivityManager::startAttempt(Supervised &s, uint32_t nowMs)
+{
+  s.state = LinkState::Connecting;
+  s.sinceMs = nowMs;
+  s.attempts++;
+  s.link->connect();
+}
+
+void ConnectivityManager::startBackoff(Supervised &s, uint32_t nowMs)
+{
+  s.state = LinkState::Backoff;
+  s.sinceMs = nowMs;
+  s.waitMs = jitter(s.backoffMs);
+  s.backoffMs = s.backoffMs < s.config.backoffMaxMs / 2 ? s.backoffMs * 2 : s.config.backoffMaxMs;
+}
+
+uint32_t ConnectivityManager::jitter(uint32_t ms)
+{
+  // xorshift32, good enough to spread the retries: ms * (0.75 .. 1.25).
+  random_ ^= random_ << 13;
+  random_ ^= random_ >> 17;
+  random_ ^= random_ << 5;
+  return ms - ms / 4 + static_cast<uint32_t>(static_cast<uint64_t>(random_ % 1024u) * (ms / 2) / 1024u);
+}
+
+const char *linkStateName(LinkState state)
+{
+  switch (state)
+  {
+  case LinkState::Blocked:
+    return "blocked";
+  case LinkState::Connecting:
+    return "connecting";
+  case LinkState::Backoff:
+    return "backoff";
+  case LinkState::Up:
+    return "up";
+  }
+  return "?";
+}
@@ -0,0 +1,102 @@
+/**
+ * Connectivity.h
+ *  Keeps the network connections of the scale up in the background, so nothing else waits for them:
+ *
+ *    WiFi  <-  cloud (Blynk)
+ *
+ *  Every connection (NetworkLink) is supervised by the ConnectivityManager, called periodically by one
+ *  task (service()):
+ *    - a link is only tried while the link it depends on is up (no cloud attempts without WiFi), and it is
+ *      dropped when that link goes down,
+ *    - an attempt that does not succeed within attemptTimeoutMs is given up,
+ *    - failed attempts are retried after an exponential backoff (backoffMinMs doubling up to backoffMaxMs,
+ *      +/- 25 % jitter so several scales do not retry in step), a link that was up and dropped is retried
+ *      at once and the backoff starts over.
+ *  The manager never blocks; how long connect() takes is up to the link.
+ */
+#pragma once
+
+#include <cstdint>
+
+#define CONNECTIVITY_MAX_LINKS 4
+
+/**
+ * @brief A connection the manager keeps up (WiFi, the cloud in the firmware, stand-ins in the native build).
+ */
+class NetworkLink
+{
+public:
+  virtual ~NetworkLink() {}
+  virtual bool connected() = 0;
+  /**
+   * @brief Starts an attempt. connected() tells when it succeeded.
+   */
+  virtual void connect() = 0;
+  /**
+   * @brief Gives the connection or a pending attempt up.
+   */
+  virtual void disconnect() = 0;
+};
+
+struct LinkConfig
+{
+  uint32_t attemptTimeoutMs = 15000;   // an attempt still not connected after this long failed
+  uint32_t backoffMinMs = 1000;        // wait after the first failed attempt
+  uint32_t backoffMaxMs = 60000;       // the wait doubles up to this
+};
+
+enum class LinkState : uint8_t
+{
+  Blocked,      // the link it depends on is down
+  Connecting,   // an attempt is running
+  Backoff,      // waiting before the next attempt
+  Up,
+};
+
+class ConnectivityManager
+{
+public:
+  /**
+   * @brief Adds a link (before the first service()).
+   * @param dependsOn: index of the link that must be up first, -1 for none (it must be added before).
+   * @return its index, -1 if CONNECTIVITY_MAX_LINKS are already added.
+   */
+  int8_t addLink(NetworkLink &link, const LinkConfig &config = LinkConfig(), int8_t dependsOn = -1);
+
+  /**
+   * @brief Checks the links and starts, gives up or drops attempts as needed.
+   * @return bit i set: link i came up or went down in this call (see up()).
+   */
+  uint8_t service(uint32_t nowMs);
+
+  bool up(int8_t link) const { return links_[link].state == LinkState::Up; }
+  LinkState state(int8_t link) const { return links_[link].state; }
+  uint32_t attempts(int8_t link) const { return links_[link].attempts; }   // connect() calls
+  uint32_t drops(int8_t link) const { return links_[link].drops; }         // was up, went down
+  uint32_t upSinceMs(int8_t link) const { return links_[link].sinceMs; }   // when it came up (if up())
+  uint32_t backoffMs(int8_t link) const { return links_[link].backoffMs; } // the next wait after a failure
+
+private:
+  struct Supervised
+  {
+    NetworkLink *link = nullptr;
+    LinkConfig config;
+    int8_t dependsOn = -1;
+    LinkState state = LinkState::Backoff;
+    uint32_t sinceMs = 0;     // start of the attempt, the backoff or the connection
+    uint32_t waitMs = 0;      // the current backoff
+    uint32_t backoffMs = 0;   // the next backoff
+    uint32_t attempts = 0;
+    uint32_t drops = 0;
+  };
+
+  void startAttempt(Supervised &s, uint32_t nowMs);
+  void startBackoff(Supervised &s, uint32_t nowMs);
+  uint32_t jitter(uint32_t ms);
+
+  Supervised links_[CONNECTIVITY_MAX_LINKS];
+  uint8_t count_ = 0;
+  uint32_t random_ = 0x2545F491u;
+};
+
+const char *linkStateName(LinkState state);
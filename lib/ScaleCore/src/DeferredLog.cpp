@@ -0,0 +1,229 @@
+/**
+ * DeferredLog.cpp
+ *  See DeferredLog.h.
+ *
+ *  The ring is a bounded multi-producer queue: every slot has a sequence word. A producer claims the next
+ *  position with a compare-and-swap on head_, fills the slot and publishes it by setting the sequence word;
+ *  the single consumer frees the slot again by moving its sequence word one lap ahead.
+ */
+#include "DeferredLog.h"
+
+#include <cstring>
+
+DeferredLog systemLog;
+
+namespace
+{
+
+const char levelLetters[] = {'-', 'E', 'W', 'I', 'D'};
+
+// appends what snprintf wrote, cut at the end of the line buffer.
+size_t advance(int written, size_t room)
+{
+  if (written < 0)
+  {
+    return 0;
+  }
+  return static_cast<size_t>(written) < room ? static_cast<size_t>(written) : (room > 0 ? room - 1 : 0);
+}
+
+float floatFromBits(LogArg arg)
+{
+  union
+  {
+    uint32_t u;
+    float f;
+  } bits;
+  bits.u = static_cast<uint32_t>(arg);
+  return bits.f;
+}
+
+}  // namespace
+
+DeferredLog::DeferredLog()
+{
+  for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+  {
+    slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool DeferredLog::push(uint8_t level, const char *format, const LogArg *args, uint8_t argCount, uint8_t copy)
+{
+  uint32_t pos = head_.load(std::memory_order_relaxed);
+  Slot *slot;
+  for (;;)
+  {
+    slot = &slots_[pos & (LOG_RING_SIZE - 1)];
+    const int32_t diff = static_cast<int32_t>(slot->seq.load(std::memory_order_acquire) - pos);
+    if (diff == 0)
+    {
+      if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // the drain has not freed this slot yet: the ring is full.
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else
+    {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  LogRecord &record = slot->record;
+  record.format = format;
+  record.timestampUs = clock_ != nullptr ? clock_->micros() : 0;
+  record.level = level;
+  record.argCount = argCount;
+  record.copied = 0;
+  size_t used = 0;
+  for (uint8_t i = 0; i < argCount; i++)
+  {
+    record.args[i] = args[i];
+    if ((copy & (1u << i)) == 0)
+    {
+      continue;
+    }
+    // a string that may not outlive the call: its bytes go into the record, cut to the room that is left.
+    const char *text = reinterpret_cast<const char *>(args[i]);
+    text = text != nullptr ? text : "(null)";
+    const size_t start = used < LOG_TEXT_SIZE ? used : LOG_TEXT_SIZE - 1;
+    size_t length = 0;
+    while (text[length] != '\0' && start + length < LOG_TEXT_SIZE - 1)
+    {
+      record.text[start + length] = text[length];
+      length++;
+    }
+    record.text[start + length] = '\0';
+    record.args[i] = static_cast<LogArg>(start);
+    record.copied = static_cast<uint8_t>(record.copied | (1u << i));
+    used = start + length + 1;
+  }
+  slot->seq.store(pos + 1, std::memory_order_release);
+  written_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+size_t DeferredLog::drain(char *line, size_t size)
+{
+  if (size < 2)
+  {
+    return 0;
+  }
+  const uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != droppedReported_)
+  {
+    const size_t length = advance(
+        std::snprintf(line, size, "%u log records dropped\n", static_cast<unsigned>(dropped - droppedReported_)), size);
+    droppedReported_ = dropped;
+    return length;
+  }
+  Slot &slot = slots_[tail_ & (LOG_RING_SIZE - 1)];
+  if (static_cast<int32_t>(slot.seq.load(std::memory_order_acquire) - (tail_ + 1)) < 0)
+  {
+    return 0;   // empty (or the producer of the oldest record is still writing it)
+  }
+  const LogRecord record = slot.record;
+  slot.seq.store(tail_ + LOG_RING_SIZE, std::memory_order_release);
+  tail_++;
+  return format(record, line, size);
+}
+
+size_t DeferredLog::format(const LogRecord &record, char *line, size_t size)
+{
+  if (size < 2)
+  {
+    return 0;
+  }
+  size_t length = advance(std::snprintf(line, size, "[%6u.%06u] %c ", static_cast<unsigned>(record.timestampUs / 1000000u),
+                                        static_cast<unsigned>(record.timestampUs % 1000000u),
+                                        levelLetters[record.level <= LOG_LEVEL_DEBUG ? record.level : 0]),
+                          size);
+  const char *p = record.format;
+  uint8_t arg = 0;
+  while (*p != '\0' && length + 1 < size)
+  {
+    if (*p != '%')
+    {
+      line[length++] = *p++;
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      line[length++] = '%';
+      p += 2;
+      continue;
+    }
+    // copy one conversion (flags, width, precision; length modifiers dropped) and print the argument with it.
+    char spec[16];
+    size_t n = 0;
+    spec[n++] = *p++;
+    while (*p != '\0' && std::strchr("-+ #0123456789.", *p) != nullptr && n < sizeof(spec) - 3)
+    {
+      spec[n++] = *p++;
+    }
+    while (*p != '\0' && std::strchr("hlzjt", *p) != nullptr)
+    {
+      p++;
+    }
+    const char conversion = *p;
+    if (conversion == '\0')
+    {
+      break;
+    }
+    p++;
+    spec[n++] = conversion;
+    spec[n] = '\0';
+    const bool copied = arg < record.argCount && (record.copied & (1u << arg)) != 0;
+    const LogArg value = arg < record.argCount ? record.args[arg] : 0;
+    arg++;
+    char *out = line + length;
+    const size_t room = size - length;
+    switch (conversion)
+    {
+    case 'd':
+    case 'i':
+      length += advance(std::snprintf(out, room, spec, static_cast<int>(static_cast<int32_t>(value))), room);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      length += advance(std::snprintf(out, room, spec, static_cast<unsigned>(static_cast<uint32_t>(value))), room);
+      break;
+    case 'c':
+      length += advance(std::snprintf(out, room, spec, static_cast<int>(static_cast<uint8_t>(value))), room);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+      length += advance(std::snprintf(out, room, spec, static_cast<double>(floatFromBits(value))), room);
+      break;
+    case 's':
+    {
+      const char *text = copied ? record.text + (value < LOG_TEXT_SIZE ? value : 0)
+                                : reinterpret_cast<const char *>(value);
+      length += advance(std::snprintf(out, room, spec, text != nullptr ? text : "(null)"), room);
+      break;
+    }
+    case 'p':
+      length += advance(std::snprintf(out, room, spec, reinterpret_cast<void *>(value)), room);
+      break;
+    default:
+      break;   // unknown conversion: skipped
+    }
+  }
+  if (length > size - 2)
+  {
+    length = size - 2;   // keep room for the '\n'
+  }
+  line[length++] = '\n';
+  return length;
+}
@@ -0,0 +1,196 @@
+/**
+ * DeferredLog.h
+ *  Deferred, leveled logging: a log call only stores a fixed-size binary record (format string pointer,
+ *  time, level and up to LOG_MAX_ARGS arguments) in a lock-free ring. Formatting and the slow serial
+ *  output are done later by a low-priority task that drains the ring (Task7 in the firmware).
+ *
+ *      LOG_INFO("Client %u connected", num);
+ *      LOG_DEBUG("Reading: %d", state.weight);
+ *
+ *  - Levels below LOG_LEVEL are removed by the preprocessor: their arguments are not even evaluated, so a
+ *    release build (-DLOG_LEVEL=LOG_LEVEL_WARN or lower) has no logging cost in the hot path.
+ *  - The format must be a string literal: only its address is stored (it is the "format id"). A %s argument
+ *    that is a string literal is stored the same way; any other string (a buffer on the stack, a name
+ *    returned by a function) is copied into the record by the log call, LOG_TEXT_SIZE bytes for all of them,
+ *    and cut when it is longer. So a buffer may be reused as soon as the log call returns.
+ *  - Arguments are integers (at most 32 bits), float/double (stored as float), char, bool and string literals.
+ *    The format is checked against the arguments at compile time like a printf.
+ *  - Any task may log, on any core (multi-producer ring, one compare-and-swap per record). A log call never
+ *    waits: when the ring is full the record is dropped and counted; the drain reports the drops.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+#include "Hal.h"
+
+#define LOG_LEVEL_NONE   0
+#define LOG_LEVEL_ERROR  1
+#define LOG_LEVEL_WARN   2
+#define LOG_LEVEL_INFO   3
+#define LOG_LEVEL_DEBUG  4
+
+// The levels that are compiled in, e.g. build_flags = -DLOG_LEVEL=LOG_LEVEL_WARN for a release build.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MAX_ARGS   4
+#define LOG_TEXT_SIZE  32     // bytes per record for the copied %s arguments (with their '\0')
+#define LOG_RING_SIZE  64     // records, a power of two
+
+typedef uintptr_t LogArg;
+
+struct LogRecord
+{
+  const char *format;
+  uint32_t timestampUs;
+  uint8_t level;
+  uint8_t argCount;
+  uint8_t copied;               // bit i: args[i] is the offset of a copied string in text
+  LogArg args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];
+};
+
+// how the arguments are stored: integers as their 32 bit pattern, floating point as float bits.
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, LogArg>::type toLogArg(T value)
+{
+  return static_cast<LogArg>(static_cast<uint32_t>(value));
+}
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, LogArg>::type toLogArg(T value)
+{
+  union
+  {
+    float f;
+    uint32_t u;
+  } bits;
+  bits.f = static_cast<float>(value);
+  return static_cast<LogArg>(bits.u);
+}
+inline LogArg toLogArg(const char *text) { return reinterpret_cast<LogArg>(text); }
+
+// a string argument that is not a string literal (const char[N]) is copied into the record: a char pointer or
+// a char array that can be changed (a buffer).
+template <typename T>
+struct LogCopiesText
+{
+  using Type = typename std::remove_reference<T>::type;
+  static constexpr bool value =
+      (std::is_pointer<Type>::value &&
+       std::is_same<typename std::remove_cv<typename std::remove_pointer<Type>::type>::type, char>::value) ||
+      (std::is_array<Type>::value && std::is_same<typename std::remove_extent<Type>::type, char>::value);
+};
+
+// bit i set: argument i is copied.
+template <typename... Args>
+constexpr uint8_t logCopyMask()
+{
+  const bool copies[] = {false, LogCopiesText<Args>::value...};
+  uint8_t mask = 0;
+  for (size_t i = 1; i < sizeof(copies); i++)
+  {
+    mask = static_cast<uint8_t>(mask | (copies[i] ? 1u << (i - 1) : 0u));
+  }
+  return mask;
+}
+
+class DeferredLog
+{
+public:
+  DeferredLog();
+
+  /**
+   * @brief The clock for the time stamps of the records (none: 0).
+   */
+  void setClock(const Clock *clock) { clock_ = clock; }
+
+  template <typename... Args>
+  void write(uint8_t level, const char *format, Args &&...args)
+  {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    const LogArg values[LOG_MAX_ARGS + 1] = {toLogArg(args)...};
+    push(level, format, values, static_cast<uint8_t>(sizeof...(Args)), logCopyMask<Args...>());
+  }
+
+  /**
+   * @brief Stores a record (any task, never waits).
+   * @param copy: bit i: args[i] is a string to copy into the record (see LOG_TEXT_SIZE).
+   * @return false if the ring was full and the record was dropped.
+   */
+  bool push(uint8_t level, const char *format, const LogArg *args, uint8_t argCount, uint8_t copy = 0);
+
+  /**
+   * @brief Takes the oldest record and formats it as one line ending in '\n' (the draining task only).
+   * @details A line "<n> log records dropped" comes first when records were dropped since the last line.
+   *          Lines longer than size are cut.
+   * @return the length of the line, 0 if there is nothing to drain.
+   */
+  size_t drain(char *line, size_t size);
+
+  /**
+   * @brief Formats one record (without the ring), e.g. "[   12.345678] I Client 1 connected\n".
+   */
+  static size_t format(const LogRecord &record, char *line, size_t size);
+
+  uint32_t written() const { return written_.load(std::memory_order_relaxed); }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> seq;
+    LogRecord record;
+  };
+
+  const Clock *clock_ = nullptr;
+  Slot slots_[LOG_RING_SIZE];
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_ = 0;
+  std::atomic<uint32_t> written_{0};
+  std::atomic<uint32_t> dropped_{0};
+  uint32_t droppedReported_ = 0;
+};
+
+// the log of the firmware (and of the native build).
+extern DeferredLog systemLog;
+
+// "if (false) printf(...)" lets the compiler check the format against the arguments and costs nothing.
+#define LOG_WRITE(level, ...)             \
+  do                                      \
+  {                                       \
+    if (false)                            \
+    {                                     \
+      std::printf(__VA_ARGS__);           \
+    }                                     \
+    systemLog.write(level, __VA_ARGS__);  \
+  } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
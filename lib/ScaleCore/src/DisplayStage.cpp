@@ -0,0 +1,124 @@
+/**
+ * DisplayStage.cpp
+ *  See DisplayStage.h.
+ */
+#include "DisplayStage.h"
+
+#include <cstring>
+
+namespace
+{
+
+const uint8_t digitFont[10] = {0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, 0x7f, 0x6f};
+const uint8_t glyphNotReady[DISPLAY_DIGITS] = {SEGMENT_MINUS, SEGMENT_MINUS, SEGMENT_MINUS, SEGMENT_MINUS};   // "----"
+const uint8_t glyphOverload[DISPLAY_DIGITS] = {SEGMENT_MINUS, 0x3f, 0x38, SEGMENT_MINUS};                     // "-OL-"
+
+// writes value right-aligned, blanks in front; returns the index of its first digit.
+uint8_t putNumber(uint32_t value, uint8_t segments[DISPLAY_DIGITS])
+{
+  uint8_t i = DISPLAY_DIGITS;
+  do
+  {
+    segments[--i] = digitFont[value % 10];
+    value /= 10;
+  } while (value != 0 && i > 0);
+  for (uint8_t j = 0; j < i; j++)
+  {
+    segments[j] = SEGMENT_BLANK;
+  }
+  return i;
+}
+
+}  // namespace
+
+uint8_t DisplayStage::digitSegments(uint8_t digit)
+{
+  return digit < 10 ? digitFont[digit] : SEGMENT_BLANK;
+}
+
+void DisplayStage::format(const ScaleState &state, bool &kilograms, uint8_t segments[DISPLAY_DIGITS])
+{
+  if (!state.isReady())
+  {
+    std::memcpy(segments, glyphNotReady, DISPLAY_DIGITS);
+    return;
+  }
+  const int32_t grams = state.weight;
+  if (grams >= DISPLAY_KG_ON_G)
+  {
+    kilograms = true;
+  }
+  else if (grams < DISPLAY_KG_OFF_G)
+  {
+    kilograms = false;
+  }
+  // WeightProcessor flags a weight below zero as an overload; a state that is not flagged is shown the same.
+  bool overload = state.isOverload() || grams < 0;
+  if (!overload && !kilograms)
+  {
+    // grams: "  50"
+    putNumber(static_cast<uint32_t>(grams), segments);
+  }
+  else if (!overload)
+  {
+    // kilograms, always 4 digits: "9.500" (hysteresis zone), "12.35", "123.5"
+    uint32_t value = static_cast<uint32_t>(grams);
+    uint8_t point = 0;
+    if (grams >= 10000)
+    {
+      value = (static_cast<uint32_t>(grams) + 5) / 10;
+      point = 1;
+      if (value >= 10000)
+      {
+        value = (static_cast<uint32_t>(grams) + 50) / 100;
+        point = 2;
+      }
+    }
+    overload = value >= 10000;
+    if (!overload)
+    {
+      putNumber(value, segments);
+      segments[point] |= SEGMENT_DP;
+    }
+  }
+  if (overload)
+  {
+    std::memcpy(segments, glyphOverload, DISPLAY_DIGITS);
+    return;
+  }
+  if (!state.isStable())
+  {
+    segments[DISPLAY_DIGITS - 1] |= SEGMENT_DP;   // the weight is still moving
+  }
+}
+
+uint8_t DisplayStage::show(const ScaleState &state)
+{
+  uint8_t next[DISPLAY_DIGITS];
+  format(state, kilograms_, next);
+  // the changed digits are written as one run (one bus transaction), from the first to the last one.
+  uint8_t first = 0;
+  uint8_t last = DISPLAY_DIGITS - 1;
+  if (valid_)
+  {
+    while (first < DISPLAY_DIGITS && next[first] == shadow_[first])
+    {
+      first++;
+    }
+    if (first == DISPLAY_DIGITS)
+    {
+      return 0;
+    }
+    while (next[last] == shadow_[last])
+    {
+      last--;
+    }
+  }
+  const uint8_t count = static_cast<uint8_t>(last - first + 1);
+  display_.writeSegments(first, next + first, count);
+  std::memcpy(shadow_, next, DISPLAY_DIGITS);
+  valid_ = true;
+  updates_++;
+  digitsWritten_ += count;
+  return count;
+}
@@ -0,0 +1,105 @@
+/**
+ * DisplayStage.h
+ *  Shows the scale state on the 4 digits 7-segment display (TM1637) with as little bus traffic as possible:
+ *  it keeps a copy (shadow) of the segments the display holds and only writes the digits that changed,
+ *  in one transaction (see SegmentDisplay::writeSegments). An unchanged weight costs no write at all, and
+ *  the display is never cleared between two values, so it does not flicker.
+ *
+ *  What is shown:
+ *    - grams as an integer, right-aligned:                      "  50", "9999"
+ *    - from 10 kg on, kilograms with a decimal point:           "10.00", "123.5"
+ *      (back to grams below 9 kg: "9.500" in between, so the unit does not flap around 10 kg)
+ *    - not ready (no sample from the HX711):                    "----"
+ *    - overload (or below zero, or 1000 kg and more):           "-OL-"
+ *    - unstable (still settling): the weight with the decimal point of the last digit lit, "  50."
+ *  Grams never have a decimal point and kilograms always have one, so the unit can be read from the display.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "Hal.h"
+#include "ScaleState.h"
+
+#define DISPLAY_DIGITS        4
+#define DISPLAY_KG_ON_G       10000   // switch to kilograms at this weight ...
+#define DISPLAY_KG_OFF_G      9000    // ... and back to grams below this one
+
+// segment bits of one digit (bit 0 = segment a ... bit 6 = segment g, bit 7 = decimal point)
+#define SEGMENT_DP     0x80
+#define SEGMENT_MINUS  0x40
+#define SEGMENT_BLANK  0x00
+
+class DisplayStage
+{
+public:
+  explicit DisplayStage(SegmentDisplay &display) : display_(display) {}
+
+  /**
+   * @brief Formats the state and writes the digits that differ from what the display shows.
+   * @return the number of digits written (0: nothing changed, no bus traffic).
+   */
+  uint8_t show(const ScaleState &state);
+
+  /**
+   * @brief Forgets the shadow: the next show() writes all the digits (after the display was reset or
+   *        powered up, or to resynchronize it now and then).
+   */
+  void invalidate() { valid_ = false; }
+
+  /**
+   * @brief The segments for a state.
+   * @param kilograms: the unit shown so far; updated with the unit of this state (hysteresis).
+   */
+  static void format(const ScaleState &state, bool &kilograms, uint8_t segments[DISPLAY_DIGITS]);
+
+  /**
+   * @brief The segments of a digit 0..9.
+   */
+  static uint8_t digitSegments(uint8_t digit);
+
+  const uint8_t *shown() const { return shadow_; }
+  uint32_t updates() const { return updates_; }       // show() calls that wrote something
+  uint32_t digitsWritten() const { return digitsWritten_; }
+
+private:
+  SegmentDisplay &display_;
+  uint8_t shadow_[DISPLAY_DIGITS] = {};
+  bool valid_ = false;
+  bool kilograms_ = false;
+  uint32_t updates_ = 0;
+  uint32_t digitsWritten_ = 0;
+};
+
+/**
+ * DisplayChangeDetector
+ *  Tells Task1 when a state shows other digits than the last one it reported: a drift below the publish
+ *  deadband that moves the rounded grams (100.4 g -> 101.3 g), the unstable point, a status. The display task
+ *  is woken for every such change and only for those; the deadband and the heartbeat of ChangeDetector are for
+ *  the network subscribers.
+ */
+class DisplayChangeDetector
+{
+public:
+  /**
+   * @brief Checks a new state. When the answer is true, the state counts as shown.
+   */
+  bool check(const ScaleState &state)
+  {
+    uint8_t next[DISPLAY_DIGITS];
+    DisplayStage::format(state, kilograms_, next);
+    if (primed_ && std::memcmp(next, shown_, DISPLAY_DIGITS) == 0)
+    {
+      return false;
+    }
+    std::memcpy(shown_, next, DISPLAY_DIGITS);
+    primed_ = true;
+    return true;
+  }
+
+private:
+  uint8_t shown_[DISPLAY_DIGITS] = {};
+  bool kilograms_ = false;
+  bool primed_ = false;
+};
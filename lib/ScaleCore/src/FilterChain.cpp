@@ -0,0 +1,71 @@
+/**
+ * FilterChain.cpp
+ *  See FilterChain.h.
+ */
+#include "FilterChain.h"
+
+#include <cstdlib>
+
+void FilterChain::configure(const FilterConfig &config)
+{
+  config_ = config;
+  median_.setWindow(config.medianWindow);
+  ema_.setShift(config.emaShift);
+  average_.setWindow(config.averageWindow);
+  kalman_.setNoise(config.kalmanProcessNoise, config.kalmanMeasurementNoise);
+  stability_.configure(config.stableToleranceMg, config.settleUs);
+  reset();
+}
+
+void FilterChain::reset()
+{
+  median_.reset();
+  ema_.reset();
+  average_.reset();
+  kalman_.reset();
+  stability_.reset();
+  primed_ = false;
+}
+
+int32_t FilterChain::smooth(int32_t x)
+{
+  // a new load on the platform: start the smoothing again from the new value instead of
+  // crawling towards it, this is what makes the weight settle in a few samples.
+  const bool step = primed_ && config_.stepCounts > 0 && std::abs(x - lastSmoothed_) > config_.stepCounts;
+  switch (config_.smoothing)
+  {
+    case Smoothing::Ema:
+      if (step)
+      {
+        ema_.snap(x);
+      }
+      return ema_.update(x);
+    case Smoothing::MovingAverage:
+      if (step)
+      {
+        average_.snap(x);
+        return x;
+      }
+      return average_.update(x);
+    case Smoothing::Kalman:
+      if (step)
+      {
+        kalman_.snap(x);
+      }
+      return kalman_.update(x);
+    case Smoothing::None:
+    default:
+      return x;
+  }
+}
+
+FilterOutput FilterChain::update(int32_t raw, uint32_t timestampUs)
+{
+  FilterOutput out;
+  out.filteredRaw = smooth(median_.update(raw));
+  lastSmoothed_ = out.filteredRaw;
+  primed_ = true;
+  out.weightMg = converter_.toMilligrams(out.filteredRaw);
+  out.stable = stability_.update(out.weightMg, timestampUs);
+  return out;
+}
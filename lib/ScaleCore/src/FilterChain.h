@@ -0,0 +1,81 @@
+/**
+ * FilterChain.h
+ *  The configurable filter pipeline between the HX711 and the published weight:
+ *
+ *    raw counts -> median (spike rejection) -> smoothing (EMA, moving average or Kalman)
+ *               -> milligrams (WeightConverter) -> stability detector
+ *
+ *  Only integer / fixed-point math is used per sample (see FixedFilter.h).
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "FixedFilter.h"
+
+enum class Smoothing : uint8_t
+{
+  None,
+  Ema,
+  MovingAverage,
+  Kalman,
+};
+
+struct FilterConfig
+{
+  uint8_t   medianWindow = 3;             // 1 = off, odd values up to 9
+  Smoothing smoothing = Smoothing::Ema;
+  uint8_t   emaShift = 3;                 // alpha = 1/8
+  uint8_t   averageWindow = 8;            // moving average length (up to 32)
+  uint32_t  kalmanProcessNoise = 4;       // counts^2 per sample
+  uint32_t  kalmanMeasurementNoise = 400; // counts^2
+  int32_t   stepCounts = 2000;            // a jump bigger than this restarts the smoothing (0 = never)
+  int32_t   stableToleranceMg = 2000;     // +/- band for the stability detector
+  uint32_t  settleUs = 300000;            // time inside the band before the weight is stable
+};
+
+struct FilterOutput
+{
+  int32_t filteredRaw;  // raw counts after median and smoothing
+  int32_t weightMg;     // milligrams
+  bool    stable;
+};
+
+class FilterChain
+{
+public:
+  explicit FilterChain(const FilterConfig &config = FilterConfig()) { configure(config); }
+
+  /**
+   * @brief Applies a new configuration and restarts all the filters.
+   */
+  void configure(const FilterConfig &config);
+
+  /**
+   * @brief Clears the filter history (e.g. after the HX711 was not ready).
+   */
+  void reset();
+
+  /**
+   * @brief Runs one sample through the chain.
+   * @param raw: HX711 raw value.
+   * @param timestampUs: time of the sample, used by the stability detector.
+   */
+  FilterOutput update(int32_t raw, uint32_t timestampUs);
+
+  WeightConverter &converter() { return converter_; }
+  const FilterConfig &config() const { return config_; }
+
+private:
+  int32_t smooth(int32_t x);
+
+  FilterConfig config_;
+  MedianFilter median_;
+  EmaFilter ema_;
+  MovingAverage average_;
+  KalmanFilter kalman_;
+  WeightConverter converter_;
+  StabilityDetector stability_;
+  int32_t lastSmoothed_ = 0;
+  bool primed_ = false;
+};
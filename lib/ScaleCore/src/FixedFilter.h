@@ -0,0 +1,327 @@
+/**
+ * FixedFilter.h
+ *  Integer / fixed-point filter kernels for the load cell signal. No float is used per sample, so the
+ *  kernels cost the same on the ESP32 as on the host and give bit-identical results on both.
+ *
+ *  All kernels work on raw HX711 counts (int32_t) and keep one sample in, one sample out:
+ *    - MedianFilter   : median of the last N samples, rejects single spikes (N odd, up to 9).
+ *    - MovingAverage  : mean of the last N samples (up to 32).
+ *    - EmaFilter      : exponential average y += (x - y) / 2^shift, state kept in Q8.
+ *    - KalmanFilter   : 1-D Kalman filter for a constant weight, gain in Q16.
+ *  EmaFilter and KalmanFilter can snap to the input on a large step, so a new load settles in a few
+ *  samples instead of the full smoothing time.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+class MedianFilter
+{
+public:
+  static constexpr uint8_t maxWindow = 9;
+
+  explicit MedianFilter(uint8_t window = 5) { setWindow(window); }
+
+  /**
+   * @brief Sets the window size (rounded down to an odd number, 1 disables the filter).
+   */
+  void setWindow(uint8_t window)
+  {
+    window = window > maxWindow ? maxWindow : (window < 1 ? 1 : window);
+    window_ = (window & 1u) ? window : static_cast<uint8_t>(window - 1u);
+    reset();
+  }
+
+  void reset()
+  {
+    count_ = 0;
+    next_ = 0;
+  }
+
+  int32_t update(int32_t x)
+  {
+    history_[next_] = x;
+    next_ = static_cast<uint8_t>((next_ + 1u) % window_);
+    if (count_ < window_)
+    {
+      count_++;
+    }
+    // insertion sort of a copy: at most 9 elements, cheaper than anything clever.
+    int32_t sorted[maxWindow];
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      int32_t value = history_[i];
+      int8_t j = static_cast<int8_t>(i) - 1;
+      while (j >= 0 && sorted[j] > value)
+      {
+        sorted[j + 1] = sorted[j];
+        j--;
+      }
+      sorted[j + 1] = value;
+    }
+    return sorted[count_ / 2u];
+  }
+
+private:
+  int32_t history_[maxWindow] = {};
+  uint8_t window_ = 1;
+  uint8_t count_ = 0;
+  uint8_t next_ = 0;
+};
+
+class MovingAverage
+{
+public:
+  static constexpr uint8_t maxWindow = 32;
+
+  explicit MovingAverage(uint8_t window = 8) { setWindow(window); }
+
+  void setWindow(uint8_t window)
+  {
+    window_ = window > maxWindow ? maxWindow : (window < 1 ? 1 : window);
+    reset();
+  }
+
+  void reset()
+  {
+    sum_ = 0;
+    count_ = 0;
+    next_ = 0;
+  }
+
+  /**
+   * @brief Restarts the average from x (used after a step).
+   */
+  void snap(int32_t x)
+  {
+    reset();
+    update(x);
+  }
+
+  int32_t update(int32_t x)
+  {
+    if (count_ == window_)
+    {
+      sum_ -= history_[next_];
+    }
+    else
+    {
+      count_++;
+    }
+    history_[next_] = x;
+    sum_ += x;
+    next_ = static_cast<uint8_t>((next_ + 1u) % window_);
+    return static_cast<int32_t>(sum_ / count_);
+  }
+
+private:
+  int32_t history_[maxWindow] = {};
+  int64_t sum_ = 0;
+  uint8_t window_ = 1;
+  uint8_t count_ = 0;
+  uint8_t next_ = 0;
+};
+
+class EmaFilter
+{
+public:
+  /**
+   * @param shift: smoothing, alpha = 1 / 2^shift (0 = no smoothing, 4 = 1/16).
+   */
+  explicit EmaFilter(uint8_t shift = 3) : shift_(shift) {}
+
+  void setShift(uint8_t shift) { shift_ = shift > 15 ? 15 : shift; }
+  void reset() { primed_ = false; }
+  void snap(int32_t x)
+  {
+    state_ = static_cast<int64_t>(x) << fractionBits;
+    primed_ = true;
+  }
+
+  int32_t update(int32_t x)
+  {
+    if (!primed_)
+    {
+      snap(x);
+    }
+    else
+    {
+      const int64_t input = static_cast<int64_t>(x) << fractionBits;
+      state_ += (input - state_) / (int64_t(1) << shift_);
+    }
+    return value();
+  }
+
+  int32_t value() const
+  {
+    // round to nearest count.
+    return static_cast<int32_t>((state_ + (int64_t(1) << (fractionBits - 1))) >> fractionBits);
+  }
+
+private:
+  static constexpr uint8_t fractionBits = 8;
+  int64_t state_ = 0;  // Q8
+  uint8_t shift_;
+  bool primed_ = false;
+};
+
+class KalmanFilter
+{
+public:
+  /**
+   * @param processNoise: Q, how much the weight may drift per sample (counts^2).
+   * @param measurementNoise: R, variance of one HX711 reading (counts^2).
+   */
+  KalmanFilter(uint32_t processNoise = 4, uint32_t measurementNoise = 400)
+      : q_(processNoise), r_(measurementNoise)
+  {
+  }
+
+  void setNoise(uint32_t processNoise, uint32_t measurementNoise)
+  {
+    q_ = processNoise;
+    r_ = measurementNoise < 1 ? 1 : measurementNoise;
+  }
+
+  void reset() { primed_ = false; }
+  void snap(int32_t x)
+  {
+    x_ = x;
+    p_ = r_;
+    primed_ = true;
+  }
+
+  int32_t update(int32_t z)
+  {
+    if (!primed_)
+    {
+      snap(z);
+      return x_;
+    }
+    // predict: the weight is constant, only the uncertainty grows.
+    p_ += q_;
+    // update: K = P / (P + R) in Q16.
+    const int64_t gain = (static_cast<int64_t>(p_) << 16) / (p_ + r_);
+    const int64_t correction = (gain * (static_cast<int64_t>(z) - x_)) / 65536;
+    x_ += static_cast<int32_t>(correction);
+    p_ = static_cast<uint32_t>(((65536 - gain) * p_) >> 16);
+    return x_;
+  }
+
+private:
+  uint32_t q_;
+  uint32_t r_;
+  uint32_t p_ = 0;
+  int32_t x_ = 0;
+  bool primed_ = false;
+};
+
+/**
+ * @brief Raw counts to milligrams: mg = (raw - offset) * mgPerCount, with mgPerCount in Q16.
+ * @details The float calibration factor is only used when the calibration changes, not per sample.
+ */
+class WeightConverter
+{
+public:
+  /**
+   * @param countsPerGram: the calibration factor (raw counts per gram, may be negative).
+   */
+  void setCalibration(int32_t offset, float countsPerGram)
+  {
+    offset_ = offset;
+    mgPerCountQ16_ = static_cast<int32_t>((1000.0f * 65536.0f) / countsPerGram);
+  }
+
+  void setOffset(int32_t offset) { offset_ = offset; }
+  int32_t offset() const { return offset_; }
+
+  int32_t toMilligrams(int32_t raw) const
+  {
+    const int64_t mg = static_cast<int64_t>(raw - offset_) * mgPerCountQ16_;
+    // round to the nearest milligram.
+    return static_cast<int32_t>((mg + (mg >= 0 ? 32768 : -32768)) / 65536);
+  }
+
+private:
+  int32_t offset_ = 0;
+  int32_t mgPerCountQ16_ = 65536;
+};
+
+/**
+ * @brief Tells when the weight has settled.
+ * @details The weight is stable once it stayed within +/- toleranceMg of a reference value for at least
+ *          settleUs. Any move outside the band restarts the timer from the new value.
+ */
+class StabilityDetector
+{
+public:
+  StabilityDetector(int32_t toleranceMg = 2000, uint32_t settleUs = 300000)
+      : toleranceMg_(toleranceMg), settleUs_(settleUs)
+  {
+  }
+
+  void configure(int32_t toleranceMg, uint32_t settleUs)
+  {
+    toleranceMg_ = toleranceMg;
+    settleUs_ = settleUs;
+  }
+
+  void reset() { primed_ = false; }
+
+  bool update(int32_t weightMg, uint32_t nowUs)
+  {
+    if (!primed_ || std::abs(weightMg - referenceMg_) > toleranceMg_)
+    {
+      referenceMg_ = weightMg;
+      sinceUs_ = nowUs;
+      primed_ = true;
+    }
+    stable_ = (nowUs - sinceUs_) >= settleUs_;
+    return stable_;
+  }
+
+  bool isStable() const { return stable_; }
+
+private:
+  int32_t toleranceMg_;
+  uint32_t settleUs_;
+  int32_t referenceMg_ = 0;
+  uint32_t sinceUs_ = 0;
+  bool primed_ = false;
+  bool stable_ = false;
+};
+
+/**
+ * @brief Automatic zero tracking: a stable weight close to zero is taken as the new zero.
+ * @details Only inside +/- bandMg (half a display step by default) and at most once every intervalUs, so a
+ *          load that is put on slowly, or a real small weight, is not tracked away.
+ */
+class ZeroTracker
+{
+public:
+  ZeroTracker(int32_t bandMg = 500, uint32_t intervalUs = 1000000) : bandMg_(bandMg), intervalUs_(intervalUs) {}
+
+  void setEnabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  /**
+   * @param filteredRaw: the filtered signal in counts, offsets removed (0 = the current zero).
+   * @return the counts to move the zero by (0 = nothing to do).
+   */
+  int32_t update(int32_t weightMg, int32_t filteredRaw, bool stable, uint32_t nowUs)
+  {
+    if (!enabled_ || !stable || filteredRaw == 0 || std::abs(weightMg) > bandMg_ || nowUs - lastUs_ < intervalUs_)
+    {
+      return 0;
+    }
+    lastUs_ = nowUs;
+    return filteredRaw;
+  }
+
+private:
+  int32_t bandMg_;
+  uint32_t intervalUs_;
+  bool enabled_ = false;
+  uint32_t lastUs_ = 0;
+};
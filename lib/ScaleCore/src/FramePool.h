@@ -0,0 +1,77 @@
+/**
+ * FramePool.h
+ *  A few fixed buffers for outgoing frames, taken and given back by any task without a lock.
+ *  Every buffer keeps Headroom bytes in front of the payload, so a protocol header can be written there
+ *  instead of copying the payload into a new (heap) buffer: the WebSockets library does that for every frame
+ *  unless the payload has WEBSOCKETS_MAX_HEADER_SIZE bytes of room in front of it (headerToPayload).
+ *
+ *      uint8_t *frame = frames.acquire(length);   // nullptr: too long or every buffer is in use
+ *      memcpy(frame, payload, length);
+ *      webSocket.sendTXT(client, frame, length, true);
+ *      frames.release(frame);
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <size_t Slots, size_t Bytes, size_t Headroom>
+class FramePool
+{
+  static_assert(Slots >= 1 && Slots <= 32, "the free slots are a 32 bit mask");
+
+public:
+  static constexpr size_t capacity() { return Bytes; }
+
+  /**
+   * @brief Takes a free buffer for a payload of length bytes (never blocks).
+   * @return the start of the payload (Headroom bytes are free in front of it), nullptr if the payload is longer
+   *         than Bytes or every buffer is in use.
+   */
+  uint8_t *acquire(size_t length)
+  {
+    if (length > Bytes)
+    {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    uint32_t used = used_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      uint8_t slot = 0;
+      while (slot < Slots && (used & (1u << slot)) != 0)
+      {
+        slot++;
+      }
+      if (slot == Slots)
+      {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      if (used_.compare_exchange_weak(used, used | (1u << slot), std::memory_order_acquire, std::memory_order_relaxed))
+      {
+        return slots_[slot] + Headroom;
+      }
+    }
+  }
+
+  /**
+   * @brief Gives back a buffer of acquire().
+   */
+  void release(uint8_t *payload)
+  {
+    const size_t slot = static_cast<size_t>(payload - Headroom - slots_[0]) / (Headroom + Bytes);
+    used_.fetch_and(~(1u << slot), std::memory_order_release);
+  }
+
+  /**
+   * @brief Payloads that did not get a buffer (too long, or all in use).
+   */
+  uint32_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  uint8_t slots_[Slots][Headroom + Bytes];
+  std::atomic<uint32_t> used_{0};
+  std::atomic<uint32_t> misses_{0};
+};
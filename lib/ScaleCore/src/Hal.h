@@ -0,0 +1,88 @@
+/**
+ * Hal.h
+ *  Thin hardware abstraction for the pieces of the scale that talk to the outside world:
+ *  the load cell (HX711), the 4 digits display (TM1637), the clock, the network transport
+ *  (WebSocket clients) and a TCP connection to a server (the MQTT broker).
+ *  The firmware implements them on top of the Arduino libraries (src/ArduinoHal.h), the native
+ *  build implements them with simulated hardware (src/native/SimHal.h), so the same pipeline code
+ *  can be run, measured and profiled on a PC.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Clock
+{
+public:
+  virtual ~Clock() {}
+  virtual uint32_t micros() const = 0;
+  virtual uint32_t millis() const { return micros() / 1000u; }
+};
+
+class LoadCell
+{
+public:
+  virtual ~LoadCell() {}
+  /**
+   * @brief true when a conversion is waiting (HX711 DOUT low).
+   */
+  virtual bool isReady() = 0;
+  /**
+   * @brief Clocks the waiting conversion out. Only call it when isReady() is true.
+   */
+  virtual int32_t read() = 0;
+  virtual void powerDown() {}
+  virtual void powerUp() {}
+};
+
+class SegmentDisplay
+{
+public:
+  virtual ~SegmentDisplay() {}
+  virtual void showNumber(long value) = 0;
+  /**
+   * @brief Shows up to 4 characters, e.g. "----".
+   */
+  virtual void showText(const char *text) = 0;
+  /**
+   * @brief Writes raw segments (bit 0 = a ... bit 6 = g, bit 7 = decimal point) to count digits
+   *        starting at position, in one bus transaction. The other digits keep what they show.
+   */
+  virtual void writeSegments(uint8_t position, const uint8_t *segments, uint8_t count) = 0;
+};
+
+class Transport
+{
+public:
+  virtual ~Transport() {}
+  virtual size_t clientCount() = 0;
+  virtual bool broadcastText(const char *data, size_t length) = 0;
+  virtual bool broadcastBinary(const uint8_t *data, size_t length) = 0;
+  virtual bool sendText(uint8_t client, const char *data, size_t length) = 0;
+  virtual bool sendBinary(uint8_t client, const uint8_t *data, size_t length) = 0;
+};
+
+/**
+ * @brief A TCP connection to a server (WiFiClient in the firmware, a socket in the native build).
+ */
+class TcpConnection
+{
+public:
+  virtual ~TcpConnection() {}
+  /**
+   * @brief Connects (waits for the TCP handshake, up to the timeout of the implementation).
+   */
+  virtual bool open(const char *host, uint16_t port) = 0;
+  virtual void close() = 0;
+  virtual bool isOpen() = 0;
+  /**
+   * @return the bytes written: length, or less if the connection failed.
+   */
+  virtual size_t write(const uint8_t *data, size_t length) = 0;
+  /**
+   * @brief Takes what arrived, never waits.
+   * @return the bytes read, 0 if nothing is there.
+   */
+  virtual size_t read(uint8_t *out, size_t max) = 0;
+};
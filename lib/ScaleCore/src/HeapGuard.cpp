@@ -0,0 +1,67 @@
+/**
+ * HeapGuard.cpp
+ *  See HeapGuard.h.
+ */
+#include "HeapGuard.h"
+
+void HeapGuard::setPolicy(uint8_t owner, HeapPolicy policy)
+{
+  owners_[index(owner)].policy.store(static_cast<uint8_t>(policy), std::memory_order_relaxed);
+}
+
+HeapPolicy HeapGuard::policy(uint8_t owner) const
+{
+  return static_cast<HeapPolicy>(owners_[index(owner)].policy.load(std::memory_order_relaxed));
+}
+
+bool HeapGuard::onAllocate(uint8_t owner, size_t size)
+{
+  if (!armed())
+  {
+    return true;
+  }
+  Owner &entry = owners_[index(owner)];
+  entry.allocations.fetch_add(1, std::memory_order_relaxed);
+  entry.bytes.fetch_add(static_cast<uint32_t>(size), std::memory_order_relaxed);
+  uint32_t largest = entry.largest.load(std::memory_order_relaxed);
+  while (size > largest && !entry.largest.compare_exchange_weak(largest, static_cast<uint32_t>(size), std::memory_order_relaxed))
+  {
+  }
+  if (static_cast<HeapPolicy>(entry.policy.load(std::memory_order_relaxed)) == HeapPolicy::Trap)
+  {
+    traps_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+HeapOwnerStats HeapGuard::stats(uint8_t owner) const
+{
+  const Owner &entry = owners_[index(owner)];
+  HeapOwnerStats out;
+  out.allocations = entry.allocations.load(std::memory_order_relaxed);
+  out.bytes = entry.bytes.load(std::memory_order_relaxed);
+  out.largest = entry.largest.load(std::memory_order_relaxed);
+  return out;
+}
+
+uint32_t HeapGuard::allocations() const
+{
+  uint32_t total = 0;
+  for (const Owner &entry : owners_)
+  {
+    total += entry.allocations.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void HeapGuard::reset()
+{
+  for (Owner &entry : owners_)
+  {
+    entry.allocations.store(0, std::memory_order_relaxed);
+    entry.bytes.store(0, std::memory_order_relaxed);
+    entry.largest.store(0, std::memory_order_relaxed);
+  }
+  traps_.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+/**
+ * HeapGuard.h
+ *  "No heap after boot" (HEAP_AFTER_BOOT in main.cpp): once setup() is done, the steady state works in
+ *  buffers sized at boot (the fan-out payloads, the WebSocket frames of FramePool.h, the command queue, the
+ *  log ring, the history write buffer, the trace blocks), so weeks of uptime cannot fragment the heap.
+ *  The guard sees every allocation made after arm(), per owner, and applies the owner's policy:
+ *    - Count : the allocation is counted (allocations, bytes, the largest one) and goes on,
+ *    - Trap  : it is counted and the hook stops (the firmware aborts: the backtrace shows who allocated).
+ *  The owners are the tasks of the task table (0..HEAP_GUARD_OTHER-1) and everyone else (HEAP_GUARD_OTHER:
+ *  WiFi, lwIP, the timer task). The hooks are the malloc wrappers of the firmware (-Wl,--wrap=malloc) and,
+ *  in the native build, the counting operator new (AllocCounter.h).
+ *
+ *  Never allocates, never blocks; the hooks may run in any task at the same time (atomic counters).
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define HEAP_GUARD_OTHER   8                       // owner of the allocations that are not made by a task of the table
+#define HEAP_GUARD_OWNERS  (HEAP_GUARD_OTHER + 1)
+
+enum class HeapPolicy : uint8_t
+{
+  Count = 0,
+  Trap = 1,
+};
+
+struct HeapOwnerStats
+{
+  uint32_t allocations;   // since arm()
+  uint32_t bytes;
+  uint32_t largest;       // the largest single allocation
+};
+
+class HeapGuard
+{
+public:
+  /**
+   * @brief What happens to the allocations of an owner once armed (all owners: Count).
+   */
+  void setPolicy(uint8_t owner, HeapPolicy policy);
+  HeapPolicy policy(uint8_t owner) const;
+
+  /**
+   * @brief From now on the allocations are counted and trapped (the end of setup()).
+   */
+  void arm() { armed_.store(true, std::memory_order_release); }
+  void disarm() { armed_.store(false, std::memory_order_release); }
+  bool armed() const { return armed_.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Called by the allocation hook before it allocates (nothing happens while not armed).
+   * @param owner: who allocates, an owner past HEAP_GUARD_OTHER counts as HEAP_GUARD_OTHER.
+   * @return false if the policy of the owner is Trap: the hook must not go on.
+   */
+  bool onAllocate(uint8_t owner, size_t size);
+
+  HeapOwnerStats stats(uint8_t owner) const;
+  uint32_t allocations() const;   // all owners
+  uint32_t traps() const { return traps_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Clears the counters (the policies and arm() stay).
+   */
+  void reset();
+
+private:
+  struct Owner
+  {
+    std::atomic<uint32_t> allocations{0};
+    std::atomic<uint32_t> bytes{0};
+    std::atomic<uint32_t> largest{0};
+    std::atomic<uint8_t> policy{static_cast<uint8_t>(HeapPolicy::Count)};
+  };
+
+  static uint8_t index(uint8_t owner) { return owner < HEAP_GUARD_OTHER ? owner : HEAP_GUARD_OTHER; }
+
+  Owner owners_[HEAP_GUARD_OWNERS];
+  std::atomic<bool> armed_{false};
+  std::atomic<uint32_t> traps_{0};
+};
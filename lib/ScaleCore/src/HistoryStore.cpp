@@ -0,0 +1,551 @@
+/**
+ * HistoryStore.cpp
+ *  See HistoryStore.h.
+ */
+#include "HistoryStore.h"
+
+#include <cstring>
+
+namespace
+{
+
+const uint32_t segmentMagic = 0x31485357u;   // "WSH1"
+
+void putU32(uint8_t *p, uint32_t v)
+{
+  p[0] = static_cast<uint8_t>(v);
+  p[1] = static_cast<uint8_t>(v >> 8);
+  p[2] = static_cast<uint8_t>(v >> 16);
+  p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+void putU64(uint8_t *p, uint64_t v)
+{
+  putU32(p, static_cast<uint32_t>(v));
+  putU32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+uint32_t getU32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t getU64(const uint8_t *p) { return getU32(p) | (static_cast<uint64_t>(getU32(p + 4)) << 32); }
+
+size_t putVarint(uint8_t *p, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80u)
+  {
+    p[n++] = static_cast<uint8_t>(v | 0x80u);
+    v >>= 7;
+  }
+  p[n++] = static_cast<uint8_t>(v);
+  return n;
+}
+
+// false if the varint does not end within the available bytes (torn record).
+bool getVarint(const uint8_t *p, size_t available, size_t &used, uint32_t &v)
+{
+  v = 0;
+  for (size_t i = 0; i < available && i < 5; i++)
+  {
+    v |= static_cast<uint32_t>(p[i] & 0x7Fu) << (7 * i);
+    if ((p[i] & 0x80u) == 0)
+    {
+      used = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+// small differences of either sign become small unsigned numbers: 0, -1, 1, -2 -> 0, 1, 2, 3
+uint32_t zigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+int32_t unzigzag(uint32_t v) { return static_cast<int32_t>((v >> 1) ^ (0u - (v & 1u))); }
+
+// decimal without printf: 64-bit formats are not available in every libc the firmware may use.
+size_t putDecimal(char *p, uint64_t v)
+{
+  char digits[20];
+  size_t n = 0;
+  do
+  {
+    digits[n++] = static_cast<char>('0' + v % 10u);
+    v /= 10u;
+  } while (v != 0);
+  for (size_t i = 0; i < n; i++)
+  {
+    p[i] = digits[n - 1 - i];
+  }
+  return n;
+}
+
+size_t putSigned(char *p, int32_t v)
+{
+  if (v < 0)
+  {
+    p[0] = '-';
+    return 1 + putDecimal(p + 1, static_cast<uint64_t>(-static_cast<int64_t>(v)));
+  }
+  return putDecimal(p, static_cast<uint64_t>(v));
+}
+
+}  // namespace
+
+//********************************************************************* HistoryStore
+
+HistoryStore::HistoryStore(HistoryStorage &storage, const HistoryConfig &config) : storage_(storage), config_(config)
+{
+  if (config_.segmentCount > maxSegments)
+  {
+    config_.segmentCount = maxSegments;
+  }
+  if (config_.segmentCount < 2)
+  {
+    config_.segmentCount = 2;
+  }
+  if (config_.segmentBytes < headerSize + maxRecordSize)
+  {
+    config_.segmentBytes = headerSize + maxRecordSize;
+  }
+}
+
+bool HistoryStore::readHeader(uint16_t segment, uint32_t &seq, HistoryPoint &base)
+{
+  uint8_t header[headerSize];
+  if (storage_.size(segment) < headerSize || storage_.read(segment, 0, header, headerSize) != headerSize ||
+      getU32(header) != segmentMagic)
+  {
+    return false;
+  }
+  seq = getU32(header + 4);
+  base.timeMs = getU64(header + 8);
+  base.value = static_cast<int32_t>(getU32(header + 16));
+  return true;
+}
+
+bool HistoryStore::begin()
+{
+  uint32_t newestSeq = 0;
+  HistoryPoint newestBase = {};
+  for (uint16_t segment = 0; segment < config_.segmentCount; segment++)
+  {
+    uint32_t seq;
+    HistoryPoint base;
+    if (readHeader(segment, seq, base) && seq > newestSeq)
+    {
+      newestSeq = seq;
+      newestBase = base;
+      current_ = segment;
+    }
+  }
+  if (newestSeq == 0)
+  {
+    return false;
+  }
+  currentSeq_ = newestSeq;
+  currentSize_ = storage_.size(current_);
+
+  // the last point is needed to encode the next one: decode the newest segment only.
+  HistoryReader reader(*this, newestBase.timeMs, UINT64_MAX);
+  HistoryPoint point;
+  last_ = newestBase;
+  while (reader.next(point))
+  {
+    last_ = point;
+  }
+  haveLast_ = true;
+  // a torn record at the end cannot be appended to: the next point starts a new segment.
+  open_ = !reader.torn();
+  return true;
+}
+
+bool HistoryStore::startSegment(uint64_t timeMs, int32_t value)
+{
+  flush();
+  const uint16_t next = currentSeq_ == 0 ? 0 : static_cast<uint16_t>((current_ + 1u) % config_.segmentCount);
+  uint8_t header[headerSize];
+  putU32(header, segmentMagic);
+  putU32(header + 4, currentSeq_ + 1u);
+  putU64(header + 8, timeMs);
+  putU32(header + 16, static_cast<uint32_t>(value));
+  // the oldest segment is reused: erased once per lap of the ring.
+  storage_.erase(next);
+  open_ = storage_.append(next, header, headerSize);
+  if (!open_)
+  {
+    return false;
+  }
+  current_ = next;
+  currentSeq_++;
+  currentSize_ = headerSize;
+  segmentStarts_++;
+  return true;
+}
+
+bool HistoryStore::append(uint64_t timeMs, int32_t value)
+{
+  if (haveLast_ && timeMs < last_.timeMs)
+  {
+    return false;
+  }
+  uint8_t record[maxRecordSize];
+  size_t length = 0;
+  bool newSegment = !open_;
+  if (open_)
+  {
+    const uint64_t elapsed = timeMs - last_.timeMs;
+    if (elapsed > UINT32_MAX)
+    {
+      newSegment = true;   // more than 49 days without a point
+    }
+    else
+    {
+      const int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(value) - static_cast<uint32_t>(last_.value));
+      length = putVarint(record, static_cast<uint32_t>(elapsed));
+      length += putVarint(record + length, zigzag(delta));
+      newSegment = currentSize_ + length > config_.segmentBytes;
+    }
+  }
+
+  if (newSegment)
+  {
+    // the point becomes the base of the new segment, no record needed.
+    if (!startSegment(timeMs, value))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    if (buffered_ + length > writeBufferSize && !flush())
+    {
+      return false;
+    }
+    std::memcpy(buffer_ + buffered_, record, length);
+    buffered_ += length;
+    currentSize_ += static_cast<uint32_t>(length);
+  }
+  last_.timeMs = timeMs;
+  last_.value = value;
+  haveLast_ = true;
+  appended_++;
+  return true;
+}
+
+bool HistoryStore::flush()
+{
+  if (buffered_ == 0)
+  {
+    return true;
+  }
+  const bool ok = storage_.append(current_, buffer_, buffered_);
+  buffered_ = 0;
+  if (!ok)
+  {
+    // the segment may now end with part of a record: continue in a new one.
+    open_ = false;
+  }
+  return ok;
+}
+
+//********************************************************************* HistoryReader
+
+HistoryReader::HistoryReader(HistoryStore &store, uint64_t fromMs, uint64_t toMs)
+    : storage_(store.storage()), fromMs_(fromMs), toMs_(toMs)
+{
+  uint32_t seqs[HistoryStore::maxSegments];
+  uint64_t bases[HistoryStore::maxSegments];
+  for (uint16_t segment = 0; segment < store.config().segmentCount; segment++)
+  {
+    uint32_t seq;
+    HistoryPoint base;
+    if (!store.readHeader(segment, seq, base))
+    {
+      continue;
+    }
+    // insertion sort by sequence number: oldest segment first.
+    size_t i = segmentCount_++;
+    while (i > 0 && seqs[i - 1] > seq)
+    {
+      seqs[i] = seqs[i - 1];
+      bases[i] = bases[i - 1];
+      order_[i] = order_[i - 1];
+      i--;
+    }
+    seqs[i] = seq;
+    bases[i] = base.timeMs;
+    order_[i] = segment;
+  }
+  // a segment ends where the next one begins: skip the ones that end before the range.
+  while (nextSegment_ + 1 < segmentCount_ && bases[nextSegment_ + 1] <= fromMs_)
+  {
+    nextSegment_++;
+  }
+}
+
+bool HistoryReader::openSegment()
+{
+  while (nextSegment_ < segmentCount_)
+  {
+    segment_ = order_[nextSegment_++];
+    fileSize_ = storage_.size(segment_);
+    uint8_t header[HistoryStore::headerSize];
+    if (fileSize_ < HistoryStore::headerSize ||
+        storage_.read(segment_, 0, header, HistoryStore::headerSize) != HistoryStore::headerSize)
+    {
+      continue;
+    }
+    point_.timeMs = getU64(header + 8);
+    point_.value = static_cast<int32_t>(getU32(header + 16));
+    fileOffset_ = HistoryStore::headerSize;
+    blockLength_ = 0;
+    blockPos_ = 0;
+    emitBase_ = true;
+    torn_ = false;
+    return true;
+  }
+  return false;
+}
+
+bool HistoryReader::decode(HistoryPoint &out)
+{
+  if (emitBase_)
+  {
+    emitBase_ = false;
+    out = point_;
+    return true;
+  }
+  // keep at least one whole record in the block.
+  if (blockLength_ - blockPos_ < HistoryStore::maxRecordSize && fileOffset_ < fileSize_)
+  {
+    const size_t kept = blockLength_ - blockPos_;
+    std::memmove(block_, block_ + blockPos_, kept);
+    const size_t got = storage_.read(segment_, fileOffset_, block_ + kept, sizeof(block_) - kept);
+    fileOffset_ += static_cast<uint32_t>(got);
+    blockLength_ = kept + got;
+    blockPos_ = 0;
+    if (got == 0)
+    {
+      fileOffset_ = fileSize_;   // read error: treat as the end of the segment
+    }
+  }
+  if (blockPos_ == blockLength_)
+  {
+    return false;
+  }
+  uint32_t elapsed;
+  uint32_t delta;
+  size_t used1;
+  size_t used2;
+  if (!getVarint(block_ + blockPos_, blockLength_ - blockPos_, used1, elapsed) ||
+      !getVarint(block_ + blockPos_ + used1, blockLength_ - blockPos_ - used1, used2, delta))
+  {
+    torn_ = true;
+    return false;
+  }
+  blockPos_ += used1 + used2;
+  point_.timeMs += elapsed;
+  point_.value = static_cast<int32_t>(static_cast<uint32_t>(point_.value) + static_cast<uint32_t>(unzigzag(delta)));
+  out = point_;
+  return true;
+}
+
+bool HistoryReader::next(HistoryPoint &out)
+{
+  while (!done_)
+  {
+    if (!open_)
+    {
+      open_ = openSegment();
+      if (!open_)
+      {
+        done_ = true;
+        break;
+      }
+    }
+    HistoryPoint point;
+    if (!decode(point))
+    {
+      open_ = false;
+      continue;
+    }
+    if (point.timeMs < fromMs_)
+    {
+      continue;
+    }
+    if (point.timeMs > toMs_)
+    {
+      done_ = true;
+      break;
+    }
+    out = point;
+    return true;
+  }
+  return false;
+}
+
+//********************************************************************* HistoryDownsampler
+
+void HistoryDownsampler::close(HistoryBucket &out) const
+{
+  out.startMs = startMs_;
+  out.min = min_;
+  out.max = max_;
+  out.avg = static_cast<int32_t>(sum_ / count_);
+  out.count = count_;
+}
+
+bool HistoryDownsampler::add(const HistoryPoint &point, HistoryBucket &out)
+{
+  const uint64_t start = point.timeMs - point.timeMs % bucketMs_;
+  bool closed = false;
+  if (count_ != 0 && start != startMs_)
+  {
+    close(out);
+    closed = true;
+    count_ = 0;
+  }
+  if (count_ == 0)
+  {
+    startMs_ = start;
+    sum_ = 0;
+    min_ = point.value;
+    max_ = point.value;
+  }
+  min_ = point.value < min_ ? point.value : min_;
+  max_ = point.value > max_ ? point.value : max_;
+  sum_ += point.value;
+  count_++;
+  return closed;
+}
+
+bool HistoryDownsampler::finish(HistoryBucket &out)
+{
+  if (count_ == 0)
+  {
+    return false;
+  }
+  close(out);
+  count_ = 0;
+  return true;
+}
+
+//********************************************************************* HistoryStream
+
+HistoryStream::HistoryStream(HistoryStore &store, uint64_t fromMs, uint64_t toMs, uint32_t bucketMs,
+                             HistoryFormat format)
+    : reader_(store, fromMs, toMs), downsampler_(bucketMs), bucketMs_(bucketMs), format_(format)
+{
+}
+
+void HistoryStream::formatPoint(const HistoryPoint &point)
+{
+  if (format_ == HistoryFormat::Binary)
+  {
+    putU64(item_, point.timeMs);
+    putU32(item_ + 8, static_cast<uint32_t>(point.value));
+    itemLength_ = HISTORY_POINT_SIZE;
+    return;
+  }
+  char *p = reinterpret_cast<char *>(item_);
+  size_t n = putDecimal(p, point.timeMs);
+  p[n++] = ',';
+  n += putSigned(p + n, point.value);
+  p[n++] = '\n';
+  itemLength_ = n;
+}
+
+void HistoryStream::formatBucket(const HistoryBucket &bucket)
+{
+  if (format_ == HistoryFormat::Binary)
+  {
+    putU64(item_, bucket.startMs);
+    putU32(item_ + 8, static_cast<uint32_t>(bucket.min));
+    putU32(item_ + 12, static_cast<uint32_t>(bucket.max));
+    putU32(item_ + 16, static_cast<uint32_t>(bucket.avg));
+    putU32(item_ + 20, bucket.count);
+    itemLength_ = HISTORY_BUCKET_SIZE;
+    return;
+  }
+  char *p = reinterpret_cast<char *>(item_);
+  size_t n = putDecimal(p, bucket.startMs);
+  p[n++] = ',';
+  n += putSigned(p + n, bucket.min);
+  p[n++] = ',';
+  n += putSigned(p + n, bucket.max);
+  p[n++] = ',';
+  n += putSigned(p + n, bucket.avg);
+  p[n++] = ',';
+  n += putDecimal(p + n, bucket.count);
+  p[n++] = '\n';
+  itemLength_ = n;
+}
+
+bool HistoryStream::produce()
+{
+  if (!started_)
+  {
+    started_ = true;
+    if (format_ == HistoryFormat::Csv)
+    {
+      const char *header = bucketMs_ ? "time_ms,min_g,max_g,avg_g,count\n" : "time_ms,weight_g\n";
+      itemLength_ = std::strlen(header);
+      std::memcpy(item_, header, itemLength_);
+      return true;
+    }
+  }
+  if (finished_)
+  {
+    return false;
+  }
+  HistoryPoint point;
+  HistoryBucket bucket;
+  while (reader_.next(point))
+  {
+    if (bucketMs_ == 0)
+    {
+      formatPoint(point);
+      items_++;
+      return true;
+    }
+    if (downsampler_.add(point, bucket))
+    {
+      formatBucket(bucket);
+      items_++;
+      return true;
+    }
+  }
+  finished_ = true;
+  if (bucketMs_ != 0 && downsampler_.finish(bucket))
+  {
+    formatBucket(bucket);
+    items_++;
+    return true;
+  }
+  return false;
+}
+
+size_t HistoryStream::read(uint8_t *out, size_t size)
+{
+  size_t written = 0;
+  while (written < size)
+  {
+    if (itemPos_ == itemLength_)
+    {
+      if (!produce())
+      {
+        break;
+      }
+      itemPos_ = 0;
+    }
+    size_t chunk = itemLength_ - itemPos_;
+    chunk = chunk < size - written ? chunk : size - written;
+    std::memcpy(out + written, item_ + itemPos_, chunk);
+    itemPos_ += chunk;
+    written += chunk;
+  }
+  return written;
+}
@@ -0,0 +1,232 @@
+/**
+ * HistoryStore.h
+ *  Weight history kept on the device (LittleFS in the firmware, plain files in the native build).
+ *
+ *  The store is a ring of segments (files of at most segmentBytes). Points are only ever appended to the
+ *  newest segment; when it is full the oldest segment is erased and reused, so every segment is erased
+ *  equally often and nothing is rewritten in place (log-structured, wear-levelled by construction).
+ *
+ *  Segment layout, all fields little-endian:
+ *
+ *        offset  size  field
+ *          0      4    magic "WSH1"
+ *          4      4    segment sequence number (uint32, grows by one per new segment)
+ *          8      8    base time (uint64, milliseconds)
+ *         16      4    base value (int32, grams)
+ *         20      ...  records: varint(time - previous time), varint(zigzag(value - previous value))
+ *
+ *  A weight that did not change and a heartbeat every minute cost 2 to 4 bytes per point, so weeks of
+ *  change-driven history fit in a few hundred KB. A record torn by a power loss ends the segment, the
+ *  next point then starts a new segment.
+ *
+ * @note: The store is not thread-safe. The firmware appends and queries from the same task (Task5).
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct HistoryPoint
+{
+  uint64_t timeMs;
+  int32_t  value;
+};
+
+/**
+ * @brief min / max / average of the points of one time bucket (downsampled queries).
+ */
+struct HistoryBucket
+{
+  uint64_t startMs;
+  int32_t  min;
+  int32_t  max;
+  int32_t  avg;
+  uint32_t count;
+};
+
+/**
+ * @brief The flash behind the store: numbered segment files that can be appended to, read and erased.
+ */
+class HistoryStorage
+{
+public:
+  virtual ~HistoryStorage() {}
+  virtual uint32_t size(uint16_t segment) = 0;   // 0 if the segment does not exist
+  virtual size_t read(uint16_t segment, uint32_t offset, uint8_t *out, size_t length) = 0;
+  virtual bool append(uint16_t segment, const uint8_t *data, size_t length) = 0;
+  virtual bool erase(uint16_t segment) = 0;
+};
+
+struct HistoryConfig
+{
+  uint16_t segmentCount = 16;     // 16 x 16 KB = 256 KB of flash
+  uint32_t segmentBytes = 16384;
+};
+
+class HistoryStore
+{
+public:
+  static constexpr uint16_t maxSegments = 64;
+  static constexpr size_t headerSize = 20;
+  static constexpr size_t maxRecordSize = 10;
+  static constexpr size_t writeBufferSize = 128;   // points are written to flash in blocks of this size
+
+  explicit HistoryStore(HistoryStorage &storage, const HistoryConfig &config = HistoryConfig());
+
+  /**
+   * @brief Finds the newest segment and the last point in it (call once at boot).
+   * @return true if some history was found.
+   */
+  bool begin();
+
+  /**
+   * @brief Adds a point. Points older than the last one are refused.
+   * @details The point is kept in RAM until writeBufferSize bytes are collected or flush() is called.
+   */
+  bool append(uint64_t timeMs, int32_t value);
+
+  /**
+   * @brief Writes the buffered points to flash (before a query, and now and then against power loss).
+   */
+  bool flush();
+
+  HistoryStorage &storage() { return storage_; }
+  const HistoryConfig &config() const { return config_; }
+  uint32_t appendCount() const { return appended_; }
+  uint32_t segmentStarts() const { return segmentStarts_; }
+
+  /**
+   * @brief Reads the header of a segment.
+   * @return false if the segment is empty or not a history segment.
+   */
+  bool readHeader(uint16_t segment, uint32_t &seq, HistoryPoint &base);
+
+private:
+  bool startSegment(uint64_t timeMs, int32_t value);
+
+  HistoryStorage &storage_;
+  HistoryConfig config_;
+  bool open_ = false;          // the current segment can take more records
+  uint16_t current_ = 0;
+  uint32_t currentSeq_ = 0;
+  uint32_t currentSize_ = 0;   // bytes in flash plus bytes buffered
+  HistoryPoint last_ = {};
+  bool haveLast_ = false;
+  uint8_t buffer_[writeBufferSize];
+  size_t buffered_ = 0;
+  uint32_t appended_ = 0;
+  uint32_t segmentStarts_ = 0;
+};
+
+/**
+ * @brief Walks the points of a time range, oldest first, reading the flash in small blocks.
+ * @details Only sees what is in flash: call HistoryStore::flush() before creating a reader.
+ *          Segments that end before fromMs are skipped without being decoded.
+ */
+class HistoryReader
+{
+public:
+  HistoryReader(HistoryStore &store, uint64_t fromMs, uint64_t toMs);
+
+  bool next(HistoryPoint &out);
+
+  /**
+   * @brief true if the last segment read ended in a partial record (power loss while writing).
+   */
+  bool torn() const { return torn_; }
+
+private:
+  bool openSegment();
+  bool decode(HistoryPoint &out);
+
+  HistoryStorage &storage_;
+  uint64_t fromMs_;
+  uint64_t toMs_;
+  uint16_t order_[HistoryStore::maxSegments];   // segments, oldest first
+  size_t segmentCount_ = 0;
+  size_t nextSegment_ = 0;
+  bool open_ = false;
+  bool done_ = false;
+  bool emitBase_ = false;
+  bool torn_ = false;
+  // decoder state of the open segment
+  uint16_t segment_ = 0;
+  uint32_t fileSize_ = 0;
+  uint32_t fileOffset_ = 0;
+  uint8_t block_[256];
+  size_t blockLength_ = 0;
+  size_t blockPos_ = 0;
+  HistoryPoint point_ = {};
+};
+
+/**
+ * @brief Folds points into buckets of bucketMs (min / max / average per bucket).
+ */
+class HistoryDownsampler
+{
+public:
+  explicit HistoryDownsampler(uint32_t bucketMs) : bucketMs_(bucketMs ? bucketMs : 1) {}
+
+  /**
+   * @return true when the point closed the previous bucket, which is then copied to out.
+   */
+  bool add(const HistoryPoint &point, HistoryBucket &out);
+
+  /**
+   * @return true if a last, partly filled bucket was copied to out.
+   */
+  bool finish(HistoryBucket &out);
+
+private:
+  void close(HistoryBucket &out) const;
+
+  uint32_t bucketMs_;
+  uint64_t startMs_ = 0;
+  int64_t sum_ = 0;
+  int32_t min_ = 0;
+  int32_t max_ = 0;
+  uint32_t count_ = 0;
+};
+
+enum class HistoryFormat : uint8_t
+{
+  Csv,      // "time_ms,weight_g" or "time_ms,min_g,max_g,avg_g,count" lines with a header line
+  Binary,   // 12 byte points (uint64 time, int32 value) or 24 byte buckets (+ int32 max, avg, uint32 count)
+};
+
+#define HISTORY_POINT_SIZE    12
+#define HISTORY_BUCKET_SIZE   24
+
+/**
+ * @brief The body of a history query, produced piece by piece so it can be sent as HTTP chunks.
+ * @details bucketMs = 0 streams the points as stored, otherwise one bucket per bucketMs.
+ */
+class HistoryStream
+{
+public:
+  HistoryStream(HistoryStore &store, uint64_t fromMs, uint64_t toMs, uint32_t bucketMs, HistoryFormat format);
+
+  /**
+   * @brief Fills out with the next bytes of the body.
+   * @return the number of bytes written, 0 at the end.
+   */
+  size_t read(uint8_t *out, size_t size);
+
+  uint32_t itemCount() const { return items_; }
+
+private:
+  bool produce();
+  void formatPoint(const HistoryPoint &point);
+  void formatBucket(const HistoryBucket &bucket);
+
+  HistoryReader reader_;
+  HistoryDownsampler downsampler_;
+  uint32_t bucketMs_;
+  HistoryFormat format_;
+  bool started_ = false;
+  bool finished_ = false;
+  uint8_t item_[64];
+  size_t itemLength_ = 0;
+  size_t itemPos_ = 0;
+  uint32_t items_ = 0;
+};
@@ -0,0 +1,75 @@
+/**
+ * Hx711Acquisition.h
+ *  Interrupt driven acquisition engine for the HX711.
+ *  The HX711 pulls DOUT low when a new conversion is ready. The falling edge wakes the acquisition
+ *  task, which clocks the 24 bits out and hands them to this engine together with the time of the edge.
+ *  The engine stores every sample in a lock-free ring, so readers never wait for the load cell.
+ *
+ * @note: The engine does not know about pins or tasks. The firmware (main.cpp) feeds it from the real
+ *        HX711 and the native build feeds it from a simulated one.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "SampleRing.h"
+
+class Hx711Acquisition
+{
+public:
+  // 64 samples = 6.4 s at 10 SPS or 0.8 s at 80 SPS.
+  using Ring = SampleRing<RawSample, 64>;
+
+  /**
+   * @brief Converts the 24 data bits clocked out of the HX711 into a signed value.
+   */
+  static int32_t signExtend24(uint32_t bits)
+  {
+    bits &= 0x00FFFFFFu;
+    return (bits & 0x00800000u) ? static_cast<int32_t>(bits | 0xFF000000u) : static_cast<int32_t>(bits);
+  }
+
+  /**
+   * @brief Stores a new conversion (acquisition task only).
+   * @param raw: the signed ADC value.
+   * @param readyUs: the time of the DOUT falling edge, in microseconds.
+   */
+  void onSample(int32_t raw, uint32_t readyUs)
+  {
+    RawSample sample;
+    sample.raw = raw;
+    sample.timestampUs = readyUs;
+    sample.seq = ring_.head();
+    ring_.push(sample);
+  }
+
+  /**
+   * @brief Counts a data-ready edge that could not be read (the HX711 was not ready any more or a
+   *        newer conversion replaced it before the task got to run).
+   */
+  void onMissedSample() { missed_.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+   * @brief Gets the newest sample without blocking.
+   * @return false if no sample was acquired yet.
+   */
+  bool latest(RawSample &out) const { return ring_.latest(out); }
+
+  /**
+   * @brief Gets the newest sample if it is not older than maxAgeUs.
+   * @details Used by the readers to tell "scale not ready" apart from "weight did not change".
+   */
+  bool latestFresh(RawSample &out, uint32_t nowUs, uint32_t maxAgeUs) const
+  {
+    return ring_.latest(out) && (nowUs - out.timestampUs) <= maxAgeUs;
+  }
+
+  const Ring &samples() const { return ring_; }
+  uint32_t sampleCount() const { return ring_.head(); }
+  uint32_t missedCount() const { return missed_.load(std::memory_order_relaxed); }
+
+private:
+  Ring ring_;
+  std::atomic<uint32_t> missed_{0};
+};
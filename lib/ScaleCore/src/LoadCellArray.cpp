@@ -0,0 +1,258 @@
+/**
+ * LoadCellArray.cpp
+ *  See LoadCellArray.h.
+ */
+#include "LoadCellArray.h"
+
+#include <cmath>
+#include <cstring>
+
+//********************************************************************* FrameAligner
+
+void FrameAligner::setChannels(uint8_t channels)
+{
+  channels_ = channels < 1 ? 1 : (channels > LOAD_CELL_MAX_CHANNELS ? LOAD_CELL_MAX_CHANNELS : channels);
+  fullMask_ = static_cast<uint8_t>((1u << channels_) - 1u);
+  haveMask_ = 0;
+}
+
+void FrameAligner::close(CellFrame &out)
+{
+  out.seq = frames_++;
+  out.timestampUs = lastUs_;
+  out.skewUs = lastUs_ - firstUs_;
+  out.missingMask = static_cast<uint8_t>(fullMask_ & ~haveMask_);
+  std::memcpy(out.raw, raw_, sizeof(raw_));
+  haveMask_ = 0;
+}
+
+bool FrameAligner::onSample(uint8_t channel, int32_t raw, uint32_t readyUs, CellFrame &out)
+{
+  if (channel >= channels_)
+  {
+    return false;
+  }
+  const uint8_t bit = static_cast<uint8_t>(1u << channel);
+  if (haveMask_ & bit)
+  {
+    // this channel is a whole conversion ahead of another one: close the frame without waiting.
+    close(out);
+    partial_++;
+    haveMask_ = bit;
+    firstUs_ = lastUs_ = readyUs;
+    raw_[channel] = raw;
+    return true;
+  }
+  // the channels are not necessarily read in the order they became ready.
+  if (haveMask_ == 0)
+  {
+    firstUs_ = lastUs_ = readyUs;
+  }
+  else if (static_cast<int32_t>(readyUs - firstUs_) < 0)
+  {
+    firstUs_ = readyUs;
+  }
+  else if (static_cast<int32_t>(readyUs - lastUs_) > 0)
+  {
+    lastUs_ = readyUs;
+  }
+  raw_[channel] = raw;
+  haveMask_ |= bit;
+  if (haveMask_ != fullMask_)
+  {
+    return false;
+  }
+  close(out);
+  return true;
+}
+
+//********************************************************************* LoadCellArray
+
+void LoadCellArray::updateGain(uint8_t channel)
+{
+  gainQ16_[channel] = static_cast<int32_t>(std::lround(trim_[channel] * countsPerGram_[0] / countsPerGram_[channel] * 65536.0f));
+}
+
+void LoadCellArray::setCalibration(uint8_t channel, int32_t offset, float countsPerGram)
+{
+  if (channel >= channels_ || countsPerGram == 0.0f)
+  {
+    return;
+  }
+  offset_[channel] = offset;
+  countsPerGram_[channel] = countsPerGram;
+  // the gains are relative to channel 0: all of them change with it.
+  for (uint8_t i = 0; i < channels_; i++)
+  {
+    updateGain(i);
+  }
+}
+
+void LoadCellArray::setTrim(uint8_t channel, float trim)
+{
+  if (channel < channels_ && trim > 0.0f)
+  {
+    trim_[channel] = trim;
+    updateGain(channel);
+  }
+}
+
+void LoadCellArray::resetTrim()
+{
+  for (uint8_t i = 0; i < channels_; i++)
+  {
+    trim_[i] = 1.0f;
+    updateGain(i);
+  }
+}
+
+void LoadCellArray::shiftZero(int32_t counts)
+{
+  const int64_t scaled = static_cast<int64_t>(counts) * 65536;
+  const int64_t gain = gainQ16_[0] != 0 ? gainQ16_[0] : 65536;
+  offset_[0] += static_cast<int32_t>((scaled + (scaled >= 0 ? gain / 2 : -gain / 2)) / gain);
+}
+
+int32_t LoadCellArray::combine(const CellFrame &frame) const
+{
+  int64_t sum = 0;
+  for (uint8_t i = 0; i < channels_; i++)
+  {
+    sum += static_cast<int64_t>(frame.raw[i] - offset_[i]) * gainQ16_[i];
+  }
+  // round to the nearest count.
+  return static_cast<int32_t>((sum + (sum >= 0 ? 32768 : -32768)) / 65536);
+}
+
+int32_t LoadCellArray::channelMilligrams(const CellFrame &frame, uint8_t channel) const
+{
+  const int64_t counts = static_cast<int64_t>(frame.raw[channel] - offset_[channel]) * gainQ16_[channel] / 65536;
+  return static_cast<int32_t>(static_cast<float>(counts) * 1000.0f / countsPerGram_[0]);
+}
+
+bool LoadCellArray::centreOfGravity(const CellFrame &frame, int16_t &x, int16_t &y) const
+{
+  if (channels_ != 4)
+  {
+    return false;
+  }
+  int64_t w[4];
+  int64_t total = 0;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    w[i] = channelMilligrams(frame, i);
+    total += w[i];
+  }
+  if (total < 10000)   // less than 10 g on the platform
+  {
+    return false;
+  }
+  x = static_cast<int16_t>(((w[1] + w[2]) - (w[0] + w[3])) * 1000 / total);
+  y = static_cast<int16_t>(((w[2] + w[3]) - (w[0] + w[1])) * 1000 / total);
+  return true;
+}
+
+bool LoadCellArray::balanceCorners(const int32_t *offsetRemoved)
+{
+  // solve sum_i trim[i] * base[i] * reading[k][i] = target for every corner k (Gauss with partial pivoting).
+  const uint8_t n = channels_;
+  double m[LOAD_CELL_MAX_CHANNELS][LOAD_CELL_MAX_CHANNELS + 1];
+  double target = 0.0;
+  for (uint8_t k = 0; k < n; k++)
+  {
+    double total = 0.0;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      m[k][i] = static_cast<double>(offsetRemoved[k * LOAD_CELL_MAX_CHANNELS + i]) * countsPerGram_[0] /
+                countsPerGram_[i];
+      total += m[k][i];
+    }
+    target += total / n;   // the trimmed platform reads the average of the corners
+  }
+  for (uint8_t k = 0; k < n; k++)
+  {
+    m[k][n] = target;
+  }
+  for (uint8_t col = 0; col < n; col++)
+  {
+    uint8_t pivot = col;
+    for (uint8_t row = col + 1; row < n; row++)
+    {
+      if (std::fabs(m[row][col]) > std::fabs(m[pivot][col]))
+      {
+        pivot = row;
+      }
+    }
+    if (std::fabs(m[pivot][col]) < 1e-9 * std::fabs(target))
+    {
+      return false;
+    }
+    for (uint8_t j = 0; j <= n; j++)
+    {
+      const double swap = m[col][j];
+      m[col][j] = m[pivot][j];
+      m[pivot][j] = swap;
+    }
+    for (uint8_t row = 0; row < n; row++)
+    {
+      if (row != col)
+      {
+        const double factor = m[row][col] / m[col][col];
+        for (uint8_t j = col; j <= n; j++)
+        {
+          m[row][j] -= factor * m[col][j];
+        }
+      }
+    }
+  }
+  float trims[LOAD_CELL_MAX_CHANNELS];
+  for (uint8_t i = 0; i < n; i++)
+  {
+    trims[i] = static_cast<float>(m[i][n] / m[i][i]);
+    if (!(trims[i] > 0.5f && trims[i] < 2.0f))
+    {
+      return false;   // more than a factor 2 off: the corner test went wrong
+    }
+  }
+  for (uint8_t i = 0; i < n; i++)
+  {
+    trim_[i] = trims[i];
+    updateGain(i);
+  }
+  return true;
+}
+
+void TareAverager::start(uint8_t channels, uint8_t frames)
+{
+  channels_ = channels < 1 ? 1 : (channels > LOAD_CELL_MAX_CHANNELS ? LOAD_CELL_MAX_CHANNELS : channels);
+  target_ = frames < 1 ? 1 : frames;
+  count_ = 0;
+  for (int64_t &sum : sums_)
+  {
+    sum = 0;
+  }
+  active_ = true;
+}
+
+bool TareAverager::onFrame(const CellFrame &frame, int32_t *offsets)
+{
+  if (!active_ || frame.missingMask != 0)
+  {
+    return false;
+  }
+  for (uint8_t channel = 0; channel < channels_; channel++)
+  {
+    sums_[channel] += frame.raw[channel];
+  }
+  if (++count_ < target_)
+  {
+    return false;
+  }
+  for (uint8_t channel = 0; channel < channels_; channel++)
+  {
+    const int64_t sum = sums_[channel];
+    offsets[channel] = static_cast<int32_t>((sum + (sum >= 0 ? count_ / 2 : -(count_ / 2))) / count_);
+  }
+  active_ = false;
+  return true;
+}
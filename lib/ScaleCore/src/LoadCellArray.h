@@ -0,0 +1,167 @@
+/**
+ * LoadCellArray.h
+ *  Several load cells (one HX711 each) under one platform, combined into one weight signal.
+ *
+ *  Every HX711 converts on its own clock, so the conversions of the channels arrive at slightly different
+ *  times. FrameAligner groups them into frames with one conversion per channel (a "cycle"): a frame is
+ *  complete when every channel delivered a new conversion. If a channel delivers a second conversion
+ *  before the others caught up, the frame is closed anyway and the slow channel keeps its last value
+ *  (it is marked in missingMask).
+ *
+ *  LoadCellArray removes the offset (tare) of each channel and scales every channel to the counts per gram
+ *  of channel 0, so the combined signal looks like one big load cell to the filter chain:
+ *
+ *      combined = sum over i of (raw[i] - offset[i]) * gain[i],   gain[i] = trim[i] * countsPerGram[0] / countsPerGram[i]
+ *
+ *  With one channel this is raw - offset, as before. trim[i] is 1 for a plain sum and is set by
+ *  balanceCorners() for a corner-balanced platform (the same weight reads the same on every corner).
+ *
+ * @note: Channel numbers of a 4 cell platform, seen from the front: 0 front-left, 1 front-right,
+ *        2 back-right, 3 back-left (used by centreOfGravity()).
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define LOAD_CELL_MAX_CHANNELS 8
+
+/**
+ * @brief One conversion of every channel.
+ */
+struct CellFrame
+{
+  uint32_t seq;           // frame number, starts at 0
+  uint32_t timestampUs;   // data-ready time of the newest conversion in the frame
+  uint32_t skewUs;        // newest minus oldest data-ready time in the frame
+  uint8_t  missingMask;   // bit i set: channel i had no new conversion, raw[i] is its previous value
+  int32_t  raw[LOAD_CELL_MAX_CHANNELS];
+};
+
+class FrameAligner
+{
+public:
+  explicit FrameAligner(uint8_t channels = 1) { setChannels(channels); }
+
+  void setChannels(uint8_t channels);
+  uint8_t channels() const { return channels_; }
+
+  /**
+   * @brief Adds a conversion of one channel.
+   * @param readyUs: the time the channel pulled DOUT low.
+   * @return true if a frame was completed (copied to out).
+   */
+  bool onSample(uint8_t channel, int32_t raw, uint32_t readyUs, CellFrame &out);
+
+  uint32_t frameCount() const { return frames_; }
+  uint32_t partialCount() const { return partial_; }
+
+private:
+  void close(CellFrame &out);
+
+  uint8_t channels_ = 1;
+  uint8_t fullMask_ = 1;
+  uint8_t haveMask_ = 0;
+  uint32_t firstUs_ = 0;
+  uint32_t lastUs_ = 0;
+  int32_t raw_[LOAD_CELL_MAX_CHANNELS] = {};
+  uint32_t frames_ = 0;
+  uint32_t partial_ = 0;
+};
+
+class LoadCellArray
+{
+public:
+  explicit LoadCellArray(uint8_t channels = 1)
+      : channels_(channels < 1 ? 1 : (channels > LOAD_CELL_MAX_CHANNELS ? LOAD_CELL_MAX_CHANNELS : channels))
+  {
+  }
+
+  uint8_t channels() const { return channels_; }
+
+  /**
+   * @param countsPerGram: the calibration factor of the channel (raw counts per gram, may be negative).
+   */
+  void setCalibration(uint8_t channel, int32_t offset, float countsPerGram);
+  void setOffset(uint8_t channel, int32_t offset) { offset_[channel] = offset; }
+  int32_t offset(uint8_t channel) const { return offset_[channel]; }
+  /**
+   * @brief Moves the zero of the combined signal: counts (of the combined signal) are added to the offset
+   *        of channel 0 (a calibration that found the empty platform at counts instead of 0).
+   */
+  void shiftZero(int32_t counts);
+
+  /**
+   * @brief The unit of the combined signal: counts per gram of channel 0.
+   */
+  float countsPerGram() const { return countsPerGram_[0]; }
+
+  /**
+   * @brief Sum of the channels without offset, in counts of channel 0.
+   */
+  int32_t combine(const CellFrame &frame) const;
+
+  /**
+   * @brief Weight on one channel in milligrams (trim included).
+   */
+  int32_t channelMilligrams(const CellFrame &frame, uint8_t channel) const;
+
+  /**
+   * @brief Where the load is on a 4 cell platform: x (left -1000 .. right 1000) and y (front -1000 .. back 1000).
+   * @return false if there are not 4 channels or the platform is (nearly) empty.
+   */
+  bool centreOfGravity(const CellFrame &frame, int16_t &x, int16_t &y) const;
+
+  /**
+   * @brief Computes the corner trims from a corner test: the same weight put on corner k (k = 0..channels-1) in turn.
+   * @param offsetRemoved: offsetRemoved[k * LOAD_CELL_MAX_CHANNELS + i] is (raw - offset) of channel i with the
+   *        weight on corner k.
+   * @return false if the readings do not allow a solution (a channel that never saw the weight).
+   */
+  bool balanceCorners(const int32_t *offsetRemoved);
+
+  /**
+   * @brief Sets the trim of one channel directly (e.g. trims computed once by balanceCorners() and kept).
+   */
+  void setTrim(uint8_t channel, float trim);
+  void resetTrim();
+  float trim(uint8_t channel) const { return trim_[channel]; }
+
+private:
+  void updateGain(uint8_t channel);
+
+  uint8_t channels_;
+  int32_t offset_[LOAD_CELL_MAX_CHANNELS] = {};
+  float countsPerGram_[LOAD_CELL_MAX_CHANNELS] = {1, 1, 1, 1, 1, 1, 1, 1};
+  float trim_[LOAD_CELL_MAX_CHANNELS] = {1, 1, 1, 1, 1, 1, 1, 1};
+  int32_t gainQ16_[LOAD_CELL_MAX_CHANNELS] = {65536, 65536, 65536, 65536, 65536, 65536, 65536, 65536};
+};
+
+/**
+ * @brief Tare without blocking: averages the raw values of the next frames, channel by channel, while the
+ *        acquisition keeps running. The averages are the new offsets (what HX711::tare() did, but without
+ *        holding the HX711s for the whole averaging window).
+ */
+class TareAverager
+{
+public:
+  /**
+   * @param frames: how many complete frames are averaged (10 = HX711::tare()).
+   */
+  void start(uint8_t channels, uint8_t frames);
+  void cancel() { active_ = false; }
+  bool active() const { return active_; }
+
+  /**
+   * @brief Adds a frame (frames with a missing channel are skipped).
+   * @return true when the average is complete: offsets holds the new offset of every channel.
+   */
+  bool onFrame(const CellFrame &frame, int32_t *offsets);
+
+private:
+  bool active_ = false;
+  uint8_t channels_ = 1;
+  uint8_t target_ = 0;
+  uint8_t count_ = 0;
+  int64_t sums_[LOAD_CELL_MAX_CHANNELS] = {};
+};
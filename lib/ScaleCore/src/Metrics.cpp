@@ -0,0 +1,420 @@
+/**
+ * Metrics.cpp
+ *  See Metrics.h.
+ */
+#include "Metrics.h"
+
+#include <cstring>
+
+namespace
+{
+
+void writeLe16(uint8_t *out, uint16_t value)
+{
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void writeLe32(uint8_t *out, uint32_t value)
+{
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+uint16_t saturate16(uint32_t value) { return value > 0xFFFFu ? 0xFFFFu : static_cast<uint16_t>(value); }
+
+// appends text to a line buffer (the lines are short, the buffer is sized for the longest one).
+class LineWriter
+{
+public:
+  LineWriter(char *line, size_t size) : line_(line), size_(size) {}
+
+  void put(const char *text)
+  {
+    while (*text != '\0' && length_ < size_)
+    {
+      line_[length_++] = *text++;
+    }
+  }
+
+  void putUnsigned(uint64_t value, uint8_t minDigits = 1)
+  {
+    char digits[20];
+    uint8_t count = 0;
+    do
+    {
+      digits[count++] = static_cast<char>('0' + value % 10u);
+      value /= 10u;
+    } while (value != 0 || count < minDigits);
+    while (count > 0 && length_ < size_)
+    {
+      line_[length_++] = digits[--count];
+    }
+  }
+
+  // value / 10^decimals with all the decimals, e.g. putFixed(1234, 6) = "0.001234".
+  void putFixed(uint64_t value, uint8_t decimals)
+  {
+    uint64_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+      scale *= 10u;
+    }
+    putUnsigned(value / scale);
+    put(".");
+    putUnsigned(value % scale, decimals);
+  }
+
+  size_t length() const { return length_; }
+
+private:
+  char *line_;
+  size_t size_;
+  size_t length_ = 0;
+};
+
+enum class FamilyKind : uint8_t
+{
+  StageHistogram,
+  LockHistogram,
+  Samples,
+  Dropped,
+  SampleRate,
+  Clients,
+  HeapFree,
+  HeapLargest,
+  HeapAllocations,
+  Uptime,
+  Boot
+};
+
+struct Family
+{
+  FamilyKind kind;
+  const char *name;
+  const char *type;
+  const char *help;
+};
+
+const Family families[] = {
+  {FamilyKind::StageHistogram, "scale_stage_latency_seconds", "histogram", "Time spent in a hot path stage."},
+  {FamilyKind::LockHistogram, "scale_lock_wait_seconds", "histogram", "Time a task waited for the hardware mutex."},
+  {FamilyKind::Samples, "scale_samples_total", "counter", "Samples acquired from the load cells."},
+  {FamilyKind::Dropped, "scale_samples_dropped_total", "counter", "Conversions that could not be read."},
+  {FamilyKind::SampleRate, "scale_sample_rate_hz", "gauge", "Samples per second over the last second."},
+  {FamilyKind::Clients, "scale_websocket_clients", "gauge", "Connected web socket clients."},
+  {FamilyKind::HeapFree, "scale_heap_free_bytes", "gauge", "Free heap."},
+  {FamilyKind::HeapLargest, "scale_heap_largest_free_block_bytes", "gauge", "Largest free heap block."},
+  {FamilyKind::HeapAllocations, "scale_heap_allocations_after_boot_total", "counter",
+   "Heap allocations after setup() (HEAP_AFTER_BOOT builds only, 0 otherwise)."},
+  {FamilyKind::Uptime, "scale_uptime_seconds", "gauge", "Time since boot."},
+  {FamilyKind::Boot, "scale_boot_stage_seconds", "gauge", "When a startup stage was reached, since reset."},
+};
+const uint8_t familyCount = sizeof(families) / sizeof(families[0]);
+
+bool isHistogram(FamilyKind kind) { return kind == FamilyKind::StageHistogram || kind == FamilyKind::LockHistogram; }
+
+}  // namespace
+
+//********************************************************************* LatencyHistogram
+
+uint32_t HistogramSnapshot::quantileUs(float q) const
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  const uint32_t rank = static_cast<uint32_t>(q * static_cast<float>(count - 1)) + 1;
+  uint32_t seen = 0;
+  for (uint8_t bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+  {
+    seen += buckets[bucket];
+    if (seen >= rank)
+    {
+      const uint32_t bound = LatencyHistogram::boundUs(bucket);
+      return bound != 0 && bound < maxUs ? bound : maxUs;
+    }
+  }
+  return maxUs;
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const
+{
+  HistogramSnapshot copy;
+  for (;;)
+  {
+    const uint32_t before = seq_.load(std::memory_order_acquire);
+    for (uint8_t bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+    {
+      copy.buckets[bucket] = buckets_[bucket].load(std::memory_order_relaxed);
+    }
+    copy.count = count_.load(std::memory_order_relaxed);
+    copy.sumUs = (static_cast<uint64_t>(sumHigh_.load(std::memory_order_relaxed)) << 32) |
+                 sumLow_.load(std::memory_order_relaxed);
+    copy.maxUs = max_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((before & 1u) == 0 && seq_.load(std::memory_order_relaxed) == before)
+    {
+      return copy;
+    }
+  }
+}
+
+//********************************************************************* names and frame
+
+const char *metricStageName(MetricStage stage)
+{
+  switch (stage)
+  {
+  case MetricStage::SampleRead:
+    return "sample_read";
+  case MetricStage::Filter:
+    return "filter";
+  case MetricStage::Display:
+    return "display";
+  case MetricStage::Broadcast:
+    return "broadcast";
+  case MetricStage::Uplink:
+    return "uplink";
+  case MetricStage::Command:
+    return "command";
+  default:
+    return "?";
+  }
+}
+
+const char *lockUserName(LockUser user)
+{
+  switch (user)
+  {
+  case LockUser::Acquisition:
+    return "acquisition";
+  case LockUser::Display:
+    return "display";
+  case LockUser::Tare:
+    return "tare";
+  default:
+    return "?";
+  }
+}
+
+const char *bootStageName(BootStage stage)
+{
+  switch (stage)
+  {
+  case BootStage::Display:
+    return "display";
+  case BootStage::LoadCells:
+    return "load_cells";
+  case BootStage::Tasks:
+    return "tasks";
+  case BootStage::FirstWeight:
+    return "first_weight";
+  case BootStage::WifiUp:
+    return "wifi";
+  case BootStage::WebServer:
+    return "web_server";
+  case BootStage::CloudUp:
+    return "cloud";
+  default:
+    return "?";
+  }
+}
+
+size_t encodeMetricsFrame(const Metrics &metrics, uint32_t uptimeS, uint8_t *buffer, size_t size)
+{
+  if (size < METRICS_FRAME_SIZE)
+  {
+    return 0;
+  }
+  buffer[0] = TELEMETRY_MAGIC;
+  buffer[1] = TELEMETRY_FRAME_METRICS;
+  buffer[2] = METRICS_HISTOGRAMS;
+  buffer[3] = 0;
+  writeLe32(buffer + 4, uptimeS);
+  writeLe32(buffer + 8, metrics.samples());
+  writeLe32(buffer + 12, metrics.dropped());
+  writeLe32(buffer + 16, metrics.sampleRateMilliHz());
+  writeLe32(buffer + 20, metrics.heapFree());
+  writeLe32(buffer + 24, metrics.heapLargest());
+  writeLe32(buffer + 28, metrics.clients());
+  uint8_t *out = buffer + 32;
+  for (uint8_t i = 0; i < METRICS_HISTOGRAMS; i++)
+  {
+    const uint8_t stages = static_cast<uint8_t>(MetricStage::Count);
+    const HistogramSnapshot s = i < stages ? metrics.stage(static_cast<MetricStage>(i)).snapshot()
+                                           : metrics.lockWait(static_cast<LockUser>(i - stages)).snapshot();
+    writeLe32(out, s.count);
+    writeLe16(out + 4, saturate16(s.quantileUs(0.5f)));
+    writeLe16(out + 6, saturate16(s.quantileUs(0.99f)));
+    writeLe32(out + 8, s.maxUs);
+    out += 12;
+  }
+  std::memset(out, 0, static_cast<size_t>(buffer + METRICS_FRAME_SIZE - out));
+  return METRICS_FRAME_SIZE;
+}
+
+//********************************************************************* MetricsExporter
+
+bool MetricsExporter::nextLine()
+{
+  if (family_ >= familyCount)
+  {
+    return false;
+  }
+  const Family &family = families[family_];
+  LineWriter line(line_, sizeof(line_));
+  if (item_ < 2)
+  {
+    line.put(item_ == 0 ? "# HELP " : "# TYPE ");
+    line.put(family.name);
+    line.put(" ");
+    line.put(item_ == 0 ? family.help : family.type);
+    item_++;
+  }
+  else if (isHistogram(family.kind))
+  {
+    const bool stages = family.kind == FamilyKind::StageHistogram;
+    const char *label = stages ? "stage" : "task";
+    const char *value = stages ? metricStageName(static_cast<MetricStage>(series_))
+                               : lockUserName(static_cast<LockUser>(series_));
+    const uint8_t part = static_cast<uint8_t>(item_ - 2);   // 0..BUCKETS-1 buckets, then sum and count
+    if (part == 0)
+    {
+      snapshot_ = stages ? metrics_.stage(static_cast<MetricStage>(series_)).snapshot()
+                         : metrics_.lockWait(static_cast<LockUser>(series_)).snapshot();
+    }
+    line.put(family.name);
+    line.put(part < METRICS_BUCKETS ? "_bucket{" : (part == METRICS_BUCKETS ? "_sum{" : "_count{"));
+    line.put(label);
+    line.put("=\"");
+    line.put(value);
+    line.put("\"");
+    if (part < METRICS_BUCKETS)
+    {
+      uint32_t cumulative = 0;
+      for (uint8_t bucket = 0; bucket <= part; bucket++)
+      {
+        cumulative += snapshot_.buckets[bucket];
+      }
+      line.put(",le=\"");
+      if (LatencyHistogram::boundUs(part) != 0)
+      {
+        line.putFixed(LatencyHistogram::boundUs(part), 6);
+      }
+      else
+      {
+        line.put("+Inf");
+      }
+      line.put("\"} ");
+      line.putUnsigned(cumulative);
+    }
+    else if (part == METRICS_BUCKETS)
+    {
+      line.put("} ");
+      line.putFixed(snapshot_.sumUs, 6);
+    }
+    else
+    {
+      line.put("} ");
+      line.putUnsigned(snapshot_.count);
+    }
+    item_++;
+    if (part == METRICS_BUCKETS + 1)
+    {
+      item_ = 2;
+      series_++;
+      const uint8_t seriesCount = stages ? static_cast<uint8_t>(MetricStage::Count)
+                                         : static_cast<uint8_t>(LockUser::Count);
+      if (series_ >= seriesCount)
+      {
+        series_ = 0;
+        item_ = 0;
+        family_++;
+      }
+    }
+  }
+  else if (family.kind == FamilyKind::Boot)
+  {
+    // one series per stage reached so far.
+    const uint8_t stages = static_cast<uint8_t>(BootStage::Count);
+    while (series_ < stages && metrics_.bootMs(static_cast<BootStage>(series_)) == 0)
+    {
+      series_++;
+    }
+    if (series_ >= stages)
+    {
+      series_ = 0;
+      item_ = 0;
+      family_++;
+      return nextLine();
+    }
+    line.put(family.name);
+    line.put("{stage=\"");
+    line.put(bootStageName(static_cast<BootStage>(series_)));
+    line.put("\"} ");
+    line.putFixed(metrics_.bootMs(static_cast<BootStage>(series_)), 3);
+    series_++;
+  }
+  else
+  {
+    line.put(family.name);
+    line.put(" ");
+    switch (family.kind)
+    {
+    case FamilyKind::Samples:
+      line.putUnsigned(metrics_.samples());
+      break;
+    case FamilyKind::Dropped:
+      line.putUnsigned(metrics_.dropped());
+      break;
+    case FamilyKind::SampleRate:
+      line.putFixed(metrics_.sampleRateMilliHz(), 3);
+      break;
+    case FamilyKind::Clients:
+      line.putUnsigned(metrics_.clients());
+      break;
+    case FamilyKind::HeapFree:
+      line.putUnsigned(metrics_.heapFree());
+      break;
+    case FamilyKind::HeapLargest:
+      line.putUnsigned(metrics_.heapLargest());
+      break;
+    case FamilyKind::HeapAllocations:
+      line.putUnsigned(metrics_.heapAllocations());
+      break;
+    default:
+      line.putUnsigned(uptimeS_);
+      break;
+    }
+    item_ = 0;
+    family_++;
+  }
+  line.put("\n");
+  lineLength_ = line.length();
+  linePos_ = 0;
+  return true;
+}
+
+size_t MetricsExporter::read(char *buffer, size_t size)
+{
+  size_t written = 0;
+  while (written < size)
+  {
+    if (linePos_ == lineLength_ && !nextLine())
+    {
+      break;
+    }
+    size_t n = lineLength_ - linePos_;
+    if (n > size - written)
+    {
+      n = size - written;
+    }
+    std::memcpy(buffer + written, line_ + linePos_, n);
+    linePos_ += n;
+    written += n;
+  }
+  return written;
+}
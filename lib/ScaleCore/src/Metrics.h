@@ -0,0 +1,275 @@
+/**
+ * Metrics.h
+ *  Runtime metrics of the firmware: latency histograms of the hot path stages (sample read, filter,
+ *  display, broadcast, cloud uplink, commands), wait times on the hardware mutex per task, the sample counters,
+ *  a few gauges (sample rate, web clients, heap) and the boot timeline (when each stage of the startup
+ *  was reached, see BootStage).
+ *
+ *  Every histogram and counter has ONE writer, the task that owns the stage (the mutex waits are
+ *  counted per waiting task for that reason). Recording is a handful of relaxed stores, no lock and
+ *  no read-modify-write; each histogram carries a sequence word so a reader gets a consistent copy
+ *  (the same seqlock idea as SampleRing). Any task can read them for a report.
+ *
+ *  Histogram buckets are powers of two in microseconds: <= 4, 8, 16, ... 32768 us and +Inf.
+ *
+ *  Two exports:
+ *    - Prometheus text format (MetricsExporter), streamed in chunks like the history: GET /metrics.
+ *    - a compact binary WebSocket frame (encodeMetricsFrame()), METRICS_FRAME_SIZE bytes, little-endian:
+ *
+ *        offset  size  field
+ *          0      1    magic 'W' (0x57, like the weight frame, see Telemetry.h)
+ *          1      1    frame type (TELEMETRY_FRAME_METRICS)
+ *          2      1    number of histograms (METRICS_HISTOGRAMS)
+ *          3      1    reserved (0)
+ *          4      4    uptime (uint32, seconds)
+ *          8      4    samples (uint32, total)
+ *         12      4    dropped samples (uint32, total)
+ *         16      4    sample rate (uint32, millihertz)
+ *         20      4    free heap (uint32, bytes)
+ *         24      4    largest free heap block (uint32, bytes)
+ *         28      4    web clients (uint32)
+ *         32     12    per histogram (stages first, then the mutex waits):
+ *                        count (uint32), p50 (uint16, us), p99 (uint16, us), max (uint32, us)
+ *                      p50 and p99 are bucket upper bounds (at most max), saturated at 65535.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "Telemetry.h"
+
+#define METRICS_BUCKETS          15     // 4 us .. 32768 us and +Inf
+#define METRICS_FIRST_BOUND_US   4
+#define METRICS_FRAME_SIZE       144
+
+enum class MetricStage : uint8_t
+{
+  SampleRead,   // clocking one conversion out of a HX711 (Task1)
+  Filter,       // filter chain, conversion and publishing of the state (Task1)
+  Display,      // writing the 7-segment display (Task2)
+  Broadcast,    // encoding and sending the weight to the web clients (Task3)
+  Uplink,       // Blynk / uplink queue service (Task4)
+  Command,      // decoding and queuing a command of a web client (Task5)
+  Count
+};
+
+enum class LockUser : uint8_t
+{
+  Acquisition,  // Task1 reading the HX711s
+  Display,      // Task2 writing the display
+  Tare,         // Task5 reading the offsets to store them (the commands themselves run in Task1)
+  Count
+};
+
+// the boot timeline, in the order the stages are normally reached. The network stages come in the background,
+// in any order after Tasks (they are not reached at all without a network).
+enum class BootStage : uint8_t
+{
+  Display,      // display initialized, shows "----" (setup())
+  LoadCells,    // HX711s set up, offsets from NVS or tared (setup())
+  Tasks,        // tasks created, acquisition running (end of setup())
+  FirstWeight,  // first stable weight (Task1)
+  WifiUp,       // WiFi connected for the first time
+  WebServer,    // HTTP server and web socket listening
+  CloudUp,      // cloud connected for the first time
+  Count
+};
+
+#define METRICS_HISTOGRAMS (static_cast<uint8_t>(MetricStage::Count) + static_cast<uint8_t>(LockUser::Count))
+static_assert(32 + 12 * METRICS_HISTOGRAMS <= METRICS_FRAME_SIZE, "the histograms do not fit in the metrics frame");
+
+/**
+ * @brief A consistent copy of a histogram.
+ */
+struct HistogramSnapshot
+{
+  uint32_t buckets[METRICS_BUCKETS];   // not cumulative
+  uint32_t count;
+  uint64_t sumUs;
+  uint32_t maxUs;
+
+  /**
+   * @brief Upper bound of the bucket that holds the given fraction (0..1) of the values, at most maxUs.
+   */
+  uint32_t quantileUs(float q) const;
+};
+
+class LatencyHistogram
+{
+public:
+  static uint8_t bucketOf(uint32_t us)
+  {
+    if (us <= METRICS_FIRST_BOUND_US)
+    {
+      return 0;
+    }
+    const uint8_t bucket = static_cast<uint8_t>(32 - __builtin_clz(us - 1) - 2);
+    return bucket < METRICS_BUCKETS - 1 ? bucket : METRICS_BUCKETS - 1;
+  }
+
+  /**
+   * @brief Upper bound of a bucket in microseconds (the last bucket has none: 0).
+   */
+  static uint32_t boundUs(uint8_t bucket) { return bucket < METRICS_BUCKETS - 1 ? METRICS_FIRST_BOUND_US << bucket : 0; }
+
+  /**
+   * @brief Records one value (the owning task only).
+   */
+  void record(uint32_t us)
+  {
+    const uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);   // odd: writing
+    std::atomic_thread_fence(std::memory_order_release);
+    std::atomic<uint32_t> &bucket = buckets_[bucketOf(us)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    const uint32_t low = sumLow_.load(std::memory_order_relaxed) + us;
+    if (low < us)
+    {
+      sumHigh_.store(sumHigh_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    sumLow_.store(low, std::memory_order_relaxed);
+    if (us > max_.load(std::memory_order_relaxed))
+    {
+      max_.store(us, std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Copies the histogram (any task).
+   * @details Retries until no record() ran during the copy, so the copy is always consistent. A reader that
+   *          preempts the writer in the middle of record() spins until the writer ran again: the readers
+   *          (Task5, /metrics) run below the recorders or on the other core.
+   */
+  HistogramSnapshot snapshot() const;
+
+private:
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<uint32_t> buckets_[METRICS_BUCKETS] = {};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> sumLow_{0};
+  std::atomic<uint32_t> sumHigh_{0};
+  std::atomic<uint32_t> max_{0};
+};
+
+class Metrics
+{
+public:
+  LatencyHistogram &stage(MetricStage stage) { return stages_[static_cast<uint8_t>(stage)]; }
+  const LatencyHistogram &stage(MetricStage stage) const { return stages_[static_cast<uint8_t>(stage)]; }
+  LatencyHistogram &lockWait(LockUser user) { return locks_[static_cast<uint8_t>(user)]; }
+  const LatencyHistogram &lockWait(LockUser user) const { return locks_[static_cast<uint8_t>(user)]; }
+
+  /**
+   * @brief Counts a sample and updates the sample rate once per second (acquisition task only).
+   */
+  void onSample(uint32_t nowUs)
+  {
+    const uint32_t samples = samples_.load(std::memory_order_relaxed) + 1;
+    samples_.store(samples, std::memory_order_relaxed);
+    const uint32_t elapsedUs = nowUs - rateStartUs_;
+    if (elapsedUs >= 1000000u)
+    {
+      rateMilliHz_.store(static_cast<uint32_t>(static_cast<uint64_t>(samples - rateStartSamples_) * 1000000000ull /
+                                               elapsedUs),
+                         std::memory_order_relaxed);
+      rateStartUs_ = nowUs;
+      rateStartSamples_ = samples;
+    }
+  }
+
+  /**
+   * @brief Counts a conversion that was lost (acquisition task only).
+   */
+  void onDroppedSample() { dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+  // gauges: the last value set wins (any task).
+  void setClients(uint32_t clients) { clients_.store(clients, std::memory_order_relaxed); }
+  void setHeap(uint32_t freeBytes, uint32_t largestBlock)
+  {
+    heapFree_.store(freeBytes, std::memory_order_relaxed);
+    heapLargest_.store(largestBlock, std::memory_order_relaxed);
+  }
+  void setHeapAllocations(uint32_t allocations) { heapAllocations_.store(allocations, std::memory_order_relaxed); }
+
+  /**
+   * @brief Records when a boot stage was reached (milliseconds since reset). Only the first time counts.
+   */
+  void markBoot(BootStage stage, uint32_t ms)
+  {
+    std::atomic<uint32_t> &mark = boot_[static_cast<uint8_t>(stage)];
+    if (mark.load(std::memory_order_relaxed) == 0)
+    {
+      mark.store(ms != 0 ? ms : 1, std::memory_order_relaxed);   // 0 means not reached
+    }
+  }
+  /**
+   * @brief When a boot stage was reached (milliseconds since reset), 0 if not yet.
+   */
+  uint32_t bootMs(BootStage stage) const { return boot_[static_cast<uint8_t>(stage)].load(std::memory_order_relaxed); }
+
+  uint32_t samples() const { return samples_.load(std::memory_order_relaxed); }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  uint32_t sampleRateMilliHz() const { return rateMilliHz_.load(std::memory_order_relaxed); }
+  uint32_t clients() const { return clients_.load(std::memory_order_relaxed); }
+  uint32_t heapFree() const { return heapFree_.load(std::memory_order_relaxed); }
+  uint32_t heapLargest() const { return heapLargest_.load(std::memory_order_relaxed); }
+  uint32_t heapAllocations() const { return heapAllocations_.load(std::memory_order_relaxed); }
+
+private:
+  LatencyHistogram stages_[static_cast<uint8_t>(MetricStage::Count)];
+  LatencyHistogram locks_[static_cast<uint8_t>(LockUser::Count)];
+  std::atomic<uint32_t> samples_{0};
+  std::atomic<uint32_t> dropped_{0};
+  std::atomic<uint32_t> rateMilliHz_{0};
+  uint32_t rateStartUs_ = 0;
+  uint32_t rateStartSamples_ = 0;
+  std::atomic<uint32_t> clients_{0};
+  std::atomic<uint32_t> heapFree_{0};
+  std::atomic<uint32_t> heapLargest_{0};
+  std::atomic<uint32_t> heapAllocations_{0};   // after setup() (HEAP_AFTER_BOOT builds)
+  std::atomic<uint32_t> boot_[static_cast<uint8_t>(BootStage::Count)] = {};
+};
+
+const char *metricStageName(MetricStage stage);
+const char *lockUserName(LockUser user);
+const char *bootStageName(BootStage stage);
+
+/**
+ * @brief Writes the metrics frame (METRICS_FRAME_SIZE bytes, see the layout above).
+ * @return METRICS_FRAME_SIZE, 0 if the buffer is too small.
+ */
+size_t encodeMetricsFrame(const Metrics &metrics, uint32_t uptimeS, uint8_t *buffer, size_t size);
+
+/**
+ * @brief The metrics in the Prometheus text format, produced in pieces of any size (e.g. HTTP chunks).
+ * @details Every histogram is copied when its first line is written, so its buckets, sum and count agree.
+ *          The output is a few KB; it is never held in memory as a whole.
+ */
+class MetricsExporter
+{
+public:
+  MetricsExporter(const Metrics &metrics, uint32_t uptimeS) : metrics_(metrics), uptimeS_(uptimeS) {}
+
+  /**
+   * @brief Fills buffer with the next part of the text.
+   * @return the number of bytes written, 0 at the end.
+   */
+  size_t read(char *buffer, size_t size);
+
+private:
+  bool nextLine();
+
+  const Metrics &metrics_;
+  uint32_t uptimeS_;
+  uint8_t family_ = 0;
+  uint8_t series_ = 0;
+  uint8_t item_ = 0;
+  HistogramSnapshot snapshot_ = {};
+  char line_[160];
+  size_t lineLength_ = 0;
+  size_t linePos_ = 0;
+};
@@ -0,0 +1,677 @@
+/**
+ * Mqtt.cpp
+ *  See Mqtt.h.
+ */
+#include "Mqtt.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define MQTT_TOPIC_MAX  64
+
+namespace
+{
+
+const uint8_t BINARY_MAGIC = 0x55;
+
+// the remaining length of a packet: 7 bits per byte, the high bit says another byte follows.
+size_t writeRemainingLength(uint32_t length, uint8_t *out)
+{
+  size_t count = 0;
+  do
+  {
+    uint8_t byte = static_cast<uint8_t>(length & 0x7F);
+    length >>= 7;
+    out[count++] = static_cast<uint8_t>(byte | (length != 0 ? 0x80 : 0));
+  } while (length != 0);
+  return count;
+}
+
+size_t remainingLengthSize(uint32_t length)
+{
+  return length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+}
+
+// a UTF-8 string of MQTT: 2 bytes length (big-endian), the characters.
+size_t writeString(const char *text, uint8_t *out)
+{
+  const size_t length = std::strlen(text);
+  out[0] = static_cast<uint8_t>(length >> 8);
+  out[1] = static_cast<uint8_t>(length);
+  std::memcpy(out + 2, text, length);
+  return 2 + length;
+}
+
+size_t stringSize(const char *text) { return text ? 2 + std::strlen(text) : 0; }
+
+// writes the fixed header, returns its length or 0 if the packet does not fit.
+size_t writeHeader(uint8_t first, uint32_t remaining, uint8_t *buffer, size_t size)
+{
+  if (1 + remainingLengthSize(remaining) + remaining > size)
+  {
+    return 0;
+  }
+  buffer[0] = first;
+  return 1 + writeRemainingLength(remaining, buffer + 1);
+}
+
+size_t writeVarint(uint32_t value, uint8_t *out)
+{
+  size_t count = 0;
+  while (value >= 0x80)
+  {
+    out[count++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[count++] = static_cast<uint8_t>(value);
+  return count;
+}
+
+bool readVarint(const uint8_t *in, size_t length, size_t &at, uint32_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7)
+  {
+    if (at >= length)
+    {
+      return false;
+    }
+    const uint8_t byte = in[at++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// small values of either sign stay short: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+uint32_t zigzag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+size_t writeDecimal(int64_t value, char *out)
+{
+  char digits[20];
+  size_t count = 0;
+  const bool negative = value < 0;
+  uint64_t magnitude = negative ? static_cast<uint64_t>(-value) : static_cast<uint64_t>(value);
+  do
+  {
+    digits[count++] = static_cast<char>('0' + magnitude % 10u);
+    magnitude /= 10u;
+  } while (magnitude != 0);
+  size_t length = 0;
+  if (negative)
+  {
+    out[length++] = '-';
+  }
+  while (count > 0)
+  {
+    out[length++] = digits[--count];
+  }
+  return length;
+}
+
+bool readDecimal(const uint8_t *in, size_t length, size_t &at, int64_t &value)
+{
+  const bool negative = at < length && in[at] == '-';
+  at += negative ? 1 : 0;
+  const size_t start = at;
+  value = 0;
+  while (at < length && in[at] >= '0' && in[at] <= '9')
+  {
+    value = value * 10 + (in[at++] - '0');
+  }
+  value = negative ? -value : value;
+  return at != start;
+}
+
+}  // namespace
+
+bool MqttReader::push(uint8_t byte)
+{
+  switch (stage_)
+  {
+  case Stage::Header:
+    header_ = byte;
+    length_ = 0;
+    lengthShift_ = 0;
+    stage_ = Stage::Length;
+    return false;
+  case Stage::Length:
+    length_ |= static_cast<uint32_t>(byte & 0x7F) << lengthShift_;
+    lengthShift_ += 7;
+    if (byte & 0x80)
+    {
+      if (lengthShift_ >= 28)
+      {
+        stage_ = Stage::Header;   // not MQTT: start over
+      }
+      return false;
+    }
+    received_ = 0;
+    kept_ = 0;
+    if (length_ == 0)
+    {
+      stage_ = Stage::Header;
+      return true;
+    }
+    stage_ = Stage::Body;
+    return false;
+  case Stage::Body:
+    if (kept_ < sizeof(body_))
+    {
+      body_[kept_++] = byte;
+    }
+    if (++received_ == length_)
+    {
+      stage_ = Stage::Header;
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+size_t encodeMqttPublish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, bool retain,
+                         uint16_t packetId, uint8_t *buffer, size_t size)
+{
+  const uint32_t remaining = static_cast<uint32_t>(stringSize(topic) + (qos > 0 ? 2 : 0) + length);
+  const uint8_t first = static_cast<uint8_t>((static_cast<uint8_t>(MqttPacket::Publish) << 4) | (qos > 0 ? 0x02 : 0) |
+                                             (retain ? 0x01 : 0));
+  size_t at = writeHeader(first, remaining, buffer, size);
+  if (at == 0)
+  {
+    return 0;
+  }
+  at += writeString(topic, buffer + at);
+  if (qos > 0)
+  {
+    buffer[at++] = static_cast<uint8_t>(packetId >> 8);
+    buffer[at++] = static_cast<uint8_t>(packetId);
+  }
+  if (length != 0)
+  {
+    std::memcpy(buffer + at, payload, length);
+  }
+  return at + length;
+}
+
+size_t encodeMqttConnect(const char *clientId, uint16_t keepAliveS, bool cleanSession, const char *willTopic,
+                         const char *willMessage, const char *username, const char *password, uint8_t *buffer,
+                         size_t size)
+{
+  // variable header: "MQTT", level 4, connect flags, keep alive.
+  uint32_t remaining = 10 + static_cast<uint32_t>(stringSize(clientId));
+  uint8_t flags = cleanSession ? 0x02 : 0x00;
+  if (willTopic)
+  {
+    remaining += static_cast<uint32_t>(stringSize(willTopic) + stringSize(willMessage));
+    flags |= 0x04 | 0x08 | 0x20;   // will, will QoS 1, will retained
+  }
+  if (username)
+  {
+    remaining += static_cast<uint32_t>(stringSize(username));
+    flags |= 0x80;
+  }
+  if (password)
+  {
+    remaining += static_cast<uint32_t>(stringSize(password));
+    flags |= 0x40;
+  }
+  size_t at = writeHeader(static_cast<uint8_t>(MqttPacket::Connect) << 4, remaining, buffer, size);
+  if (at == 0)
+  {
+    return 0;
+  }
+  at += writeString("MQTT", buffer + at);
+  buffer[at++] = 4;
+  buffer[at++] = flags;
+  buffer[at++] = static_cast<uint8_t>(keepAliveS >> 8);
+  buffer[at++] = static_cast<uint8_t>(keepAliveS);
+  at += writeString(clientId, buffer + at);
+  if (willTopic)
+  {
+    at += writeString(willTopic, buffer + at);
+    at += writeString(willMessage, buffer + at);
+  }
+  if (username)
+  {
+    at += writeString(username, buffer + at);
+  }
+  if (password)
+  {
+    at += writeString(password, buffer + at);
+  }
+  return at;
+}
+
+size_t encodeMqttSubscribe(uint16_t packetId, const char *filter, uint8_t qos, uint8_t *buffer, size_t size)
+{
+  const uint32_t remaining = static_cast<uint32_t>(2 + stringSize(filter) + 1);
+  size_t at = writeHeader((static_cast<uint8_t>(MqttPacket::Subscribe) << 4) | 0x02, remaining, buffer, size);
+  if (at == 0)
+  {
+    return 0;
+  }
+  buffer[at++] = static_cast<uint8_t>(packetId >> 8);
+  buffer[at++] = static_cast<uint8_t>(packetId);
+  at += writeString(filter, buffer + at);
+  buffer[at++] = qos;
+  return at;
+}
+
+bool decodeMqttPublish(const uint8_t *body, size_t length, uint8_t flags, char *topic, size_t topicSize,
+                       uint16_t &packetId, const uint8_t *&payload, size_t &payloadLength)
+{
+  if (length < 2)
+  {
+    return false;
+  }
+  const size_t topicLength = (static_cast<size_t>(body[0]) << 8) | body[1];
+  const size_t qos = (flags >> 1) & 0x03;
+  size_t at = 2 + topicLength;
+  if (at + (qos > 0 ? 2 : 0) > length)
+  {
+    return false;
+  }
+  const size_t copied = topicLength < topicSize - 1 ? topicLength : topicSize - 1;
+  std::memcpy(topic, body + 2, copied);
+  topic[copied] = '\0';
+  packetId = 0;
+  if (qos > 0)
+  {
+    packetId = static_cast<uint16_t>((body[at] << 8) | body[at + 1]);
+    at += 2;
+  }
+  payload = body + at;
+  payloadLength = length - at;
+  return true;
+}
+
+size_t encodeUplinkPayload(uint8_t format, const UplinkPoint *points, size_t count, uint8_t *buffer, size_t size)
+{
+  if (count == 0 || count > 255)
+  {
+    return 0;
+  }
+  if (format == UPLINK_PAYLOAD_BINARY)
+  {
+    // header + per point: pin, 5 bytes value, 5 bytes time at most.
+    if (size < 6 + count * 11)
+    {
+      return 0;
+    }
+    size_t at = 0;
+    buffer[at++] = BINARY_MAGIC;
+    buffer[at++] = static_cast<uint8_t>(count);
+    const uint32_t baseMs = points[0].timestampMs;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+      buffer[at++] = static_cast<uint8_t>(baseMs >> shift);
+    }
+    uint32_t previousMs = baseMs;
+    for (size_t i = 0; i < count; i++)
+    {
+      buffer[at++] = points[i].pin;
+      at += writeVarint(zigzag(points[i].value), buffer + at);
+      at += writeVarint(points[i].timestampMs - previousMs, buffer + at);
+      previousMs = points[i].timestampMs;
+    }
+    return at;
+  }
+  // compact text: pin (3) + value (11) + time (10) + 2 separators per point.
+  size_t at = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (at + 26 > size)
+    {
+      return 0;
+    }
+    char *out = reinterpret_cast<char *>(buffer);
+    if (i != 0)
+    {
+      out[at++] = ';';
+    }
+    at += writeDecimal(points[i].pin, out + at);
+    out[at++] = ',';
+    at += writeDecimal(points[i].value, out + at);
+    out[at++] = ',';
+    at += writeDecimal(points[i].timestampMs, out + at);
+  }
+  return at;
+}
+
+size_t decodeUplinkPayload(uint8_t format, const uint8_t *payload, size_t length, UplinkPoint *points, size_t maxCount)
+{
+  size_t at = 0;
+  size_t count = 0;
+  if (format == UPLINK_PAYLOAD_BINARY)
+  {
+    if (length < 6 || payload[0] != BINARY_MAGIC || payload[1] > maxCount)
+    {
+      return 0;
+    }
+    const size_t expected = payload[1];
+    uint32_t timeMs = static_cast<uint32_t>(payload[2]) | (static_cast<uint32_t>(payload[3]) << 8) |
+                      (static_cast<uint32_t>(payload[4]) << 16) | (static_cast<uint32_t>(payload[5]) << 24);
+    at = 6;
+    for (; count < expected; count++)
+    {
+      uint32_t value;
+      uint32_t deltaMs;
+      if (at >= length)
+      {
+        return 0;
+      }
+      points[count].pin = payload[at++];
+      if (!readVarint(payload, length, at, value) || !readVarint(payload, length, at, deltaMs))
+      {
+        return 0;
+      }
+      timeMs += deltaMs;
+      points[count].value = unzigzag(value);
+      points[count].timestampMs = timeMs;
+    }
+    return at == length ? count : 0;
+  }
+  while (at < length)
+  {
+    int64_t pin;
+    int64_t value;
+    int64_t timeMs;
+    if (count == maxCount || !readDecimal(payload, length, at, pin) || at >= length || payload[at++] != ',' ||
+        !readDecimal(payload, length, at, value) || at >= length || payload[at++] != ',' ||
+        !readDecimal(payload, length, at, timeMs))
+    {
+      return 0;
+    }
+    points[count].pin = static_cast<uint8_t>(pin);
+    points[count].value = static_cast<int32_t>(value);
+    points[count].timestampMs = static_cast<uint32_t>(timeMs);
+    count++;
+    if (at < length && payload[at++] != ';')
+    {
+      return 0;
+    }
+  }
+  return count;
+}
+
+MqttClient::MqttClient(TcpConnection &connection, const char *host, uint16_t port, const MqttConfig &config)
+    : connection_(connection), host_(host), port_(port), config_(config)
+{
+}
+
+size_t MqttClient::topicOf(const char *subtopic, char *out, size_t size) const
+{
+  const int length = std::snprintf(out, size, "%s/%s", config_.topic, subtopic);
+  return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+void MqttClient::connect()
+{
+  if (state_ != State::Down)
+  {
+    drop();
+  }
+  reader_.reset();
+  if (!connection_.open(host_, port_))
+  {
+    return;   // the ConnectivityManager tries again after its backoff
+  }
+  char willTopic[MQTT_TOPIC_MAX];
+  topicOf("status", willTopic, sizeof(willTopic));
+  const size_t length = encodeMqttConnect(config_.clientId, config_.keepAliveS, config_.cleanSession, willTopic,
+                                          "offline", config_.username, config_.password, tx_, sizeof(tx_));
+  state_ = State::Connecting;
+  lastReceivedMs_ = nowMs_;
+  pingPending_ = false;
+  if (length == 0 || !send(tx_, length))
+  {
+    drop();
+  }
+}
+
+void MqttClient::disconnect()
+{
+  if (state_ != State::Down && connection_.isOpen())
+  {
+    const uint8_t packet[2] = {static_cast<uint8_t>(MqttPacket::Disconnect) << 4, 0};
+    send(packet, sizeof(packet));
+  }
+  drop();
+}
+
+void MqttClient::drop()
+{
+  // the QoS 1 messages stay in the window, they are sent again after the next CONNACK.
+  connection_.close();
+  state_ = State::Down;
+  reader_.reset();
+}
+
+bool MqttClient::send(const uint8_t *packet, size_t length)
+{
+  if (connection_.write(packet, length) != length)
+  {
+    drop();
+    return false;
+  }
+  stats_.packetsSent++;
+  stats_.bytesSent += static_cast<uint32_t>(length);
+  lastSentMs_ = nowMs_;
+  return true;
+}
+
+void MqttClient::poll(uint32_t nowMs)
+{
+  nowMs_ = nowMs;
+  if (state_ == State::Down)
+  {
+    return;
+  }
+  if (!connection_.isOpen())
+  {
+    drop();
+    return;
+  }
+  uint8_t chunk[64];
+  size_t count;
+  while (state_ != State::Down && (count = connection_.read(chunk, sizeof(chunk))) != 0)
+  {
+    stats_.bytesReceived += static_cast<uint32_t>(count);
+    lastReceivedMs_ = nowMs;
+    for (size_t i = 0; i < count && state_ != State::Down; i++)
+    {
+      if (reader_.push(chunk[i]))
+      {
+        stats_.packetsReceived++;
+        onPacket(nowMs);
+      }
+    }
+  }
+  if (state_ != State::Up)
+  {
+    return;   // a CONNECT without answer is given up by the ConnectivityManager (attempt timeout)
+  }
+
+  const uint32_t keepAliveMs = static_cast<uint32_t>(config_.keepAliveS) * 1000u;
+  if (keepAliveMs != 0 && nowMs - lastReceivedMs_ > keepAliveMs + keepAliveMs / 2)
+  {
+    // not even a PINGRESP for 1.5 keep alive periods: the connection is dead without TCP knowing it yet.
+    drop();
+    return;
+  }
+  // a ping when nothing was sent (the broker's keep alive) or nothing came back (QoS 0 gets no answers) for half
+  // a period, one at a time.
+  if (keepAliveMs != 0 && !pingPending_ &&
+      (nowMs - lastSentMs_ >= keepAliveMs / 2 || nowMs - lastReceivedMs_ >= keepAliveMs / 2))
+  {
+    const uint8_t packet[2] = {static_cast<uint8_t>(MqttPacket::Pingreq) << 4, 0};
+    pingPending_ = send(packet, sizeof(packet));
+  }
+  for (Inflight &message : inflight_)
+  {
+    if (state_ == State::Up && message.used && nowMs - message.sentMs >= config_.retryMs)
+    {
+      resend(message, nowMs);
+    }
+  }
+}
+
+void MqttClient::onPacket(uint32_t nowMs)
+{
+  switch (reader_.type())
+  {
+  case MqttPacket::Connack:
+    if (reader_.length() >= 2 && reader_.body()[1] == 0)
+    {
+      onConnected(nowMs);
+    }
+    else
+    {
+      drop();   // refused (client id, credentials)
+    }
+    break;
+  case MqttPacket::Puback:
+    if (reader_.length() >= 2)
+    {
+      const uint16_t packetId = static_cast<uint16_t>((reader_.body()[0] << 8) | reader_.body()[1]);
+      for (Inflight &message : inflight_)
+      {
+        if (message.used && message.packetId == packetId)
+        {
+          message.used = false;
+          stats_.acks++;
+        }
+      }
+    }
+    break;
+  case MqttPacket::Pingresp:
+    pingPending_ = false;
+    break;
+  default:
+    break;   // nothing is subscribed
+  }
+}
+
+void MqttClient::onConnected(uint32_t nowMs)
+{
+  state_ = State::Up;
+  stats_.connects++;
+  // retained, so a dashboard that subscribes later still sees the state; QoS 0 keeps the window for the weights.
+  static const uint8_t online[] = {'o', 'n', 'l', 'i', 'n', 'e'};
+  publish("status", online, sizeof(online), 0, true);
+  if (config_.info)
+  {
+    publish("info", reinterpret_cast<const uint8_t *>(config_.info), std::strlen(config_.info), 0, true);
+  }
+  // what the broker did not acknowledge before the connection was lost goes again, oldest first.
+  bool any = false;
+  uint32_t lastOrder = 0;
+  while (state_ == State::Up)
+  {
+    Inflight *oldest = nullptr;
+    for (Inflight &message : inflight_)
+    {
+      if (message.used && (!any || message.order > lastOrder) && (!oldest || message.order < oldest->order))
+      {
+        oldest = &message;
+      }
+    }
+    if (!oldest)
+    {
+      break;
+    }
+    any = true;
+    lastOrder = oldest->order;
+    resend(*oldest, nowMs);
+  }
+}
+
+void MqttClient::resend(Inflight &message, uint32_t nowMs)
+{
+  message.packet[0] |= 0x08;   // DUP
+  message.sentMs = nowMs;
+  stats_.resends++;
+  send(message.packet, message.length);
+}
+
+bool MqttClient::canPublish(uint8_t qos) const
+{
+  return state_ == State::Up && (qos == 0 || inflight() < MQTT_INFLIGHT_MAX);
+}
+
+size_t MqttClient::inflight() const
+{
+  size_t count = 0;
+  for (const Inflight &message : inflight_)
+  {
+    count += message.used ? 1 : 0;
+  }
+  return count;
+}
+
+bool MqttClient::publish(const char *subtopic, const uint8_t *payload, size_t length, uint8_t qos, bool retain)
+{
+  if (!canPublish(qos))
+  {
+    return false;
+  }
+  char topic[MQTT_TOPIC_MAX];
+  if (topicOf(subtopic, topic, sizeof(topic)) == 0)
+  {
+    return false;
+  }
+  if (qos == 0)
+  {
+    const size_t packetLength = encodeMqttPublish(topic, payload, length, 0, retain, 0, tx_, sizeof(tx_));
+    if (packetLength == 0)
+    {
+      return false;
+    }
+    stats_.publishes++;
+    return send(tx_, packetLength);
+  }
+
+  Inflight *slot = nullptr;
+  for (Inflight &message : inflight_)
+  {
+    slot = message.used ? slot : &message;
+  }
+  const uint16_t packetId = nextPacketId_;
+  const size_t packetLength =
+      encodeMqttPublish(topic, payload, length, 1, retain, packetId, slot->packet, sizeof(slot->packet));
+  if (packetLength == 0)
+  {
+    return false;
+  }
+  nextPacketId_ = static_cast<uint16_t>(nextPacketId_ == 0xFFFF ? 1 : nextPacketId_ + 1);
+  slot->used = true;
+  slot->packetId = packetId;
+  slot->order = nextOrder_++;
+  slot->sentMs = nowMs_;
+  slot->length = static_cast<uint16_t>(packetLength);
+  stats_.publishes++;
+  // kept until the PUBACK: a failed write is sent again after the reconnect, so the message is taken.
+  send(slot->packet, packetLength);
+  return true;
+}
+
+bool MqttSink::sendBatch(const UplinkPoint *points, size_t count)
+{
+  // a batch longer than MQTT_BATCH_POINTS goes as several messages; if a later one cannot be sent the whole
+  // batch stays in the uplink queue and the first ones arrive twice (at least once, like QoS 1 itself).
+  for (size_t first = 0; first < count; first += MQTT_BATCH_POINTS)
+  {
+    const size_t chunk = count - first < MQTT_BATCH_POINTS ? count - first : MQTT_BATCH_POINTS;
+    const size_t length = encodeUplinkPayload(format_, points + first, chunk, payload_, sizeof(payload_));
+    if (length == 0 || !client_.publish("weight", payload_, length, qos_, false))
+    {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,257 @@
+/**
+ * Mqtt.h
+ *  MQTT 3.1.1 as a cloud backend of the uplink (instead of Blynk), for a broker of the plant (mosquitto, ...):
+ *    - MqttClient : the connection (a NetworkLink of the ConnectivityManager) over a TcpConnection; QoS 0 and
+ *                   QoS 1 publishing, QoS 1 messages are kept until the broker acknowledged them and sent again
+ *                   after a reconnect (persistent session), keep alive, a last will,
+ *    - MqttSink   : the UplinkSink that publishes every batch of the uplink queue as one message.
+ *  The UplinkQueue keeps the points while the broker is not reachable or the QoS 1 window is full, so
+ *  together they store and forward: nothing taken while offline is lost until the backlog overflows.
+ *
+ *  Topics, under a prefix (MqttConfig::topic):
+ *      <topic>/weight   the batches (UPLINK_PAYLOAD_COMPACT or UPLINK_PAYLOAD_BINARY, see below)
+ *      <topic>/status   "online" (retained) after the connection, "offline" (retained, the last will) when
+ *                       the broker loses the scale, nothing on a clean disconnect
+ *      <topic>/info     what the weight messages are, retained: {"format":"binary","qos":1,"unit":"g"}
+ *
+ *  Payloads of <topic>/weight:
+ *    - compact : text, one point per entry, "<pin>,<value>,<ms>" separated by ';', e.g. "0,512,81234;1,512,81234"
+ *    - binary  : 'U' (0x55), the number of points (1 byte), the time of the first point (uint32 ms, little-endian),
+ *                then per point: the pin (1 byte), the value (zigzag varint), the time since the previous point
+ *                (varint, ms; 0 for the first one). 4 to 6 bytes per point for a weight in grams.
+ *  Everything is encoded into fixed buffers, nothing is allocated.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Connectivity.h"
+#include "Hal.h"
+#include "UplinkQueue.h"
+
+#define MQTT_PACKET_MAX       256   // the longest packet sent or kept for a resend
+#define MQTT_INFLIGHT_MAX     4     // QoS 1 messages waiting for their PUBACK
+#define MQTT_BATCH_POINTS     8     // points per weight message (a longer batch is split)
+
+#define UPLINK_PAYLOAD_COMPACT  0
+#define UPLINK_PAYLOAD_BINARY   1
+
+// MQTT control packet types (the high nibble of the first byte).
+enum class MqttPacket : uint8_t
+{
+  Connect = 1,
+  Connack = 2,
+  Publish = 3,
+  Puback = 4,
+  Subscribe = 8,
+  Suback = 9,
+  Pingreq = 12,
+  Pingresp = 13,
+  Disconnect = 14,
+};
+
+/**
+ * @brief Reads MQTT packets from a byte stream, one byte at a time (no allocation).
+ * @details A packet longer than MQTT_PACKET_MAX is read to its end but only its start is kept (truncated()).
+ */
+class MqttReader
+{
+public:
+  /**
+   * @return true when the byte completed a packet (type(), flags(), body() until the next push()).
+   */
+  bool push(uint8_t byte);
+  void reset() { stage_ = Stage::Header; }
+
+  MqttPacket type() const { return static_cast<MqttPacket>(header_ >> 4); }
+  uint8_t flags() const { return header_ & 0x0F; }
+  const uint8_t *body() const { return body_; }
+  size_t length() const { return kept_; }
+  bool truncated() const { return kept_ < length_; }
+
+private:
+  enum class Stage : uint8_t
+  {
+    Header,
+    Length,
+    Body,
+  };
+
+  Stage stage_ = Stage::Header;
+  uint8_t header_ = 0;
+  uint8_t lengthShift_ = 0;
+  uint32_t length_ = 0;
+  uint32_t received_ = 0;
+  size_t kept_ = 0;
+  uint8_t body_[MQTT_PACKET_MAX];
+};
+
+/**
+ * @brief Writes a PUBLISH packet.
+ * @param packetId: used with qos 1 only.
+ * @return the length of the packet, 0 if the buffer is too small.
+ */
+size_t encodeMqttPublish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, bool retain,
+                         uint16_t packetId, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Writes a CONNECT packet (used by the native build and by tools; MqttClient writes its own).
+ * @param willTopic: nullptr for no last will.
+ */
+size_t encodeMqttConnect(const char *clientId, uint16_t keepAliveS, bool cleanSession, const char *willTopic,
+                         const char *willMessage, const char *username, const char *password, uint8_t *buffer,
+                         size_t size);
+
+/**
+ * @brief Writes a SUBSCRIBE packet for one topic filter (native build and tools).
+ */
+size_t encodeMqttSubscribe(uint16_t packetId, const char *filter, uint8_t qos, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Reads the topic, packet id and payload of a PUBLISH packet (body of MqttReader).
+ * @param topic: receives the topic, '\0' terminated (cut to topicSize - 1).
+ * @return false if the body is not a valid PUBLISH.
+ */
+bool decodeMqttPublish(const uint8_t *body, size_t length, uint8_t flags, char *topic, size_t topicSize,
+                       uint16_t &packetId, const uint8_t *&payload, size_t &payloadLength);
+
+/**
+ * @brief Writes a batch of uplink points (see the payloads above).
+ * @return the length of the payload, 0 if the buffer is too small.
+ */
+size_t encodeUplinkPayload(uint8_t format, const UplinkPoint *points, size_t count, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Reads a batch of uplink points back (native build and tools).
+ * @return the number of points, 0 if the payload is not valid or has more than maxCount points.
+ */
+size_t decodeUplinkPayload(uint8_t format, const uint8_t *payload, size_t length, UplinkPoint *points, size_t maxCount);
+
+struct MqttConfig
+{
+  const char *clientId = "smartscale";
+  const char *topic = "smartscale";   // prefix of <topic>/weight, /status, /info
+  const char *username = nullptr;     // nullptr: none
+  const char *password = nullptr;
+  const char *info = nullptr;         // retained on <topic>/info after every connection, nullptr: none
+  uint16_t keepAliveS = 30;
+  uint32_t retryMs = 5000;            // a QoS 1 message without PUBACK is sent again after this
+  bool cleanSession = false;          // false: the broker keeps the session, unacknowledged messages survive a reconnect
+};
+
+struct MqttStats
+{
+  uint32_t connects;      // CONNACK accepted
+  uint32_t packetsSent;
+  uint32_t bytesSent;     // MQTT packets, without TCP/IP
+  uint32_t packetsReceived;
+  uint32_t bytesReceived;
+  uint32_t publishes;     // PUBLISH packets, resends not counted
+  uint32_t resends;       // QoS 1 messages sent again (DUP)
+  uint32_t acks;          // PUBACK received
+};
+
+/**
+ * @brief An MQTT connection that publishes (nothing is subscribed). Not thread-safe: one task (Task4).
+ */
+class MqttClient : public NetworkLink
+{
+public:
+  MqttClient(TcpConnection &connection, const char *host, uint16_t port, const MqttConfig &config = MqttConfig());
+
+  /**
+   * @brief True once the broker accepted the connection (CONNACK, read by poll()).
+   */
+  bool connected() override { return state_ == State::Up; }
+  /**
+   * @brief Opens the TCP connection (the only wait) and sends CONNECT with the last will.
+   */
+  void connect() override;
+  /**
+   * @brief Clean disconnect (DISCONNECT: the broker does not publish the last will).
+   */
+  void disconnect() override;
+
+  /**
+   * @brief Reads the answers of the broker, keeps the connection alive and sends unacknowledged QoS 1
+   *        messages again. Call it often (every cycle of Task4), also while connecting.
+   */
+  void poll(uint32_t nowMs);
+
+  /**
+   * @brief Publishes under <topic>/<subtopic>.
+   * @return false if not connected, the QoS 1 window is full or the connection failed.
+   */
+  bool publish(const char *subtopic, const uint8_t *payload, size_t length, uint8_t qos, bool retain);
+
+  /**
+   * @brief Whether publish() can take a message of this QoS now.
+   */
+  bool canPublish(uint8_t qos) const;
+  size_t inflight() const;
+  const MqttStats &stats() const { return stats_; }
+
+private:
+  enum class State : uint8_t
+  {
+    Down,
+    Connecting,   // CONNECT sent, waiting for CONNACK
+    Up,
+  };
+
+  struct Inflight
+  {
+    bool used;
+    uint16_t packetId;
+    uint32_t order;    // resent in the order they were published
+    uint32_t sentMs;
+    uint16_t length;
+    uint8_t packet[MQTT_PACKET_MAX];
+  };
+
+  bool send(const uint8_t *packet, size_t length);
+  void onPacket(uint32_t nowMs);
+  void onConnected(uint32_t nowMs);
+  void resend(Inflight &message, uint32_t nowMs);
+  void drop();
+  size_t topicOf(const char *subtopic, char *out, size_t size) const;
+
+  TcpConnection &connection_;
+  const char *host_;
+  uint16_t port_;
+  MqttConfig config_;
+  State state_ = State::Down;
+  MqttReader reader_;
+  Inflight inflight_[MQTT_INFLIGHT_MAX] = {};
+  uint16_t nextPacketId_ = 1;
+  uint32_t nextOrder_ = 0;
+  uint32_t nowMs_ = 0;
+  uint32_t lastSentMs_ = 0;
+  uint32_t lastReceivedMs_ = 0;
+  bool pingPending_ = false;
+  uint8_t tx_[MQTT_PACKET_MAX];
+  MqttStats stats_ = {};
+};
+
+/**
+ * @brief The uplink queue publishes through MQTT: one message per batch (MQTT_BATCH_POINTS points at most,
+ *        a longer batch is split) on <topic>/weight.
+ */
+class MqttSink : public UplinkSink
+{
+public:
+  MqttSink(MqttClient &client, uint8_t qos, uint8_t format) : client_(client), qos_(qos), format_(format) {}
+
+  /**
+   * @brief Not while the QoS 1 window is full either: the uplink queue keeps the points meanwhile.
+   */
+  bool connected() override { return client_.canPublish(qos_); }
+  bool sendBatch(const UplinkPoint *points, size_t count) override;
+
+private:
+  MqttClient &client_;
+  uint8_t qos_;
+  uint8_t format_;
+  uint8_t payload_[MQTT_PACKET_MAX];
+};
@@ -0,0 +1,202 @@
+/**
+ * PowerScheduler.cpp
+ *  See PowerScheduler.h.
+ */
+#include "PowerScheduler.h"
+
+#include <cstdlib>
+
+// a probe that got no conversion within the settling time and this many periods: the HX711 does not answer.
+static const uint32_t probeTimeoutPeriods = 5;
+
+void PowerScheduler::configure(const PowerConfig &config)
+{
+  config_ = config;
+  if (config_.samplePeriodMs == 0)
+  {
+    config_.samplePeriodMs = 1;
+  }
+  if (config_.networkBatchMs == 0)
+  {
+    config_.networkBatchMs = 1;
+  }
+  // a conversion after a power-up comes hx711SettleMs + up to one period later: powering down is only worth it
+  // if the HX711s are off for at least as long as a probe keeps them on.
+  const uint32_t probeOnMs = config_.hx711SettleMs + config_.samplePeriodMs;
+  probeIntervalMs_ = config_.maxReactionMs > config_.samplePeriodMs + 2 * probeOnMs
+                         ? config_.maxReactionMs - config_.samplePeriodMs
+                         : 0;
+}
+
+void PowerScheduler::begin(uint32_t nowMs)
+{
+  setState(PowerState::Active);
+  powered_ = true;
+  probing_ = false;
+  haveRest_ = false;
+  lastChangeMs_ = nowMs;
+  accountedMs_ = nowMs;
+  stats_ = {};
+}
+
+void PowerScheduler::setState(PowerState state)
+{
+  if (state == PowerState::Active && this->state() != PowerState::Active)
+  {
+    stats_.wakeUps++;
+  }
+  state_.store(static_cast<uint8_t>(state), std::memory_order_relaxed);
+}
+
+void PowerScheduler::account(uint32_t nowMs)
+{
+  const uint32_t elapsed = nowMs - accountedMs_;
+  accountedMs_ = nowMs;
+  switch (state())
+  {
+    case PowerState::Active:
+      stats_.activeMs += elapsed;
+      break;
+    case PowerState::Idle:
+      stats_.idleMs += elapsed;
+      break;
+    case PowerState::PowerDown:
+      stats_.powerDownMs += elapsed;
+      break;
+  }
+  if (powered_)
+  {
+    stats_.hx711OnMs += elapsed;
+  }
+}
+
+PowerAction PowerScheduler::wake(uint32_t nowMs)
+{
+  lastChangeMs_ = nowMs;
+  probing_ = false;
+  setState(PowerState::Active);
+  if (!powered_)
+  {
+    powered_ = true;
+    return PowerAction::PowerUp;
+  }
+  return PowerAction::None;
+}
+
+PowerAction PowerScheduler::onWeight(int32_t weightMg, bool valid, uint32_t nowMs)
+{
+  account(nowMs);
+  if (!valid)
+  {
+    // no weight (HX711 not ready, overload): stay awake, the firmware shows it.
+    haveRest_ = false;
+    return wake(nowMs);
+  }
+  if (!haveRest_ || std::abs(weightMg - restMg_) > config_.changeBandMg)
+  {
+    const bool first = !haveRest_;
+    restMg_ = weightMg;
+    haveRest_ = true;
+    if (!first || state() != PowerState::Active)
+    {
+      return wake(nowMs);
+    }
+    lastChangeMs_ = nowMs;
+    return PowerAction::None;
+  }
+  if (state() == PowerState::PowerDown && probing_)
+  {
+    // a quiet probe: off until the next one.
+    probing_ = false;
+    powered_ = false;
+    nextProbeMs_ = probeStartMs_ + probeIntervalMs_;
+    return PowerAction::PowerDown;
+  }
+  return PowerAction::None;
+}
+
+PowerAction PowerScheduler::onActivity(uint32_t nowMs)
+{
+  account(nowMs);
+  return wake(nowMs);
+}
+
+PowerAction PowerScheduler::poll(uint32_t nowMs, bool clients)
+{
+  account(nowMs);
+  if (clients)
+  {
+    return wake(nowMs);   // and idle only idleAfterMs after the last one left
+  }
+  const uint32_t quietMs = nowMs - lastChangeMs_;
+  switch (state())
+  {
+    case PowerState::Active:
+      if (quietMs >= config_.idleAfterMs && haveRest_)
+      {
+        setState(PowerState::Idle);
+      }
+      break;
+    case PowerState::Idle:
+      if (quietMs >= config_.powerDownAfterMs && probeIntervalMs_ != 0)
+      {
+        setState(PowerState::PowerDown);
+        powered_ = false;
+        probing_ = false;
+        // like the end of a quiet probe: probeIntervalMs counts from a power-up, whose conversion comes
+        // hx711SettleMs later, not from a conversion (this one).
+        nextProbeMs_ = nowMs + probeIntervalMs_ - config_.hx711SettleMs;
+        return PowerAction::PowerDown;
+      }
+      break;
+    case PowerState::PowerDown:
+      if (!probing_ && static_cast<int32_t>(nowMs - nextProbeMs_) >= 0)
+      {
+        probing_ = true;
+        powered_ = true;
+        probeStartMs_ = nowMs;
+        stats_.probes++;
+        return PowerAction::PowerUp;
+      }
+      if (probing_ && nowMs - probeStartMs_ > config_.hx711SettleMs + probeTimeoutPeriods * config_.samplePeriodMs)
+      {
+        haveRest_ = false;
+        return wake(nowMs);   // the HX711 did not answer the probe: awake, "not ready"
+      }
+      break;
+  }
+  return PowerAction::None;
+}
+
+uint32_t PowerScheduler::msUntilProbe(uint32_t nowMs) const
+{
+  if (powered_)
+  {
+    return 0;
+  }
+  const int32_t left = static_cast<int32_t>(nextProbeMs_ - nowMs);
+  return left > 0 ? static_cast<uint32_t>(left) : 0;
+}
+
+PowerStats PowerScheduler::stats(uint32_t nowMs) const
+{
+  PowerStats out = stats_;
+  const uint32_t elapsed = nowMs - accountedMs_;
+  switch (state())
+  {
+    case PowerState::Active:
+      out.activeMs += elapsed;
+      break;
+    case PowerState::Idle:
+      out.idleMs += elapsed;
+      break;
+    case PowerState::PowerDown:
+      out.powerDownMs += elapsed;
+      break;
+  }
+  if (powered_)
+  {
+    out.hx711OnMs += elapsed;
+  }
+  return out;
+}
@@ -0,0 +1,139 @@
+/**
+ * PowerScheduler.h
+ *  Decisions of the low-power mode (LOW_POWER in main.cpp): when the HX711s may be powered down, when they
+ *  are powered up again to look for a load, and when the network tasks may wait for each other.
+ *
+ *    Active     a load moved, a command or a web client: every conversion is weighed, the network tasks
+ *               run at their own periods.
+ *    Idle       the weight stayed within changeBandMg of its resting value for idleAfterMs: every conversion
+ *               is still weighed (a load is seen at the next one), the network tasks run together once per
+ *               networkBatchMs, so the CPU sleeps between two conversions.
+ *    PowerDown  unchanged for powerDownAfterMs: the HX711s are powered down (power_down(), ~1 uA) and only
+ *               powered up for a probe every probeIntervalMs: one conversion after the settling time of the
+ *               HX711. A probe outside the band makes the scale Active with the HX711s on, a quiet one powers
+ *               them down again. A load put on the platform is seen within maxReactionMs.
+ *
+ *  The scheduler knows neither pins nor tasks: the firmware calls it with the weights of Task1 and the time,
+ *  and does what the returned PowerAction says; the native build drives it with a simulated clock ("power"
+ *  scenario). Written by Task1 only; state() and networkBatched() may be read by any task.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+enum class PowerState : uint8_t
+{
+  Active,
+  Idle,
+  PowerDown,
+};
+
+enum class PowerAction : uint8_t
+{
+  None,
+  PowerUp,     // power the HX711s up (and restart the filters: the next conversion is weighed on its own)
+  PowerDown,   // power the HX711s down
+};
+
+struct PowerConfig
+{
+  uint32_t samplePeriodMs = 100;       // HX711 conversion period (100 at 10 SPS)
+  uint32_t hx711SettleMs = 400;        // power_up() to the first conversion (400 ms at 10 SPS, 50 at 80 SPS)
+  uint32_t maxReactionMs = 2000;       // a load put on while powered down is weighed within this
+  uint32_t idleAfterMs = 10000;        // unchanged this long: Idle
+  uint32_t powerDownAfterMs = 60000;   // unchanged this long: PowerDown
+  uint32_t networkBatchMs = 1000;      // Idle and PowerDown: the network tasks wake together this often
+  int32_t  changeBandMg = 2000;        // a weight outside +/- this around the resting weight is activity
+};
+
+struct PowerStats
+{
+  uint64_t activeMs;
+  uint64_t idleMs;
+  uint64_t powerDownMs;
+  uint64_t hx711OnMs;       // powered up (every state, probes included)
+  uint32_t probes;          // power-ups to look for a load
+  uint32_t wakeUps;         // PowerDown or Idle -> Active
+};
+
+class PowerScheduler
+{
+public:
+  explicit PowerScheduler(const PowerConfig &config = PowerConfig()) { configure(config); }
+
+  void configure(const PowerConfig &config);
+  const PowerConfig &config() const { return config_; }
+
+  /**
+   * @brief Time between two probes in PowerDown: the reaction latency minus one conversion period.
+   * @return 0 if maxReactionMs leaves no time to power down (the scheduler then stops at Idle).
+   */
+  uint32_t probeIntervalMs() const { return probeIntervalMs_; }
+
+  /**
+   * @brief Starts the clock (end of setup(), the HX711s are powered).
+   */
+  void begin(uint32_t nowMs);
+
+  /**
+   * @brief A weighed conversion (Task1): every one in Active and Idle, the probe in PowerDown.
+   * @param valid: false for a HX711 that is not ready or an overload: the scale stays awake.
+   * @return PowerDown after a quiet probe.
+   */
+  PowerAction onWeight(int32_t weightMg, bool valid, uint32_t nowMs);
+
+  /**
+   * @brief Something that wants the scale awake: a command, a web client.
+   * @return PowerUp if the HX711s were powered down.
+   */
+  PowerAction onActivity(uint32_t nowMs);
+
+  /**
+   * @brief The transitions that only depend on the time (Task1, every cycle and after every wait).
+   * @param clients: web clients connected (they keep the scale Active).
+   */
+  PowerAction poll(uint32_t nowMs, bool clients);
+
+  PowerState state() const { return static_cast<PowerState>(state_.load(std::memory_order_relaxed)); }
+  bool hx711Powered() const { return powered_; }
+  bool probing() const { return probing_; }
+
+  /**
+   * @brief How long Task1 may sleep while the HX711s are powered down (until the next probe).
+   */
+  uint32_t msUntilProbe(uint32_t nowMs) const;
+
+  /**
+   * @brief Idle and PowerDown: the network tasks run in the same window, one wake-up for all of them.
+   */
+  bool networkBatched() const { return state() != PowerState::Active; }
+
+  /**
+   * @brief The start of the next network window: a multiple of networkBatchMs, the same for every task.
+   */
+  uint32_t nextNetworkMs(uint32_t nowMs) const { return (nowMs / config_.networkBatchMs + 1) * config_.networkBatchMs; }
+
+  /**
+   * @brief Time per state so far (read by a report: may be one update old).
+   */
+  PowerStats stats(uint32_t nowMs) const;
+
+private:
+  void setState(PowerState state);
+  void account(uint32_t nowMs);
+  PowerAction wake(uint32_t nowMs);
+
+  PowerConfig config_;
+  uint32_t probeIntervalMs_ = 0;
+  std::atomic<uint8_t> state_{static_cast<uint8_t>(PowerState::Active)};
+  bool powered_ = true;
+  bool probing_ = false;
+  bool haveRest_ = false;
+  int32_t restMg_ = 0;          // the resting weight
+  uint32_t lastChangeMs_ = 0;   // the weight left the band, a command or a client
+  uint32_t nextProbeMs_ = 0;
+  uint32_t probeStartMs_ = 0;
+  uint32_t accountedMs_ = 0;
+  PowerStats stats_ = {};
+};
@@ -0,0 +1,253 @@
+/**
+ * ProfileFilter.h
+ *  The filter chain of FilterChain.h with the settings of a scale profile (ScaleProfile.h) as constants:
+ *
+ *    raw counts -> median of P::medianWindow -> P::smoothing -> milligrams -> stability (P::stableToleranceMg)
+ *
+ *  The window sizes, the EMA shift and the stability band are template arguments, so the median sorts a
+ *  fixed number of values, the EMA divides by a constant power of two, the smoothing that is not used is
+ *  not compiled in and there is no switch per sample. Only the calibration (WeightConverter) stays a
+ *  run-time value: it comes from the web page and NVS.
+ *
+ *  Gives bit-identical results to a FilterChain configured with ProfileTraits<P>::filterConfig() (checked by
+ *  the "profiles" scenario of the native build), but cannot be changed at run time: there is no configure(), the
+ *  firmware answers the "filter" command with Unsupported (SCALE_FIXED_FILTER builds).
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+
+#include "FilterChain.h"
+#include "FixedFilter.h"
+#include "ScaleProfile.h"
+
+/**
+ * @brief MedianFilter with a window fixed at compile time (odd).
+ */
+template <uint8_t Window>
+class FixedMedian
+{
+  static_assert((Window & 1u) == 1u && Window <= MedianFilter::maxWindow, "odd window, up to 9");
+
+public:
+  void reset()
+  {
+    count_ = 0;
+    next_ = 0;
+  }
+
+  int32_t update(int32_t x)
+  {
+    if constexpr (Window == 1)
+    {
+      return x;
+    }
+    else
+    {
+      history_[next_] = x;
+      next_ = next_ + 1u == Window ? 0 : static_cast<uint8_t>(next_ + 1u);
+      if (count_ < Window)
+      {
+        count_++;
+        return sorted(count_);
+      }
+      return sorted(Window);   // the usual case: a constant trip count, unrolled by the compiler
+    }
+  }
+
+private:
+  int32_t sorted(uint8_t count) const
+  {
+    int32_t values[Window];
+    for (uint8_t i = 0; i < count; i++)
+    {
+      int32_t value = history_[i];
+      int8_t j = static_cast<int8_t>(i) - 1;
+      while (j >= 0 && values[j] > value)
+      {
+        values[j + 1] = values[j];
+        j--;
+      }
+      values[j + 1] = value;
+    }
+    return values[count / 2u];
+  }
+
+  int32_t history_[Window] = {};
+  uint8_t count_ = 0;
+  uint8_t next_ = 0;
+};
+
+/**
+ * @brief EmaFilter with a constant shift (alpha = 1 / 2^Shift).
+ */
+template <uint8_t Shift>
+class FixedEma
+{
+public:
+  void reset() { primed_ = false; }
+  void snap(int32_t x)
+  {
+    state_ = static_cast<int64_t>(x) << fractionBits;
+    primed_ = true;
+  }
+
+  int32_t update(int32_t x)
+  {
+    if (!primed_)
+    {
+      snap(x);
+    }
+    else
+    {
+      const int64_t input = static_cast<int64_t>(x) << fractionBits;
+      state_ += (input - state_) / (int64_t(1) << Shift);
+    }
+    return static_cast<int32_t>((state_ + (int64_t(1) << (fractionBits - 1))) >> fractionBits);
+  }
+
+private:
+  static constexpr uint8_t fractionBits = 8;
+  int64_t state_ = 0;  // Q8
+  bool primed_ = false;
+};
+
+/**
+ * @brief MovingAverage with a constant window.
+ */
+template <uint8_t Window>
+class FixedAverage
+{
+public:
+  void reset()
+  {
+    sum_ = 0;
+    count_ = 0;
+    next_ = 0;
+  }
+
+  void snap(int32_t x)
+  {
+    reset();
+    update(x);
+  }
+
+  int32_t update(int32_t x)
+  {
+    if (count_ == Window)
+    {
+      sum_ -= history_[next_];
+    }
+    else
+    {
+      count_++;
+    }
+    history_[next_] = x;
+    sum_ += x;
+    next_ = next_ + 1u == Window ? 0 : static_cast<uint8_t>(next_ + 1u);
+    return static_cast<int32_t>(count_ == Window ? sum_ / Window : sum_ / count_);
+  }
+
+private:
+  int32_t history_[Window] = {};
+  int64_t sum_ = 0;
+  uint8_t count_ = 0;
+  uint8_t next_ = 0;
+};
+
+template <class P>
+class ProfileFilterChain
+{
+public:
+  /**
+   * @brief The settings of the profile, as a FilterConfig (reports, the trace header).
+   */
+  static constexpr FilterConfig config() { return ProfileTraits<P>::filterConfig(); }
+
+  /**
+   * @brief Clears the filter history (e.g. after the HX711 was not ready).
+   */
+  void reset()
+  {
+    median_.reset();
+    smoother_.reset();
+    stablePrimed_ = false;
+    primed_ = false;
+  }
+
+  /**
+   * @brief Runs one sample through the chain (see FilterChain::update()).
+   */
+  FilterOutput update(int32_t raw, uint32_t timestampUs)
+  {
+    FilterOutput out;
+    out.filteredRaw = smooth(median_.update(raw));
+    lastSmoothed_ = out.filteredRaw;
+    primed_ = true;
+    out.weightMg = converter_.toMilligrams(out.filteredRaw);
+    if (!stablePrimed_ || std::abs(out.weightMg - referenceMg_) > P::stableToleranceMg)
+    {
+      referenceMg_ = out.weightMg;
+      sinceUs_ = timestampUs;
+      stablePrimed_ = true;
+    }
+    out.stable = (timestampUs - sinceUs_) >= P::settleUs;
+    return out;
+  }
+
+  WeightConverter &converter() { return converter_; }
+
+private:
+  using Smoother = std::conditional_t<P::smoothing == Smoothing::Ema, FixedEma<P::emaShift>,
+                   std::conditional_t<P::smoothing == Smoothing::MovingAverage, FixedAverage<P::averageWindow>,
+                                      KalmanFilter>>;
+
+  static Smoother makeSmoother()
+  {
+    if constexpr (P::smoothing == Smoothing::Kalman)
+    {
+      return KalmanFilter(P::kalmanProcessNoise, P::kalmanMeasurementNoise);
+    }
+    else
+    {
+      return Smoother();
+    }
+  }
+
+  int32_t smooth(int32_t x)
+  {
+    if constexpr (P::smoothing == Smoothing::None)
+    {
+      return x;
+    }
+    else
+    {
+      // a new load on the platform: start the smoothing again from the new value (see FilterChain::smooth()).
+      const bool step = P::stepCounts > 0 && primed_ && std::abs(x - lastSmoothed_) > P::stepCounts;
+      if constexpr (P::smoothing == Smoothing::MovingAverage)
+      {
+        if (step)
+        {
+          smoother_.snap(x);
+          return x;
+        }
+      }
+      else if (step)
+      {
+        smoother_.snap(x);
+      }
+      return smoother_.update(x);
+    }
+  }
+
+  FixedMedian<P::medianWindow> median_;
+  Smoother smoother_ = makeSmoother();   // Smoothing::None: an unused FixedEma
+  WeightConverter converter_;
+  int32_t lastSmoothed_ = 0;
+  int32_t referenceMg_ = 0;
+  uint32_t sinceUs_ = 0;
+  bool primed_ = false;
+  bool stablePrimed_ = false;
+};
@@ -0,0 +1,356 @@
+/**
+ * RawTrace.cpp
+ *  See RawTrace.h.
+ */
+#include "RawTrace.h"
+
+#include <cstring>
+
+namespace
+{
+
+const uint8_t HEADER_MAGIC[4] = {'H', 'X', 'T', '1'};
+const size_t HEADER_FIXED = 26;
+const size_t HEADER_PER_CHANNEL = 12;
+
+void put16(uint8_t *out, uint16_t value)
+{
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void put32(uint8_t *out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+void putFloat(uint8_t *out, float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  put32(out, bits);
+}
+
+uint16_t get16(const uint8_t *in) { return static_cast<uint16_t>(in[0] | (in[1] << 8)); }
+
+uint32_t get32(const uint8_t *in)
+{
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) | (static_cast<uint32_t>(in[2]) << 16) |
+         (static_cast<uint32_t>(in[3]) << 24);
+}
+
+float getFloat(const uint8_t *in)
+{
+  const uint32_t bits = get32(in);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+size_t writeVarint(uint32_t value, uint8_t *out)
+{
+  size_t count = 0;
+  while (value >= 0x80)
+  {
+    out[count++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[count++] = static_cast<uint8_t>(value);
+  return count;
+}
+
+bool readVarint(const uint8_t *in, size_t end, size_t &at, uint32_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7)
+  {
+    if (at >= end)
+    {
+      return false;
+    }
+    const uint8_t byte = in[at++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t zigzag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+uint8_t tagOf(TraceRecordKind kind, uint8_t low) { return static_cast<uint8_t>((static_cast<uint8_t>(kind) << 5) | (low & 0x1F)); }
+
+}  // namespace
+
+size_t encodeTraceHeader(const TraceHeader &header, uint8_t *buffer, size_t size)
+{
+  const uint8_t channels = header.channels < 1 ? 1 : (header.channels > LOAD_CELL_MAX_CHANNELS ? LOAD_CELL_MAX_CHANNELS : header.channels);
+  const size_t length = HEADER_FIXED + HEADER_PER_CHANNEL * channels;
+  if (length > size)
+  {
+    return 0;
+  }
+  std::memcpy(buffer, HEADER_MAGIC, sizeof(HEADER_MAGIC));
+  put16(buffer + 4, static_cast<uint16_t>(length));
+  buffer[6] = channels;
+  buffer[7] = header.flags;
+  put16(buffer + 8, header.sps);
+  put32(buffer + 10, static_cast<uint32_t>(header.maxGrams));
+  putFloat(buffer + 14, header.countsPerGram);
+  putFloat(buffer + 18, header.countsPerDegree);
+  putFloat(buffer + 22, header.refTemperatureC);
+  uint8_t *out = buffer + HEADER_FIXED;
+  for (uint8_t channel = 0; channel < channels; channel++, out += HEADER_PER_CHANNEL)
+  {
+    put32(out, static_cast<uint32_t>(header.offsets[channel]));
+    putFloat(out + 4, header.channelCountsPerGram[channel]);
+    putFloat(out + 8, header.trims[channel]);
+  }
+  return length;
+}
+
+size_t decodeTraceHeader(const uint8_t *data, size_t length, TraceHeader &out)
+{
+  if (length < HEADER_FIXED || std::memcmp(data, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0)
+  {
+    return 0;
+  }
+  const size_t headerLength = get16(data + 4);
+  const uint8_t channels = data[6];
+  // a longer header (a later version) is skipped over, its extra fields are not known here.
+  if (channels < 1 || channels > LOAD_CELL_MAX_CHANNELS || headerLength < HEADER_FIXED + HEADER_PER_CHANNEL * channels ||
+      headerLength > length)
+  {
+    return 0;
+  }
+  out = TraceHeader();
+  out.channels = channels;
+  out.flags = data[7];
+  out.sps = get16(data + 8);
+  out.maxGrams = static_cast<int32_t>(get32(data + 10));
+  out.countsPerGram = getFloat(data + 14);
+  out.countsPerDegree = getFloat(data + 18);
+  out.refTemperatureC = getFloat(data + 22);
+  const uint8_t *in = data + HEADER_FIXED;
+  for (uint8_t channel = 0; channel < channels; channel++, in += HEADER_PER_CHANNEL)
+  {
+    out.offsets[channel] = static_cast<int32_t>(get32(in));
+    out.channelCountsPerGram[channel] = getFloat(in + 4);
+    out.trims[channel] = getFloat(in + 8);
+  }
+  return headerLength;
+}
+
+bool TraceRecorder::start(const TraceHeader &header)
+{
+  if (active_)
+  {
+    stop();
+  }
+  TraceBlock first;
+  first.first = true;
+  first.length = static_cast<uint16_t>(encodeTraceHeader(header, first.data, sizeof(first.data)));
+  if (!queue_.push(first))
+  {
+    stats_.droppedBlocks++;
+    return false;
+  }
+  stats_ = TraceRecorderStats();
+  stats_.blocks = 1;
+  stats_.bytes = first.length;
+  block_.length = 0;
+  blockNumber_ = 0;
+  active_ = true;
+  return true;
+}
+
+void TraceRecorder::stop()
+{
+  if (active_)
+  {
+    close();
+    active_ = false;
+  }
+}
+
+void TraceRecorder::sample(uint8_t channel, int32_t raw, uint32_t readyUs)
+{
+  if (!active_ || channel >= LOAD_CELL_MAX_CHANNELS)
+  {
+    return;
+  }
+  // the first sample of a channel in a block is stored against 0 (the block is decoded on its own).
+  open(readyUs);
+  add(tagOf(TraceRecordKind::Sample, channel), readyUs, true, raw - lastRaw_[channel]);
+  lastRaw_[channel] = raw;
+  stats_.samples++;
+}
+
+void TraceRecorder::missed(uint8_t channel, uint32_t timeUs)
+{
+  if (active_)
+  {
+    open(timeUs);
+    add(tagOf(TraceRecordKind::Missed, channel), timeUs, false, 0);
+    stats_.missed++;
+  }
+}
+
+void TraceRecorder::event(TraceEvent event, int32_t value, uint32_t timeUs)
+{
+  if (active_)
+  {
+    open(timeUs);
+    add(tagOf(TraceRecordKind::Event, static_cast<uint8_t>(event)), timeUs, true, value);
+    stats_.events++;
+  }
+}
+
+void TraceRecorder::open(uint32_t timeUs)
+{
+  if (block_.length != 0 && block_.length + TRACE_RECORD_MAX > TRACE_BLOCK_BYTES)
+  {
+    close();
+  }
+  if (block_.length == 0)
+  {
+    block_.data[0] = TRACE_BLOCK_MAGIC;
+    put16(block_.data + 1, blockNumber_++);
+    put32(block_.data + 5, timeUs);
+    block_.length = TRACE_BLOCK_HEADER;
+    lastUs_ = timeUs;
+    std::memset(lastRaw_, 0, sizeof(lastRaw_));
+  }
+}
+
+void TraceRecorder::add(uint8_t tag, uint32_t timeUs, bool hasValue, int32_t value)
+{
+  uint8_t *out = block_.data + block_.length;
+  size_t length = 0;
+  out[length++] = tag;
+  length += writeVarint(timeUs - lastUs_, out + length);
+  if (hasValue)
+  {
+    length += writeVarint(zigzag(value), out + length);
+  }
+  block_.length = static_cast<uint16_t>(block_.length + length);
+  lastUs_ = timeUs;
+}
+
+void TraceRecorder::close()
+{
+  if (block_.length == 0)
+  {
+    return;
+  }
+  put16(block_.data + 3, static_cast<uint16_t>(block_.length - TRACE_BLOCK_HEADER));
+  block_.first = false;
+  queue(block_);
+  block_.length = 0;
+}
+
+void TraceRecorder::queue(const TraceBlock &block)
+{
+  if (queue_.push(block))
+  {
+    stats_.blocks++;
+    stats_.bytes += block.length;
+  }
+  else
+  {
+    stats_.droppedBlocks++;   // the block number is still used: the reader sees the gap
+  }
+}
+
+TraceReader::TraceReader(const uint8_t *data, size_t length) : data_(data), length_(length)
+{
+  at_ = decodeTraceHeader(data, length, header_);
+  blockEnd_ = at_;
+}
+
+bool TraceReader::openBlock()
+{
+  while (at_ != 0 && at_ + TRACE_BLOCK_HEADER <= length_)
+  {
+    const uint8_t *block = data_ + at_;
+    const size_t records = get16(block + 3);
+    if (block[0] != TRACE_BLOCK_MAGIC || at_ + TRACE_BLOCK_HEADER + records > length_)
+    {
+      // not a block: look for the next magic byte.
+      corrupt_++;
+      at_++;
+      while (at_ < length_ && data_[at_] != TRACE_BLOCK_MAGIC)
+      {
+        at_++;
+      }
+      continue;
+    }
+    const uint16_t number = get16(block + 1);
+    if (started_ && number != static_cast<uint16_t>(blockNumber_ + 1))
+    {
+      gaps_ += static_cast<uint16_t>(number - blockNumber_ - 1);
+    }
+    started_ = true;
+    blockNumber_ = number;
+    timeUs_ = get32(block + 5);
+    std::memset(lastRaw_, 0, sizeof(lastRaw_));
+    at_ += TRACE_BLOCK_HEADER;
+    blockEnd_ = at_ + records;
+    blocks_++;
+    return true;
+  }
+  return false;
+}
+
+bool TraceReader::next(TraceRecord &out)
+{
+  while (at_ != 0)
+  {
+    if (at_ >= blockEnd_ && !openBlock())
+    {
+      return false;
+    }
+    if (at_ >= blockEnd_)
+    {
+      continue;   // an empty block
+    }
+    const uint8_t tag = data_[at_++];
+    uint32_t deltaUs = 0;
+    uint32_t value = 0;
+    const TraceRecordKind kind = static_cast<TraceRecordKind>(tag >> 5);
+    const bool hasValue = kind != TraceRecordKind::Missed;
+    if (kind > TraceRecordKind::Event || !readVarint(data_, blockEnd_, at_, deltaUs) ||
+        (hasValue && !readVarint(data_, blockEnd_, at_, value)) ||
+        (kind != TraceRecordKind::Event && (tag & 0x1F) >= LOAD_CELL_MAX_CHANNELS))
+    {
+      // the rest of the block cannot be trusted.
+      corrupt_++;
+      at_ = blockEnd_;
+      continue;
+    }
+    timeUs_ += deltaUs;
+    out.kind = kind;
+    out.channel = tag & 0x1F;
+    out.event = static_cast<TraceEvent>(tag & 0x1F);
+    out.value = unzigzag(value);
+    out.timeUs = timeUs_;
+    out.block = blockNumber_;
+    if (kind == TraceRecordKind::Sample)
+    {
+      out.value += lastRaw_[out.channel];
+      lastRaw_[out.channel] = out.value;
+    }
+    else if (kind == TraceRecordKind::Event)
+    {
+      out.channel = 0;
+    }
+    return true;
+  }
+  return false;
+}
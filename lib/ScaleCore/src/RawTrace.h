@@ -0,0 +1,208 @@
+/**
+ * RawTrace.h
+ *  Raw HX711 traces: every conversion of every channel with its data-ready time, the conversions that were
+ *  missed, and what was done to the scale meanwhile (tare, zero tracking, rate, the known weight on the
+ *  platform). Task1 records them into a compact file; the native build replays a trace through the same
+ *  classes as Task1 (frame aligner, load cell array, tare, acquisition, filter chain, zero tracking, change
+ *  detector), much faster than real time, and compares the weights with the known ones ("replay" scenario).
+ *
+ *  The file is a header block followed by data blocks, all little-endian. Every data block can be decoded
+ *  on its own (the deltas start again in every block), so a block that was dropped only leaves a gap.
+ *
+ *      header : "HXT1", the header length (uint16), channels (uint8), flags (uint8, TRACE_FLAG_*),
+ *               output rate (uint16, SPS), capacity (int32, g), counts per gram of the combined signal
+ *               (float), zero drift in counts per degree and its reference temperature (2 floats),
+ *               then per channel: offset (int32), counts per gram (float), trim (float)
+ *      block  : 0xB7, block number (uint16), length of the records (uint16), time of the block (uint32, us),
+ *               the records
+ *      record : a tag byte, the kind in the 3 high bits and the channel or the event in the low 5 bits, then
+ *                 sample : time since the previous record (varint, us), raw value minus the previous raw
+ *                          value of the channel in this block (zigzag varint)
+ *                 missed : time since the previous record (varint, us)
+ *                 event  : time since the previous record (varint, us), value (zigzag varint)
+ *
+ *  About 6 bytes per conversion at 10 SPS and 5 at 80 SPS, instead of 12 for a RawSample. The times are
+ *  uint32 us like micros(): a record older than the previous one (another channel) is stored as a wrapped
+ *  delta and reads back right.
+ *
+ *  The trace keeps the calibration of the header: a calibration finished while recording is not in it.
+ *
+ *  The recorder never allocates and never blocks: full blocks go to a queue that the writing task (Task5)
+ *  empties; a block that does not fit is dropped and counted.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "LoadCellArray.h"
+#include "SpscQueue.h"
+
+#define TRACE_BLOCK_BYTES   256    // one block, header included
+#define TRACE_BLOCK_MAGIC   0xB7
+#define TRACE_BLOCK_HEADER  9      // magic, number, length, time
+#define TRACE_RECORD_MAX    11     // tag + 2 varints
+
+#define TRACE_FLAG_ZERO_TRACK  0x01   // zero tracking was on when the trace started
+
+#define TRACE_NO_REFERENCE  (-1)   // Reference event: the weight on the platform is not known any more
+
+enum class TraceRecordKind : uint8_t
+{
+  Sample = 0,
+  Missed = 1,
+  Event = 2,
+};
+
+enum class TraceEvent : uint8_t
+{
+  Tare = 0,          // a tare started, value: conversions averaged
+  Reference = 1,     // the known weight on the platform from now on, value: mg (TRACE_NO_REFERENCE: unknown)
+  ZeroTrack = 2,     // zero tracking switched, value: 0/1
+  Rate = 3,          // HX711 output rate changed, value: SPS
+  Temperature = 4,   // board temperature (zero drift), value: 1/100 degree
+};
+
+/**
+ * @brief What the replay needs to weigh like the firmware did when the trace started.
+ */
+struct TraceHeader
+{
+  uint8_t channels = 1;
+  uint8_t flags = 0;
+  uint16_t sps = 10;
+  int32_t maxGrams = 5000;
+  float countsPerGram = 1.0f;      // of the combined signal (what the filter chain converts with)
+  float countsPerDegree = 0.0f;
+  float refTemperatureC = 25.0f;
+  int32_t offsets[LOAD_CELL_MAX_CHANNELS] = {};
+  float channelCountsPerGram[LOAD_CELL_MAX_CHANNELS] = {1, 1, 1, 1, 1, 1, 1, 1};
+  float trims[LOAD_CELL_MAX_CHANNELS] = {1, 1, 1, 1, 1, 1, 1, 1};
+};
+
+struct TraceRecord
+{
+  TraceRecordKind kind;
+  uint8_t channel;      // Sample and Missed
+  TraceEvent event;     // Event
+  int32_t value;        // raw value (Sample) or event value
+  uint32_t timeUs;
+  uint16_t block;       // number of the block it came from
+};
+
+/**
+ * @brief A piece of the file: the header (first) or one data block.
+ */
+struct TraceBlock
+{
+  uint16_t length;
+  bool first;           // the header: the file starts here
+  uint8_t data[TRACE_BLOCK_BYTES];
+};
+
+// recorder (Task1) -> writer (Task5); 8 blocks are ~5 s at 80 SPS.
+using TraceBlockQueue = SpscQueue<TraceBlock, 8>;
+
+/**
+ * @brief Writes the header of a trace.
+ * @return the length, 0 if the buffer is too small.
+ */
+size_t encodeTraceHeader(const TraceHeader &header, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Reads the header at the start of a file.
+ * @return its length, 0 if it is not a trace.
+ */
+size_t decodeTraceHeader(const uint8_t *data, size_t length, TraceHeader &out);
+
+struct TraceRecorderStats
+{
+  uint32_t samples;
+  uint32_t missed;
+  uint32_t events;
+  uint32_t blocks;          // queued, the header included
+  uint32_t bytes;           // queued
+  uint32_t droppedBlocks;   // the queue was full
+};
+
+/**
+ * @brief Records a trace into blocks (one task: Task1). Not thread-safe, but take() may run in another task.
+ */
+class TraceRecorder
+{
+public:
+  /**
+   * @brief Starts a new trace: the header is queued as the first block (the writer starts a new file).
+   * @return false if the queue is full (nothing is recorded then).
+   */
+  bool start(const TraceHeader &header);
+  /**
+   * @brief Ends the trace: the block being filled is queued.
+   */
+  void stop();
+  bool active() const { return active_; }
+
+  void sample(uint8_t channel, int32_t raw, uint32_t readyUs);
+  void missed(uint8_t channel, uint32_t timeUs);
+  void event(TraceEvent event, int32_t value, uint32_t timeUs);
+
+  /**
+   * @brief Takes the oldest finished block (the writing task).
+   */
+  bool take(TraceBlock &out) { return queue_.pop(out); }
+
+  const TraceRecorderStats &stats() const { return stats_; }
+
+private:
+  void open(uint32_t timeUs);
+  void add(uint8_t tag, uint32_t timeUs, bool hasValue, int32_t value);
+  void close();
+  void queue(const TraceBlock &block);
+
+  TraceBlockQueue queue_;
+  TraceBlock block_ = {};
+  bool active_ = false;
+  uint16_t blockNumber_ = 0;
+  uint32_t lastUs_ = 0;
+  int32_t lastRaw_[LOAD_CELL_MAX_CHANNELS] = {};
+  TraceRecorderStats stats_ = {};
+};
+
+/**
+ * @brief Reads the records of a whole trace file (native build, tools).
+ * @details A block with a bad header or a record that runs past its end is skipped (corruptBlocks()); missing
+ *          block numbers are counted as gaps.
+ */
+class TraceReader
+{
+public:
+  TraceReader(const uint8_t *data, size_t length);
+
+  bool valid() const { return at_ != 0; }
+  const TraceHeader &header() const { return header_; }
+
+  /**
+   * @return false at the end of the file.
+   */
+  bool next(TraceRecord &out);
+
+  uint32_t blocks() const { return blocks_; }
+  uint32_t gaps() const { return gaps_; }                  // blocks missing between two blocks
+  uint32_t corruptBlocks() const { return corrupt_; }
+
+private:
+  bool openBlock();
+
+  const uint8_t *data_;
+  size_t length_;
+  size_t at_ = 0;          // next byte of the file
+  size_t blockEnd_ = 0;    // end of the records of the current block
+  TraceHeader header_;
+  bool started_ = false;
+  uint16_t blockNumber_ = 0;
+  uint32_t timeUs_ = 0;
+  int32_t lastRaw_[LOAD_CELL_MAX_CHANNELS] = {};
+  uint32_t blocks_ = 0;
+  uint32_t gaps_ = 0;
+  uint32_t corrupt_ = 0;
+};
@@ -0,0 +1,149 @@
+/**
+ * SampleRing.h
+ *  Lock-free single-producer / multi-consumer ring buffer for load cell samples.
+ *  The acquisition task is the only writer. Any number of readers (display, web server, cloud)
+ *  can take the newest sample, or walk the history with their own cursor, without taking a lock.
+ *
+ *  Every slot carries its own sequence word (a small seqlock):
+ *    - odd  value : the producer is writing the slot right now.
+ *    - even value : the slot holds sample number (value / 2 - 1).
+ *  A reader copies the slot and checks that the sequence word did not change while copying.
+ *  If the producer lapped the reader, the reader skips forward and counts the lost samples.
+ *
+ * @note: This file does not depend on Arduino, so it is also compiled in the native (host) build.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief One raw conversion from the HX711.
+ * @details raw is the sign-extended 24-bit ADC value, timestampUs is the time (in microseconds) at
+ *          which the HX711 pulled DOUT low, seq is the running sample number given by the producer.
+ */
+struct RawSample
+{
+  int32_t  raw;          // 24-bit two's complement value, sign-extended to 32 bits
+  uint32_t timestampUs;  // time of the DOUT falling edge (data ready)
+  uint32_t seq;          // sample number, starts at 0
+};
+
+template <typename T, size_t N>
+class SampleRing
+{
+  static_assert((N & (N - 1)) == 0 && N >= 2, "SampleRing size must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value, "SampleRing only holds trivially copyable samples");
+
+public:
+  static constexpr size_t capacity = N;
+
+  /**
+   * @brief Adds a sample to the ring (producer only).
+   * @details Never blocks. The oldest sample is overwritten when the ring is full.
+   */
+  void push(const T &value)
+  {
+    const uint32_t index = head_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[index & (N - 1)];
+    // mark the slot as "being written" before touching the payload.
+    slot.seq.store(2u * index + 1u, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&slot.value, &value, sizeof(T));
+    // publish the slot, then the new head.
+    slot.seq.store(2u * index + 2u, std::memory_order_release);
+    head_.store(index + 1u, std::memory_order_release);
+  }
+
+  /**
+   * @brief Number of samples pushed since start. Also the cursor value of the next sample.
+   */
+  uint32_t head() const { return head_.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Copies the newest sample into out.
+   * @return false if nothing has been pushed yet.
+   */
+  bool latest(T &out) const
+  {
+    for (;;)
+    {
+      const uint32_t h = head();
+      if (h == 0)
+      {
+        return false;
+      }
+      if (readSlot(h - 1u, out))
+      {
+        return true;
+      }
+      // the producer overwrote the slot while we were copying it; try again with the new head.
+    }
+  }
+
+  /**
+   * @brief Reads the samples a consumer has not seen yet.
+   * @details cursor is owned by the consumer and starts at 0 (or at head() to skip the history).
+   *          Samples that were overwritten before the consumer got to them are skipped and added to lost.
+   * @param cursor: the consumer position, advanced past every sample returned or lost.
+   * @param out: destination array.
+   * @param maxCount: size of the destination array.
+   * @param lost: incremented by the number of samples the consumer missed.
+   * @return: the number of samples copied to out.
+   */
+  size_t read(uint32_t &cursor, T *out, size_t maxCount, uint32_t &lost) const
+  {
+    size_t count = 0;
+    while (count < maxCount)
+    {
+      const uint32_t h = head();
+      if (cursor == h)
+      {
+        break;
+      }
+      // if the producer is more than one lap ahead, jump to the oldest sample still in the ring.
+      if (h - cursor > N)
+      {
+        lost += (h - cursor) - N;
+        cursor = h - N;
+      }
+      if (readSlot(cursor, out[count]))
+      {
+        ++count;
+      }
+      else
+      {
+        ++lost;
+      }
+      ++cursor;
+    }
+    return count;
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> seq{0};
+    T value;
+  };
+
+  // copies sample number index; false if the slot does not (or no longer) hold that sample.
+  bool readSlot(uint32_t index, T &out) const
+  {
+    const Slot &slot = slots_[index & (N - 1)];
+    const uint32_t expected = 2u * index + 2u;
+    if (slot.seq.load(std::memory_order_acquire) != expected)
+    {
+      return false;
+    }
+    std::memcpy(&out, &slot.value, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == expected;
+  }
+
+  Slot slots_[N];
+  std::atomic<uint32_t> head_{0};
+};
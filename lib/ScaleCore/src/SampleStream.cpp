@@ -0,0 +1,58 @@
+/**
+ * SampleStream.cpp
+ *  See SampleStream.h.
+ */
+#include "SampleStream.h"
+
+StreamBatcher::StreamBatcher(uint8_t batchSamples, uint32_t flushUs)
+    : batchSamples_(batchSamples == 0 ? 1 : (batchSamples > TELEMETRY_BATCH_MAX ? TELEMETRY_BATCH_MAX : batchSamples)),
+      flushUs_(flushUs)
+{
+}
+
+uint32_t StreamBatcher::service(const StreamRing &ring, Transport &transport, uint32_t nowUs)
+{
+  uint32_t messages = 0;
+  StreamSample sample;
+  uint32_t lost = 0;
+  while (ring.read(cursor_, &sample, 1, lost) == 1)
+  {
+    // the seq of the samples of a batch is counted up from the first one: a gap starts a new batch.
+    if (count_ != 0 && sample.seq != batch_[count_ - 1].seq + 1u)
+    {
+      messages += send(transport, nowUs) ? 1 : 0;
+    }
+    lost_ += lost;
+    lostTotal_ += lost;
+    lost = 0;
+    batch_[count_++] = sample;
+    if (count_ == batchSamples_)
+    {
+      messages += send(transport, nowUs) ? 1 : 0;
+    }
+  }
+  lost_ += lost;
+  lostTotal_ += lost;
+  if (count_ != 0 && nowUs - batch_[0].timestampUs >= flushUs_)
+  {
+    messages += send(transport, nowUs) ? 1 : 0;
+  }
+  return messages;
+}
+
+bool StreamBatcher::send(Transport &transport, uint32_t nowUs)
+{
+  const size_t length = encodeSampleBatch(batch_, count_, lost_, frame_, sizeof(frame_));
+  const uint32_t latencyUs = nowUs - batch_[0].timestampUs;
+  maxLatencyUs_ = latencyUs > maxLatencyUs_ ? latencyUs : maxLatencyUs_;
+  samplesSent_ += count_;
+  count_ = 0;
+  lost_ = 0;
+  if (transport.clientCount() == 0)
+  {
+    return false;
+  }
+  messagesSent_++;
+  transport.broadcastBinary(frame_, length);
+  return true;
+}
@@ -0,0 +1,72 @@
+/**
+ * SampleStream.h
+ *  Streaming of every sample to the web clients (dynamic mode, see Checkweigher.h).
+ *
+ *  The acquisition task pushes every sample into a StreamRing (lock-free, it never waits for the network).
+ *  The sending task reads the ring with its own cursor and sends the samples in batches of batchSamples per
+ *  WebSocket message (TELEMETRY_FRAME_SAMPLES, see Telemetry.h): one message per client per batch instead
+ *  of one per sample. A batch that is not full is sent anyway once its oldest sample is flushUs old, so
+ *  the clients never wait long for the last samples. Samples the sender was too slow for (overwritten in
+ *  the ring) are counted and reported in the next batch.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Checkweigher.h"
+#include "Hal.h"
+#include "SampleRing.h"
+#include "Telemetry.h"
+
+// 256 samples = 3.2 s at 80 SPS: the sender may fall that far behind before samples are lost.
+using StreamRing = SampleRing<StreamSample, 256>;
+// items of the checkweigher, for the sending task.
+using ItemRing = SampleRing<CheckweighResult, 8>;
+
+class StreamBatcher
+{
+public:
+  /**
+   * @param batchSamples: samples per message, 1..TELEMETRY_BATCH_MAX.
+   * @param flushUs: a partial batch is sent when its oldest sample is this old.
+   */
+  StreamBatcher(uint8_t batchSamples, uint32_t flushUs);
+
+  /**
+   * @brief Reads the new samples and sends the batches that are due (sending task only).
+   *  Samples read while no client is connected are dropped, not kept for the next client.
+   * @return the number of messages sent (each to all the clients).
+   */
+  uint32_t service(const StreamRing &ring, Transport &transport, uint32_t nowUs);
+
+  /**
+   * @brief Skips to the newest sample (e.g. when the first client connects).
+   */
+  void resync(const StreamRing &ring)
+  {
+    cursor_ = ring.head();
+    count_ = 0;
+  }
+
+  uint8_t batchSamples() const { return batchSamples_; }
+  uint32_t samplesSent() const { return samplesSent_; }
+  uint32_t messagesSent() const { return messagesSent_; }
+  uint32_t lost() const { return lostTotal_; }
+  uint32_t maxLatencyUs() const { return maxLatencyUs_; }   // oldest sample of a batch when it was sent
+
+private:
+  bool send(Transport &transport, uint32_t nowUs);
+
+  uint8_t batchSamples_;
+  uint32_t flushUs_;
+  uint32_t cursor_ = 0;
+  StreamSample batch_[TELEMETRY_BATCH_MAX];
+  uint8_t count_ = 0;
+  uint32_t lost_ = 0;           // since the last batch
+  uint8_t frame_[TELEMETRY_BATCH_SIZE(TELEMETRY_BATCH_MAX)];
+  uint32_t samplesSent_ = 0;
+  uint32_t messagesSent_ = 0;
+  uint32_t lostTotal_ = 0;
+  uint32_t maxLatencyUs_ = 0;
+};
@@ -0,0 +1,144 @@
+/**
+ * ScaleProfile.h
+ *  Compile-time description of one scale variant built from this code: wiring, load cells, HX711 gain and
+ *  rate, and the filter settings. A profile is a type with static constexpr members, so everything derived
+ *  from it (capacity, sample period, calibration windows, the fixed-point factor, the filter chain of
+ *  ProfileFilter.h) is folded by the compiler: no variant costs a branch or a byte of RAM at run time.
+ *
+ *      using Profile = KitchenScale;                            // main.cpp, set by SCALE_PROFILE
+ *      ProfileTraits<Profile>::maxGrams                         // 5000, a constant
+ *      ProfileFilterChain<Profile> chain;                       // median, EMA and stability with constant settings
+ *
+ *  A new variant derives from ProfileDefaults, overrides what differs and gets a PlatformIO env
+ *  (build_flags = -DSCALE_PROFILE=...). ProfileTraits checks a profile when it is used (static_assert).
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "FilterChain.h"
+#include "LoadCellArray.h"
+
+/**
+ * @brief Settings every profile starts from: the development board of the project (one 5 kg load cell,
+ *        10 SPS, TM1637 on GPIO 48/47) and the filter settings of FilterConfig.
+ */
+struct ProfileDefaults
+{
+  static constexpr uint8_t displayClkPin = 48;     // TM1637 CLK
+  static constexpr uint8_t displayDioPin = 47;     // TM1637 DIO
+  static constexpr uint8_t displayBrightness = 5;  // 0 (dimmest) .. 7
+  static constexpr uint8_t hx711Gain = 128;        // channel A: 128 or 64
+  static constexpr uint8_t sps = 10;               // HX711 output rate: 10 or 80 (the RATE pin)
+  static constexpr bool dynamic = false;           // checkweigher (SCALE_MODE_DYNAMIC)
+
+  // filter chain (see FilterConfig)
+  static constexpr uint8_t medianWindow = 3;
+  static constexpr Smoothing smoothing = Smoothing::Ema;
+  static constexpr uint8_t emaShift = 3;
+  static constexpr uint8_t averageWindow = 8;
+  static constexpr uint32_t kalmanProcessNoise = 4;
+  static constexpr uint32_t kalmanMeasurementNoise = 400;
+  static constexpr int32_t stepCounts = 2000;
+  static constexpr int32_t stableToleranceMg = 2000;
+  static constexpr uint32_t settleUs = 300000;
+};
+
+/**
+ * @brief Kitchen scale: one 5 kg load cell, static weighing at 10 SPS (the original build).
+ */
+struct KitchenScale : ProfileDefaults
+{
+  static constexpr const char *name = "kitchen";
+  static constexpr uint8_t cells = 1;
+  static constexpr uint8_t doutPins[cells] = {21};
+  static constexpr uint8_t sckPins[cells] = {20};
+  static constexpr float countsPerGram[cells] = {-396.99f};   // default until calibrated (NVS wins)
+  static constexpr float trims[cells] = {1.0f};
+  static constexpr int32_t cellCapacityGrams = 5000;
+};
+
+/**
+ * @brief Platform scale: four 50 kg load cells under the corners (200 kg), heavier filtering.
+ * @note: Corner order seen from the front: 0 front-left, 1 front-right, 2 back-right, 3 back-left.
+ */
+struct PlatformScale : ProfileDefaults
+{
+  static constexpr const char *name = "platform";
+  static constexpr uint8_t cells = 4;
+  static constexpr uint8_t doutPins[cells] = {21, 19, 17, 15};
+  static constexpr uint8_t sckPins[cells] = {20, 18, 16, 14};
+  static constexpr float countsPerGram[cells] = {-39.7f, -39.7f, -39.7f, -39.7f};
+  static constexpr float trims[cells] = {1.0f, 1.0f, 1.0f, 1.0f};
+  static constexpr int32_t cellCapacityGrams = 50000;
+
+  static constexpr uint8_t medianWindow = 5;
+  static constexpr Smoothing smoothing = Smoothing::MovingAverage;
+  static constexpr uint8_t averageWindow = 8;
+  static constexpr int32_t stepCounts = 400;            // ~10 g
+  static constexpr int32_t stableToleranceMg = 20000;   // +/- 20 g: the display shows kg from 10 kg on
+  static constexpr uint32_t settleUs = 500000;
+};
+
+/**
+ * @brief Checkweigher: one 5 kg load cell at 80 SPS, items on a conveyor (SCALE_MODE_DYNAMIC).
+ */
+struct CheckweigherScale : ProfileDefaults
+{
+  static constexpr const char *name = "checkweigher";
+  static constexpr uint8_t cells = 1;
+  static constexpr uint8_t doutPins[cells] = {21};
+  static constexpr uint8_t sckPins[cells] = {20};
+  static constexpr float countsPerGram[cells] = {-396.99f};
+  static constexpr float trims[cells] = {1.0f};
+  static constexpr int32_t cellCapacityGrams = 5000;
+  static constexpr uint8_t sps = 80;
+  static constexpr bool dynamic = true;
+};
+
+/**
+ * @brief What follows from a profile, all constant expressions.
+ */
+template <class P>
+struct ProfileTraits
+{
+  static_assert(P::cells >= 1 && P::cells <= LOAD_CELL_MAX_CHANNELS, "1 to LOAD_CELL_MAX_CHANNELS load cells");
+  static_assert(P::sps == 10 || P::sps == 80, "the HX711 runs at 10 or 80 SPS");
+  static_assert(P::hx711Gain == 128 || P::hx711Gain == 64, "channel A gain is 128 or 64");
+  static_assert(!P::dynamic || P::sps == 80, "the checkweigher needs 80 SPS");
+  static_assert(P::medianWindow >= 1 && P::medianWindow <= MedianFilter::maxWindow && (P::medianWindow & 1) == 1,
+                "median window: odd, up to 9");
+  static_assert(P::averageWindow >= 1 && P::averageWindow <= MovingAverage::maxWindow, "average window: up to 32");
+  static_assert(P::emaShift <= 15, "EMA shift: up to 15");
+  static_assert(P::cellCapacityGrams > 0 && P::cellCapacityGrams * P::cells <= 2000000,
+                "capacity in milligrams must fit an int32_t");
+  static_assert(P::displayBrightness <= 7, "TM1637 brightness: 0..7");
+
+  static constexpr int32_t maxGrams = P::cellCapacityGrams * P::cells;   // the whole platform
+  static constexpr uint32_t samplePeriodUs = 1000000u / P::sps;
+  static constexpr uint32_t samplePeriodMs = 1000u / P::sps;             // Task1's deadline (12 at 80 SPS)
+  static constexpr uint32_t hx711SettleMs = P::sps == 80 ? 50u : 400u;   // power_up() to the first conversion (datasheet)
+  // the calibration windows are times, not sample counts: the load rings for the same time at any rate.
+  static constexpr uint8_t calibrationSamples = static_cast<uint8_t>(1600u / samplePeriodMs);
+  static constexpr uint16_t calibrationTimeoutSamples = static_cast<uint16_t>(30000u / samplePeriodMs);
+  // the default factor of the combined signal (counts per gram of channel 0) as WeightConverter keeps it.
+  static constexpr int32_t mgPerCountQ16 = static_cast<int32_t>((1000.0f * 65536.0f) / P::countsPerGram[0]);
+
+  /**
+   * @brief The same settings for the run-time FilterChain (the "filter" command can change them there).
+   */
+  static constexpr FilterConfig filterConfig()
+  {
+    FilterConfig config;
+    config.medianWindow = P::medianWindow;
+    config.smoothing = P::smoothing;
+    config.emaShift = P::emaShift;
+    config.averageWindow = P::averageWindow;
+    config.kalmanProcessNoise = P::kalmanProcessNoise;
+    config.kalmanMeasurementNoise = P::kalmanMeasurementNoise;
+    config.stepCounts = P::stepCounts;
+    config.stableToleranceMg = P::stableToleranceMg;
+    config.settleUs = P::settleUs;
+    return config;
+  }
+};
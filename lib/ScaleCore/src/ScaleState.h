@@ -0,0 +1,31 @@
+/**
+ * ScaleState.h
+ *  The published state of the scale. Task1 (acquisition) is the only writer; the display, web server
+ *  and cloud tasks take a copy whenever they need it, without the semaphore.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "Snapshot.h"
+
+// ScaleState::flags bits
+#define SCALE_FLAG_STABLE     0x01   // the weight has settled
+#define SCALE_FLAG_OVERLOAD   0x02   // reading above maxScaleValue or below zero
+#define SCALE_FLAG_NOT_READY  0x04   // no fresh sample from the HX711
+
+struct ScaleState
+{
+  int32_t  weight;       // grams (0 when overloaded or not ready)
+  int32_t  weightMg;     // the same weight in milligrams, before rounding to grams
+  int32_t  raw;          // raw HX711 value the weight was computed from
+  uint32_t seq;          // sample number of the raw value
+  uint32_t timestampUs;  // time the raw value was ready
+  uint8_t  flags;        // SCALE_FLAG_*
+
+  bool isStable() const { return (flags & SCALE_FLAG_STABLE) != 0; }
+  bool isOverload() const { return (flags & SCALE_FLAG_OVERLOAD) != 0; }
+  bool isReady() const { return (flags & SCALE_FLAG_NOT_READY) == 0; }
+};
+
+using ScaleStateSnapshot = Snapshot<ScaleState>;
@@ -0,0 +1,39 @@
+/**
+ * Snapshot.h
+ *  Single-writer value that any number of readers can copy without a lock (double-buffered seqlock).
+ *  The writer fills the buffer the readers are NOT using and then publishes it, so a reader only has
+ *  to retry when the writer completes a whole publication while the reader is copying.
+ *  A writer that is preempted half way through never blocks a reader, even one with a higher priority
+ *  on the same core (a plain seqlock would spin forever in that case).
+ *
+ * @note: This is a SampleRing with two slots, where readers only look at the newest one.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "SampleRing.h"
+
+template <typename T>
+class Snapshot
+{
+public:
+  /**
+   * @brief Publishes a new value (writer only, never blocks).
+   */
+  void publish(const T &value) { buffers_.push(value); }
+
+  /**
+   * @brief Copies the newest value.
+   * @return false if nothing was published yet.
+   */
+  bool read(T &out) const { return buffers_.latest(out); }
+
+  /**
+   * @brief Number of publications so far. Readers can compare it to see if anything changed.
+   */
+  uint32_t version() const { return buffers_.head(); }
+
+private:
+  SampleRing<T, 2> buffers_;
+};
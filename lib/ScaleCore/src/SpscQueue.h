@@ -0,0 +1,58 @@
+/**
+ * SpscQueue.h
+ *  Bounded queue between exactly one producer task and one consumer task, without a lock.
+ *  Unlike SampleRing, nothing is overwritten: push() fails when the queue is full, so the producer can
+ *  tell its client right away instead of losing the entry.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  /**
+   * @brief Adds an entry (producer only, never blocks).
+   * @return false if the queue is full.
+   */
+  bool push(const T &value)
+  {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= N)
+    {
+      return false;
+    }
+    slots_[tail & (N - 1)] = value;
+    tail_.store(tail + 1u, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest entry (consumer only, never blocks).
+   * @return false if the queue is empty.
+   */
+  bool pop(T &out)
+  {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    out = slots_[head & (N - 1)];
+    head_.store(head + 1u, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+
+private:
+  T slots_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+};
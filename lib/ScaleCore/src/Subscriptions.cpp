@@ -0,0 +1,70 @@
+/**
+ * Subscriptions.cpp
+ *  See Subscriptions.h.
+ */
+#include "Subscriptions.h"
+
+#include <cstdlib>
+
+Subscription defaultSubscription(int32_t deadbandMg, uint32_t heartbeatUs, uint8_t format)
+{
+  Subscription subscription;
+  subscription.intervalUs = 0;
+  subscription.heartbeatUs = heartbeatUs;
+  subscription.deadbandMg = deadbandMg;
+  subscription.alarmMg = SUBSCRIPTION_NO_ALARM;
+  subscription.format = format;
+  subscription.fields = TELEMETRY_FIELD_WEIGHT;
+  return subscription;
+}
+
+bool SubscriberState::due(const Subscription &subscription, const ScaleState &state, uint32_t nowUs, uint32_t &waitUs)
+{
+  bool wanted;
+  if (subscription.alarmMg != SUBSCRIPTION_NO_ALARM)
+  {
+    const bool above = state.weightMg >= subscription.alarmMg;
+    if (fresh_)
+    {
+      // an alarm client only hears of crossings: the side it starts on is not one.
+      fresh_ = false;
+      above_ = above;
+      sentUs_ = nowUs - subscription.intervalUs;
+      return false;
+    }
+    wanted = above != above_;
+  }
+  else
+  {
+    const uint32_t sinceUs = nowUs - sentUs_;
+    wanted = fresh_ || state.flags != flags_ || std::abs(state.weightMg - weightMg_) > subscription.deadbandMg ||
+             (subscription.heartbeatUs != 0 && sinceUs >= subscription.heartbeatUs);
+    if (!wanted && subscription.heartbeatUs != 0)
+    {
+      const uint32_t heartbeatWaitUs = subscription.heartbeatUs - sinceUs;
+      waitUs = heartbeatWaitUs < waitUs ? heartbeatWaitUs : waitUs;
+    }
+  }
+  if (!wanted)
+  {
+    return false;
+  }
+  const uint32_t sinceUs = nowUs - sentUs_;
+  if (!fresh_ && sinceUs < subscription.intervalUs)
+  {
+    // held back by the rate: the newest state goes out when the interval is over.
+    const uint32_t rateWaitUs = subscription.intervalUs - sinceUs;
+    waitUs = rateWaitUs < waitUs ? rateWaitUs : waitUs;
+    return false;
+  }
+  return true;
+}
+
+void SubscriberState::sent(const Subscription &subscription, const ScaleState &state, uint32_t nowUs)
+{
+  fresh_ = false;
+  flags_ = state.flags;
+  weightMg_ = state.weightMg;
+  above_ = subscription.alarmMg != SUBSCRIPTION_NO_ALARM && state.weightMg >= subscription.alarmMg;
+  sentUs_ = nowUs;
+}
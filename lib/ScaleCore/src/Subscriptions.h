@@ -0,0 +1,371 @@
+/**
+ * Subscriptions.h
+ *  What every web client wants of the weight, and the fan-out that sends it (Task3).
+ *  A dashboard asks for 10 messages per second, a logger for one per second with all the fields, an alarm
+ *  client only for the moments the weight crosses its threshold; the page itself keeps the old behaviour
+ *  (every change of a gram, a heartbeat). Per tick every distinct payload (format and fields) is encoded
+ *  once and shared by all the clients that get it; a client that cannot take its messages loses the
+ *  oldest ones, it never makes the others (or Task3) wait.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Hal.h"
+#include "ScaleState.h"
+#include "Telemetry.h"
+
+#define SUBSCRIPTION_JSON      0
+#define SUBSCRIPTION_BINARY    1            // the 16 byte weight frame (the fields do not apply)
+#define SUBSCRIPTION_NO_ALARM  INT32_MIN    // Subscription::alarmMg: not an alarm client
+
+struct Subscription
+{
+  uint32_t intervalUs;    // at least this long between two messages (the rate), 0 = no limit
+  uint32_t heartbeatUs;   // a message at least this often without a change, 0 = never
+  int32_t  deadbandMg;    // only when the weight moved more than this since the last message (or the flags changed)
+  int32_t  alarmMg;       // not SUBSCRIPTION_NO_ALARM: only when the weight crosses it, nothing else
+  uint8_t  format;        // SUBSCRIPTION_JSON / SUBSCRIPTION_BINARY
+  uint8_t  fields;        // TELEMETRY_FIELD_* of the JSON message
+
+  bool operator==(const Subscription &other) const
+  {
+    return intervalUs == other.intervalUs && heartbeatUs == other.heartbeatUs && deadbandMg == other.deadbandMg &&
+           alarmMg == other.alarmMg && format == other.format && fields == other.fields;
+  }
+  bool operator!=(const Subscription &other) const { return !(*this == other); }
+
+  // the payload this client gets: the same key, the same bytes.
+  uint8_t payloadKey() const { return format == SUBSCRIPTION_BINARY ? 0xFF : (fields & TELEMETRY_FIELD_ALL); }
+};
+
+/**
+ * @brief The subscription of a client that did not ask for anything: the weight on every change of
+ *        deadbandMg and every heartbeatUs, in the format of the build.
+ */
+Subscription defaultSubscription(int32_t deadbandMg, uint32_t heartbeatUs, uint8_t format);
+
+/**
+ * @brief Decides, for one client, when a new state is worth a message.
+ */
+class SubscriberState
+{
+public:
+  /**
+   * @brief The next message goes out at once (new client, new subscription).
+   */
+  void reset() { fresh_ = true; }
+
+  /**
+   * @brief Whether the state is sent now.
+   * @param waitUs: set when the client wants the state but its rate does not allow it yet, or to the next
+   *        heartbeat: how long until it should be looked at again (left alone otherwise).
+   */
+  bool due(const Subscription &subscription, const ScaleState &state, uint32_t nowUs, uint32_t &waitUs);
+
+  /**
+   * @brief Records the state that was sent.
+   */
+  void sent(const Subscription &subscription, const ScaleState &state, uint32_t nowUs);
+
+private:
+  bool fresh_ = true;
+  bool above_ = false;   // alarm clients: the side of the threshold of the last message
+  uint8_t flags_ = 0;
+  int32_t weightMg_ = 0;
+  uint32_t sentUs_ = 0;
+};
+
+struct FanOutStats
+{
+  uint32_t ticks;        // publish() calls
+  uint32_t encodes;      // payloads encoded
+  uint32_t messages;     // messages handed to the transport (a broadcast counts once per client)
+  uint32_t broadcasts;   // ticks where every client got the same payload with one broadcast
+  uint32_t drops;        // queued messages dropped because the client was too slow
+  uint32_t failures;     // sends the transport refused (the client is left alone for a while)
+};
+
+/**
+ * @brief Sends the weight to up to Clients web clients, each with its own subscription (Task3 only).
+ * @details Every client has a queue of Depth messages; the queued payloads live in a pool and are shared
+ *          (reference counted). When the transport refuses a send, the client is retried after backoffUs
+ *          and, if new messages keep coming, loses the oldest one.
+ */
+template <size_t Clients, size_t Depth>
+class FanOut
+{
+  static_assert(Clients >= 1 && Clients <= 32, "the active clients are a 32 bit mask");
+  static_assert(Depth >= 1 && Depth <= 255, "Depth must fit the queue counters");
+
+public:
+  explicit FanOut(uint32_t backoffUs = 100000) : backoffUs_(backoffUs) {}
+
+  /**
+   * @brief The clients that are connected and want the weight (bit i: client i). A client that comes gets
+   *        a message at once, one that goes loses its queue.
+   */
+  void setActive(uint32_t mask)
+  {
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      const uint32_t bit = 1u << client;
+      if ((mask & bit) != 0 && (active_ & bit) == 0)
+      {
+        clients_[client].state.reset();
+        clients_[client].retryUs = 0;
+        clients_[client].backoff = false;
+      }
+      else if ((mask & bit) == 0 && (active_ & bit) != 0)
+      {
+        clear(client);
+      }
+    }
+    active_ = mask & allClients();
+  }
+  uint32_t active() const { return active_; }
+
+  /**
+   * @brief Sets the subscription of a client (nothing happens if it did not change).
+   */
+  void subscribe(uint8_t client, const Subscription &subscription)
+  {
+    if (client < Clients && clients_[client].subscription != subscription)
+    {
+      clients_[client].subscription = subscription;
+      clients_[client].state.reset();
+    }
+  }
+  const Subscription &subscription(uint8_t client) const { return clients_[client].subscription; }
+
+  /**
+   * @brief Sends the state to the clients it is due for, then whatever the clients still have queued.
+   * @details One broadcast when every client gets the same payload and nothing is queued, one send per
+   *          client otherwise. Call it for every new state and when waitUs() is over.
+   */
+  void publish(const ScaleState &state, uint32_t nowUs, Transport &transport)
+  {
+    stats_.ticks++;
+    waitUs_ = UINT32_MAX;
+    uint32_t due = 0;
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      Client &c = clients_[client];
+      if ((active_ & (1u << client)) != 0 && c.state.due(c.subscription, state, nowUs, waitUs_))
+      {
+        due |= 1u << client;
+        c.state.sent(c.subscription, state, nowUs);
+      }
+    }
+    if (due != 0 && !broadcast(due, state, transport))
+    {
+      enqueue(due, state);
+    }
+    drain(nowUs, transport);
+  }
+
+  /**
+   * @brief How long Task3 may sleep before publish() has something to do without a new state
+   *        (a change held back by a rate, a heartbeat, a retry). UINT32_MAX: nothing.
+   */
+  uint32_t waitUs() const { return waitUs_; }
+
+  size_t queued(uint8_t client) const { return clients_[client].count; }
+  const FanOutStats &stats() const { return stats_; }
+
+private:
+  struct Payload
+  {
+    uint8_t data[TELEMETRY_JSON_MAX];
+    uint8_t length;
+    uint8_t refs;   // queue entries that point at it, 0 = free
+    bool binary;
+  };
+
+  struct Client
+  {
+    Subscription subscription = defaultSubscription(0, 0, SUBSCRIPTION_JSON);
+    SubscriberState state;
+    uint16_t queue[Depth];   // pool indexes, oldest at head
+    uint8_t head = 0;
+    uint8_t count = 0;
+    bool backoff = false;
+    uint32_t retryUs = 0;
+  };
+
+  static constexpr uint32_t allClients() { return Clients == 32 ? 0xFFFFFFFFu : (1u << Clients) - 1u; }
+
+  static size_t encode(uint8_t key, const ScaleState &state, uint8_t *out)
+  {
+    if (key == 0xFF)
+    {
+      return encodeWeightFrame(state, out, TELEMETRY_JSON_MAX);
+    }
+    return encodeWeightJsonFields(state, key, reinterpret_cast<char *>(out), TELEMETRY_JSON_MAX);
+  }
+
+  // every connected client is due, wants the same payload and has nothing queued: one broadcast.
+  bool broadcast(uint32_t due, const ScaleState &state, Transport &transport)
+  {
+    size_t count = 0;
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      if ((active_ & (1u << client)) != 0)
+      {
+        const Client &c = clients_[client];
+        if ((due & (1u << client)) == 0 || c.count != 0 ||
+            c.subscription.payloadKey() != clients_[firstClient(due)].subscription.payloadKey())
+        {
+          return false;
+        }
+        count++;
+      }
+    }
+    if (count != transport.clientCount())
+    {
+      return false;   // the transport has clients that do not want the weight
+    }
+    const uint8_t key = clients_[firstClient(due)].subscription.payloadKey();
+    const size_t length = encode(key, state, scratch_);
+    stats_.encodes++;
+    stats_.broadcasts++;
+    stats_.messages += static_cast<uint32_t>(count);
+    const bool ok = key == 0xFF ? transport.broadcastBinary(scratch_, length)
+                                : transport.broadcastText(reinterpret_cast<const char *>(scratch_), length);
+    stats_.failures += ok ? 0 : 1;
+    return true;
+  }
+
+  void enqueue(uint32_t due, const ScaleState &state)
+  {
+    // room first (drop the oldest), so the pool always has a free slot for the new payloads.
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      Client &c = clients_[client];
+      if ((due & (1u << client)) != 0 && c.count == Depth)
+      {
+        release(c.queue[c.head]);
+        c.head = static_cast<uint8_t>((c.head + 1) % Depth);
+        c.count--;
+        stats_.drops++;
+      }
+    }
+    // one payload per key for this tick.
+    uint8_t keys[Clients];
+    uint16_t slots[Clients];
+    size_t encoded = 0;
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      if ((due & (1u << client)) == 0)
+      {
+        continue;
+      }
+      Client &c = clients_[client];
+      const uint8_t key = c.subscription.payloadKey();
+      size_t k = 0;
+      while (k < encoded && keys[k] != key)
+      {
+        k++;
+      }
+      if (k == encoded)
+      {
+        const uint16_t slot = allocate();
+        Payload &payload = pool_[slot];
+        payload.length = static_cast<uint8_t>(encode(key, state, payload.data));
+        payload.binary = key == 0xFF;
+        stats_.encodes++;
+        keys[encoded] = key;
+        slots[encoded] = slot;
+        encoded++;
+      }
+      pool_[slots[k]].refs++;
+      c.queue[(c.head + c.count) % Depth] = slots[k];
+      c.count++;
+    }
+  }
+
+  void drain(uint32_t nowUs, Transport &transport)
+  {
+    for (uint8_t client = 0; client < Clients; client++)
+    {
+      Client &c = clients_[client];
+      if (c.count == 0)
+      {
+        continue;
+      }
+      if (c.backoff && static_cast<int32_t>(nowUs - c.retryUs) < 0)
+      {
+        keepWaitUs(c.retryUs - nowUs);
+        continue;
+      }
+      c.backoff = false;
+      while (c.count > 0)
+      {
+        const Payload &payload = pool_[c.queue[c.head]];
+        const bool ok = payload.binary ? transport.sendBinary(client, payload.data, payload.length)
+                                       : transport.sendText(client, reinterpret_cast<const char *>(payload.data),
+                                                            payload.length);
+        if (!ok)
+        {
+          // the client does not take more now: try again later, the queue keeps the newest messages.
+          stats_.failures++;
+          c.backoff = true;
+          c.retryUs = nowUs + backoffUs_;
+          keepWaitUs(backoffUs_);
+          break;
+        }
+        stats_.messages++;
+        release(c.queue[c.head]);
+        c.head = static_cast<uint8_t>((c.head + 1) % Depth);
+        c.count--;
+      }
+    }
+  }
+
+  void clear(uint8_t client)
+  {
+    Client &c = clients_[client];
+    while (c.count > 0)
+    {
+      release(c.queue[c.head]);
+      c.head = static_cast<uint8_t>((c.head + 1) % Depth);
+      c.count--;
+    }
+  }
+
+  uint16_t allocate()
+  {
+    for (uint16_t slot = 0; slot < Clients * Depth; slot++)
+    {
+      if (pool_[slot].refs == 0)
+      {
+        return slot;
+      }
+    }
+    return 0;   // not reached: every queue entry holds at most one slot and there is room for all of them
+  }
+
+  void release(uint16_t slot) { pool_[slot].refs--; }
+
+  void keepWaitUs(uint32_t us) { waitUs_ = us < waitUs_ ? us : waitUs_; }
+
+  static uint8_t firstClient(uint32_t mask)
+  {
+    uint8_t client = 0;
+    while ((mask & (1u << client)) == 0)
+    {
+      client++;
+    }
+    return client;
+  }
+
+  const uint32_t backoffUs_;
+  uint32_t active_ = 0;
+  uint32_t waitUs_ = UINT32_MAX;
+  Client clients_[Clients];
+  Payload pool_[Clients * Depth] = {};
+  uint8_t scratch_[TELEMETRY_JSON_MAX];
+  FanOutStats stats_ = {};
+};
@@ -0,0 +1,129 @@
+/**
+ * TaskTiming.h
+ *  Run time, release jitter and deadline misses of one task, measured by the task itself:
+ *  it calls begin() when it wakes up for a cycle and end() when the cycle is done.
+ *    - periodic task (periodUs > 0): the jitter is how late the task started compared to its release time
+ *      (previous release + period). A cycle misses its deadline when jitter + run time > deadlineUs.
+ *      A task that slipped by more than a whole period is re-synchronised (and the cycle counts as missed).
+ *    - event driven task (periodUs = 0): there is no release time, only the run time is checked, unless the
+ *      task knows when it was released (beginReleased(), e.g. the time of an interrupt).
+ *  The counters are written by the measured task only. Other tasks may read them for a report; a value
+ *  read while the task updates it can be one cycle old, which is fine for a report.
+ */
+#pragma once
+
+#include <cstdint>
+
+struct TaskTimingReport
+{
+  uint32_t cycles;
+  uint32_t misses;
+  uint32_t jitterAvgUs;
+  uint32_t jitterMaxUs;
+  uint32_t runAvgUs;
+  uint32_t runMaxUs;
+};
+
+class TaskTiming
+{
+public:
+  explicit TaskTiming(uint32_t periodUs = 0, uint32_t deadlineUs = 0) { configure(periodUs, deadlineUs); }
+
+  /**
+   * @param deadlineUs: 0 = the period (or no deadline for an event driven task).
+   */
+  void configure(uint32_t periodUs, uint32_t deadlineUs)
+  {
+    periodUs_ = periodUs;
+    deadlineUs_ = deadlineUs != 0 ? deadlineUs : periodUs;
+  }
+
+  void begin(uint32_t nowUs)
+  {
+    startUs_ = nowUs;
+    jitterUs_ = 0;
+    if (periodUs_ != 0)
+    {
+      if (!started_)
+      {
+        releaseUs_ = nowUs;
+        started_ = true;
+      }
+      else
+      {
+        releaseUs_ += periodUs_;
+        const int32_t late = static_cast<int32_t>(nowUs - releaseUs_);
+        jitterUs_ = late > 0 ? static_cast<uint32_t>(late) : static_cast<uint32_t>(-late);
+        if (late > static_cast<int32_t>(periodUs_))
+        {
+          releaseUs_ = nowUs;   // more than a period behind: start counting again from now
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Starts a cycle of an event driven task whose release time is known (e.g. the time of the
+   *        interrupt that woke it): the jitter is the wake-up latency.
+   */
+  void beginReleased(uint32_t releaseUs, uint32_t nowUs)
+  {
+    startUs_ = nowUs;
+    const int32_t late = static_cast<int32_t>(nowUs - releaseUs);
+    jitterUs_ = late > 0 ? static_cast<uint32_t>(late) : 0;
+  }
+
+  void end(uint32_t nowUs)
+  {
+    const uint32_t runUs = nowUs - startUs_;
+    cycles_++;
+    jitterSumUs_ += jitterUs_;
+    runSumUs_ += runUs;
+    jitterMaxUs_ = jitterUs_ > jitterMaxUs_ ? jitterUs_ : jitterMaxUs_;
+    runMaxUs_ = runUs > runMaxUs_ ? runUs : runMaxUs_;
+    if (deadlineUs_ != 0 && ((periodUs_ != 0 && jitterUs_ > periodUs_) || jitterUs_ + runUs > deadlineUs_))
+    {
+      misses_++;
+    }
+  }
+
+  /**
+   * @brief The task slept longer than its period on purpose (e.g. the batched network wake-ups of the
+   *        low-power mode): the next begin() is a new release time, not a late cycle.
+   */
+  void resync() { started_ = false; }
+
+  /**
+   * @brief Jitter of the current (or last) cycle.
+   */
+  uint32_t lastJitterUs() const { return jitterUs_; }
+
+  TaskTimingReport report() const
+  {
+    TaskTimingReport r;
+    r.cycles = cycles_;
+    r.misses = misses_;
+    r.jitterAvgUs = cycles_ ? static_cast<uint32_t>(jitterSumUs_ / cycles_) : 0;
+    r.jitterMaxUs = jitterMaxUs_;
+    r.runAvgUs = cycles_ ? static_cast<uint32_t>(runSumUs_ / cycles_) : 0;
+    r.runMaxUs = runMaxUs_;
+    return r;
+  }
+
+  uint32_t periodUs() const { return periodUs_; }
+  uint32_t deadlineUs() const { return deadlineUs_; }
+
+private:
+  uint32_t periodUs_ = 0;
+  uint32_t deadlineUs_ = 0;
+  bool started_ = false;
+  uint32_t releaseUs_ = 0;
+  uint32_t startUs_ = 0;
+  uint32_t jitterUs_ = 0;
+  uint32_t cycles_ = 0;
+  uint32_t misses_ = 0;
+  uint64_t jitterSumUs_ = 0;
+  uint64_t runSumUs_ = 0;
+  uint32_t jitterMaxUs_ = 0;
+  uint32_t runMaxUs_ = 0;
+};
@@ -0,0 +1,241 @@
+/**
+ * Telemetry.cpp
+ *  See Telemetry.h.
+ */
+#include "Telemetry.h"
+
+#include <cstring>
+
+namespace
+{
+
+// writes value in decimal, returns the number of characters.
+size_t writeUnsigned(uint32_t value, char *out)
+{
+  char digits[10];
+  size_t count = 0;
+  do
+  {
+    digits[count++] = static_cast<char>('0' + value % 10u);
+    value /= 10u;
+  } while (value != 0);
+  size_t length = 0;
+  while (count > 0)
+  {
+    out[length++] = digits[--count];
+  }
+  return length;
+}
+
+size_t writeDecimal(int32_t value, char *out)
+{
+  if (value < 0)
+  {
+    out[0] = '-';
+    return 1 + writeUnsigned(0u - static_cast<uint32_t>(value), out + 1);
+  }
+  return writeUnsigned(static_cast<uint32_t>(value), out);
+}
+
+void writeLe32(uint8_t *out, uint32_t value)
+{
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+void writeLe16(uint8_t *out, uint16_t value)
+{
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+uint16_t readLe16(const uint8_t *in) { return static_cast<uint16_t>(in[0] | (in[1] << 8)); }
+
+uint32_t readLe32(const uint8_t *in)
+{
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) | (static_cast<uint32_t>(in[2]) << 16) |
+         (static_cast<uint32_t>(in[3]) << 24);
+}
+
+}  // namespace
+
+size_t encodeWeightJson(const ScaleState &state, char *buffer, size_t size)
+{
+  static const char prefix[] = "{\"weight\":";
+  const size_t prefixLength = sizeof(prefix) - 1;
+  // prefix + sign + 10 digits + '}' + '\0'
+  if (size < prefixLength + 13)
+  {
+    return 0;
+  }
+  std::memcpy(buffer, prefix, prefixLength);
+  size_t length = prefixLength + writeDecimal(state.weight, buffer + prefixLength);
+  buffer[length++] = '}';
+  buffer[length] = '\0';
+  return length;
+}
+
+size_t encodeWeightJsonFields(const ScaleState &state, uint8_t fields, char *buffer, size_t size)
+{
+  struct Field
+  {
+    uint8_t bit;
+    const char *name;   // with the quotes, the colon and the separator
+  };
+  static const Field names[] = {
+      {TELEMETRY_FIELD_WEIGHT, "\"weight\":"}, {TELEMETRY_FIELD_MG, "\"mg\":"},   {TELEMETRY_FIELD_FLAGS, "\"flags\":"},
+      {TELEMETRY_FIELD_RAW, "\"raw\":"},       {TELEMETRY_FIELD_SEQ, "\"seq\":"}, {TELEMETRY_FIELD_TIME, "\"us\":"},
+  };
+  if (size < TELEMETRY_JSON_MAX)
+  {
+    return 0;
+  }
+  if ((fields & TELEMETRY_FIELD_ALL) == 0)
+  {
+    fields = TELEMETRY_FIELD_WEIGHT;
+  }
+  const int32_t values[] = {state.weight, state.weightMg, static_cast<int32_t>(state.flags), state.raw};
+  size_t length = 0;
+  buffer[length++] = '{';
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if ((fields & names[i].bit) == 0)
+    {
+      continue;
+    }
+    if (length > 1)
+    {
+      buffer[length++] = ',';
+    }
+    const size_t nameLength = std::strlen(names[i].name);
+    std::memcpy(buffer + length, names[i].name, nameLength);
+    length += nameLength;
+    if (i < 4)
+    {
+      length += writeDecimal(values[i], buffer + length);
+    }
+    else
+    {
+      length += writeUnsigned(i == 4 ? state.seq : state.timestampUs, buffer + length);
+    }
+  }
+  buffer[length++] = '}';
+  buffer[length] = '\0';
+  return length;
+}
+
+size_t encodeWeightFrame(const ScaleState &state, uint8_t *buffer, size_t size)
+{
+  if (size < TELEMETRY_FRAME_SIZE)
+  {
+    return 0;
+  }
+  buffer[0] = TELEMETRY_MAGIC;
+  buffer[1] = TELEMETRY_FRAME_WEIGHT;
+  buffer[2] = state.flags;
+  buffer[3] = 0;
+  writeLe32(buffer + 4, state.seq);
+  writeLe32(buffer + 8, state.timestampUs);
+  writeLe32(buffer + 12, static_cast<uint32_t>(state.weightMg));
+  return TELEMETRY_FRAME_SIZE;
+}
+
+bool decodeWeightFrame(const uint8_t *buffer, size_t size, ScaleState &state)
+{
+  if (size < TELEMETRY_FRAME_SIZE || buffer[0] != TELEMETRY_MAGIC || buffer[1] != TELEMETRY_FRAME_WEIGHT)
+  {
+    return false;
+  }
+  state = ScaleState();
+  state.flags = buffer[2];
+  state.seq = readLe32(buffer + 4);
+  state.timestampUs = readLe32(buffer + 8);
+  state.weightMg = static_cast<int32_t>(readLe32(buffer + 12));
+  state.weight = (state.weightMg + (state.weightMg >= 0 ? 500 : -500)) / 1000;
+  return true;
+}
+
+size_t encodeSampleBatch(const StreamSample *samples, size_t count, uint32_t lost, uint8_t *buffer, size_t size)
+{
+  if (count == 0 || count > TELEMETRY_BATCH_MAX || size < TELEMETRY_BATCH_SIZE(count))
+  {
+    return 0;
+  }
+  buffer[0] = TELEMETRY_MAGIC;
+  buffer[1] = TELEMETRY_FRAME_SAMPLES;
+  buffer[2] = static_cast<uint8_t>(count);
+  buffer[3] = 0;
+  writeLe32(buffer + 4, samples[0].seq);
+  writeLe32(buffer + 8, samples[0].timestampUs);
+  writeLe32(buffer + 12, lost);
+  uint8_t *out = buffer + 16;
+  for (size_t i = 0; i < count; i++)
+  {
+    const uint32_t deltaUs = i == 0 ? 0 : samples[i].timestampUs - samples[i - 1].timestampUs;
+    writeLe32(out, static_cast<uint32_t>(samples[i].weightMg));
+    writeLe16(out + 4, deltaUs / 10 > 0xFFFFu ? 0xFFFFu : static_cast<uint16_t>(deltaUs / 10));
+    out += 6;
+  }
+  return TELEMETRY_BATCH_SIZE(count);
+}
+
+size_t decodeSampleBatch(const uint8_t *buffer, size_t size, StreamSample *samples, size_t maxCount, uint32_t &lost)
+{
+  if (size < TELEMETRY_BATCH_SIZE(1) || buffer[0] != TELEMETRY_MAGIC || buffer[1] != TELEMETRY_FRAME_SAMPLES)
+  {
+    return 0;
+  }
+  const size_t count = buffer[2];
+  if (count == 0 || count > maxCount || size < TELEMETRY_BATCH_SIZE(count))
+  {
+    return 0;
+  }
+  lost = readLe32(buffer + 12);
+  uint32_t timestampUs = readLe32(buffer + 8);
+  const uint8_t *in = buffer + 16;
+  for (size_t i = 0; i < count; i++)
+  {
+    timestampUs += readLe16(in + 4) * 10u;
+    samples[i].weightMg = static_cast<int32_t>(readLe32(in));
+    samples[i].timestampUs = timestampUs;
+    samples[i].seq = readLe32(buffer + 4) + static_cast<uint32_t>(i);
+    in += 6;
+  }
+  return count;
+}
+
+size_t encodeItemJson(const CheckweighResult &item, char *buffer, size_t size)
+{
+  // {"item":{"n":<10>,"mg":<11>,"peakMg":<11>,"ms":<10>,"plateau":1,"stuck":1}} is at most 100 characters.
+  if (size < 112)
+  {
+    return 0;
+  }
+  struct Field
+  {
+    const char *name;
+    int32_t value;
+  };
+  const Field fields[] = {
+      {"{\"item\":{\"n\":", static_cast<int32_t>(item.item)},
+      {",\"mg\":", item.weightMg},
+      {",\"peakMg\":", item.peakMg},
+      {",\"ms\":", static_cast<int32_t>(item.durationUs / 1000)},
+      {",\"plateau\":", (item.flags & CHECKWEIGH_PLATEAU) != 0 ? 1 : 0},
+      {",\"stuck\":", (item.flags & CHECKWEIGH_TIMEOUT) != 0 ? 1 : 0},
+  };
+  size_t length = 0;
+  for (const Field &field : fields)
+  {
+    const size_t nameLength = std::strlen(field.name);
+    std::memcpy(buffer + length, field.name, nameLength);
+    length += nameLength;
+    length += writeDecimal(field.value, buffer + length);
+  }
+  buffer[length++] = '}';
+  buffer[length++] = '}';
+  buffer[length] = '\0';
+  return length;
+}
@@ -0,0 +1,107 @@
+/**
+ * Telemetry.h
+ *  Encoding of the weight messages sent to the web clients.
+ *  The encoders write into a caller supplied buffer and never allocate.
+ *
+ *  Two formats are available (the binary format also carries the metrics frame, see Metrics.h):
+ *    - JSON   : {"weight":123}, what the web page has always received (text frame). A client can ask for
+ *               more fields (TELEMETRY_FIELD_*, see Subscriptions.h), in this order:
+ *               {"weight":123,"mg":123456,"flags":1,"raw":-51234,"seq":812,"us":81234567}
+ *    - binary : a fixed 16 byte frame (binary frame), all fields little-endian:
+ *
+ *        offset  size  field
+ *          0      1    magic 'W' (0x57)
+ *          1      1    frame type (TELEMETRY_FRAME_WEIGHT)
+ *          2      1    status bits (SCALE_FLAG_*)
+ *          3      1    reserved (0)
+ *          4      4    sequence number (uint32, sample number)
+ *          8      4    timestamp (uint32, microseconds since boot)
+ *         12      4    weight (int32, milligrams)
+ *
+ *  In the dynamic (checkweigher) mode every sample is streamed as well, in batches (binary frame):
+ *
+ *        offset  size  field
+ *          0      1    magic 'W' (0x57)
+ *          1      1    frame type (TELEMETRY_FRAME_SAMPLES)
+ *          2      1    number of samples n (1..TELEMETRY_BATCH_MAX)
+ *          3      1    reserved (0)
+ *          4      4    sequence number of the first sample (uint32, the next ones follow without a gap)
+ *          8      4    timestamp of the first sample (uint32, microseconds since boot)
+ *         12      4    samples lost just before this batch (uint32, the sender was too slow)
+ *         16     6*n   per sample: weight (int32, milligrams, not filtered),
+ *                      time since the previous sample (uint16, 10 us units, 0 for the first one)
+ *
+ *  and every item that passed is sent as JSON (see Checkweigher.h):
+ *    {"item":{"n":12,"mg":250120,"peakMg":263400,"ms":420,"plateau":1,"stuck":0}}
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Checkweigher.h"
+#include "ScaleState.h"
+
+/**
+ * @brief Writes the JSON message understood by the web page: {"weight":123}
+ * @return the length of the message, 0 if the buffer is too small.
+ */
+size_t encodeWeightJson(const ScaleState &state, char *buffer, size_t size);
+
+// fields of the JSON weight message (a bit mask, see above).
+#define TELEMETRY_FIELD_WEIGHT   0x01   // "weight": grams
+#define TELEMETRY_FIELD_MG       0x02   // "mg": milligrams
+#define TELEMETRY_FIELD_FLAGS    0x04   // "flags": SCALE_FLAG_*
+#define TELEMETRY_FIELD_RAW      0x08   // "raw": HX711 counts
+#define TELEMETRY_FIELD_SEQ      0x10   // "seq": sample number
+#define TELEMETRY_FIELD_TIME     0x20   // "us": time the sample was ready
+#define TELEMETRY_FIELD_ALL      0x3F
+#define TELEMETRY_JSON_MAX       112    // the longest JSON weight message, '\0' included
+
+/**
+ * @brief Writes the JSON weight message with the given fields (TELEMETRY_FIELD_WEIGHT alone gives exactly
+ *        what encodeWeightJson() writes; no field at all gives the weight too).
+ * @return the length of the message, 0 if the buffer is too small (TELEMETRY_JSON_MAX is always enough).
+ */
+size_t encodeWeightJsonFields(const ScaleState &state, uint8_t fields, char *buffer, size_t size);
+
+#define TELEMETRY_MAGIC          0x57   // 'W'
+#define TELEMETRY_FRAME_WEIGHT   0x01
+#define TELEMETRY_FRAME_METRICS  0x02   // runtime metrics, see Metrics.h
+#define TELEMETRY_FRAME_SAMPLES  0x03   // batch of stream samples (dynamic mode)
+#define TELEMETRY_FRAME_SIZE     16
+#define TELEMETRY_BATCH_MAX      32
+#define TELEMETRY_BATCH_SIZE(n)  (16 + 6 * (n))
+
+/**
+ * @brief Writes the binary weight frame (TELEMETRY_FRAME_SIZE bytes).
+ * @return TELEMETRY_FRAME_SIZE, 0 if the buffer is too small.
+ */
+size_t encodeWeightFrame(const ScaleState &state, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Reads a binary weight frame back (used by the native build and by tools).
+ * @details Only weightMg, weight (rounded), seq, timestampUs and flags are carried by the frame.
+ * @return false if the frame is not a valid weight frame.
+ */
+bool decodeWeightFrame(const uint8_t *buffer, size_t size, ScaleState &state);
+
+/**
+ * @brief Writes a batch of stream samples (TELEMETRY_BATCH_SIZE(count) bytes, see the layout above).
+ * @param lost: samples the sender could not send since the previous batch.
+ * @return the length of the frame, 0 if count is 0 or too large or the buffer is too small.
+ */
+size_t encodeSampleBatch(const StreamSample *samples, size_t count, uint32_t lost, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Reads a batch of stream samples back (native build and tools). The seq of the samples after the
+ *        first one is not carried, it is counted up.
+ * @return the number of samples, 0 if the frame is not a valid batch.
+ */
+size_t decodeSampleBatch(const uint8_t *buffer, size_t size, StreamSample *samples, size_t maxCount, uint32_t &lost);
+
+/**
+ * @brief Writes the JSON message of an item that passed the checkweigher (see above).
+ * @return the length of the message, 0 if the buffer is too small (112 bytes are always enough).
+ */
+size_t encodeItemJson(const CheckweighResult &item, char *buffer, size_t size);
@@ -0,0 +1,156 @@
+/**
+ * UplinkQueue.cpp
+ *  See UplinkQueue.h.
+ */
+#include "UplinkQueue.h"
+
+#include <cstdlib>
+
+void UplinkQueue::offer(uint8_t pin, int32_t value, uint32_t nowMs)
+{
+  if (pin >= maxPins)
+  {
+    return;
+  }
+  PinState &state = pins_[pin];
+  state.used = true;
+  const bool inDeadband = state.everSent && std::abs(value - state.lastSent) < config_.deadband;
+  const bool keepAliveDue = state.everSent && (nowMs - state.lastSentMs) >= config_.keepAliveMs;
+  if (inDeadband && !keepAliveDue)
+  {
+    // back inside the deadband: nothing to send (drop a pending value that would only be noise).
+    if (state.pending)
+    {
+      coalesced_++;
+      state.pending = false;
+    }
+    return;
+  }
+  if (state.pending)
+  {
+    coalesced_++;   // replaces a value that was never sent
+  }
+  state.pending = true;
+  state.point.pin = pin;
+  state.point.value = value;
+  state.point.timestampMs = nowMs;
+}
+
+size_t UplinkQueue::pendingCount() const
+{
+  size_t count = 0;
+  for (const PinState &state : pins_)
+  {
+    count += state.pending ? 1 : 0;
+  }
+  return count;
+}
+
+void UplinkQueue::pushBacklog(const UplinkPoint &point)
+{
+  if (backlogCount_ == backlogCapacity)
+  {
+    // full: the oldest point is lost.
+    backlogHead_ = (backlogHead_ + 1) % backlogCapacity;
+    backlogCount_--;
+    dropped_++;
+  }
+  backlog_[(backlogHead_ + backlogCount_) % backlogCapacity] = point;
+  backlogCount_++;
+}
+
+size_t UplinkQueue::collectPending(UplinkPoint *out, size_t max)
+{
+  size_t count = 0;
+  for (PinState &state : pins_)
+  {
+    if (state.pending && count < max)
+    {
+      out[count++] = state.point;
+      state.pending = false;
+    }
+  }
+  return count;
+}
+
+size_t UplinkQueue::peekBacklog(UplinkPoint *out, size_t max) const
+{
+  size_t count = 0;
+  while (count < max && count < backlogCount_)
+  {
+    out[count] = backlog_[(backlogHead_ + count) % backlogCapacity];
+    count++;
+  }
+  return count;
+}
+
+void UplinkQueue::markParked(const UplinkPoint *points, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    PinState &state = pins_[points[i].pin];
+    state.everSent = true;
+    state.lastSent = points[i].value;
+    state.lastSentMs = points[i].timestampMs;
+  }
+}
+
+uint32_t UplinkQueue::service(UplinkSink &sink, uint32_t nowMs)
+{
+  if (anyRoundTrip_ && (nowMs - lastRoundTripMs_) < config_.minIntervalMs)
+  {
+    return 0;   // rate limit
+  }
+
+  if (!sink.connected())
+  {
+    // offline: park the pending values in the backlog, in the order they were taken.
+    UplinkPoint parked[maxPins];
+    const size_t count = collectPending(parked, maxPins);
+    for (size_t i = 0; i < count; i++)
+    {
+      pushBacklog(parked[i]);
+    }
+    // the deadband now compares to what will be sent on reconnect.
+    markParked(parked, count);
+    if (count != 0)
+    {
+      // parking uses up the slot as well, so the backlog fills at the upload rate and not at the offer rate.
+      lastRoundTripMs_ = nowMs;
+      anyRoundTrip_ = true;
+    }
+    return 0;
+  }
+
+  // the backlog goes first so the cloud gets the values in order, the pending values fill the rest.
+  UplinkPoint batch[maxBatch];
+  const size_t batchSize = config_.batchSize < maxBatch ? config_.batchSize : maxBatch;
+  const size_t fromBacklog = peekBacklog(batch, batchSize);
+  size_t count = fromBacklog;
+  if (fromBacklog == backlogCount_)
+  {
+    count += collectPending(batch + count, batchSize - count);
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  lastRoundTripMs_ = nowMs;
+  anyRoundTrip_ = true;
+  if (!sink.sendBatch(batch, count))
+  {
+    // keep the new values for the next round trip, the backlog part is still in the backlog.
+    for (size_t i = fromBacklog; i < count; i++)
+    {
+      pushBacklog(batch[i]);
+    }
+    markParked(batch + fromBacklog, count - fromBacklog);
+    return 1;
+  }
+  backlogHead_ = (backlogHead_ + fromBacklog) % backlogCapacity;
+  backlogCount_ -= fromBacklog;
+  markParked(batch + fromBacklog, count - fromBacklog);
+  sent_ += static_cast<uint32_t>(count);
+  return 1;
+}
@@ -0,0 +1,101 @@
+/**
+ * UplinkQueue.h
+ *  The cloud uplink stage: values for the cloud (virtual pins) are offered as often as they change,
+ *  the queue decides what is actually sent and when.
+ *    - coalescing : only the newest value of each pin is kept until the next send,
+ *    - deadband   : a value closer than the deadband to the last sent one is dropped,
+ *    - rate limit : at most one round trip every minIntervalMs,
+ *    - batching   : all pending pins go out together in one round trip (up to batchSize points),
+ *    - backlog    : while the cloud is not reachable the points are kept in a bounded ring
+ *                   (oldest dropped first) and sent in order after the reconnect.
+ *  The queue is owned by the uplink task only, it is not thread-safe.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct UplinkPoint
+{
+  uint32_t timestampMs;  // when the value was taken
+  int32_t  value;
+  uint8_t  pin;          // virtual pin (V0 = 0, V1 = 1, ...)
+};
+
+/**
+ * @brief The cloud connection used by the queue (Blynk in the firmware, a stand-in in the native build).
+ */
+class UplinkSink
+{
+public:
+  virtual ~UplinkSink() {}
+  virtual bool connected() = 0;
+  /**
+   * @brief Sends the points in one round trip.
+   * @return false if the send failed, the points are then kept for later.
+   */
+  virtual bool sendBatch(const UplinkPoint *points, size_t count) = 0;
+};
+
+struct UplinkConfig
+{
+  int32_t  deadband = 1;          // in the unit of the values (grams for the weight)
+  uint32_t minIntervalMs = 1000;  // at most one round trip per second
+  uint32_t keepAliveMs = 60000;   // send the value again after this long even if it did not change
+  uint8_t  batchSize = 8;         // points per round trip
+};
+
+class UplinkQueue
+{
+public:
+  static constexpr uint8_t maxPins = 8;
+  static constexpr uint16_t backlogCapacity = 256;   // 12 bytes per point, 3 KB
+  static constexpr uint8_t maxBatch = 32;
+
+  explicit UplinkQueue(const UplinkConfig &config = UplinkConfig()) : config_(config) {}
+
+  /**
+   * @brief Offers the current value of a pin. Cheap, call it as often as the value may change.
+   */
+  void offer(uint8_t pin, int32_t value, uint32_t nowMs);
+
+  /**
+   * @brief Sends what is due (backlog first, then the pending values) if the rate limit allows it.
+   * @return the number of round trips made (0 or 1).
+   */
+  uint32_t service(UplinkSink &sink, uint32_t nowMs);
+
+  size_t pendingCount() const;
+  size_t backlogCount() const { return backlogCount_; }
+  uint32_t droppedCount() const { return dropped_; }
+  uint32_t coalescedCount() const { return coalesced_; }
+  uint32_t sentCount() const { return sent_; }
+
+private:
+  struct PinState
+  {
+    bool used = false;
+    bool pending = false;
+    bool everSent = false;
+    int32_t lastSent = 0;
+    uint32_t lastSentMs = 0;
+    UplinkPoint point = {};
+  };
+
+  void pushBacklog(const UplinkPoint &point);
+  size_t collectPending(UplinkPoint *out, size_t max);
+  size_t peekBacklog(UplinkPoint *out, size_t max) const;
+  // the points left the pending table (sent or in the backlog): the deadband compares to them from now on.
+  void markParked(const UplinkPoint *points, size_t count);
+
+  UplinkConfig config_;
+  PinState pins_[maxPins];
+  UplinkPoint backlog_[backlogCapacity];
+  size_t backlogHead_ = 0;   // oldest point
+  size_t backlogCount_ = 0;
+  uint32_t lastRoundTripMs_ = 0;
+  bool anyRoundTrip_ = false;
+  uint32_t dropped_ = 0;
+  uint32_t coalesced_ = 0;
+  uint32_t sent_ = 0;
+};
@@ -0,0 +1,7 @@
+/**
+ * WeightProcessor.cpp
+ *  See WeightProcessor.h.
+ */
+#include "WeightProcessor.h"
+
+template class BasicWeightProcessor<FilterChain>;
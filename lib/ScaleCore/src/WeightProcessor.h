@@ -0,0 +1,87 @@
+/**
+ * WeightProcessor.h
+ *  Turns the newest HX711 sample into the published ScaleState: filter chain, conversion to grams,
+ *  overload and not-ready checks. This is the body of getWeight() in the firmware, kept free of
+ *  Arduino so the native build runs exactly the same code.
+ *
+ *  The filter chain is a template argument: WeightProcessor uses the run-time FilterChain, a scale profile
+ *  build the chain with the constant settings of the profile (ProfileFilterChain<P>, ProfileFilter.h).
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "FilterChain.h"
+#include "Hx711Acquisition.h"
+#include "ScaleState.h"
+
+template <class Chain>
+class BasicWeightProcessor
+{
+public:
+  /**
+   * @param maxGrams: load cell capacity, heavier readings are flagged as overload.
+   * @param readyTimeoutUs: a sample older than this means the HX711 is not ready.
+   */
+  BasicWeightProcessor(int32_t maxGrams, uint32_t readyTimeoutUs) : maxGrams_(maxGrams), readyTimeoutUs_(readyTimeoutUs) {}
+
+  /**
+   * @brief Builds the scale state from the newest sample.
+   * @details Every sample goes through the filter chain exactly once, however often this is called.
+   * @param acquisition: where the samples come from.
+   * @param offset: the tare offset (raw counts with an empty platform).
+   * @param nowUs: current time, used to detect a HX711 that stopped sending samples.
+   */
+  ScaleState update(const Hx711Acquisition &acquisition, int32_t offset, uint32_t nowUs)
+  {
+    ScaleState state = {};
+    RawSample sample;
+    if (!acquisition.latestFresh(sample, nowUs, readyTimeoutUs_))
+    {
+      // no fresh sample: the HX711 is not ready. Start the filters again once it is back.
+      filter_.reset();
+      lastSeq_ = 0xFFFFFFFFu;
+      state.seq = acquisition.sampleCount();
+      state.timestampUs = nowUs;
+      state.flags = SCALE_FLAG_NOT_READY;
+      return state;
+    }
+
+    if (sample.seq != lastSeq_)
+    {
+      // the tare offset can change at any time (web interface).
+      filter_.converter().setOffset(offset);
+      filtered_ = filter_.update(sample.raw, sample.timestampUs);
+      lastSeq_ = sample.seq;
+    }
+    state.raw = sample.raw;
+    state.seq = sample.seq;
+    state.timestampUs = sample.timestampUs;
+
+    // grams, rounded to the nearest gram.
+    const int32_t grams = (filtered_.weightMg + (filtered_.weightMg >= 0 ? 500 : -500)) / 1000;
+    if (grams > maxGrams_ || grams < 0)
+    {
+      state.flags = SCALE_FLAG_OVERLOAD;
+      return state;
+    }
+    state.weight = grams;
+    state.weightMg = filtered_.weightMg;
+    state.flags = filtered_.stable ? SCALE_FLAG_STABLE : 0;
+    return state;
+  }
+
+  Chain &filter() { return filter_; }
+  const FilterOutput &lastOutput() const { return filtered_; }
+
+private:
+  Chain filter_;
+  FilterOutput filtered_ = {};
+  int32_t maxGrams_;
+  uint32_t readyTimeoutUs_;
+  uint32_t lastSeq_ = 0xFFFFFFFFu;
+};
+
+// compiled once, in WeightProcessor.cpp.
+extern template class BasicWeightProcessor<FilterChain>;
+using WeightProcessor = BasicWeightProcessor<FilterChain>;
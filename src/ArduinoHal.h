@@ -0,0 +1,298 @@
+/**
+ * ArduinoHal.h
+ *  Implementation of the hardware abstraction (lib/ScaleCore/src/Hal.h) on the ESP32 with the
+ *  Arduino libraries used by the project. Each class only forwards to the library object it wraps.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <TM1637.h>
+#include <WebSocketsServer.h>
+#include <WiFiClient.h>
+#include "FramePool.h"
+#include "HX711.h"
+#include "Hal.h"
+#include "HistoryStore.h"
+
+class ArduinoClock : public Clock
+{
+public:
+  uint32_t micros() const override { return ::micros(); }
+  uint32_t millis() const override { return ::millis(); }
+};
+
+class Hx711LoadCell : public LoadCell
+{
+public:
+  Hx711LoadCell() {}
+  explicit Hx711LoadCell(HX711 &hx711) : hx711_(&hx711) {}
+  /**
+   * @brief Connects the wrapper to its HX711 (for arrays of load cells, one per channel).
+   */
+  void attach(HX711 &hx711) { hx711_ = &hx711; }
+  bool isReady() override { return hx711_->is_ready(); }
+  int32_t read() override { return hx711_->read(); }
+  void powerDown() override { hx711_->power_down(); }
+  void powerUp() override { hx711_->power_up(); }
+
+private:
+  HX711 *hx711_ = nullptr;
+};
+
+/**
+ * @brief The TM1637 library for setup (init, brightness) and whole values; writeSegments() talks to the chip
+ *        directly on CLK/DIO, because the library always rewrites all the digits.
+ * @details A write is two transactions: the data command (write, auto-increment address), then the address of
+ *          the first digit followed by the segments. The brightness (display control) set by the library stays.
+ */
+class Tm1637Display : public SegmentDisplay
+{
+public:
+  Tm1637Display(TM1637 &tm1637, uint8_t clkPin, uint8_t dioPin) : tm1637_(tm1637), clkPin_(clkPin), dioPin_(dioPin) {}
+  void showNumber(long value) override { tm1637_.display(value); }
+  void showText(const char *text) override { tm1637_.display(text); }
+  void writeSegments(uint8_t position, const uint8_t *segments, uint8_t count) override
+  {
+    pinMode(clkPin_, OUTPUT);
+    pinMode(dioPin_, OUTPUT);
+    start();
+    writeByte(0x40);              // data command: write to the display, auto-increment the address
+    stop();
+    start();
+    writeByte(0xC0 | position);   // address of the first digit
+    for (uint8_t i = 0; i < count; i++)
+    {
+      writeByte(segments[i]);
+    }
+    stop();
+  }
+
+private:
+  static const uint8_t bitDelayUs = 5;   // the TM1637 clocks up to 250 kHz
+
+  void start()
+  {
+    digitalWrite(clkPin_, HIGH);
+    digitalWrite(dioPin_, HIGH);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(dioPin_, LOW);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(clkPin_, LOW);
+  }
+
+  void stop()
+  {
+    digitalWrite(clkPin_, LOW);
+    digitalWrite(dioPin_, LOW);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(clkPin_, HIGH);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(dioPin_, HIGH);
+    delayMicroseconds(bitDelayUs);
+  }
+
+  // LSB first, then one clock for the acknowledge of the chip (not checked: nothing to do about it).
+  void writeByte(uint8_t value)
+  {
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      digitalWrite(clkPin_, LOW);
+      digitalWrite(dioPin_, (value >> bit) & 1 ? HIGH : LOW);
+      delayMicroseconds(bitDelayUs);
+      digitalWrite(clkPin_, HIGH);
+      delayMicroseconds(bitDelayUs);
+    }
+    digitalWrite(clkPin_, LOW);
+    pinMode(dioPin_, INPUT);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(clkPin_, HIGH);
+    delayMicroseconds(bitDelayUs);
+    digitalWrite(clkPin_, LOW);
+    pinMode(dioPin_, OUTPUT);
+  }
+
+  TM1637 &tm1637_;
+  uint8_t clkPin_;
+  uint8_t dioPin_;
+};
+
+#define WEB_FRAME_SLOTS  3     // Task3, Task5 and one more (a frame is only held while it is sent)
+#define WEB_FRAME_BYTES  256   // the longest frame sent: the calibration status (224 bytes)
+
+/**
+ * @brief The web clients (WebSocketsServer).
+ * @details Every frame is copied into a buffer of a FramePool, with room for the WebSocket header in front of
+ *          it (headerToPayload): otherwise the library allocates a buffer on the heap for every frame and client.
+ *          A longer frame, or one that finds every buffer in use, goes the library's way (counted: frameMisses()).
+ */
+class WebSocketTransport : public Transport
+{
+public:
+  explicit WebSocketTransport(WebSocketsServer &webSocket) : webSocket_(webSocket) {}
+  size_t clientCount() override { return webSocket_.connectedClients(); }
+  bool broadcastText(const char *data, size_t length) override
+  {
+    uint8_t *frame = copy(data, length);
+    const bool ok = frame != nullptr ? webSocket_.broadcastTXT(frame, length, true) : webSocket_.broadcastTXT(data, length);
+    release(frame);
+    return ok;
+  }
+  bool broadcastBinary(const uint8_t *data, size_t length) override
+  {
+    uint8_t *frame = copy(data, length);
+    const bool ok = frame != nullptr ? webSocket_.broadcastBIN(frame, length, true) : webSocket_.broadcastBIN(data, length);
+    release(frame);
+    return ok;
+  }
+  bool sendText(uint8_t client, const char *data, size_t length) override
+  {
+    uint8_t *frame = copy(data, length);
+    const bool ok = frame != nullptr ? webSocket_.sendTXT(client, frame, length, true) : webSocket_.sendTXT(client, data, length);
+    release(frame);
+    return ok;
+  }
+  bool sendBinary(uint8_t client, const uint8_t *data, size_t length) override
+  {
+    uint8_t *frame = copy(data, length);
+    const bool ok = frame != nullptr ? webSocket_.sendBIN(client, frame, length, true) : webSocket_.sendBIN(client, data, length);
+    release(frame);
+    return ok;
+  }
+
+  uint32_t frameMisses() const { return frames_.misses(); }
+
+private:
+  uint8_t *copy(const void *data, size_t length)
+  {
+    uint8_t *frame = frames_.acquire(length);
+    if (frame != nullptr)
+    {
+      memcpy(frame, data, length);
+    }
+    return frame;
+  }
+  void release(uint8_t *frame)
+  {
+    if (frame != nullptr)
+    {
+      frames_.release(frame);
+    }
+  }
+
+  WebSocketsServer &webSocket_;
+  FramePool<WEB_FRAME_SLOTS, WEB_FRAME_BYTES, WEBSOCKETS_MAX_HEADER_SIZE> frames_;
+};
+
+/**
+ * @brief A TCP connection over WiFi (the MQTT broker). Only open() waits, for the handshake, at most connectTimeoutMs.
+ */
+class WifiTcpConnection : public TcpConnection
+{
+public:
+  explicit WifiTcpConnection(int32_t connectTimeoutMs) : connectTimeoutMs_(connectTimeoutMs) {}
+
+  bool open(const char *host, uint16_t port) override
+  {
+    if (!client_.connect(host, port, connectTimeoutMs_))
+    {
+      return false;
+    }
+    client_.setNoDelay(true);   // a batch is one small packet: no Nagle delay before it leaves
+    return true;
+  }
+  void close() override { client_.stop(); }
+  bool isOpen() override { return client_.connected(); }
+  size_t write(const uint8_t *data, size_t length) override { return client_.write(data, length); }
+  size_t read(uint8_t *out, size_t max) override
+  {
+    const int available = client_.available();
+    if (available <= 0)
+    {
+      return 0;
+    }
+    const int got = client_.read(out, static_cast<size_t>(available) < max ? static_cast<size_t>(available) : max);
+    return got > 0 ? static_cast<size_t>(got) : 0;
+  }
+
+private:
+  WiFiClient client_;
+  int32_t connectTimeoutMs_;
+};
+
+/**
+ * @brief History segments as files on a flash file system (LittleFS): <directory>/segNN.bin.
+ * @details The segment being written stays open between the appends (flushed after each one), so a flush of the
+ *          history does not open a file (a File and a FILE on the heap) every time.
+ */
+class FsHistoryStorage : public HistoryStorage
+{
+public:
+  FsHistoryStorage(fs::FS &fs, const char *directory) : fs_(fs), directory_(directory) {}
+
+  void begin() { fs_.mkdir(directory_); }
+
+  uint32_t size(uint16_t segment) override
+  {
+    File file = fs_.open(path(segment), FILE_READ);
+    if (!file)
+    {
+      return 0;
+    }
+    const uint32_t length = file.size();
+    file.close();
+    return length;
+  }
+
+  size_t read(uint16_t segment, uint32_t offset, uint8_t *out, size_t length) override
+  {
+    File file = fs_.open(path(segment), FILE_READ);
+    if (!file)
+    {
+      return 0;
+    }
+    const size_t got = file.seek(offset) ? file.read(out, length) : 0;
+    file.close();
+    return got;
+  }
+
+  bool append(uint16_t segment, const uint8_t *data, size_t length) override
+  {
+    if (!appendFile_ || appendSegment_ != segment)
+    {
+      appendFile_.close();
+      appendFile_ = fs_.open(path(segment), FILE_APPEND);
+      appendSegment_ = segment;
+      if (!appendFile_)
+      {
+        return false;
+      }
+    }
+    const bool ok = appendFile_.write(data, length) == length;
+    appendFile_.flush();   // on flash now: the queries (other handles) and a reset see it
+    return ok;
+  }
+
+  bool erase(uint16_t segment) override
+  {
+    if (appendFile_ && appendSegment_ == segment)
+    {
+      appendFile_.close();
+    }
+    const char *name = path(segment);
+    return !fs_.exists(name) || fs_.remove(name);
+  }
+
+private:
+  const char *path(uint16_t segment)
+  {
+    snprintf(path_, sizeof(path_), "%s/seg%02u.bin", directory_, static_cast<unsigned>(segment));
+    return path_;
+  }
+
+  fs::FS &fs_;
+  const char *directory_;
+  char path_[32];
+  File appendFile_;
+  uint16_t appendSegment_ = 0;
+};
@@ -0,0 +1,107 @@
+/**
+ * TaskTable.h
+ *  The FreeRTOS tasks of the firmware, described in one table (see taskTable in main.cpp) instead of
+ *  separate xTaskCreate() calls: core, priority, period, deadline and stack budget of every task.
+ *
+ *  Every task gets its TaskSpec as parameter. It measures itself with spec.timing (TaskTiming.h):
+ *  begin() when it wakes up, end() when the cycle is done. reportTasks() prints, per task, how much of
+ *  the stack budget was ever used (uxTaskGetStackHighWaterMark) and the timing counters, so the stacks
+ *  can be shrunk and the acquisition period checked under network load. In a HEAP_AFTER_BOOT build it also
+ *  prints the heap allocations every task made after setup() (HeapGuard.h); spec.heap says whether the task
+ *  may allocate at all then.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "HeapGuard.h"
+#include "TaskTiming.h"
+
+struct TaskSpec
+{
+  TaskFunction_t function;
+  const char *name;
+  uint32_t stackBytes;     // stack budget
+  UBaseType_t priority;    // higher runs first
+  BaseType_t core;         // 0 or 1, tskNO_AFFINITY for either
+  uint32_t periodMs;       // 0 = event driven (woken by an interrupt or a notification)
+  uint32_t deadlineMs;     // 0 = the period
+  TaskHandle_t *handle;
+  TaskTiming *timing;
+  HeapPolicy heap;         // allocations after setup(), HEAP_AFTER_BOOT_TRAP builds: Trap stops the firmware
+};
+
+/**
+ * @brief Creates the tasks of the table.
+ * @return false if a task could not be created (not enough memory for its stack).
+ */
+inline bool startTasks(const TaskSpec *tasks, size_t count)
+{
+  bool ok = true;
+  uint32_t budget = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const TaskSpec &task = tasks[i];
+    task.timing->configure(task.periodMs * 1000UL, task.deadlineMs * 1000UL);
+    if (xTaskCreatePinnedToCore(task.function, task.name, task.stackBytes, (void *)&task, task.priority,
+                                task.handle, task.core) != pdPASS)
+    {
+      Serial.printf("Task %s could not be created (%u bytes of stack)\n", task.name, (unsigned)task.stackBytes);
+      ok = false;
+    }
+    budget += task.stackBytes;
+  }
+  Serial.printf("%u tasks created, %u bytes of stack in total\n", (unsigned)count, (unsigned)budget);
+  return ok;
+}
+
+/**
+ * @brief Sleeps until the next period of a periodic task (no drift, unlike vTaskDelay()).
+ */
+inline void waitForNextPeriod(const TaskSpec &task, TickType_t &lastWake)
+{
+  vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(task.periodMs));
+}
+
+/**
+ * @brief Prints stack use and timing of every task of the table.
+ * @details Every line is formatted into a buffer on the stack: Serial.printf() takes the heap for a line
+ *          longer than 64 characters.
+ * @param heap: the allocations after setup() are printed too (nullptr: not counted in this build).
+ * @note On the ESP32 uxTaskGetStackHighWaterMark() returns bytes (the stack that was never used).
+ */
+inline void reportTasks(const TaskSpec *tasks, size_t count, const HeapGuard *heap = nullptr)
+{
+  Serial.println(heap != nullptr
+                     ? "task          core prio  stack used/budget   cycles  misses  jitter avg/max us  run avg/max us  heap allocs/bytes"
+                     : "task          core prio  stack used/budget   cycles  misses  jitter avg/max us  run avg/max us");
+  char line[160];
+  for (size_t i = 0; i < count; i++)
+  {
+    const TaskSpec &task = tasks[i];
+    const uint32_t unused = *task.handle != NULL ? uxTaskGetStackHighWaterMark(*task.handle) : task.stackBytes;
+    const TaskTimingReport r = task.timing->report();
+    int length = snprintf(line, sizeof(line), "%-13s %4d %4u %10u/%-8u %8u %7u %8u/%-8u %7u/%-7u", task.name,
+                          (int)task.core, (unsigned)task.priority, (unsigned)(task.stackBytes - unused),
+                          (unsigned)task.stackBytes, (unsigned)r.cycles, (unsigned)r.misses, (unsigned)r.jitterAvgUs,
+                          (unsigned)r.jitterMaxUs, (unsigned)r.runAvgUs, (unsigned)r.runMaxUs);
+    if (heap != nullptr && length > 0 && (size_t)length < sizeof(line))
+    {
+      const HeapOwnerStats h = heap->stats((uint8_t)i);
+      length += snprintf(line + length, sizeof(line) - length, " %8u/%-8u%s", (unsigned)h.allocations,
+                         (unsigned)h.bytes, heap->policy((uint8_t)i) == HeapPolicy::Trap ? " trap" : "");
+    }
+    if (length > 0)
+    {
+      Serial.write((const uint8_t *)line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+      Serial.println();
+    }
+  }
+  if (heap != nullptr)
+  {
+    const HeapOwnerStats other = heap->stats(HEAP_GUARD_OTHER);
+    const int length = snprintf(line, sizeof(line), "other tasks (WiFi, lwIP, ...) %8u/%-8u", (unsigned)other.allocations,
+                                (unsigned)other.bytes);
+    Serial.write((const uint8_t *)line, length > 0 && (size_t)length < sizeof(line) ? (size_t)length : 0);
+    Serial.println();
+  }
+}
@@ -2,11 +2,13 @@
  * Smart Scale IoT Project
  *  This is a simple smart scale application that uses ESP32 and HX711 to measure weight.
  * It uses a load cell to measure the weight and a 4 digits 7-segment display to show the weight.
- * It displays the current weight on a 4 digits 7-segment display and sends the weight to the Blynk cloud.  
+ * It displays the current weight on a 4 digits 7-segment display and sends the weight to the Blynk cloud
+ * (or to an MQTT broker, see CLOUD_BACKEND).
  * It also provides a simple web interface to display the current weight and tare the scale.
  * The web interface can be accessed using the IP address of the ESP32. 
  * It uses freeRTOS to create different tasks for getting the weight, displaying the weight, handling the web server, and Blynk cloud interaction.
- * The application uses a semaphore to ensure that only one task can access the shared resource (load cell and display) at a time.    
+ * The application uses a semaphore to ensure that only one task can access the hardware (load cell and display) at a time.    
+ * The current weight is published by the acquisition task as a snapshot that the other tasks read without the semaphore.
  * 
  * @author: Muhsin Atto
  * @email: darenhaji@gmail.com
@@ -26,9 +28,76 @@
 #include <WiFiClient.h>         // WiFiClient library to create a client to connect to the WiFi network
 #include <WebServer.h>         // needed to create a simple webserver (make sure tools -> board is set to ESP32, otherwise you will get a "WebServer.h: No such file or directory" error)
 #include <WebSocketsServer.h>  // needed for instant communication between client and server through Websockets
-#include<ArduinoJson.h>       // ArduinoJson library to handle JSON data.
+#include <LittleFS.h>           // flash file system for the weight history
+#include <Preferences.h>        // NVS: the calibration survives a reboot
+#include <sys/time.h>           // gettimeofday(), the wall clock set by NTP
+#include <esp_rom_sys.h>        // esp_rom_printf(): a message without the heap (HEAP_AFTER_BOOT_TRAP)
+#include "Hx711Acquisition.h"  // interrupt driven HX711 acquisition and the lock-free sample ring (lib/ScaleCore)
+#include "ScaleState.h"        // published scale state (weight, raw value, flags) read without a lock (lib/ScaleCore)
+#include "WeightProcessor.h"   // fixed-point filter chain, conversion to grams, overload/stability flags (lib/ScaleCore)
+#include "Telemetry.h"         // weight messages for the web clients, encoded without allocation (lib/ScaleCore)
+#include "ChangeDetector.h"    // decides when a new weight is worth publishing (lib/ScaleCore)
+#include "UplinkQueue.h"       // coalescing, rate limited cloud uplink with offline backlog (lib/ScaleCore)
+#include "HistoryStore.h"      // weight history in flash and range queries (lib/ScaleCore)
+#include "LoadCellArray.h"     // several load cells combined into one weight, frame alignment (lib/ScaleCore)
+#include "ArduinoHal.h"        // clock, load cell, display and WebSocket transport behind the Hal.h interfaces
+#include "TaskTable.h"         // the FreeRTOS tasks in one table: core, priority, period, stack budget, timing
+#include "Metrics.h"           // latency histograms, mutex waits, sample counters, heap (lib/ScaleCore)
+#include "DeferredLog.h"       // LOG_ERROR/WARN/INFO/DEBUG: binary records, formatted later by Task7 (lib/ScaleCore)
+#include "DisplayStage.h"      // g/kg formatting, status glyphs, writes only the digits that changed (lib/ScaleCore)
+#include "Calibration.h"       // multi-point calibration from the web page, least-squares fit, NVS record (lib/ScaleCore)
+#include "Connectivity.h"      // WiFi and cloud brought up and kept up in the background, with backoff (lib/ScaleCore)
+#include "SampleStream.h"      // dynamic mode: every sample to the web clients in batches, checkweigher (lib/ScaleCore)
+#include "Commands.h"          // typed commands of the web clients, run by Task1 and acknowledged (lib/ScaleCore)
+#include "Subscriptions.h"     // what each web client wants of the weight, shared encoding per tick (lib/ScaleCore)
+#include "Mqtt.h"              // MQTT client and uplink sink, compact/binary weight payloads (lib/ScaleCore)
+#include "RawTrace.h"          // raw HX711 traces to flash, replayed by the native build (lib/ScaleCore)
+#include "HeapGuard.h"         // "no heap after boot": allocations after setup() counted per task or trapped (lib/ScaleCore)
+#include "ScaleProfile.h"      // compile-time scale profiles: wiring, load cells, HX711 gain and rate, filters (lib/ScaleCore)
+#include "ProfileFilter.h"     // the filter chain with the constant settings of a profile (lib/ScaleCore)
+#include "PowerScheduler.h"    // low-power mode: idle, HX711 power-down and probes, batched network wake-ups (lib/ScaleCore)
 
 
+// Cloud backend of the uplink (Task4): where the weight goes through the uplink queue.
+// CLOUD_BACKEND_BLYNK: the Blynk cloud and app (virtual pins V0 and V1).
+// CLOUD_BACKEND_MQTT:  an MQTT broker of your own (mosquitto, ...), see Mqtt.h for the topics and payloads;
+//   QoS 1 keeps every point until the broker acknowledged it, a retained status topic says whether the scale
+//   is online (the last will says "offline"). Both keep a backlog while the cloud is not reachable.
+// Can also be set from platformio.ini: build_flags = -DCLOUD_BACKEND=1 (env:esp32-s3-devkitm-1-mqtt)
+#define CLOUD_BACKEND_BLYNK  0
+#define CLOUD_BACKEND_MQTT   1
+#ifndef CLOUD_BACKEND
+#define CLOUD_BACKEND CLOUD_BACKEND_BLYNK
+#endif
+
+#if CLOUD_BACKEND == CLOUD_BACKEND_MQTT
+// MQTT broker configuration
+// You need to replace MQTT_HOST with the name or the IP address of your broker.
+#define MQTT_HOST       "broker.local"
+#define MQTT_PORT       1883
+#define MQTT_CLIENT_ID  "smartscale"   // unique per scale on the broker
+#define MQTT_TOPIC      "smartscale"   // smartscale/weight, smartscale/status, smartscale/info
+#define MQTT_USER       nullptr        // "user" if the broker wants a login
+#define MQTT_PASSWORD   nullptr
+#define MQTT_KEEPALIVE_S  30           // a dead connection is noticed after 1.5 times this
+#ifndef MQTT_QOS
+#define MQTT_QOS        1              // 0: at most once (lost while the link is dead but not noticed yet), 1: at least once
+#endif
+#ifndef MQTT_PAYLOAD
+#define MQTT_PAYLOAD    UPLINK_PAYLOAD_COMPACT   // or UPLINK_PAYLOAD_BINARY: fewer bytes, needs a decoder
+#endif
+#if MQTT_PAYLOAD == UPLINK_PAYLOAD_BINARY
+#define MQTT_INFO  "{\"format\":\"binary\",\"unit\":\"g\"}"
+#else
+#define MQTT_INFO  "{\"format\":\"compact\",\"unit\":\"g\"}"
+#endif
+#define CLOUD_NAME  "MQTT broker"
+// the points keep the numbers of the Blynk virtual pins (pin 0 and 1 in the payloads).
+#define V0 0
+#define V1 1
+#else
+#define CLOUD_NAME  "Blynk cloud"
+
 // Blynk Cloud configuration
 // Blynk Cloud is used to send the current weight to the Blynk cloud and display it on the Blynk app.   
 // You need to create a Blynk account and a template to use this feature.
@@ -46,15 +115,195 @@
 // Include the Blynk library for ESP32
 // @note If I moved this to above, I will get an error.
 #include <BlynkSimpleEsp32.h>  // Blynk library for ESP32. 
+#endif
+
+// Scale profile: the variant of the scale this firmware is built for (see ScaleProfile.h). A profile holds the
+// display and HX711 wiring, the load cells (count, capacity, default calibration factors, corner trims), the
+// HX711 gain and rate, and the filter settings, as constants: the compiler folds them into the code.
+// SCALE_PROFILE_KITCHEN:      one 5 kg load cell at 10 SPS, DOUT 21 / SCK 20, display CLK 48 / DIO 47 (default).
+// SCALE_PROFILE_PLATFORM:     four 50 kg load cells under the corners (200 kg), DOUT {21, 19, 17, 15}, SCK {20, 18, 16, 14}.
+// SCALE_PROFILE_CHECKWEIGHER: one 5 kg load cell at 80 SPS, items on a conveyor (SCALE_MODE_DYNAMIC).
+// Set from platformio.ini: build_flags = -DSCALE_PROFILE=1 (env:esp32-s3-devkitm-1-platform, ...). For another
+// variant, add a profile to ScaleProfile.h, a number here and an env.
+#define SCALE_PROFILE_KITCHEN       0
+#define SCALE_PROFILE_PLATFORM      1
+#define SCALE_PROFILE_CHECKWEIGHER  2
+#ifndef SCALE_PROFILE
+#if defined(SCALE_MODE) && SCALE_MODE == 1   // -DSCALE_MODE=1 alone: the checkweigher, as before the profiles
+#define SCALE_PROFILE SCALE_PROFILE_CHECKWEIGHER
+#else
+#define SCALE_PROFILE SCALE_PROFILE_KITCHEN
+#endif
+#endif
+#if SCALE_PROFILE == SCALE_PROFILE_PLATFORM
+using Profile = PlatformScale;
+#elif SCALE_PROFILE == SCALE_PROFILE_CHECKWEIGHER
+using Profile = CheckweigherScale;
+#else
+using Profile = KitchenScale;
+#endif
+using ProfileLimits = ProfileTraits<Profile>;
+// SCALE_FIXED_FILTER 1: the filter settings of the profile are compiled into the filter chain (ProfileFilter.h),
+// the "filter" command of the web page is then refused (Unsupported). 0: they are only the defaults of the
+// run-time filter chain. The profile envs of platformio.ini set it to 1.
+#ifndef SCALE_FIXED_FILTER
+#define SCALE_FIXED_FILTER 0
+#endif
+
+// Display circuit wiring (TM1637)
+#define CLK_PIN    Profile::displayClkPin   // GPIO of the ESP32 MCU connected to the pin CLK of the Display
+#define DIO_PIN    Profile::displayDioPin   // GPIO of the ESP32 MCU connected to the pin DIO of the Display
+
+// Load cells: one HX711 per load cell, each with its own DOUT and SCK pin and its own calibration factor.
+// Corner order for 4 cells, seen from the front: 0 front-left, 1 front-right, 2 back-right, 3 back-left.
+#define LOAD_CELL_COUNT Profile::cells
+const uint8_t (&loadCellDoutPins)[LOAD_CELL_COUNT] = Profile::doutPins;   // HX711 DOUT
+const uint8_t (&loadCellSckPins)[LOAD_CELL_COUNT] = Profile::sckPins;     // HX711 SCK
+// corner trims from a corner test (LoadCellArray::balanceCorners()), 1.0 = plain sum of the cells.
+const float (&loadCellTrims)[LOAD_CELL_COUNT] = Profile::trims;
+#define maxScaleValue ProfileLimits::maxGrams   // maximum weight of the whole platform
+
+// Weighing mode.
+// SCALE_MODE_STATIC (default): an item is put on the platform and weighed once the weight settled. The HX711
+//   runs at 10 SPS and the web clients get the filtered weight when it changed.
+// SCALE_MODE_DYNAMIC: checkweigher, items pass over the platform on a conveyor (see Checkweigher.h). The HX711
+//   runs at 80 SPS, every sample is streamed to the web clients in batches of STREAM_BATCH_SAMPLES per message
+//   (see SampleStream.h) and the weight of every item is sent once it left the platform. The filtered weight,
+//   the display, the cloud and the history work as in the static mode.
+// 80 SPS needs the RATE pin of the HX711 high: wired on the board (HX711_RATE_PIN -1) or driven by a GPIO.
+// Can also be set from platformio.ini: build_flags = -DSCALE_MODE=1
+#define SCALE_MODE_STATIC   0
+#define SCALE_MODE_DYNAMIC  1
+#ifndef SCALE_MODE
+#define SCALE_MODE (SCALE_PROFILE == SCALE_PROFILE_CHECKWEIGHER ? SCALE_MODE_DYNAMIC : SCALE_MODE_STATIC)
+#endif
+static_assert(Profile::dynamic == (SCALE_MODE == SCALE_MODE_DYNAMIC), "SCALE_MODE does not match the scale profile");
+#ifndef HX711_RATE_PIN
+#define HX711_RATE_PIN  -1         // GPIO connected to the RATE pin of the HX711s (-1: set on the board)
+#endif
+#define STREAM_BATCH_SAMPLES  16   // samples per WebSocket message (200 ms at 80 SPS)
+#define STREAM_FLUSH_MS       250  // a batch that is not full is sent when its oldest sample is this old
+
+// Cores: the acquisition (Task1) and the display (Task2) run on one core, the networking tasks (Task3 web,
+// Task4 Blynk, Task5 HTTP/WebSocket) on the other one, next to the WiFi stack. A busy network never delays
+// reading the HX711s. The priorities, periods and stack budgets of all tasks are in taskTable (see setup()).
+#define ACQUISITION_CORE  1
+#define NETWORK_CORE      0
+#define HX711_READY_TIMEOUT_MS 500   // no data-ready edge for this long means the HX711 is not ready (not connected).
+#define HX711_SAMPLE_PERIOD_MS ProfileLimits::samplePeriodMs   // 100 ms at 10 SPS, 12 at 80 SPS: Task1's deadline
+#define NETWORK_TASK_PERIOD_MS 5     // how often Task5 serves the HTTP clients and the WebSocket
+#define TASK_REPORT_MS         30000 // how often Task6 prints the stack use and timing of the tasks
+#define LOG_DRAIN_PERIOD_MS    50    // how often Task7 formats the log records and writes them to Serial
+// The log levels that are compiled in are set with LOG_LEVEL (DeferredLog.h, default LOG_LEVEL_INFO), e.g.
+// build_flags = -DLOG_LEVEL=LOG_LEVEL_DEBUG to see every reading, -DLOG_LEVEL=LOG_LEVEL_WARN for a release build.
+
+// Runtime metrics: GET /metrics (Prometheus text format) and a binary metrics frame sent to the web clients
+// every METRICS_PUSH_MS by Task3 (0 = never, see Metrics.h for the layout).
+#define METRICS_PUSH_MS        5000
 
-// Display circuit wiring
-#define CLK_PIN    48         // GPIO PIN 48 from the ESP32 MCU is connected to the pin CLK of the Display
-#define DIO_PIN    47         // GPIO PIN 47 from the ESP32 MCU is connected to the pin DIO of the Display
+// Web client telemetry format.
+// 0 = JSON text message {"weight":123} (default, what older pages expect).
+// 1 = compact 16 byte binary frame with sequence number, timestamp, weight (mg) and status bits,
+//     sent with broadcastBIN (see Telemetry.h for the layout). The web page understands both.
+// Can also be set from platformio.ini: build_flags = -DTELEMETRY_BINARY=1
+#ifndef TELEMETRY_BINARY
+#define TELEMETRY_BINARY 0
+#endif
 
-// HX711 circuit wiring
-#define DOUT_PIN  21           // GPIO PIN 21 from the ESP32 MCU is connected to the pin DOUT of the HX711
-#define SCK_PIN   20           // GPIO PIN 20 from the ESP32 MCU is connected to the pin SCK  of the HX711
-#define maxScaleValue 5000     // load cell maximum weight is 5k = 5000grams.
+// Change-driven publishing: Task1 wakes the web server when the weight moved more than PUBLISH_DEADBAND_MG,
+// when it became stable or its status changed, and at least every PUBLISH_HEARTBEAT_MS. The display is woken
+// whenever the digits it shows change (DisplayChangeDetector), however small the change.
+#define PUBLISH_DEADBAND_MG   1000     // 1 gram
+#define PUBLISH_HEARTBEAT_MS  10000    // 10 seconds
+// Task2 only writes the digits that changed (DisplayStage.h); every DISPLAY_RESYNC_MS it rewrites all of them
+// in case the display lost them (e.g. a brown-out of the module).
+#define DISPLAY_RESYNC_MS     60000    // 1 minute
+
+// Calibration (web page: start, a known weight per point, finish): see Calibration.h. The result and the tare
+// offsets are kept in NVS (namespace CALIBRATION_NVS_NAMESPACE), so a reboot weighs at once without taring.
+// CALIBRATION_TEMPERATURE 1 also fits the drift of the zero with the temperature of the chip (read by Task4
+// every TEMPERATURE_READ_MS); the points must then be taken over a few degrees.
+#define CALIBRATION_NVS_NAMESPACE  "scale"
+#ifndef CALIBRATION_TEMPERATURE
+#define CALIBRATION_TEMPERATURE    0
+#endif
+#define TEMPERATURE_READ_MS        5000
+
+// Commands of the web clients (tare, zero tracking, rate, filter, calibration, topics, trace; see Commands.h):
+// Task5 only decodes and queues them, Task1 runs them between two samples and acknowledges them, Task5 sends the
+// acknowledgements. Nothing in the web server waits for the load cells, a tare included.
+#define TARE_FRAMES             10     // a tare averages this many conversions (like HX711::tare())
+#define TARE_TIMEOUT_MS         3000   // a tare that did not get them in this time fails (HX711 not ready)
+#define ZERO_TRACK_BAND_MG      500    // zero tracking ("zero on", off at boot): a stable weight within +/- 0.5 g
+#define ZERO_TRACK_INTERVAL_MS  1000   // is taken as the new zero, at most once a second
+#define WEB_CLIENT_MAX          8      // clients 0..7 can choose their topics ("sub"), the others get everything
+#define TOPIC_WEIGHT            0x01   // the weight (JSON or binary frame)
+#define TOPIC_METRICS           0x02   // the metrics frame
+#define TOPIC_STREAM            0x04   // every sample (dynamic mode)
+#define TOPIC_ITEMS             0x08   // the items of the checkweigher (dynamic mode)
+#define TOPIC_ALL               0x0F
+// The weight goes to every web client as it subscribed ("sub rate|deadband|alarm|format|fields", see Subscriptions.h).
+// A client that does not take its messages keeps the newest FANOUT_QUEUE_DEPTH and is tried again after
+// FANOUT_BACKOFF_MS, Task3 never waits for it.
+#define FANOUT_QUEUE_DEPTH      4
+#define FANOUT_BACKOFF_MS       100
+
+// Cloud uplink (Task4): the weight is sent when it changed by at least UPLINK_DEADBAND_G, at most one
+// round trip every UPLINK_MIN_INTERVAL_MS, and again after UPLINK_KEEPALIVE_MS if nothing changed.
+#define UPLINK_DEADBAND_G       2        // ignores the 1 g flicker of the rounding
+#define UPLINK_MIN_INTERVAL_MS  1000
+#define UPLINK_KEEPALIVE_MS     60000
+#define UPLINK_TASK_PERIOD_MS   100      // how often Task4 runs Blynk and the uplink queue
+
+// Weight history in flash (LittleFS, 16 segments of 16 KB): a point is recorded when the weight moved by more
+// than HISTORY_DEADBAND_MG, the status changed, or HISTORY_HEARTBEAT_MS passed. Read it with GET /history.
+#define HISTORY_DEADBAND_MG   1000     // 1 gram
+#define HISTORY_HEARTBEAT_MS  60000    // 1 minute
+#define HISTORY_FLUSH_MS      60000    // buffered points are written to flash at least this often
+
+// Raw HX711 trace ("trace start" ... "trace stop", see RawTrace.h): Task1 records every conversion, Task5
+// writes the blocks to TRACE_FILE, GET /trace downloads it for the replay of the native build. To flash and
+// not to the serial port, which carries the log. A new trace replaces the last one.
+#define TRACE_FILE       "/trace.bin"
+#define TRACE_MAX_BYTES  (256 * 1024)   // ~12 hours at 10 SPS, ~1.5 hours at 80 SPS (one load cell)
+// "No heap after boot" (see HeapGuard.h). Every buffer of the steady state is sized at boot; these builds
+// check it: HEAP_AFTER_BOOT_COUNT counts every allocation made after setup(), per task (task report of Task6,
+// GET /metrics), HEAP_AFTER_BOOT_TRAP also stops the firmware when a task whose heap column in taskTable is
+// HeapPolicy::Trap allocates. Both need the malloc wrappers of env:esp32-s3-devkitm-1-noheap (platformio.ini).
+#define HEAP_AFTER_BOOT_OFF    0
+#define HEAP_AFTER_BOOT_COUNT  1
+#define HEAP_AFTER_BOOT_TRAP   2
+#ifndef HEAP_AFTER_BOOT
+#define HEAP_AFTER_BOOT HEAP_AFTER_BOOT_OFF
+#endif
+// Low-power mode (see PowerScheduler.h, env:esp32-s3-devkitm-1-lowpower). Task1 already sleeps between two
+// data-ready edges; LOW_POWER 1 also lets the whole chip sleep while nothing happens on the platform:
+//   - unchanged for POWER_IDLE_AFTER_MS: the network tasks (Task4, Task5, Task7) wake together once every
+//     POWER_NETWORK_BATCH_MS instead of every 5, 50 and 100 ms, so the CPU sleeps between two conversions
+//     (automatic light sleep, woken by the HX711 DOUT pins and the timer),
+//   - unchanged for POWER_DOWN_AFTER_MS: the HX711s are powered down and the display switched off; Task1
+//     powers them up for one conversion every few seconds and wakes up if the weight moved. A load put on the
+//     platform is weighed within POWER_MAX_REACTION_MS.
+// A connected web client, a command or a weight that is not ready keeps the scale awake. The light sleep
+// needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE in the sdkconfig of the core; without them
+// esp_pm_configure() fails (logged at boot) and only the HX711s, the display and the wake-ups are saved.
+#ifndef LOW_POWER
+#define LOW_POWER 0
+#endif
+#define POWER_MAX_REACTION_MS   2000     // a load put on a powered down scale is shown within this
+#define POWER_IDLE_AFTER_MS     10000    // 10 seconds
+#define POWER_DOWN_AFTER_MS     60000    // 1 minute
+#define POWER_NETWORK_BATCH_MS  1000     // also how late an HTTP request is answered while the scale sleeps
+#define POWER_CHANGE_BAND_MG    2000     // +/- 2 g around the resting weight is "nothing happened"
+#define POWER_CPU_MIN_MHZ       40       // the CPU clock while it waits (the XTAL)
+#if LOW_POWER
+#include <esp_idf_version.h>
+#include <esp_pm.h>             // esp_pm_configure(): frequency scaling and automatic light sleep
+#include <esp_sleep.h>          // esp_sleep_enable_gpio_wakeup(): the HX711 DOUT pins end a light sleep
+#include <driver/gpio.h>        // gpio_intr_enable(), gpio_intr_disable()
+#include <hal/gpio_ll.h>        // gpio_ll_intr_disable(): from the data-ready interrupt
+#endif
+#define NTP_SERVER            "pool.ntp.org"
 
 // WiFi configuration
 // You need to replace these with your own WiFi network name and password.  
@@ -62,39 +311,41 @@
 #define AP_NAME  "VM1080293"       // AP name 
 #define AP_PASS "Omidmuhsin2015"  // AP password 
 
+// Connectivity (Task4, see Connectivity.h): the scale weighs right after power-up; WiFi, the web server, the web
+// socket and the cloud come up in the background and are reconnected with a backoff when they drop.
+#define WIFI_ATTEMPT_TIMEOUT_MS   15000    // a WiFi attempt still not connected after this long is started again
+#define CLOUD_ATTEMPT_TIMEOUT_MS  3000     // Blynk.connect() waits for the login (MQTT: for the TCP connection), Task4 is blocked that long at most
+#define RECONNECT_BACKOFF_MIN_MS  1000     // wait after the first failed attempt, doubled after every failure
+#define RECONNECT_BACKOFF_MAX_MS  60000    // up to this
+
 /* 
-  The basic HTML page to show the current weight and tare the scale, when needed. 
-  The whole html is contained (compressed) in a string variable called "website". 
-  https://www.textfixer.com/html/compress-html-compression.php
-  We can use this string variable to send the HTML page to the client when requested.
-  If you want to change the HTML page, you can change the string variable "website".
-  The HTML page contains a button to tare the scale and a span to display the current weight.
-  The button will send a message to the server to tare the scale, and the server will respond 
-  with the current weight.
-  The span with id "rand" will be updated with the current weight received from the server.
-  
-  @note This is a simple web interface to interact with the scale. However, we can design our own web interface 
-  using seperate HTML, CSS, and JavaScript files, for real projects, to build better web pages. We can also 
-  use JSON to create a more complex web interface with more features. I could even have a chat graph to show
-  the current weight over time. However, as this is a simple demo, I decided to use a simple HTML page to show the 
-  current weight and tare the scale.
+  The web page to show the current weight and tare the scale, when needed. 
+  The page source is web/index.html. Before every build, tools/embed_web.py compresses it with gzip into
+  a const byte array in flash (include/WebUiData.h, generated), so the page costs no RAM, is streamed
+  straight from flash and sent compressed. The page has a button to tare the scale, the current weight,
+  a chart of the recent readings and a few settings; the chart and the settings live in the browser.
+  The page is sent with an ETag: a browser that already has it gets a "304 Not Modified" instead.
+  If you want to change the page, edit web/index.html and build again.
   */
-String website = "<!DOCTYPE html><html><head><title>SmartScaleMeasuring</title></head><body style='background-color: #EEEEEE;'><span style='color: #003366;'><h1>Displaying the Current Weight</h1><p>The current Weight is: <span id='rand'>-</span></p><p><button type='button' id='BTN_SEND_BACK'>Taring the Scale (Zeroing the Scale)</button></p></span></body><script> var Socket; document.getElementById('BTN_SEND_BACK').addEventListener('click', button_send_back); function init() { Socket = new WebSocket('ws://' + window.location.hostname + ':81/'); Socket.onmessage = function(event) { processCommand(event); }; } function button_send_back() { Socket.send('Taring the Scale'); } function processCommand(event) { document.getElementById('rand').innerHTML = event.data; console.log(event.data); } window.onload = function(event) { init(); }</script></html>";
+#include "WebUiData.h"        // WEB_UI_GZ, WEB_UI_ETAG (generated by tools/embed_web.py)
 
 // Web server and web socket configuration 
 WebServer  server(80);                                //  the server uses port 80 (standard port for websites)
 WebSocketsServer webSocket = WebSocketsServer(81);    // the websocket uses port 81 (standard port for websockets
-StaticJsonDocument<200> jsonDoc_tx;                      // JSON document to hold the data to be sent to the Blynk cloud and web server
 // FreeRTOS tasks and semaphore configuration
-// We will create 4 tasks to handle the different functionalities of the application.
-StaticJsonDocument<200> jsonDoc_rx;                     // JSON document to hold the data received from the Blynk cloud and web server
+// We will create 7 tasks to handle the different functionalities of the application.
 
 
 TaskHandle_t TaskHandle_1;  // get weight task 
 TaskHandle_t TaskHandle_2;  // display weight task 
 TaskHandle_t TaskHandle_3;  // web server task
-TaskHandle_t TaskHandle_4;  // Blyn Task
-SemaphoreHandle_t semaphore; 
+TaskHandle_t TaskHandle_4;  // connectivity (WiFi, web server, cloud) and Blynk task
+TaskHandle_t TaskHandle_5;  // HTTP server and web socket task
+TaskHandle_t TaskHandle_6;  // task monitor
+TaskHandle_t TaskHandle_7;  // log drain
+// Run time, jitter and deadline misses of every task, measured by the task itself (see TaskTiming.h).
+TaskTiming timingWeight, timingDisplay, timingWebSocket, timingBlynk, timingNetwork, timingMonitor, timingLog;
+SemaphoreHandle_t semaphore;   // protects the hardware only: the HX711s (scaleReaders, loadCells) and the display
 const int shared_resource = 3; 
 
 // HX711 scale reader object
@@ -102,138 +353,972 @@ const int shared_resource = 3;
 // This variable reads the load cell using the HX711 chip
 // HX711 is a chip that converts the analog signal from the load cell to a 
 // digital signal that can be read by the ESP32
-HX711 scaleReader;
+// There is one HX711 per load cell (channel).
+HX711 scaleReaders[LOAD_CELL_COUNT];
+
+// Acquisition engine: Task1 pushes every combined conversion of the load cells into a lock-free ring buffer.
+// The readers take the newest sample from the ring without waiting for the load cell.
+Hx711Acquisition acquisition;
+// time (micros) of the last DOUT falling edge of every channel, written by the data-ready interrupts.
+volatile uint32_t hx711ReadyMicros[LOAD_CELL_COUNT] = {};
+// bit i set: channel i signalled a new conversion that Task1 has not read yet.
+volatile uint32_t hx711ReadyMask = 0;
+portMUX_TYPE hx711Mux = portMUX_INITIALIZER_UNLOCKED;
 
-// Blynk timer object to run the Blynk cloud interaction
-// BlynkTimer is used to run the Blynk cloud interaction every second
-BlynkTimer timer;
+// Task1 groups the conversions of the channels into frames (one conversion per channel) and combines every
+// frame into one signal: the offsets (tare) removed, all channels in the counts per gram of channel 0.
+// The offsets are changed under the semaphore (tare), like the HX711s.
+FrameAligner cellAligner(LOAD_CELL_COUNT);
+LoadCellArray loadCellArray(LOAD_CELL_COUNT);
 
-// Calibration factor for the load cell
+// Filter chain, conversion and checks between the raw samples and the published weight (only used by Task1).
+// The filters of the profile (kitchen: median of 3 to reject spikes, EMA 1/8 to smooth, stable after 300ms
+// within +/-2g), compiled in with SCALE_FIXED_FILTER or set in setup() and changed by the "filter" command.
+#if SCALE_FIXED_FILTER
+using WeightFilter = ProfileFilterChain<Profile>;
+#else
+using WeightFilter = FilterChain;
+#endif
+BasicWeightProcessor<WeightFilter> weightProcessor(maxScaleValue, HX711_READY_TIMEOUT_MS * 1000UL);
+// Task1 uses it to decide when to wake the web server, and displayChange to decide when to wake the display.
+ChangeDetector changeDetector(PUBLISH_DEADBAND_MG, PUBLISH_HEARTBEAT_MS * 1000UL);
+DisplayChangeDetector displayChange;
+
+// Cloud uplink queue (Task4 only): coalesces the values, applies the deadband and the rate limit, and keeps
+// a backlog while Blynk is not connected. See UplinkQueue.h.
+UplinkQueue uplink([]() {
+  UplinkConfig config;
+  config.deadband = UPLINK_DEADBAND_G;
+  config.minIntervalMs = UPLINK_MIN_INTERVAL_MS;
+  config.keepAliveMs = UPLINK_KEEPALIVE_MS;
+  return config;
+}());
+
+// Calibration factor for the load cells (one per channel)
 // This numbr is used to convert the raw reading from the load cell to the actual weight.
-// See the getCalibrateFactor() function for more details on how to calculate this factor.
-float calibration_factor = -396.99; // Calibration factor to get the well known weight 
-                                    // This number works for me.  You can change this number to 
-                                    // get the correct weight for your load cell.                      
+// It is the default until the scale is calibrated from the web page (the calibration stored in NVS wins),
+// and with several load cells it sets how the channels are weighted against each other.
+// The factors are in the profile (ScaleProfile.h): -396.99 works for the 5 kg cell of the kitchen scale.
+// You can change them there to get the correct weight for your load cells.
+const float (&calibration_factors)[LOAD_CELL_COUNT] = Profile::countsPerGram;
+
+// Calibration state machine: commands from the web page (Task5), samples from Task1, both under the semaphore
+// like the offsets of loadCellArray. Task1 applies a finished calibration, Task5 stores it in NVS.
+Calibrator calibrator([]() {
+  CalibrationConfig config;
+  config.samplesPerPoint = ProfileLimits::calibrationSamples;          // 1.6 s and 30 s: times, not sample counts,
+  config.timeoutSamples = ProfileLimits::calibrationTimeoutSamples;    // the load rings for the same time at any rate
+  config.temperatureCompensation = CALIBRATION_TEMPERATURE != 0;
+  return config;
+}());
+ZeroDrift zeroDrift;                          // temperature drift of the zero (under the semaphore)
+float platformCountsPerGram = 0;              // factor of the combined signal (under the semaphore)
+bool platformCalibrated = false;              // platformCountsPerGram comes from a calibration
+volatile float boardTemperatureC = 25.0f;     // chip temperature (Task4)
+volatile bool calibrationToSave = false;      // the offsets or the calibration changed: Task5 writes NVS
+Preferences preferences;                      // NVS (Task5 and setup() only)
+
+// Commands of the web clients (see Commands.h).
+CommandQueue commandQueue;                    // Task5 -> Task1
+AckQueue ackQueue;                            // Task1 -> Task5
+TareAverager tareAverager;                    // Task1 only
+Command tareCommand;                          // the tare being averaged (Task1 only)
+uint32_t tareStartUs = 0;                     // Task1 only
+ZeroTracker zeroTracker(ZERO_TRACK_BAND_MG, ZERO_TRACK_INTERVAL_MS * 1000UL);   // Task1 only
+TraceRecorder traceRecorder;                  // Task1 records, Task5 takes the blocks
+float traceTemperatureC = 0;                  // temperature last written to the trace (Task1 only)
+uint32_t traceFileBytes = 0;                  // length of TRACE_FILE (Task5 only)
+File traceFile;                               // TRACE_FILE, open while a trace is written (Task5 only)
+// Allocations after setup() (HEAP_AFTER_BOOT builds). Constant-initialized: the malloc wrappers may run
+// before the constructors of the other globals.
+HeapGuard heapGuard;
+// Low-power mode (LOW_POWER builds): written by Task1 only, the other tasks read its state (see PowerScheduler.h).
+PowerScheduler powerScheduler;
+// What the calibration is doing: published by Task1 after every calibration command, sent by Task5.
+struct CalibrationStatus
+{
+  CalibrationState state;
+  CalibrationError error;
+  uint8_t points;
+  uint8_t progress;
+  CalibrationResult fit;
+};
+Snapshot<CalibrationStatus> calibrationStatus;
+// The topics of every web client: set when it connects and by "sub" (Task5), read by Task3.
+volatile uint8_t clientTopics[WEB_CLIENT_MAX] = {};
+volatile uint8_t clientConnected = 0;         // bit i: client i is connected
+// What every web client wants of the weight: kept by Task5 ("sub"), published for Task3.
+Subscription subscriptions[WEB_CLIENT_MAX];   // Task5 only
+Snapshot<Subscription> clientSubscriptions[WEB_CLIENT_MAX];
+volatile bool everySampleToWeb = false;       // a client wants less than PUBLISH_DEADBAND_MG or an alarm: Task1 wakes Task3 for every sample
+char ackJson[112];                            // Task5 only, see encodeAckJson()
                                   
 // This variable is used to store the current weight.
- long static  currentWeight = 0; // current weight 
+// Task1 publishes a new state for every sample, the other tasks read a consistent copy of it
+// (weight, raw value, flags, sample number and time) without taking the semaphore.
+ScaleStateSnapshot scaleState;  // current weight 
 
 // This is the 4 digits 7-segment display object 
 TM1637 displayScale(CLK_PIN,DIO_PIN);
 // This is the WiFiMulti object to connect to the WiFi network.
 WiFiMulti wifiMulti;  // wifi access
 
+// The pipeline talks to the hardware through these (see Hal.h), the native build uses simulated ones.
+ArduinoClock systemClock;                 // micros()/millis()
+Hx711LoadCell loadCells[LOAD_CELL_COUNT]; // HX711 conversions, one per channel (attached in setup())
+Tm1637Display display(displayScale, CLK_PIN, DIO_PIN);   // 4 digits 7-segment display
+// What the display shows (Task2 only, under the semaphore like the display): keeps a copy of the digits.
+DisplayStage displayStage(display);
+WebSocketTransport transport(webSocket);  // web clients
+
+/**
+ * @brief The web clients that want one topic ("sub" command): a broadcast only goes to them.
+ * @details One broadcast when every client wants it (the usual case), one send per client otherwise.
+ */
+class TopicTransport : public Transport
+{
+public:
+  TopicTransport(Transport &clients, uint8_t topic) : clients_(clients), topic_(topic) {}
+
+  size_t clientCount() override
+  {
+    size_t count = clients_.clientCount();
+    for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+    {
+      count -= isConnected(client) && !wants(client) ? 1 : 0;
+    }
+    return count;
+  }
+  bool broadcastText(const char *data, size_t length) override
+  {
+    if (everyoneWants())
+    {
+      return clients_.broadcastText(data, length);
+    }
+    bool ok = true;
+    for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+    {
+      ok &= !isConnected(client) || !wants(client) || clients_.sendText(client, data, length);
+    }
+    return ok;
+  }
+  bool broadcastBinary(const uint8_t *data, size_t length) override
+  {
+    if (everyoneWants())
+    {
+      return clients_.broadcastBinary(data, length);
+    }
+    bool ok = true;
+    for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+    {
+      ok &= !isConnected(client) || !wants(client) || clients_.sendBinary(client, data, length);
+    }
+    return ok;
+  }
+  bool sendText(uint8_t client, const char *data, size_t length) override { return clients_.sendText(client, data, length); }
+  bool sendBinary(uint8_t client, const uint8_t *data, size_t length) override
+  {
+    return clients_.sendBinary(client, data, length);
+  }
+
+private:
+  static bool isConnected(uint8_t client) { return (clientConnected & (1u << client)) != 0; }
+  bool wants(uint8_t client) const { return (clientTopics[client] & topic_) != 0; }
+  bool everyoneWants() const
+  {
+    for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+    {
+      if (isConnected(client) && !wants(client))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Transport &clients_;
+  uint8_t topic_;
+};
+
+FanOut<WEB_CLIENT_MAX, FANOUT_QUEUE_DEPTH> weightFanOut(FANOUT_BACKOFF_MS * 1000UL);   // Task3
+TopicTransport metricsClients(transport, TOPIC_METRICS);   // Task3
+TopicTransport streamClients(transport, TOPIC_STREAM);     // Task3, dynamic mode
+TopicTransport itemClients(transport, TOPIC_ITEMS);        // Task3, dynamic mode
+
+// Weight history (Task5 only: it records and answers the /history queries, so no lock is needed).
+FsHistoryStorage historyStorage(LittleFS, "/history");
+HistoryStore history(historyStorage);
+ChangeDetector historyDetector(HISTORY_DEADBAND_MG, HISTORY_HEARTBEAT_MS * 1000UL);
+uint32_t historyFlushMs = 0;   // millis() of the last flush
+
+// Preallocated telemetry buffers (Task3 only), so a broadcast never touches the heap (the weight messages are
+// in the pool of weightFanOut).
+uint8_t metricsFrame[METRICS_FRAME_SIZE];        // metrics frame
+uint32_t metricsPushMs = 0;                      // millis() of the last metrics frame
+
+// Why Task3 was woken (task notification bits).
+#define NOTIFY_WEIGHT  0x01   // the weight changed, settled or the heartbeat (notifySubscribers())
+#define NOTIFY_STREAM  0x02   // a batch of samples or an item is ready (dynamic mode)
+
+#if SCALE_MODE == SCALE_MODE_DYNAMIC
+// Dynamic mode: Task1 pushes every sample into streamRing and feeds the checkweigher, Task3 sends them.
+// The rings are lock-free: Task1 never waits for the network, a slow Task3 only loses samples (counted).
+StreamRing streamRing;                  // every sample, in milligrams (Task1 writes, Task3 reads)
+ItemRing itemRing;                      // the items that passed (Task1 writes, Task3 reads)
+PeakDetector peakDetector;              // Task1 only
+uint32_t streamSeq = 0;                 // sample number (Task1 only)
+StreamBatcher streamBatcher(STREAM_BATCH_SAMPLES, STREAM_FLUSH_MS * 1000UL);   // Task3 only
+uint32_t itemCursor = 0;                // Task3 only
+char itemJson[112];                     // Task3 only, see encodeItemJson()
+#endif
+
+// Runtime metrics. Every stage is recorded by the task that runs it (see Metrics.h), any task can read them.
+Metrics metrics;
+
 //******************************************* Help functions *********************************************************************
 
-/** 
- *  @brif This function is used to get the calibration factor for the load cell.  
-  *         The calibration factor is used to convert the raw reading from the load cell to the actual weight.
-  *         The calibration factor is calculated by taking two readings from the load cell:
-  *           - The first reading is taken with no weight on the scale (y1 = 0).
-  *           - The second reading is taken with a known weight on the scale (y2 = 50.0g).
-  *        The calibration factor is then calculated using the formula:
-  *        calibration_factor = (y2 - y1) / (x2 - x1)
-  *        where:          
-  *           - y1 is the first reading (0.0g)
-  *           - y2 is the second reading (50.0g)
-  *           - x1 is the first raw reading (raw_reading1)
-  *           - x2 is the second raw reading (raw_reading2)
-  *        The function returns the calibration factor as a float value.
-  *@note: This function assumes that the load cell is connected to the ESP32 using the HX711 library.
-  *@para: This function does not take any parameters.  
-  *@return: The calibration factor as a float value.
- **/
+/**
+ * @brief Takes the hardware semaphore and records how long the task waited for it.
+ * @param user: who is waiting (one histogram per waiting task).
+ */
+void takeHardware(LockUser user)
+{
+  uint32_t start = micros();
+  xSemaphoreTake(semaphore, portMAX_DELAY);
+  metrics.lockWait(user).record(micros() - start);
+}
 
-float getCalibrateFactor()
+/**
+ * @brief Records the first time a stage of the startup is reached (GET /metrics) and logs it.
+ */
+void markBoot(BootStage stage)
 {
-  // Step1: get raw reading with no scale factor set.
-  // weight is 0 
-  Serial.println("Do not put any weight");
-  scaleReader.set_scale();    //no calibration 
-  scaleReader.tare();    // removing weight on the scale
-  float raw_reading1 = scaleReader.read_average(10); // zero weight reading 
-  delay(5000);
-  Serial.println("Put on your weight ");
-  // my known weight is 50.0g
-  float myWeight = 50.0; //y2, y1 =0.
-  // step 2: get another raw reading when your weight is on the scale 
-  float raw_reading2 = scaleReader.read_average(10); //x2
-  delay(5000);
-  // factor = (y2 - y1) / (x2 - x1)
-  float calibration_factor = (myWeight - 0.0)/(raw_reading2-raw_reading1);
-  return calibration_factor;  
+  if (metrics.bootMs(stage) == 0)
+  {
+    metrics.markBoot(stage, millis());
+    LOG_INFO("Boot: %s after %u ms", bootStageName(stage), (unsigned)millis());
+  }
 }
 
+/**
+ * @brief Updates the gauges that are not recorded on the way (web clients and heap).
+ */
+void updateMetricGauges()
+{
+  metrics.setClients(transport.clientCount());
+  metrics.setHeap(ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+  metrics.setHeapAllocations(heapGuard.allocations());
+}
 
 /**
- * @brief function is used to reset the display to show "----".
- *          It is called when the display needs to be cleared or reset.  
- * @para: This function does not take any parameters.
- * @note: This function is used to reset the display to show "----" on the 4 digits 7-segment display.
- *        It is called when the display needs to be cleared or reset.
- *        It is used to ensure that the display is clear before showing the current weight.
+ * @brief Sends the runtime metrics in the Prometheus text format (GET /metrics).
+ * @details The text is a few KB; it is produced and sent in chunks of 512 bytes (see MetricsExporter).
+ *          Example: http://<ip>/metrics
  */
-void resetDisplay()
-{   
-    // This function is used to reset the display to show "----"
-    displayScale.display("----"); 
+void handleMetrics()
+{
+  updateMetricGauges();
+  MetricsExporter exporter(metrics, millis() / 1000);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);   // chunked transfer
+  server.send(200, "text/plain; version=0.0.4", "");
+  char chunk[512];
+  size_t length;
+  while ((length = exporter.read(chunk, sizeof(chunk))) != 0)
+  {
+    server.sendContent(chunk, length);
+  }
+  server.sendContent("");   // end of the chunked answer
+}
+
+/**
+ * @brief Sends the web page (GET /).
+ * @details The page is already gzip-compressed in flash and is streamed from there, nothing is copied to the heap.
+ *          If the browser sends the ETag of the page it already has (If-None-Match), only "304 Not Modified" is sent.
+ */
+void handleRoot()
+{
+  server.sendHeader("ETag", WEB_UI_ETAG);
+  // the browser may keep the page but must check with the ETag before using it.
+  server.sendHeader("Cache-Control", "no-cache");
+  if (server.header("If-None-Match") == WEB_UI_ETAG)
+  {
+    server.send(304);
+    return;
+  }
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send_P(200, "text/html", (PGM_P)WEB_UI_GZ, sizeof(WEB_UI_GZ));
+}
+
+/**
+ * @brief Wall clock time in milliseconds since 1970, 0 while the clock is not set by NTP yet.
+ */
+uint64_t wallClockMs()
+{
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  if (now.tv_sec < 1600000000)   // before 2020: not synchronized
+  {
+    return 0;
+  }
+  return (uint64_t)now.tv_sec * 1000ULL + now.tv_usec / 1000;
+}
+
+/**
+ * @brief Mounts the flash file system (formatted on first use) and finds the weight history (Task5, once).
+ */
+void mountHistory()
+{
+  if (LittleFS.begin(true))
+  {
+    historyStorage.begin();
+    const bool found = history.begin();
+    LOG_INFO("Weight history %s", found ? "found" : "is empty");
+    (void)found;   // only logged with LOG_LEVEL_INFO and above
+  }
+  else
+  {
+    LOG_ERROR("LittleFS could not be mounted, no weight history");
+  }
+}
+
+/**
+ * @brief Records the current weight in the history when it changed (called from Task5).
+ * @details Points are only recorded once the clock is set, so the history has real time stamps.
+ *          The points are buffered in RAM and written to flash every HISTORY_FLUSH_MS.
+ */
+void recordHistory()
+{
+  ScaleState state = {};
+  const uint64_t nowMs = wallClockMs();
+  if (nowMs != 0 && scaleState.read(state) && state.isReady() &&
+      historyDetector.check(state, micros()) != ChangeReason::None)
+  {
+    history.append(nowMs, state.weight);
+  }
+  if (millis() - historyFlushMs >= HISTORY_FLUSH_MS)
+  {
+    history.flush();
+    historyFlushMs = millis();
+  }
+}
+
+/**
+ * @brief Sends a time range of the weight history (GET /history).
+ * @details Arguments (all optional):
+ *            - from, to : time range in milliseconds since 1970 (default: everything),
+ *            - bucket   : downsampling in milliseconds, min/max/avg per bucket (default 0: every point),
+ *            - format   : "csv" (default) or "bin" (12 byte points / 24 byte buckets, see HistoryStore.h).
+ *          The answer is streamed in chunks of 512 bytes, so any range can be sent with a small buffer.
+ *          Example: http://<ip>/history?from=1760000000000&bucket=3600000
+ */
+void handleHistory()
+{
+  const uint64_t fromMs = server.hasArg("from") ? strtoull(server.arg("from").c_str(), nullptr, 10) : 0;
+  const uint64_t toMs = server.hasArg("to") ? strtoull(server.arg("to").c_str(), nullptr, 10) : UINT64_MAX;
+  const uint32_t bucketMs = server.hasArg("bucket") ? strtoul(server.arg("bucket").c_str(), nullptr, 10) : 0;
+  const bool binary = server.arg("format") == "bin";
+
+  history.flush();   // the query reads from flash only
+  HistoryStream stream(history, fromMs, toMs, bucketMs, binary ? HistoryFormat::Binary : HistoryFormat::Csv);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);   // chunked transfer
+  server.send(200, binary ? "application/octet-stream" : "text/csv", "");
+  uint8_t chunk[512];
+  size_t length;
+  while ((length = stream.read(chunk, sizeof(chunk))) != 0)
+  {
+    server.sendContent((const char *)chunk, length);
+  }
+  server.sendContent("");   // end of the chunked answer
+}
+
+/**
+ * @brief Writes the blocks of the raw trace to flash (Task5).
+ * @details The header block starts a new file, which stays open until the next trace (no File on the heap
+ *          for every write). The blocks past TRACE_MAX_BYTES are dropped, the file keeps the start of the trace.
+ */
+void writeTrace()
+{
+  TraceBlock block;
+  bool written = false;
+  while (traceRecorder.take(block))
+  {
+    if (block.first)
+    {
+      traceFile.close();
+      traceFile = LittleFS.open(TRACE_FILE, "w");
+      traceFileBytes = 0;
+    }
+    if (traceFile && traceFileBytes + block.length <= TRACE_MAX_BYTES)
+    {
+      traceFileBytes += traceFile.write(block.data, block.length);
+      written = true;
+    }
+  }
+  if (written)
+  {
+    traceFile.flush();   // GET /trace reads it through another handle
+  }
+}
+
+/**
+ * @brief Sends the raw trace file (GET /trace), for the "replay" scenario of the native build.
+ * @details Example: curl -o trace.bin http://<ip>/trace
+ */
+void handleTrace()
+{
+  File file = LittleFS.open(TRACE_FILE, "r");
+  if (!file)
+  {
+    server.send(404, "text/plain", "no trace, send \"trace start\" first");
+    return;
+  }
+  server.streamFile(file, "application/octet-stream");
+  file.close();
+}
+
+/**
+ * @brief Applies a finished calibration (Task1, under the semaphore).
+ * @details The zero that was found is moved into the offsets, so the combined signal is 0 with an empty
+ *          platform; the factor goes to the filter chain and the drift is applied to every sample from now on.
+ * @param fit: the result of the calibration.
+ */
+void applyCalibration(const CalibrationResult &fit)
+{
+  loadCellArray.shiftZero((int32_t)lroundf(fit.zeroCounts));
+  zeroDrift.countsPerDegree = fit.countsPerDegree;
+  zeroDrift.refTemperatureC = fit.refTemperatureC;
+  platformCountsPerGram = fit.countsPerGram;
+  platformCalibrated = true;
+  weightProcessor.filter().converter().setCalibration(0, platformCountsPerGram);
+  calibrationToSave = true;
+}
+
+/**
+ * @brief Stores the offsets and the calibration in NVS (Task5).
+ * @details A few ms of flash writing, so it is done here and not in Task1.
+ */
+void saveCalibration()
+{
+  CalibrationRecord record;
+  memset(&record, 0, sizeof(record));
+  takeHardware(LockUser::Tare);
+  record.channels = LOAD_CELL_COUNT;
+  record.fitted = platformCalibrated ? 1 : 0;
+  for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+  {
+    record.offsets[channel] = loadCellArray.offset(channel);
+  }
+  record.countsPerGram = platformCountsPerGram;
+  record.countsPerDegree = zeroDrift.countsPerDegree;
+  record.refTemperatureC = zeroDrift.refTemperatureC;
+  calibrationToSave = false;
+  xSemaphoreGive(semaphore);
+  sealCalibrationRecord(record);
+  if (preferences.putBytes("cal", &record, sizeof(record)) == sizeof(record))
+  {
+    LOG_INFO("Calibration stored in NVS");
+  }
+  else
+  {
+    LOG_ERROR("Calibration could not be stored in NVS");
+  }
+}
+
+/**
+ * @brief Acknowledges a command that Task1 ran (Task1). Task5 sends the acknowledgement to the client.
+ * @param value: the result, e.g. the new offset of a tare.
+ */
+void acknowledge(const Command &command, CommandStatus status, int32_t value)
+{
+  if (!ackQueue.push(makeAck(command, status, value, micros())))
+  {
+    LOG_WARN("Acknowledgement of command %u lost", (unsigned)command.id);
+  }
+}
+
+/**
+ * @brief Runs a calibration command (Task1, under the semaphore) and publishes the calibration status.
+ * @return Ok, or Failed if the calibrator refused it (the reason is in the status).
+ */
+CommandStatus runCalibrationCommand(const Command &command)
+{
+  static const char *const names[] = {"start", "point", "finish", "cancel", "status"};
+  const CalibrationCommand which = (CalibrationCommand)command.argument;
+  bool done = true;
+  switch (which)
+  {
+    case CalibrationCommand::Start:
+      calibrator.start();
+      break;
+    case CalibrationCommand::Point:
+      done = calibrator.addPoint(command.value / 1000.0f);   // the known weight, sent in milligrams
+      break;
+    case CalibrationCommand::Finish:
+      done = calibrator.finish();
+      break;
+    case CalibrationCommand::Cancel:
+      calibrator.cancel();
+      break;
+    case CalibrationCommand::Status:
+      break;
+  }
+  CalibrationStatus status;
+  status.state = calibrator.state();
+  status.error = calibrator.error();
+  status.points = calibrator.pointCount();
+  status.progress = calibrator.progress();
+  status.fit = calibrator.result();
+  calibrationStatus.publish(status);
+  if (which != CalibrationCommand::Status)
+  {
+    // the names are copied into the log record (LOG_TEXT_SIZE bytes): the error gets its own line.
+    LOG_INFO("Calibration %s: %s, %u points", names[command.argument], calibrationStateName(status.state),
+             (unsigned)status.points);
+    if (status.error != CalibrationError::None)
+    {
+      LOG_WARN("Calibration: %s", calibrationErrorName(status.error));
+    }
+  }
+  (void)names;   // only logged in a LOG_LEVEL_INFO build
+  return done ? CommandStatus::Ok : CommandStatus::Failed;
+}
+
+/**
+ * @brief Sends the calibration status (the last one Task1 published) to a client (Task5).
+ * @param num: the client that sent the calibration command.
+ */
+void sendCalibrationStatus(uint8_t num)
+{
+  CalibrationStatus status;
+  if (!calibrationStatus.read(status))
+  {
+    return;
+  }
+  char reply[224];
+  int length = snprintf(reply, sizeof(reply),
+                        "{\"cal\":{\"state\":\"%s\",\"error\":\"%s\",\"points\":%u,\"progress\":%u",
+                        calibrationStateName(status.state), calibrationErrorName(status.error), (unsigned)status.points,
+                        (unsigned)status.progress);
+  if (status.state == CalibrationState::Done)
+  {
+    length += snprintf(reply + length, sizeof(reply) - length,
+                       ",\"countsPerGram\":%.3f,\"drift\":%.2f,\"rmsG\":%.2f,\"maxG\":%.2f", status.fit.countsPerGram,
+                       status.fit.countsPerDegree, status.fit.rmsErrorG, status.fit.maxErrorG);
+  }
+  snprintf(reply + length, sizeof(reply) - length, "}}");
+  transport.sendText(num, reply, strlen(reply));
+}
+
+/**
+ * @brief Changes one setting of the filter chain (Task1). The filters start again from the next sample.
+ * @return Invalid if the value is out of range (nothing is changed then), Unsupported if the settings of the
+ *         profile are compiled into the filter chain (SCALE_FIXED_FILTER).
+ */
+CommandStatus setFilter(FilterParam param, int32_t value)
+{
+#if SCALE_FIXED_FILTER
+  (void)param;
+  (void)value;
+  return CommandStatus::Unsupported;
+#else
+  FilterConfig config = weightProcessor.filter().config();
+  switch (param)
+  {
+    case FilterParam::Median:
+      if (value < 1 || value > 9 || value % 2 == 0)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.medianWindow = (uint8_t)value;
+      break;
+    case FilterParam::Ema:
+      if (value < 1 || value > 8)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.smoothing = Smoothing::Ema;
+      config.emaShift = (uint8_t)value;
+      break;
+    case FilterParam::Average:
+      if (value < 1 || value > 32)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.smoothing = Smoothing::MovingAverage;
+      config.averageWindow = (uint8_t)value;
+      break;
+    case FilterParam::Kalman:
+      if (value < 0)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.smoothing = Smoothing::Kalman;
+      config.kalmanMeasurementNoise = value > 0 ? (uint32_t)value : config.kalmanMeasurementNoise;
+      break;
+    case FilterParam::None:
+      config.smoothing = Smoothing::None;
+      break;
+    case FilterParam::Tolerance:
+      if (value < 1 || value > 1000000)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.stableToleranceMg = value;
+      break;
+    case FilterParam::Settle:
+      if (value < 0 || value > 10000)
+      {
+        return CommandStatus::Invalid;
+      }
+      config.settleUs = (uint32_t)value * 1000u;
+      break;
+  }
+  weightProcessor.filter().configure(config);
+  return CommandStatus::Ok;
+#endif
+}
+
+/**
+ * @brief Ends a tare (Task1, under the semaphore): the averaged conversions are the new offsets.
+ * @param offsets: the new offset of every load cell.
+ */
+void finishTare(const int32_t *offsets)
+{
+  for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+  {
+    loadCellArray.setOffset(channel, offsets[channel]);
+    scaleReaders[channel].set_offset(offsets[channel]);
+  }
+  zeroDrift.refTemperatureC = boardTemperatureC;   // the new zero is at today's temperature
+  calibrationToSave = true;                        // Task5 keeps the new offsets in NVS
+  acknowledge(tareCommand, CommandStatus::Ok, offsets[0]);
+  LOG_INFO("Taring done:)");
+}
+
+/**
+ * @brief Writes a conversion to the raw trace (Task1, under the semaphore), the board temperature before it
+ *        if it changed (the replay corrects the zero drift with it).
+ */
+void traceConversion(uint8_t channel, int32_t raw, uint32_t readyMicros)
+{
+  const float temperature = boardTemperatureC;
+  if (temperature != traceTemperatureC)
+  {
+    traceRecorder.event(TraceEvent::Temperature, (int32_t)lroundf(temperature * 100), readyMicros);
+    traceTemperatureC = temperature;
+  }
+  traceRecorder.sample(channel, raw, readyMicros);
+}
+
+/**
+ * @brief Runs a trace command (Task1, under the semaphore).
+ * @details "start" writes what the replay needs to weigh like this scale (offsets, calibration, capacity) into
+ *          the header of the trace; "mark" tells the replay the weight that is on the platform from now on.
+ */
+CommandStatus runTraceCommand(const Command &command)
+{
+  switch ((TraceCommand)command.argument)
+  {
+    case TraceCommand::Start:
+    {
+      TraceHeader header;
+      header.channels = LOAD_CELL_COUNT;
+      header.flags = zeroTracker.enabled() ? TRACE_FLAG_ZERO_TRACK : 0;
+      header.sps = Profile::sps;
+      header.maxGrams = maxScaleValue;
+      header.countsPerGram = platformCountsPerGram;
+      header.countsPerDegree = zeroDrift.countsPerDegree;
+      header.refTemperatureC = zeroDrift.refTemperatureC;
+      for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+      {
+        header.offsets[channel] = loadCellArray.offset(channel);
+        header.channelCountsPerGram[channel] = calibration_factors[channel];
+        header.trims[channel] = loadCellArray.trim(channel);
+      }
+      if (!traceRecorder.start(header))
+      {
+        return CommandStatus::Busy;   // Task5 did not write the last blocks yet
+      }
+      traceTemperatureC = boardTemperatureC;
+      traceRecorder.event(TraceEvent::Temperature, (int32_t)lroundf(traceTemperatureC * 100), micros());
+      LOG_INFO("Raw trace started");
+      return CommandStatus::Ok;
+    }
+    case TraceCommand::Stop:
+      traceRecorder.stop();
+      LOG_INFO("Raw trace stopped, %u conversions", (unsigned)traceRecorder.stats().samples);
+      return CommandStatus::Ok;
+    case TraceCommand::Mark:
+      if (!traceRecorder.active())
+      {
+        return CommandStatus::Failed;
+      }
+      traceRecorder.event(TraceEvent::Reference, command.value, micros());
+      return CommandStatus::Ok;
+  }
+  return CommandStatus::Invalid;
+}
+
+/**
+ * @brief Runs the commands the web clients queued (Task1, between two samples, under the semaphore).
+ * @details Every command is short: a tare only starts averaging the next TARE_FRAMES conversions (see
+ *          finishTare()), nothing here waits for a HX711. Every command is acknowledged, the tare once done.
+ */
+void runCommands()
+{
+  if (tareAverager.active() && micros() - tareStartUs > TARE_TIMEOUT_MS * 1000UL)
+  {
+    tareAverager.cancel();
+    acknowledge(tareCommand, CommandStatus::Failed, 0);
+    LOG_WARN("Taring failed, the scale is not ready");
+  }
+  Command command;
+  while (commandQueue.pop(command))
+  {
+    switch (command.type)
+    {
+      case CommandType::Tare:
+        if (tareAverager.active())
+        {
+          acknowledge(command, CommandStatus::Busy, 0);
+          break;
+        }
+        LOG_INFO("Client %u requesting to tare the scale", (unsigned)command.client);
+        tareCommand = command;
+        tareStartUs = micros();
+        tareAverager.start(LOAD_CELL_COUNT, TARE_FRAMES);
+        traceRecorder.event(TraceEvent::Tare, TARE_FRAMES, tareStartUs);
+        break;
+      case CommandType::ZeroTrack:
+        zeroTracker.setEnabled(command.value != 0);
+        traceRecorder.event(TraceEvent::ZeroTrack, command.value, micros());
+        LOG_INFO("Zero tracking %s", command.value != 0 ? "on" : "off");
+        acknowledge(command, CommandStatus::Ok, command.value);
+        break;
+      case CommandType::SetRate:
+#if HX711_RATE_PIN >= 0
+        // the deadline of Task1 in the task report stays the one of the build (HX711_SAMPLE_PERIOD_MS).
+        if (command.value == 10 || command.value == 80)
+        {
+          digitalWrite(HX711_RATE_PIN, command.value == 80 ? HIGH : LOW);
+          traceRecorder.event(TraceEvent::Rate, command.value, micros());
+          LOG_INFO("HX711 rate %d SPS", (int)command.value);
+          acknowledge(command, CommandStatus::Ok, command.value);
+        }
+        else
+        {
+          acknowledge(command, CommandStatus::Invalid, command.value);
+        }
+#else
+        acknowledge(command, CommandStatus::Unsupported, Profile::sps);   // RATE set on the board
+#endif
+        break;
+      case CommandType::SetFilter:
+        acknowledge(command, setFilter((FilterParam)command.argument, command.value), command.value);
+        break;
+      case CommandType::Calibrate:
+        acknowledge(command, runCalibrationCommand(command), command.value);
+        break;
+      case CommandType::Subscribe:
+        break;   // handled by Task5, never queued
+      case CommandType::Trace:
+        acknowledge(command, runTraceCommand(command), (int32_t)traceRecorder.stats().samples);
+        break;
+    }
+  }
+}
+
+/**
+ * @brief A client came, went or changed its subscription (Task5): Task3 sends it a message at once, and
+ *        Task1 wakes Task3 for every sample if a client wants changes smaller than the ones the change
+ *        detector reports, or watches a threshold.
+ */
+void subscriptionsChanged()
+{
+  bool everySample = false;
+  for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+  {
+    const Subscription &subscription = subscriptions[client];
+    everySample |= (clientConnected & (1u << client)) != 0 &&
+                   (subscription.deadbandMg < PUBLISH_DEADBAND_MG || subscription.alarmMg != SUBSCRIPTION_NO_ALARM);
+  }
+  everySampleToWeb = everySample;
+  if (TaskHandle_3 != NULL)
+  {
+    xTaskNotify(TaskHandle_3, NOTIFY_WEIGHT, eSetBits);
+  }
+}
+
+/**
+ * @brief Changes what a client gets ("sub", Task5): its topics, or how it gets the weight (Subscriptions.h).
+ * @details Task3 picks the new subscription up with its next message; the client gets one at once.
+ * @param num: the client that sent the command.
+ */
+CommandStatus subscribeClient(uint8_t num, const Command &command)
+{
+  if (num >= WEB_CLIENT_MAX)
+  {
+    return CommandStatus::Unsupported;   // this client gets every topic, as the page does
+  }
+  Subscription &subscription = subscriptions[num];
+  switch ((SubscribeParam)command.argument)
+  {
+    case SubscribeParam::Topics:
+      clientTopics[num] = (uint8_t)command.value;
+      return CommandStatus::Ok;
+    case SubscribeParam::Rate:
+      subscription.intervalUs = command.value == 0 ? 0 : 1000000UL / (uint32_t)command.value;
+      break;
+    case SubscribeParam::Deadband:
+      subscription.deadbandMg = command.value;
+      break;
+    case SubscribeParam::Alarm:
+      subscription.alarmMg = command.value;
+      break;
+    case SubscribeParam::Format:
+      subscription.format = (uint8_t)command.value;
+      break;
+    case SubscribeParam::Fields:
+      subscription.fields = (uint8_t)command.value;
+      break;
+  }
+  clientSubscriptions[num].publish(subscription);
+  subscriptionsChanged();
+  return CommandStatus::Ok;
+}
+
+#if LOW_POWER
+/**
+ * @brief Wakes Task1 while it waits for the next probe (a web client connected, a command).
+ */
+void wakeAcquisition()
+{
+  if (TaskHandle_1 != NULL)
+  {
+    xTaskNotifyGive(TaskHandle_1);
+  }
+}
+#endif
+
+/**
+ * @brief Decodes a command of a web client and queues it for Task1 (Task5, see Commands.h).
+ * @details Only the fixed-format decoder runs here, nothing waits for the load cells, so the web server
+ *          and the web socket go on at once. Invalid commands, topics and a full queue are answered here.
+ * @param num: the client that sent the command.
+ */
+void handleCommandMessage(uint8_t num, const uint8_t *payload, size_t length)
+{
+  const uint32_t start = micros();
+  Command command;
+  CommandStatus status = CommandStatus::Ok;
+  bool answerNow = true;
+  if (!parseCommand((const char *)payload, length, num, command))
+  {
+    LOG_WARN("Client %u sent an invalid command", num);
+    status = CommandStatus::Invalid;
+  }
+  else if (command.type == CommandType::Subscribe)
+  {
+    status = subscribeClient(num, command);
+  }
+  else
+  {
+    command.queuedUs = start;
+    answerNow = !commandQueue.push(command);
+    status = CommandStatus::Busy;   // only sent if the queue is full
+#if LOW_POWER
+    wakeAcquisition();   // powered down, Task1 would only see it at the next probe
+#endif
+  }
+  if (answerNow)
+  {
+    command.queuedUs = start;
+    const CommandAck ack = makeAck(command, status, command.value, micros());
+    transport.sendText(num, ackJson, encodeAckJson(ack, ackJson, sizeof(ackJson)));
+  }
+  metrics.stage(MetricStage::Command).record(micros() - start);
+}
+
+/**
+ * @brief Sends the acknowledgements of the commands Task1 ran to their clients (Task5).
+ */
+void sendAcknowledgements()
+{
+  CommandAck ack;
+  while (ackQueue.pop(ack))
+  {
+    transport.sendText(ack.client, ackJson, encodeAckJson(ack, ackJson, sizeof(ackJson)));
+    if (ack.type == CommandType::Calibrate)
+    {
+      sendCalibrationStatus(ack.client);   // what the page shows in the calibration card
+    }
+  }
 }
 
+
 /**
   * @brief  This function is used to get the current weight from the load cell.
-  * @details       It checks if the scale is ready, sets the calibration factor, and gets the reading from the load cell. 
+  * @details       It takes the newest sample acquired by Task1 from the sample ring, runs it through the
+  *        filter chain (spike rejection, smoothing, stability detection) and converts it to grams using the
+  *        tare offset and the calibration factor, in fixed-point. It never waits for the load cell.
+  *        The weight is flagged as stable once it has settled (see FilterConfig).
+  *        If there is no sample newer than HX711_READY_TIMEOUT_MS, the scale is not ready and it returns zero.
   *        If the reading is greater than the maximum scale value or less than or equal to zero, it returns zero.
   *        If the reading is within the valid range, it returns the reading (in grams). 
-  * @para: This function does not take any parameters.
+  * @param state: filled with the weight, the raw value it was computed from and the status flags.
   * @return: The current weight as a long value.
   * @note: This function assumes that the load cell is connected to the ESP32 using the HX711 library.
   *        If you see an unexpected weight (less than 0) for a long time, then you can reset the ESP32 chip. 
   *        After this, you should see the expected weight on the display and in the serial monitor. 
  */
 
-long  getWeight()
+long  getWeight(ScaleState &state)
 {  
-  // is scale ready?
-  if (scaleReader.is_ready()) 
-  {          
-    // set calibration factor  
-    // You can change this value to get the correct weight for your load cell.    
-    // see getCalibrateFactor() function for more details on how to calculate this factor.  
-    scaleReader.set_scale(calibration_factor);
-    // get reading from the load cell          
-    long gram_reading = scaleReader.get_units();
-    Serial.println(""); 
-    Serial.print("Reading: ");
-    Serial.println(gram_reading); 
-    // reading must be less than max scale value.
-    if ( (gram_reading > maxScaleValue) || (gram_reading <0) )
-      {
-        Serial.println("Overweight!"); // if the reading is greater than the max scale value, then it is overweight.
-        resetDisplay();                // reset the display to show "----"
-        Serial.println("Resetting the display to show ----");
-        delay(1000);                   // wait for 1 second      
-        return 0;                       // overweight 
-      }
-    else
-      {
-        // if the reading is within the valid range, then return the reading.                  
-        return gram_reading;           // return the reading 
-      }
-  } 
-  else 
-  {    
+  // filter the newest sample, convert it to grams and check it (see WeightProcessor).
+  // the offsets of the load cells are already removed by loadCellArray (Task1), so the offset here is 0.
+  state = weightProcessor.update(acquisition, 0, systemClock.micros());
+  if (!state.isReady())
+  {
     // This means that the scale is not ready to read the weight.
     // It could be due to a bad connection or the esp32 is not powered on.
     // You can check the connections and power supply to the scale.
-    // If the scale is not ready, then return 0.
-    resetDisplay();                // reset display
-    // print a message to the serial monitor to indicate that the scale is not ready yet. 
-    Serial.println("Scale is not ready yet...");
-    // wait for 1 second before returning again. 
-    delay(1000); 
-    // return 0 to indicate that the scale is not ready.
+    // log a message to indicate that the scale is not ready yet. 
+    LOG_WARN("Scale is not ready yet...");
     return 0;
-  } 
+  }
+  // every reading (only in a LOG_LEVEL_DEBUG build, otherwise this line is removed by the preprocessor).
+  LOG_DEBUG("Reading: %d", (int)state.weight);
+  if (state.isOverload())
+  {
+    LOG_WARN("Overweight! %d g", (int)state.weight); // if the reading is greater than the max scale value, then it is overweight.
+  }
+  return state.weight;
+}
+
+/**
+ * @brief Interrupt handler for the HX711 data-ready signal (DOUT falling edge), one per channel.
+ * @details The HX711 pulls DOUT low when a new conversion is ready. The handler only stores the time of
+ *          the edge, marks the channel as ready and wakes Task1, which reads the conversion. Reading the
+ *          24 bits here would keep the interrupt busy for too long.
+ * @param arg: the channel number.
+ */
+void IRAM_ATTR onHx711DataReady(void *arg)
+{
+  const uint32_t channel = (uint32_t)(uintptr_t)arg;
+  hx711ReadyMicros[channel] = micros();
+  portENTER_CRITICAL_ISR(&hx711Mux);
+  hx711ReadyMask |= 1u << channel;
+  portEXIT_CRITICAL_ISR(&hx711Mux);
+#if LOW_POWER
+  // a low level interrupt (only a level ends a light sleep): masked until Task1 read the conversion.
+  gpio_ll_intr_disable(&GPIO, (gpio_num_t)loadCellDoutPins[channel]);
+#endif
+  if (TaskHandle_1 != NULL)
+  {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(TaskHandle_1, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+  }
 }
 
 /**
@@ -241,11 +1326,12 @@ long  getWeight()
  * @details  It is called when a client connects, disconnects, or sends a message to the server.  
  *       It handles the following events:
  *       - WStype_DISCONNECTED: When a client disconnects, it prints a message to the serial monitor. 
- *       - WStype_CONNECTED: When a client connects, it prints a message to the serial monitor.
- *       - WStype_TEXT: a client sends a message = "Taring the Scale"  to the server, server tares the
- *                   scale and prints a message to the serial monitor.
- * @note currently, we assume that we only have one button to tare the scale.
- *       This function is used to communicate between clients and the server using web sockets.
+ *       - WStype_CONNECTED: When a client connects, it prints a message to the serial monitor; the new
+ *                   client gets every topic and the weight like the page until it sends "sub".
+ *       - WStype_TEXT: a command (tare, zero tracking, rate, filter, calibration, topics and subscriptions;
+ *                   see Commands.h),
+ *                   decoded and queued for Task1 (see handleCommandMessage()), acknowledged when done.
+ * @note This function is used to communicate between clients and the server using web sockets.
  *       It is called by the webSocket.onEvent() function in the setup() function.  
  * 
  * @param num: The client number that sent the message.
@@ -262,36 +1348,37 @@ void webSocketEvent(byte num, WStype_t type, uint8_t * payload, size_t length)
   switch (type) {    
     // handle the different types of events
     case WStype_ERROR:          // if there is an error, then type == WStype_ERROR
-      Serial.println("Error on client " + String(num));
+      LOG_WARN("Error on client %u", num);
       break;                                 
     case WStype_DISCONNECTED:   // if a client is disconnected, then type == WStype_DISCONNECTED
-      Serial.println("Client " + String(num) + " disconnected");
+      LOG_INFO("Client %u disconnected", num);
+      if (num < WEB_CLIENT_MAX)
+      {
+        clientConnected &= (uint8_t)~(1u << num);
+        subscriptionsChanged();
+      }
       break;
     case WStype_CONNECTED:   // if a client is connected, then type == WStype_CONNECTED
-      Serial.println("Client " + String(num) + " connected");
-      // optionally you can add code here what to do when connected
-      break;
-    case WStype_TEXT:                          
-      // a clients sends a request to tare the scale( we assume we only have one button)
-      // we could receive different data. 
-      // if we receive any other data, we can handle it accordingly.
-      // This could be the case when we have multiple buttons or actions. 
-      DeserializationError error = deserializeJson(jsonDoc_rx, payload, length); // deserialize the payload to a JSON document               
-      if (error) 
-      {
-        Serial.println("Failed to deserialize JSON: " + String(error.c_str()));
-        return; // exit the function if there is an error
-      }   
-      else
+      LOG_INFO("Client %u connected", num);
+      if (num < WEB_CLIENT_MAX)
       {
-        // print the received JSON document to the serial monitor for debugging purposes.
-        const char *str = jsonDoc_rx["rand"]; // get the message from the JSON document
-        Serial.println("Received JSON: " + String(str[0]));
-        Serial.println("Client " + String(num) + "requesting to tare the scale");
-        scaleReader.tare(); // tare the scale
-        Serial.println("Taring done:)");
+        // every topic and the weight as the page always got it, until the client asks for something else.
+        clientTopics[num] = TOPIC_ALL;
+        subscriptions[num] = defaultSubscription(PUBLISH_DEADBAND_MG, PUBLISH_HEARTBEAT_MS * 1000UL,
+                                                 TELEMETRY_BINARY ? SUBSCRIPTION_BINARY : SUBSCRIPTION_JSON);
+        clientSubscriptions[num].publish(subscriptions[num]);
+        clientConnected |= (uint8_t)(1u << num);
+        subscriptionsChanged();
+#if LOW_POWER
+        wakeAcquisition();   // a client keeps the scale awake
+#endif
       }
-     
+      break;
+    case WStype_TEXT:
+      // a command of the page, e.g. "7 tare" (the tare button) or "8 cal point 500".
+      handleCommandMessage(num, payload, length);
+      break;
+    default:
       break;
   }
 }
@@ -299,176 +1386,939 @@ void webSocketEvent(byte num, WStype_t type, uint8_t * payload, size_t length)
 
 /**
  * @brief   This function is used to display the current weight on the 4 digits 7-segment display.
- * @details takes the weight value as a parameter and displays it on the display. 
- *          It is called when the current weight needs to be displayed on the display.
- *          It resets the display first to ensure that the display is clear before showing the current weight. 
- *          It is used to display the current weight on the display in a human-readable format.  
- * @param weightVal: The weight value to be displayed on the display.
- * @returns: This function does not return any value.
+ * @details formats the state (grams, kilograms from 10 kg on, "----" not ready, "-OL-" overload, a dot
+ *          on the last digit while the weight is not stable) and writes only the digits that changed.
+ *          The display is not cleared first anymore: an unchanged weight costs no bus traffic, and a
+ *          change never shows "----" in between, so the display does not flicker.
+ * @param state: the scale state to be displayed on the display.
+ * @returns: the number of digits written (0: the display already showed it).
   */
-void displayWeight(long weightVal)
+uint8_t displayWeight(const ScaleState &state)
 {       
-    // reset the display first so that we can have a clear display.
-    // when digit is not displayed, it is assumed to be "-". 
-    // This is done to ensure that the display is clear before showing the current weight.
-    Serial.println("Displaying the current weight on the display"); 
-    resetDisplay();
-    displayScale.display(weightVal);
+    uint8_t digits = displayStage.show(state);
+    if (digits != 0)
+    {
+      LOG_DEBUG("Displaying %d (%u digits written)", (int)state.weight, (unsigned)digits); 
+    }
+    return digits;
+}
+
+//*********************************************************************************************** Cloud ******************************
+
+#if CLOUD_BACKEND == CLOUD_BACKEND_MQTT
+// The MQTT broker: the client is the cloud link of the connectivity manager (Task4 only, see runConnectivity()),
+// the sink publishes the batches of the uplink queue. Only opening the TCP connection waits (CLOUD_ATTEMPT_TIMEOUT_MS).
+WifiTcpConnection mqttConnection(CLOUD_ATTEMPT_TIMEOUT_MS);
+MqttClient mqttClient(mqttConnection, MQTT_HOST, MQTT_PORT, []() {
+  MqttConfig config;
+  config.clientId = MQTT_CLIENT_ID;
+  config.topic = MQTT_TOPIC;
+  config.username = MQTT_USER;
+  config.password = MQTT_PASSWORD;
+  config.info = MQTT_INFO;
+  config.keepAliveS = MQTT_KEEPALIVE_S;
+  return config;
+}());
+MqttSink mqttSink(mqttClient, MQTT_QOS, MQTT_PAYLOAD);
+UplinkSink &cloudSink = mqttSink;
+NetworkLink &cloudLink = mqttClient;
+#else
+/**
+ * @brief Blynk as the destination of the uplink queue.
+ * @details All the points of a batch are written in one Blynk group, so they go out in one round trip.
+ *          Blynk keeps no timestamps for virtual pin writes, so points from the backlog are written in order.
+ */
+class BlynkSink : public UplinkSink
+{
+public:
+  bool connected() override { return Blynk.connected(); }
+  bool sendBatch(const UplinkPoint *points, size_t count) override
+  {
+    Blynk.beginGroup();
+    for (size_t i = 0; i < count; i++)
+    {
+      Blynk.virtualWrite(points[i].pin, points[i].value);
+    }
+    Blynk.endGroup();
+    return Blynk.connected();
+  }
+};
+
+/**
+ * @brief The Blynk cloud as a link of the connectivity manager (only tried while WiFi is up).
+ * @details Blynk.connect() waits for the login, at most CLOUD_ATTEMPT_TIMEOUT_MS; it is only called by Task4.
+ */
+class BlynkLink : public NetworkLink
+{
+public:
+  bool connected() override { return Blynk.connected(); }
+  void connect() override { Blynk.connect(CLOUD_ATTEMPT_TIMEOUT_MS); }
+  void disconnect() override { Blynk.disconnect(); }
+};
+
+BlynkSink blynkSink;
+BlynkLink blynkLink;
+UplinkSink &cloudSink = blynkSink;
+NetworkLink &cloudLink = blynkLink;
+#endif
+
+//*********************************************************************************************** Connectivity ******************************
+
+/**
+ * @brief The WiFi station as a link of the connectivity manager.
+ * @details WiFi.begin() returns at once, the driver connects in the background. The driver does not reconnect
+ *          by itself (setAutoReconnect(false) in setup()): the manager does, with its backoff.
+ */
+class WifiLink : public NetworkLink
+{
+public:
+  bool connected() override { return WiFi.status() == WL_CONNECTED; }
+  void connect() override { WiFi.begin(AP_NAME, AP_PASS); }
+  void disconnect() override { WiFi.disconnect(); }
+};
+
+WifiLink wifiLink;
+ConnectivityManager connectivity;        // Task4 only (links added in setup())
+int8_t wifiLinkId = -1;
+int8_t cloudLinkId = -1;
+volatile bool webServicesStarted = false; // set by Task4 once the web server and web socket listen (Task5 serves them)
+
+/**
+ * @brief Starts the web server, the web socket and the clock (NTP) once WiFi is up for the first time.
+ * @details The handlers are registered in setup(); only the listening waits for the network.
+ */
+void startWebServices()
+{
+  server.begin();
+  webSocket.begin();
+  // the history needs the real time: set the clock from NTP (UTC) in the background.
+  configTime(0, 0, NTP_SERVER);
+  webServicesStarted = true;
+  markBoot(BootStage::WebServer);
+  LOG_INFO("Web server on port 80, web socket on port 81");
 }
 
-//*********************************************************************************************** Blynk Cloud ******************************
+/**
+ * @brief Keeps WiFi and the cloud up (see ConnectivityManager) and reacts when they come up or go down.
+ * @details Called by Task4 every UPLINK_TASK_PERIOD_MS. Only a cloud attempt waits (Blynk.connect(), or the TCP
+ *          connection to the MQTT broker).
+ */
+void runConnectivity()
+{
+  const uint8_t changed = connectivity.service(millis());
+  if (changed & (1u << wifiLinkId))
+  {
+    if (connectivity.up(wifiLinkId))
+    {
+      // This is your local IP address, you need it to access the web interface.
+      IPAddress ip = WiFi.localIP();
+      LOG_INFO("WiFi connected, IP address %u.%u.%u.%u", (unsigned)ip[0], (unsigned)ip[1], (unsigned)ip[2], (unsigned)ip[3]);
+      (void)ip;   // only logged with LOG_LEVEL_INFO and above
+      markBoot(BootStage::WifiUp);
+      if (!webServicesStarted)
+      {
+        startWebServices();
+      }
+    }
+    else
+    {
+      LOG_WARN("WiFi lost, reconnecting");
+    }
+  }
+  if (changed & (1u << cloudLinkId))
+  {
+    if (connectivity.up(cloudLinkId))
+    {
+      LOG_INFO(CLOUD_NAME " connected (%u attempts)", (unsigned)connectivity.attempts(cloudLinkId));
+      markBoot(BootStage::CloudUp);
+    }
+    else
+    {
+      LOG_WARN(CLOUD_NAME " lost, the uplink keeps a backlog");
+    }
+  }
+}
 
 /**
- * @brief function is used to run the Blynk cloud interaction.
- * @details sends the current weight to the Blynk cloud using virtual pins V0 and V1.   
- *          It is called every second to update the current weight on the Blynk cloud.
+ * @brief function is used to send the weight to the cloud (Blynk or the MQTT broker, see CLOUD_BACKEND).
+ * @details offers the current weight for the virtual pins V0 and V1 to the uplink queue, which decides
+ *          what is sent and when (deadband, rate limit, one batch per round trip, backlog when offline).   
+ *          It never waits, so it can be called as often as needed.
  * @para This function does not take any parameters.
  * @returns: This function does not return any value. *  
  **/
-void runBlynk()
+void runUplink()
 {
-  // send the current weight to the Blynk cloud using virtual pins V0 and V1
-  Serial.println("Sending the current weight to the Blynk cloud");  
-  Blynk.virtualWrite(V0,currentWeight);   // send the current weight to the Blynk cloud using virtual pin V0    
-  Blynk.virtualWrite(V1,currentWeight);   // send the current weight to the Blynk cloud using virtual pin V1
-  Serial.println("Current weight sent to the Blynk cloud"); 
-  //wait for 1 second before sending the next weight. 
-  delay(1000); 
+  ScaleState state = {};
+  scaleState.read(state);   // copy of the current state, no semaphore needed
+  uint32_t now = millis();
+  if (state.isReady())
+  {
+    uplink.offer(V0, state.weight, now);   // the current weight for virtual pin V0    
+    uplink.offer(V1, state.weight, now);   // the current weight for virtual pin V1
+  }
+  uint32_t sent = uplink.service(cloudSink, now);
+  if (sent != 0)
+  {
+    LOG_DEBUG("%u round trips to the " CLOUD_NAME, (unsigned)sent); 
+  }
 }
 
 
 //********************************************************************* freeRTOS Tasks ********************************************************
 /**
- * @brief: This task is used to get the current weight from the load cell.
- * @details takes the semaphore to ensure that only one task can access the load cell at a time.  
- *          It reads the current weight from the load cell and stores it in the currentWeight variable.
- *          It releases the semaphore after reading the weight.  
- * @para: This task does not take any parameters.
- * @note: This task runs every 500 milliseconds to get the current weight from the load cell.
+ * @brief Wakes the task that sends the weight (web server).
+ * @details Called by Task1 when the ChangeDetector reports a change, a new stable weight or a heartbeat.
+ *          The display is woken on its own, when its digits change (see Task1).
+ */
+void notifySubscribers()
+{
+  if (TaskHandle_3 != NULL)
+  {
+    xTaskNotify(TaskHandle_3, NOTIFY_WEIGHT, eSetBits);   // web server
+  }
+}
+
+/**
+ * @brief Sleeps until the next period of a network task (Task4, Task5, Task7).
+ * @details In the low-power mode, while the scale is idle or powered down, it sleeps until the next network
+ *          window instead (PowerScheduler::nextNetworkMs()): the same time for every task, so they wake up
+ *          together once per POWER_NETWORK_BATCH_MS and the CPU sleeps in between.
+ */
+void waitForNetworkWindow(const TaskSpec &task, TickType_t &lastWake)
+{
+#if LOW_POWER
+  if (powerScheduler.networkBatched())
+  {
+    const uint32_t now = millis();
+    vTaskDelay(pdMS_TO_TICKS(powerScheduler.nextNetworkMs(now) - now));
+    lastWake = xTaskGetTickCount();
+    task.timing->resync();   // longer than the period on purpose: not a deadline miss
+    return;
+  }
+#endif
+  waitForNextPeriod(task, lastWake);
+}
+
+#if LOW_POWER
+/**
+ * @brief Does what the power scheduler decided (Task1).
+ * @details Powers the HX711s up or down under the semaphore, like every other use of them. Powered down,
+ *          their data-ready interrupts and light sleep wake-ups are off (DOUT means nothing then); powered up,
+ *          the filters start again from the first conversion. Task2 is woken when the display has to be
+ *          switched off or on.
+ */
+void runPowerAction(PowerAction action)
+{
+  if (action != PowerAction::None)
+  {
+    const bool on = action == PowerAction::PowerUp;
+    takeHardware(LockUser::Acquisition);
+    for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+    {
+      if (on)
+      {
+        scaleReaders[channel].power_up();
+        gpio_wakeup_enable((gpio_num_t)loadCellDoutPins[channel], GPIO_INTR_LOW_LEVEL);
+        gpio_intr_enable((gpio_num_t)loadCellDoutPins[channel]);
+      }
+      else
+      {
+        gpio_intr_disable((gpio_num_t)loadCellDoutPins[channel]);
+        gpio_wakeup_disable((gpio_num_t)loadCellDoutPins[channel]);
+        scaleReaders[channel].power_down();
+      }
+    }
+    xSemaphoreGive(semaphore);
+    if (on)
+    {
+      weightProcessor.filter().reset();
+    }
+    LOG_DEBUG("HX711s powered %s", on ? "up" : "down");
+  }
+  // the display is off while the scale is powered down.
+  static bool displayOff = false;
+  const bool off = powerScheduler.state() == PowerState::PowerDown;
+  if (off != displayOff && TaskHandle_2 != NULL)
+  {
+    displayOff = off;
+    xTaskNotifyGive(TaskHandle_2);
+  }
+}
+
+/**
+ * @brief Prints how the time since boot was spent by the low-power mode (Task6, after the task report).
+ */
+void reportPower()
+{
+  const PowerStats power = powerScheduler.stats(millis());
+  const uint64_t totalMs = power.activeMs + power.idleMs + power.powerDownMs;
+  if (totalMs == 0)
+  {
+    return;
+  }
+  char line[128];
+  const int length = snprintf(line, sizeof(line),
+                              "power: active %u %%, idle %u %%, powered down %u %%, HX711s on %u %%, %u probes, %u wake-ups",
+                              (unsigned)(power.activeMs * 100 / totalMs), (unsigned)(power.idleMs * 100 / totalMs),
+                              (unsigned)(power.powerDownMs * 100 / totalMs), (unsigned)(power.hx711OnMs * 100 / totalMs),
+                              (unsigned)power.probes, (unsigned)power.wakeUps);
+  if (length > 0)
+  {
+    Serial.write((const uint8_t *)line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    Serial.println();
+  }
+}
+
+/**
+ * @brief Prepares the low-power mode (setup(), before the tasks start).
+ * @details The power scheduler gets the sample period and the settling time of the profile. The CPU clock
+ *          is scaled down and the chip sleeps (light sleep) whenever every task waits; the HX711 DOUT pins
+ *          (level interrupts, see setup()) and the FreeRTOS timer wake it up. The WiFi modem sleeps between
+ *          the beacons it has to listen to.
+ */
+void startLowPower()
+{
+  PowerConfig config;
+  config.samplePeriodMs = ProfileLimits::samplePeriodMs;
+  config.hx711SettleMs = ProfileLimits::hx711SettleMs;
+  config.maxReactionMs = POWER_MAX_REACTION_MS;
+  config.idleAfterMs = POWER_IDLE_AFTER_MS;
+  config.powerDownAfterMs = POWER_DOWN_AFTER_MS;
+  config.networkBatchMs = POWER_NETWORK_BATCH_MS;
+  config.changeBandMg = POWER_CHANGE_BAND_MG;
+  powerScheduler.configure(config);
+  if (powerScheduler.probeIntervalMs() == 0)
+  {
+    Serial.println("POWER_MAX_REACTION_MS is too short to power the HX711s down, the scale only goes idle");
+  }
+  esp_sleep_enable_gpio_wakeup();
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  esp_pm_config_t pm = {};
+#else
+  esp_pm_config_esp32s3_t pm = {};
+#endif
+  pm.max_freq_mhz = (int)getCpuFrequencyMhz();
+  pm.min_freq_mhz = POWER_CPU_MIN_MHZ;
+  pm.light_sleep_enable = true;
+  const esp_err_t error = esp_pm_configure(&pm);
+  if (error != ESP_OK)
+  {
+    // the core was built without CONFIG_PM_ENABLE / CONFIG_FREERTOS_USE_TICKLESS_IDLE.
+    Serial.printf("No light sleep (esp_pm_configure: %s)\n", esp_err_to_name(error));
+  }
+  WiFi.setSleep(WIFI_PS_MAX_MODEM);
+  powerScheduler.begin(millis());
+}
+#endif
+
+#if SCALE_MODE == SCALE_MODE_DYNAMIC
+/**
+ * @brief Streams one sample and runs the checkweigher on it (dynamic mode, Task1).
+ * @details The sample is converted to milligrams without the filter chain: the checkweigher needs every
+ *          conversion as it was. Task3 is woken for every full batch and for every item.
+ * @param combined: the combined counts of the load cells, offsets and drift removed.
+ */
+void streamSample(int32_t combined, uint32_t timestampUs)
+{
+  StreamSample sample;
+  sample.weightMg = weightProcessor.filter().converter().toMilligrams(combined);
+  sample.timestampUs = timestampUs;
+  sample.seq = streamSeq++;
+  streamRing.push(sample);
+  CheckweighResult item;
+  const bool itemDone = peakDetector.onSample(sample, item);
+  if (itemDone)
+  {
+    itemRing.push(item);
+    LOG_INFO("Item %u: %d mg in %u ms", (unsigned)item.item, (int)item.weightMg, (unsigned)(item.durationUs / 1000));
+  }
+  if ((itemDone || streamSeq % STREAM_BATCH_SAMPLES == 0) && TaskHandle_3 != NULL)
+  {
+    xTaskNotify(TaskHandle_3, NOTIFY_STREAM, eSetBits);
+  }
+}
+
+/**
+ * @brief Sends the samples and the items Task1 streamed since the last call (dynamic mode, Task3).
+ */
+void sendStream()
+{
+  uint32_t start = micros();
+  streamBatcher.service(streamRing, streamClients, systemClock.micros());
+  CheckweighResult item;
+  uint32_t lost = 0;
+  while (itemRing.read(itemCursor, &item, 1, lost) == 1)
+  {
+    itemClients.broadcastText(itemJson, encodeItemJson(item, itemJson, sizeof(itemJson)));
+  }
+  metrics.stage(MetricStage::Broadcast).record(micros() - start);
+}
+#endif
+
+/**
+ * @brief: This task is used to get the current weight from the load cells.
+ * @details sleeps until a HX711 data-ready interrupt wakes it and reads the channels that have a new conversion.
+ *          The conversions are grouped into frames (one conversion per load cell, see FrameAligner); every
+ *          complete frame is combined into one value and pushed into the lock-free sample ring (acquisition).
+ *          The semaphore is only taken while the HX711s are read.
+ *          It then converts the newest sample and publishes it in the scaleState snapshot, so the other
+ *          tasks always have the latest weight without waiting for this task.
+ *          When the weight changed (see ChangeDetector), it wakes the web server task; when the digits of the
+ *          display changed (DisplayChangeDetector), the display task.
+ *          In the low-power mode it also runs the power scheduler: while the HX711s are powered down it sleeps
+ *          until the next probe and only weighs the probe's conversion (see PowerScheduler.h).
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task runs at the HX711 output rate (10 or 80 samples per second).
+ *        It has the highest priority of the application tasks; a cycle must be done before the next conversion.
  *        It is used to ensure that the current weight is updated frequently and accurately.
  */
 void Task1( void *pvParameters )
 {  
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
   while (1)
   {  
-    // taking the semaphore 
-    xSemaphoreTake(semaphore,portMAX_DELAY);    
-    // get the current weight from the load cell 
-    // if the scale is not ready, then it will return 0.
-    // if the scale is ready, then it will return the current weight.
-    Serial.println("Task1:Getting the current weight from the load cell");
-    currentWeight = getWeight();   // current weight 
-    //releasing the semaphore. 
-    xSemaphoreGive(semaphore);  
-    // wait for 500 milliseconds before getting the next weight.
-    vTaskDelay(500/ portTICK_PERIOD_MS); // poll over 500ms, as requested. 
+    // wait for the data-ready edge. If there is no edge, the HX711 is not ready (getWeight() reports it).
+#if LOW_POWER
+    // powered down there is no edge to wait for: sleep until the next probe (or a web client, a command).
+    const uint32_t waitMs = powerScheduler.hx711Powered() ? HX711_READY_TIMEOUT_MS : powerScheduler.msUntilProbe(millis());
+    const uint32_t samplesBefore = acquisition.sampleCount();
+#else
+    const uint32_t waitMs = HX711_READY_TIMEOUT_MS;
+#endif
+    const bool woken = ulTaskNotifyTake(pdTRUE, waitMs / portTICK_PERIOD_MS) != 0;
+    if (woken)
+    {
+      // which channels have a new conversion.
+      portENTER_CRITICAL(&hx711Mux);
+      uint32_t readyMask = hx711ReadyMask;
+      hx711ReadyMask = 0;
+      portEXIT_CRITICAL(&hx711Mux);
+      // the task was released by the oldest of these edges: the time until now is its wake-up latency.
+      uint32_t releaseMicros = micros();
+      for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+      {
+        if ((readyMask & (1u << channel)) != 0 && (int32_t)(hx711ReadyMicros[channel] - releaseMicros) < 0)
+        {
+          releaseMicros = hx711ReadyMicros[channel];
+        }
+      }
+      task.timing->beginReleased(releaseMicros, micros());
+      // taking the semaphore, the HX711s are also used to tare the scale.
+      takeHardware(LockUser::Acquisition);
+      while (readyMask != 0)
+      {
+        for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+        {
+          if ((readyMask & (1u << channel)) == 0)
+          {
+            continue;
+          }
+          uint32_t readyMicros = hx711ReadyMicros[channel];
+          if (loadCells[channel].isReady())
+          {
+            // clock the 24 bits out of the HX711; a complete frame is combined and stored as one sample.
+            CellFrame frame;
+            uint32_t start = micros();
+            int32_t raw = loadCells[channel].read();
+            metrics.stage(MetricStage::SampleRead).record(micros() - start);
+            if (traceRecorder.active())
+            {
+              traceConversion(channel, raw, readyMicros);   // "trace start": every conversion to flash
+            }
+            if (cellAligner.onSample(channel, raw, readyMicros, frame))
+            {
+              // the calibration sees the signal without the drift correction (it may fit a new one).
+              const float temperature = boardTemperatureC;
+              const int32_t combined = loadCellArray.combine(frame);
+              calibrator.onSample(combined, temperature);
+              const int32_t corrected = combined - zeroDrift.correction(temperature);
+              acquisition.onSample(corrected, frame.timestampUs);
+              int32_t tareOffsets[LOAD_CELL_COUNT];
+              if (tareAverager.active() && tareAverager.onFrame(frame, tareOffsets))
+              {
+                finishTare(tareOffsets);   // a tare command averaged enough conversions
+              }
+#if SCALE_MODE == SCALE_MODE_DYNAMIC
+              streamSample(corrected, frame.timestampUs);   // every sample to the web clients and the checkweigher
+#endif
+              metrics.onSample(micros());
+            }
+          }
+          else
+          {
+            acquisition.onMissedSample();
+            metrics.onDroppedSample();
+            traceRecorder.missed(channel, readyMicros);
+          }
+        }
+        // reading the data bits toggles DOUT, so drop the edges it produced and the wake-ups so far. A channel
+        // that signalled while the others were read keeps its bit: it is read in the next round, not one
+        // conversion later, so its frame is not skewed.
+        portENTER_CRITICAL(&hx711Mux);
+        hx711ReadyMask &= ~readyMask;
+        portEXIT_CRITICAL(&hx711Mux);
+#if LOW_POWER
+        // DOUT is high again: the level interrupts of the channels just read can fire for the next conversion.
+        for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+        {
+          if ((readyMask & (1u << channel)) != 0 && powerScheduler.hx711Powered())
+          {
+            gpio_intr_enable((gpio_num_t)loadCellDoutPins[channel]);
+          }
+        }
+#endif
+        ulTaskNotifyTake(pdTRUE, 0);
+        // an edge after this keeps its own wake-up.
+        portENTER_CRITICAL(&hx711Mux);
+        readyMask = hx711ReadyMask;
+        hx711ReadyMask = 0;
+        portEXIT_CRITICAL(&hx711Mux);
+      }
+      // a calibration finished from the web page: use it from the next sample on.
+      CalibrationResult fit;
+      if (calibrator.takeResult(fit))
+      {
+        applyCalibration(fit);
+      }
+      //releasing the semaphore. 
+      xSemaphoreGive(semaphore);  
+    }
+#if LOW_POWER
+    // a web client or a command keeps the scale awake (powered up before a tare needs the HX711s), the time
+    // makes it idle, powers it down and starts the probes.
+    runPowerAction(powerScheduler.poll(millis(), clientConnected != 0 || !commandQueue.empty()));
+    if (powerScheduler.state() == PowerState::PowerDown && acquisition.sampleCount() == samplesBefore)
+    {
+      continue;   // powered down, no new conversion: the published weight stays the resting one
+    }
+#endif
+    // the commands of the web clients, between two samples (see runCommands()).
+    if (!commandQueue.empty() || tareAverager.active())
+    {
+      takeHardware(LockUser::Acquisition);
+      runCommands();
+      xSemaphoreGive(semaphore);
+    }
+    // if the scale is not ready, then the weight is 0 and the state is flagged as not ready.
+    // if the scale is ready, then it will be the current weight.
+    ScaleState state;
+    uint32_t start = micros();
+    getWeight(state);
+#if LOW_POWER
+    // a probe's weight: back to sleep if it did not move, awake (and published) if it did.
+    runPowerAction(powerScheduler.onWeight(state.weightMg, state.isReady() && !state.isOverload(), millis()));
+    if (powerScheduler.state() == PowerState::PowerDown)
+    {
+      task.timing->end(micros());
+      continue;
+    }
+#endif
+    scaleState.publish(state);   // current weight 
+    metrics.stage(MetricStage::Filter).record(micros() - start);
+    // zero tracking ("zero on"): a stable weight close to zero becomes the new zero.
+    const int32_t zeroCounts = zeroTracker.update(state.weightMg, weightProcessor.lastOutput().filteredRaw,
+                                                  state.isReady() && state.isStable(), state.timestampUs);
+    if (zeroCounts != 0)
+    {
+      takeHardware(LockUser::Acquisition);
+      loadCellArray.shiftZero(zeroCounts);
+      xSemaphoreGive(semaphore);
+      weightProcessor.filter().reset();   // the filters must not pull the old zero back in
+      LOG_DEBUG("Zero tracked by %d counts", (int)zeroCounts);
+    }
+    // how long the boot took until the scale could be used (stored offsets: no tare in setup()).
+    if (state.isReady() && state.isStable())
+    {
+      markBoot(BootStage::FirstWeight);   // only the first time counts
+    }
+    // wake the display whenever its digits change (a drift below the deadband can move the rounded grams).
+    if (displayChange.check(state) && TaskHandle_2 != NULL)
+    {
+      xTaskNotifyGive(TaskHandle_2);
+    }
+    // wake the web server if the weight changed, settled, or for the heartbeat.
+    if (changeDetector.check(state, systemClock.micros()) != ChangeReason::None)
+    {
+      notifySubscribers();
+    }
+    else if (everySampleToWeb && TaskHandle_3 != NULL)
+    {
+      xTaskNotify(TaskHandle_3, NOTIFY_WEIGHT, eSetBits);   // a web client looks at smaller changes
+    }
+    if (woken)
+    {
+      task.timing->end(micros());
+    }
   }
 }
 
 /**
  * @brief: This task is used to display the current weight on the 4 digits 7-segment display.
- * @details takes the semaphore to ensure that only one task can access the display at a time.    
- *          It reads the current weight from the currentWeight variable and displays it on the display.
- *          It releases the semaphore after displaying the weight. 
- * @para: This task does not take any parameters.
- * @note: This task runs every second to display the current weight on the display. 
- *        It is used to ensure that the current weight is displayed frequently and accurately.
- *        The display is reset before displaying the current weight to ensure that the display is clear.   
+ * @details takes a copy of the current scale state and displays the weight on the display.
+ *          The semaphore is only taken while the display is written. 
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task is woken by Task1 as soon as the digits to show changed (the rounded weight, the unstable
+ *        point, a status), there is no fixed refresh tick anymore. Only the digits that changed are written;
+ *        all of them are rewritten every DISPLAY_RESYNC_MS (it wakes up for that too). In the low-power mode it switches the display off
+ *        while the HX711s are powered down (woken by Task1 for that too).
  * @return: This task does not return any value.
   */
 void Task2( void *pvParameters )
 {  
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  uint32_t resyncMs = millis();
+#if LOW_POWER
+  bool displayIsOff = false;
+#endif
    while(1)
   { 
+    task.timing->begin(micros());
+    // get the current weight, no semaphore needed.
+    ScaleState state = {};
+    scaleState.read(state);
+    if (millis() - resyncMs >= DISPLAY_RESYNC_MS)
+    {
+      displayStage.invalidate();   // the next write covers all the digits
+      resyncMs = millis();
+    }
     // taking the semaphore 
-    xSemaphoreTake(semaphore,portMAX_DELAY);
-    // display the current weight on the display
-    Serial.println("Task2: Displaying the current weight on the display");
-    // if the current weight is 0, then display "----" on the display
-    displayWeight(currentWeight);   
-    // if the current weight is greater than 0, then display the current weight on the display
-    // wait for 1 second before displaying the next weight.
-    // The semaphore is released after displaying the weight to allow other tasks to access the shared resource.
+    takeHardware(LockUser::Display);
+#if LOW_POWER
+    // powered down (low-power mode): the display is off, lit segments draw more than the sleeping chip.
+    const bool displayOff = powerScheduler.state() == PowerState::PowerDown;
+    if (displayOff != displayIsOff)
+    {
+      displayIsOff = displayOff;
+      if (displayOff)
+      {
+        displayScale.offMode();
+      }
+      else
+      {
+        displayScale.onMode();
+        displayStage.invalidate();   // the next write covers all the digits
+      }
+    }
+    const bool show = !displayIsOff;
+#else
+    const bool show = true;
+#endif
+    if (show)
+    {
+      // display the current weight on the display (only the digits that changed)
+      uint32_t start = micros();
+      displayWeight(state);   
+      metrics.stage(MetricStage::Display).record(micros() - start);
+    }
+    // The semaphore is released after displaying the weight to allow other tasks to access the display.
     //releasing the semaphore.  
     xSemaphoreGive(semaphore); 
-    // wait for 1 second before displaying the next weight.
-    vTaskDelay((1000/ portTICK_PERIOD_MS)); // run per (n) second.
+    task.timing->end(micros());
+    // wait until Task1 reports other digits, at most until the next resync.
+    ulTaskNotifyTake(pdTRUE, DISPLAY_RESYNC_MS / portTICK_PERIOD_MS);
   }  
 }
 
 /**
  * @brief:  This task is used to run the web server.
- * @details takes the semaphore to ensure that only one task can access the web server at a time.
- *          It handles the web server requests and sends the current weight to the web clients. * 
- * @para:   This task does not take any parameters.
- * @note:   This task runs every second to handle the web server requests and send the current weight to the
- *          web clients. It is used to ensure that the web server is running and broadcasting the current 
- *          weight to the clients.
+ * @details takes a copy of the current scale state and sends the current weight to the web clients, each as
+ *          it subscribed (weightFanOut, see Subscriptions.h).
+ *          It does not need the semaphore, so it never waits for the load cell or the display.
+ * @para:   pvParameters: its entry of taskTable.
+ * @note:   This task is woken by Task1 when the weight changed, settled, or for the heartbeat, so the
+ *          web clients get a new weight right away and no traffic is sent while nothing happens.
+ *          It also sends the metrics frame every METRICS_PUSH_MS.
+ *          In the dynamic mode it is also woken for every batch of samples and every item (see sendStream()),
+ *          and at least every STREAM_FLUSH_MS for the batch that is not full. A weight held back by the rate of
+ *          a client, a heartbeat and a slow client's retry wake it up as well (weightFanOut.waitUs()).
  * @return: This task does not return any value.
  *  
  * */
 void Task3( void *pvParameters )
 {   
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  uint32_t events = NOTIFY_WEIGHT;
   while (1)
   {
-    // taking the semaphore 
-    // This is used to ensure that only one task can access the web server at a time.
-    // This is done to avoid any conflicts between the tasks that access the web server.  
-    Serial.println("Task3: Running the web server");
-    // handle the web server requests 
-    xSemaphoreTake(semaphore,portMAX_DELAY);
-    // convert the current weight to a string and send it to the web clients.
-    // This is done to update the current weight on the web interface.
-    
-    String jsonString = ""; 
-    // create a JSON object to hold the current weight
-
-    JsonObject object = jsonDoc_tx.to<JsonObject>(); // create a JSON object
-    object["weight"] = currentWeight;               // add the current weight to the JSON object  
-
-    // serialize the JSON object to a string
-    serializeJson(jsonDoc_tx, jsonString);              // convert the JSON object to a string
-    // send the JSON string to the web clients.     
-    webSocket.broadcastTXT(jsonString);     // send char_array to clients(broadcast). 
-    // give the semaphore to allow other tasks to access the shared resource.
-    Serial.println("Task3: Web server is running and broadcasting the current weight to the clients");
-    xSemaphoreGive(semaphore);  //releasing the semaphore. 
-    // wait for 1 second before running the web server again.
-    vTaskDelay((1000/ portTICK_PERIOD_MS)); // run per 1 second.
+    task.timing->begin(micros());
+    // the clients that want the weight, and how (set by Task5).
+    uint32_t weightClients = 0;
+    for (uint8_t client = 0; client < WEB_CLIENT_MAX; client++)
+    {
+      Subscription subscription;
+      if (clientSubscriptions[client].read(subscription))
+      {
+        weightFanOut.subscribe(client, subscription);
+      }
+      if ((clientConnected & (1u << client)) != 0 && (clientTopics[client] & TOPIC_WEIGHT) != 0)
+      {
+        weightClients |= 1u << client;
+      }
+    }
+    weightFanOut.setActive(weightClients);
+    if ((events & NOTIFY_WEIGHT) != 0 || weightFanOut.waitUs() != UINT32_MAX)
+    {
+      // get the current weight, no semaphore needed.
+      ScaleState state = {};
+      scaleState.read(state);
+      uint32_t start = micros();
+      // every distinct message is encoded once and shared by the clients that get it (one broadcast when
+      // they all get the same), this is done to update the current weight on the web interface.
+      weightFanOut.publish(state, micros(), transport);
+      metrics.stage(MetricStage::Broadcast).record(micros() - start);
+    }
+#if SCALE_MODE == SCALE_MODE_DYNAMIC
+    sendStream();
+#endif
+    // the metrics frame for the clients that show them (the web page ignores it).
+    if (METRICS_PUSH_MS != 0 && millis() - metricsPushMs >= METRICS_PUSH_MS)
+    {
+      metricsPushMs = millis();
+      updateMetricGauges();
+      metricsClients.broadcastBinary(metricsFrame, encodeMetricsFrame(metrics, millis() / 1000, metricsFrame, sizeof(metricsFrame)));
+    }
+    task.timing->end(micros());
+    // wait until Task1 reports a change or a heartbeat, or until the next metrics frame is due.
+#if SCALE_MODE == SCALE_MODE_DYNAMIC
+    uint32_t waitMs = STREAM_FLUSH_MS;
+#else
+    uint32_t waitMs = METRICS_PUSH_MS != 0 ? METRICS_PUSH_MS : 2 * PUBLISH_HEARTBEAT_MS;
+#endif
+    if (weightFanOut.waitUs() / 1000 + 1 < waitMs)
+    {
+      waitMs = weightFanOut.waitUs() / 1000 + 1;   // a weight held back by a rate, a heartbeat, a retry
+    }
+    events = 0;
+    xTaskNotifyWait(0, 0xFFFFFFFFu, &events, waitMs / portTICK_PERIOD_MS);
   }
 }
 
 /**
- * @brief: This task is used to run the Blynk cloud interaction.
- * @details takes the semaphore to ensure that only one task can access the Blynk cloud at a time.      
- *          It sends the current weight to the Blynk cloud using virtual pins V0 and V1.
- *          It releases the semaphore after sending the weight.  
- * @para: This task does not take any parameters.
- * @note: This task runs every second to send the current weight to the Blynk cloud.
+ * @brief: This task keeps the network up and runs the Blynk cloud interaction.
+ * @details It brings WiFi, the web server and the cloud up in the background and reconnects them (see
+ *          runConnectivity()), runs Blynk while it is connected and sends the current weight to the Blynk cloud
+ *          using virtual pins V0 and V1 through the uplink queue (see runUplink()); with CLOUD_BACKEND_MQTT
+ *          it publishes to the MQTT broker instead.
+ *          The weight is read from the scaleState snapshot, so the semaphore is not needed.
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task runs every UPLINK_TASK_PERIOD_MS; the uplink queue limits the round trips to the cloud.
+ *        A cloud attempt blocks this task for up to CLOUD_ATTEMPT_TIMEOUT_MS (a deadline miss in the task
+ *        report), no other task waits for it.
  *        It is used to ensure that the current weight is updated frequently and accurately on the Blynk cloud.
- *        The Blynk cloud is used to display the current weight over time (5 seconds).     
  *        This task requires a Blynk account and a template to be created before using it.
  *        You need to replace the BLYNK_AUTH_TOKEN with your own Blynk authentication token.                     
  * @return: This task does not return any value.
  * */
 void Task4(void *pvParameters )
 {   
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  TickType_t lastWake = xTaskGetTickCount();
   while (1)
   {
-    // this task take the semaphore 
-    Serial.println("Task4: Running the Blynk cloud interaction");
-    // This is used to ensure that only one task can access the Blynk cloud at a time.
-    // This is done to avoid any conflicts between the tasks that access the Blynk cloud.
-    xSemaphoreTake(semaphore,portMAX_DELAY);
-    Serial.println("Task4: Blynk cloud interaction is running and sending the current weight to the Blynk cloud");
-    // run the Blynk cloud interaction 
-    Blynk.run();
-    // start the Blynk timer to run the Blynk cloud interaction every second
-    timer.run();
-    // give the semaphore to allow other tasks to access the shared resource.
-    xSemaphoreGive(semaphore);  //releasing the semaphore. 
-    // wait for 1 second before running the Blynk cloud interaction again.
-    vTaskDelay((1000/ portTICK_PERIOD_MS)); // run per (n) second.
+    task.timing->begin(micros());
+    // WiFi, web server and cloud: connect, reconnect with backoff.
+    runConnectivity();
+#if CLOUD_BACKEND == CLOUD_BACKEND_MQTT
+    // the answers of the broker (CONNACK, PUBACK, PINGRESP), keep alive and resends; never waits.
+    mqttClient.poll(millis());
+#else
+    // run the Blynk cloud interaction (heartbeat, incoming data) while it is connected; Blynk.run() would
+    // otherwise try to reconnect by itself and wait for it.
+    if (connectivity.up(cloudLinkId))
+    {
+      Blynk.run();
+    }
+#endif
+    // send the current weight if it is due
+    uint32_t start = micros();
+    runUplink();
+    metrics.stage(MetricStage::Uplink).record(micros() - start);
+#if CALIBRATION_TEMPERATURE
+    // the chip temperature for the drift of the zero (the sensor is slow, so not in Task1).
+    static uint32_t temperatureMs = 0;
+    if (millis() - temperatureMs >= TEMPERATURE_READ_MS)
+    {
+      temperatureMs = millis();
+      boardTemperatureC = temperatureRead();
+    }
+#endif
+    task.timing->end(micros());
+    // the uplink queue decides when to send, this task only has to run often enough.
+    waitForNetworkWindow(task, lastWake);
+  }
+}
+
+/**
+ * @brief: This task serves the HTTP clients (page, /history) and the web socket, records the weight history
+ *         and stores the calibration in NVS when it changed.
+ * @details It used to be done in loop(); as a task it has its own core, priority and stack budget like
+ *          the other tasks, and loop() (the Arduino loop task and its stack) is not needed anymore.
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task runs every NETWORK_TASK_PERIOD_MS (every POWER_NETWORK_BATCH_MS while a low-power build is
+ *        idle). A long /history answer delays its next cycle, which shows up as jitter and deadline misses in
+ *        the task report.
+ * @return: This task does not return any value.
+ * */
+void Task5(void *pvParameters )
+{
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  mountHistory();           // once, before the first /history request or point
+  TickType_t lastWake = xTaskGetTickCount();
+  while (1)
+  {
+    task.timing->begin(micros());
+    if (webServicesStarted) // listening once WiFi came up (Task4)
+    {
+      server.handleClient();  // webserver methode that handles all Client
+      webSocket.loop();       // web socket events (connect, disconnect, messages)
+      sendAcknowledgements(); // the commands Task1 ran
+    }
+    recordHistory();        // weight history in flash (same task as the /history queries)
+    writeTrace();           // the raw trace Task1 records ("trace start")
+    if (calibrationToSave)
+    {
+      saveCalibration();    // new offsets or calibration: keep them in NVS
+    }
+    task.timing->end(micros());
+    waitForNetworkWindow(task, lastWake);
+  }
+}
+
+/**
+ * @brief: This task writes the log (see DeferredLog.h) to the serial monitor.
+ * @details The other tasks only store binary log records; this task formats them and writes them to Serial,
+ *          so the slow serial output (115200 baud, ~87 us per character) never delays them.
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task runs every LOG_DRAIN_PERIOD_MS with the lowest priority.
+ * @return: This task does not return any value.
+ * */
+void Task7(void *pvParameters )
+{
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  TickType_t lastWake = xTaskGetTickCount();
+  char line[128];
+  while (1)
+  {
+    task.timing->begin(micros());
+    size_t length;
+    while ((length = systemLog.drain(line, sizeof(line))) != 0)
+    {
+      Serial.write((const uint8_t *)line, length);
+    }
+    task.timing->end(micros());
+    waitForNetworkWindow(task, lastWake);
+  }
+}
+
+// Task6 prints the table, it is defined after it.
+void Task6(void *pvParameters );
+
+/*
+  The tasks of the application: one line per task. Task1 (acquisition) has the highest priority and has the
+  acquisition core to itself except for the display; the network tasks share the other core with WiFi.
+  The stack budgets are in bytes; the task report (Task6) shows how much of each was ever used, so they can
+  be trimmed further. periodMs 0 means the task is woken by an interrupt or a notification; deadlineMs 0
+  means the period.
+  heap is what a HEAP_AFTER_BOOT_TRAP build does when the task allocates after setup(). Task1, Task2 and Task6
+  never do. The others stay counted: Task3's first send makes lwIP create a semaphore for the task, Task4 runs
+  WiFi, Blynk and the MQTT connection, Task5 the web server (a String per request) and LittleFS, and Task7's
+  first float makes newlib allocate the small cache of its number formatting.
+*/
+const TaskSpec taskTable[] = {
+  // function name           stack  prio  core              period                  deadline                handle         timing            heap
+  {Task1, "get Weight",      4096,  5,    ACQUISITION_CORE, 0,                      HX711_SAMPLE_PERIOD_MS, &TaskHandle_1, &timingWeight,    HeapPolicy::Trap},
+  {Task2, "Display 1",       3072,  2,    ACQUISITION_CORE, 0,                      100,                    &TaskHandle_2, &timingDisplay,   HeapPolicy::Trap},
+  {Task3, "Web Socket",      3072,  3,    NETWORK_CORE,     0,                      50,                     &TaskHandle_3, &timingWebSocket, HeapPolicy::Count},
+  {Task4, "Net + Cloud",     6144,  1,    NETWORK_CORE,     UPLINK_TASK_PERIOD_MS,  0,                      &TaskHandle_4, &timingBlynk,     HeapPolicy::Count},
+  {Task5, "HTTP Server",     8192,  2,    NETWORK_CORE,     NETWORK_TASK_PERIOD_MS, 50,                     &TaskHandle_5, &timingNetwork,   HeapPolicy::Count},
+  {Task6, "Task Monitor",    3072,  1,    ACQUISITION_CORE, TASK_REPORT_MS,         0,                      &TaskHandle_6, &timingMonitor,   HeapPolicy::Trap},
+  {Task7, "Log Drain",       3072,  1,    NETWORK_CORE,     LOG_DRAIN_PERIOD_MS,    0,                      &TaskHandle_7, &timingLog,       HeapPolicy::Count},
+};
+const size_t taskCount = sizeof(taskTable) / sizeof(taskTable[0]);
+static_assert(sizeof(taskTable) / sizeof(taskTable[0]) <= HEAP_GUARD_OTHER, "the heap guard has one owner per task");
+
+#if HEAP_AFTER_BOOT != HEAP_AFTER_BOOT_OFF
+/*
+  The malloc wrappers (-Wl,--wrap=malloc,...): every malloc(), calloc() and realloc() of the firmware and the
+  libraries, operator new and String included, goes through them first. Allocations with heap_caps_malloc()
+  (the WiFi driver) are not seen; the free heap and largest block gauges of GET /metrics still show them.
+*/
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t count, size_t size);
+extern "C" void *__real_realloc(void *pointer, size_t size);
+
+/**
+ * @brief The entry of taskTable that runs now, HEAP_GUARD_OTHER for any other task (WiFi, lwIP, timers).
+ */
+uint8_t heapOwner()
+{
+  const TaskHandle_t current = xTaskGetCurrentTaskHandle();
+  for (size_t i = 0; i < taskCount; i++)
+  {
+    if (*taskTable[i].handle == current)
+    {
+      return (uint8_t)i;
+    }
+  }
+  return HEAP_GUARD_OTHER;
+}
+
+/**
+ * @brief Shows an allocation to the heap guard, stops the firmware if the task must not allocate.
+ */
+void guardAllocation(size_t size)
+{
+  if (heapGuard.armed() && !heapGuard.onAllocate(heapOwner(), size))
+  {
+    // esp_rom_printf() does not allocate; the backtrace of abort() shows who did.
+    esp_rom_printf("\nHeap allocation of %u bytes by \"%s\" after setup()\n", (unsigned)size, pcTaskGetName(NULL));
+    abort();
+  }
+}
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+  guardAllocation(size);
+  return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size)
+{
+  guardAllocation(count * size);
+  return __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *pointer, size_t size)
+{
+  if (size != 0)   // realloc(p, 0) frees
+  {
+    guardAllocation(size);
+  }
+  return __real_realloc(pointer, size);
+}
+#endif
+
+/**
+ * @brief: This task prints the stack use and the timing of every task (see reportTasks()) on the serial monitor,
+ *         and in the low-power mode the time spent in each power state (see reportPower()).
+ * @para: pvParameters: its entry of taskTable.
+ * @note: This task runs every TASK_REPORT_MS.
+ * @return: This task does not return any value.
+ * */
+void Task6(void *pvParameters )
+{
+  const TaskSpec &task = *(const TaskSpec *)pvParameters;
+  TickType_t lastWake = xTaskGetTickCount();
+  while (1)
+  {
+    waitForNextPeriod(task, lastWake);
+    task.timing->begin(micros());
+    reportTasks(taskTable, taskCount, HEAP_AFTER_BOOT != HEAP_AFTER_BOOT_OFF ? &heapGuard : nullptr);
+#if LOW_POWER
+    reportPower();
+#endif
+    task.timing->end(micros());
   }
 }
 
@@ -480,23 +2330,24 @@ void Task4(void *pvParameters )
  * @brief function is used to set up the ESP32 and initialize the display, load cell, WiFi connection, web server, and Blynk cloud.
  *        It is called once when the ESP32 is powered on or reset.
  *  
- *@details This function initializes the display, load cell, WiFi connection, web server, and Blynk cloud.
+ *@details This function initializes the display and the load cell first, then starts the tasks, so the scale
+ *         weighs a few hundred ms after power-up whatever the network does.
  *         It sets the brightness of the display, initializes the load cell, and sets the calibration factor.
- *         It also creates a semaphore to ensure that only one task can access the shared resource at a time.
- *         It starts the web server and web socket, and sets up the Blynk cloud interaction.      
+ *         It also creates a semaphore to ensure that only one task can access the hardware at a time.
+ *         WiFi, the web server, the web socket and the Blynk cloud are only prepared here: Task4 connects
+ *         them in the background (see runConnectivity()) and keeps them connected.
+ *         Every stage of the startup is logged and exported as a metric (BootStage, GET /metrics).
  * @para:  This function does not take any parameters.
  * @return: This function does not return any value.  
  */
 void setup() 
 {
-  // connect to the available wifi using your AP name and password. 
-  // This is done to connect the ESP32 to the WiFi network.
-  Serial.println("Connecting to WiFi..."); // print a message to the serial monitor to indicate that the ESP32 is connecting to the WiFi network.
-  // WiFi.begin() function is used to connect the ESP32 to the WiFi network.
-  WiFi.begin(AP_NAME,AP_PASS);  
   // Serial.begin() function is used to initialize the serial communication with the ESP32.
   // The serial communication is initialized with a baud rate of 115200.  
   Serial.begin(115200);   
+  // the log records get their time from the system clock. The boot messages below go to Serial directly,
+  // the log (and the boot timeline) is written by Task7 once the tasks run.
+  systemLog.setClock(&systemClock);
   
   // 1- Initializing the display (4 digits 7 segment display) 
   // The display is used to show the current weight.
@@ -505,23 +2356,69 @@ void setup()
   // initialize the display with the CLK_PIN and DIO_PIN
   displayScale.init();  // initialize the display
   // set the brightness of the display
-  displayScale.setBrightness(5); // set the brightness (0:dimmest, 7:brightest) 
+  displayScale.setBrightness(Profile::displayBrightness); // set the brightness (0:dimmest, 7:brightest) 
+  // "----" until the first weight (Task2 takes over from here).
+  ScaleState booting = {};
+  booting.flags = SCALE_FLAG_NOT_READY;
+  displayStage.show(booting);
+  markBoot(BootStage::Display);
     
   //2- Load cell setting and initilization 
   Serial.println("Initializing the scale");
-  scaleReader.begin(DOUT_PIN,SCK_PIN);   
-  
-  // set the calibration factor = 0 for the load cell
-  scaleReader.set_scale();    //no calibration 
-  //Tare the scale to remove any weight on the scale.
-  // Taring the scale means removing any weight on the scale and setting the current weight to zero.
-  // This is done to ensure that the scale starts from zero when there is no weight on it.  
-  // Taring the scale is done by calling the tare() function of the HX711 library.
-  // This function will set the current weight to zero and remove any weight on the scale.  
-  scaleReader.tare();         
+#if HX711_RATE_PIN >= 0
+  // RATE high: 80 SPS, low: 10 SPS (before the first conversion, the HX711 restarts its filter on a change).
+  pinMode(HX711_RATE_PIN, OUTPUT);
+  digitalWrite(HX711_RATE_PIN, SCALE_MODE == SCALE_MODE_DYNAMIC ? HIGH : LOW);
+#endif
+  // the offsets and the calibration of the last run (NVS). Without them (first boot, other load cells),
+  // the scale is tared and the default calibration factors are used.
+  preferences.begin(CALIBRATION_NVS_NAMESPACE, false);
+  CalibrationRecord stored;
+  const bool haveStored = preferences.getBytes("cal", &stored, sizeof(stored)) == sizeof(stored) &&
+                          calibrationRecordValid(stored, LOAD_CELL_COUNT);
+  for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+  {
+    scaleReaders[channel].begin(loadCellDoutPins[channel], loadCellSckPins[channel], Profile::hx711Gain);   
+    loadCells[channel].attach(scaleReaders[channel]);
+    // set the calibration factor = 0 for the load cell
+    scaleReaders[channel].set_scale();    //no calibration 
+    if (haveStored)
+    {
+      // weigh from the stored zero at once: no tare, nothing to wait for.
+      scaleReaders[channel].set_offset(stored.offsets[channel]);
+    }
+    else
+    {
+      //Tare the scale to remove any weight on the scale.
+      // Taring the scale means removing any weight on the scale and setting the current weight to zero.
+      // This is done to ensure that the scale starts from zero when there is no weight on it.  
+      // Taring the scale is done by calling the tare() function of the HX711 library.
+      // It averages 10 conversions (1 s at 10 SPS); the offsets are stored afterwards (by Task5).
+      scaleReaders[channel].tare();         
+      calibrationToSave = true;
+    }
+    loadCellArray.setCalibration(channel, scaleReaders[channel].get_offset(), calibration_factors[channel]);
+    loadCellArray.setTrim(channel, loadCellTrims[channel]);
+  }
+  // the filter chain converts the combined counts to milligrams in fixed-point, the float factor is only used here.
+  // the offsets are removed by loadCellArray, the combined counts are in counts per gram of channel 0
+  // unless a calibration measured the factor of the whole platform.
+  platformCalibrated = haveStored && stored.fitted != 0;
+  platformCountsPerGram = platformCalibrated ? stored.countsPerGram : loadCellArray.countsPerGram();
+  if (haveStored)
+  {
+    zeroDrift.countsPerDegree = stored.countsPerDegree;
+    zeroDrift.refTemperatureC = stored.refTemperatureC;
+  }
+#if !SCALE_FIXED_FILTER
+  weightProcessor.filter().configure(ProfileLimits::filterConfig());   // the "filter" command changes them later
+#endif
+  weightProcessor.filter().converter().setCalibration(0, platformCountsPerGram);
+  Serial.println(haveStored ? "Calibration loaded from NVS" : "Scale tared, default calibration");
+  markBoot(BootStage::LoadCells);
 
   // create a new semaphpre and check if it has been created.
-  // The semaphore is used to ensure that only one task can access the shared resource (load cell and display) at a time.
+  // The semaphore is used to ensure that only one task can access the hardware (load cell and display) at a time.
   // This is done to avoid any conflicts between the tasks that access the shared resource.
   Serial.println("Creating a semaphore to handle shared resources");
   // create a mutex semaphore to handle shared resources
@@ -531,92 +2428,97 @@ void setup()
     Serial.println("Semaphore could not be created!");
   }
 
-  // wait for the WiFi connection to be established.
-  Serial.println("Connecting to WiFi...");
-  if(WiFi.status() != WL_CONNECTED) 
-  {        
-    Serial.println("..... Connecting.... \n");
-    delay(1000);   
-  }  
+  // the weight history (flash file system) is mounted by Task5, see mountHistory(): the scan of the segments
+  // does not delay the first weight.
 
-  // This is your local IP address. 
-  // You can use this IP address to access the web interface of the ESP32.
-  // It will be printed on the Serial Monitor after the ESP32 is connected to the WiFi network.
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());  // you need this IP to access to the web interface
-    
-  //3 start the web server and sockets.
-  Serial.println("Starting the web server and web socket");
-  // start the web server on port 80
-  // The web server will serve the HTML page defined in the "website" string variable.
+  //3 prepare the web server and sockets (they listen once WiFi is up, see startWebServices()).
+  // The web server will serve the gzip-compressed page from flash (see handleRoot()).
   // The web server will handle any client requests to the root path ("/").
-  server.on("/", []() {                               
-  server.send(200, "text/html", website);              //  send out the HTML string "webpage" to the client
-      });
-  
-  server.begin();   
-  Serial.println("Web server started on port 80"); // print the web server started message on the Serial Monitor                                 
-  // start the web socket on port 81.
-  webSocket.begin();    
-  webSocket.onEvent(webSocketEvent);                 // set the web socket event handler to handle client requests.
-  Serial.println("Web socket started on port 81");   // print the web socket started message on the Serial Monitor
+  server.on("/", handleRoot);
+  // the weight history, e.g. /history?from=...&to=...&bucket=...&format=csv|bin (see handleHistory()).
+  server.on("/history", HTTP_GET, handleHistory);
+  // the runtime metrics in the Prometheus text format (see handleMetrics()).
+  server.on("/metrics", HTTP_GET, handleMetrics);
+  // the raw HX711 trace of "trace start" ... "trace stop" (see handleTrace()).
+  server.on("/trace", HTTP_GET, handleTrace);
+  // keep the If-None-Match header of the requests, it is needed to answer 304.
+  static const char *collectedHeaders[] = {"If-None-Match"};
+  server.collectHeaders(collectedHeaders, 1);
   // The webSocket.onEvent(webSocketEvent) function is used to set the event handler for the web socket.
   // This function will be called when a client connects, disconnects, or sends a message to the server.  
-  
-  
-  //4- Blynk interaction
+  webSocket.onEvent(webSocketEvent);
+
+  //4- WiFi and Blynk interaction, connected in the background by Task4.
   // Blynk is used to send the current weight to the Blynk cloud and display it on the Blynk app.
-  Serial.println("Starting Blynk Cloud");     
-  // Blynk.begin() function is used to start the Blynk cloud interaction.
   // You need to replace the BLYNK_AUTH_TOKEN with your own Blynk authentication token.   
   // You can get the BLYNK_AUTH_TOKEN from the Blynk app after creating a template.
-  // Blynk.begin() function takes the BLYNK_AUTH_TOKEN, AP_NAME, and AP_PASS as parameters.       
-  // Blynk.begin() function will connect the ESP32 to the Blynk cloud and start the Blynk cloud interaction.
-   Blynk.begin(BLYNK_AUTH_TOKEN, AP_NAME, AP_PASS); // Blynk starts here.
+  // Blynk.begin() used to connect WiFi and the cloud here and wait until both answered (forever without a
+  // network); Blynk.config() only sets the token, Task4 connects (see BlynkLink).
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);   // the connectivity manager reconnects, with its backoff
+#if CLOUD_BACKEND == CLOUD_BACKEND_BLYNK
+  Blynk.config(BLYNK_AUTH_TOKEN);
+#endif
+  LinkConfig wifiConfig;
+  wifiConfig.attemptTimeoutMs = WIFI_ATTEMPT_TIMEOUT_MS;
+  wifiConfig.backoffMinMs = RECONNECT_BACKOFF_MIN_MS;
+  wifiConfig.backoffMaxMs = RECONNECT_BACKOFF_MAX_MS;
+  LinkConfig cloudConfig = wifiConfig;
+  cloudConfig.attemptTimeoutMs = CLOUD_ATTEMPT_TIMEOUT_MS;
+  wifiLinkId = connectivity.addLink(wifiLink, wifiConfig);
+  cloudLinkId = connectivity.addLink(cloudLink, cloudConfig, wifiLinkId);   // the cloud needs WiFi
 
-  // BlynkTimer is used to run the Blynk cloud interaction every second.  
-  // The timer.setInterval() function takes the interval in milliseconds and the function to be called as parameters.   
-  timer.setInterval(1000L, runBlynk); 
+  // The weight is sent by Task4 through the uplink queue (see runUplink()).
    
   //5- Creating different tasks(getting weight, displaying the current weight, web server and blynk interaction.
    Serial.println("Creating tasks");
   // Create different tasks for getting weight, displaying weight, web server, and Blynk cloud interaction.
-  // The tasks are created with different priorities and stack sizes.
+  // The cores, priorities, periods and stack sizes are in taskTable (see above).
   // Task1: getting weight
   // Task2: displaying weight
-  // Task3: web server
-  // Task4: Blynk cloud interaction (commented out).
-
-  xTaskCreate(Task1, "get Weight", 10000, NULL, 1, &TaskHandle_1); // getting weight 
-  xTaskCreate(Task2, "Display 1", 10000,NULL, 1, &TaskHandle_2);  
-  xTaskCreate(Task3, "Web Server", 10000,NULL, 2, &TaskHandle_3);
-  xTaskCreate(Task4, "Blynk Cloud", 10000,NULL,3, &TaskHandle_4);
-  // Blynk cloud interaction is commented out. You can uncomment it to use it.
+  // Task3: web socket broadcast
+  // Task4: WiFi, web server and Blynk cloud (connect, reconnect) and the cloud uplink
+  // Task5: HTTP server, web socket events and weight history
+  // Task6: task monitor (stack high-water marks, jitter, deadline misses)
+  // Task7: log drain (formats the log records and writes them to Serial)
+#if LOW_POWER
+  startLowPower();   // light sleep, WiFi modem sleep and the power scheduler of Task1
+#endif
+  startTasks(taskTable, taskCount);
+  // Task1 is woken by the HX711 data-ready signals (DOUT goes low when a conversion is ready), one per channel.
+  // In the low-power mode a low level (with the light sleep wake-up), masked until Task1 read the conversion.
+  for (uint8_t channel = 0; channel < LOAD_CELL_COUNT; channel++)
+  {
+    attachInterruptArg(digitalPinToInterrupt(loadCellDoutPins[channel]), onHx711DataReady,
+                       (void *)(uintptr_t)channel, LOW_POWER ? ONLOW_WE : FALLING);
+  }
+  markBoot(BootStage::Tasks);
 
-  // Starting the demo and run the tasks.
+  // Starting the demo and run the tasks; WiFi and the cloud follow in the background.
   Serial.println("....Starting the demo .... \n");  
+
+#if HEAP_AFTER_BOOT != HEAP_AFTER_BOOT_OFF
+  // from here on every buffer should exist already: the allocations are counted, per task (and trapped).
+  for (size_t i = 0; i < taskCount; i++)
+  {
+    heapGuard.setPolicy((uint8_t)i, HEAP_AFTER_BOOT == HEAP_AFTER_BOOT_TRAP ? taskTable[i].heap : HeapPolicy::Count);
+  }
+  heapGuard.arm();
+#endif
 }
 
 //**************************************************************************** main function (loop) *****************************************************
 
 /**
  * @brief function is the main loop of the ESP32 application.
- * @details  It runs continuously after the setup function is called. 
- *            This function handles the web server and web socket events.
- *            It calls the server.handleClient() function to handle any client requests to the web server.
- *            It also calls the webSocket.loop() function to handle any web socket events.
+ * @details  All the work is done by the tasks of taskTable: the web server and web socket events are
+ *           handled by Task5. The loop deletes its own task, which gives its stack back to the heap.
  * @para: This function does not take any parameters.
  * @return: This function does not return any value.
  * 
  */
 void loop() 
 {   
-  // run server forever. 
-  // This function handles the web server and web socket events.
-  // It is called continuously in the main loop to handle any client requests to the web server.
-  // It calls the server.handleClient() function to handle any client requests to the web server.
-  // It also calls the webSocket.loop() function to handle any web socket events. 
-  server.handleClient();  // webserver methode that handles all Client
-  webSocket.loop();   
+  vTaskDelete(NULL);
 }
 // This is the end of the main function (loop) and the end of the program.
@@ -0,0 +1,141 @@
+/**
+ * AcquisitionScenario.cpp
+ *  Runs the interrupt driven HX711 acquisition against the simulated HX711 and measures
+ *  how many samples are lost and how old the newest sample is when the readers pick it up.
+ *
+ *  The acquisition thread does exactly what Task1 does in the firmware: it sleeps until the
+ *  data-ready "interrupt" notifies it, reads the conversion and pushes it into the ring.
+ *  The reader threads stand in for the display, web server and cloud tasks.
+ *  Returns 1 if a reader loses a sample although it polls before the ring fills up.
+ */
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "HostClock.h"
+#include "HostNotify.h"
+#include "Scenarios.h"
+#include "SimulatedHx711.h"
+#include "Stats.h"
+
+namespace
+{
+
+struct ReaderResult
+{
+  uint32_t received = 0;
+  uint32_t lost = 0;
+  LatencyStats latency;
+};
+
+}  // namespace
+
+int runAcquisitionScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 3));
+  const int readers = static_cast<int>(options.get("readers", 3));
+  const uint32_t pollMs = static_cast<uint32_t>(options.get("pollms", 20));
+
+  Hx711Acquisition acquisition;
+  SimulatedHx711 hx711(sps, 84000, -396.99f, 40);
+  HostNotify dataReady;
+  std::atomic<uint32_t> readyMicros{0};
+  std::atomic<bool> running{true};
+
+  // acquisition "task": woken by the data-ready edge, never polls.
+  std::thread acquire([&]() {
+    while (running)
+    {
+      if (dataReady.take(500000) == 0)
+      {
+        continue;  // no edge within 500 ms: HX711 not ready
+      }
+      if (!hx711.isReady())
+      {
+        acquisition.onMissedSample();
+        continue;
+      }
+      const uint32_t readyUs = readyMicros.load();
+      acquisition.onSample(hx711.read(), readyUs);
+    }
+  });
+
+  // readers: poll the newest samples with their own cursor, no lock.
+  std::vector<ReaderResult> results(static_cast<size_t>(readers));
+  std::vector<std::thread> readerThreads;
+  for (int i = 0; i < readers; i++)
+  {
+    readerThreads.emplace_back([&, i]() {
+      ReaderResult &result = results[static_cast<size_t>(i)];
+      result.latency.reserve(sps * seconds + 16);
+      uint32_t cursor = 0;
+      RawSample batch[16];
+      while (running)
+      {
+        const size_t count = acquisition.samples().read(cursor, batch, 16, result.lost);
+        const uint32_t now = hostMicros();
+        for (size_t k = 0; k < count; k++)
+        {
+          result.latency.add(now - batch[k].timestampUs);
+        }
+        result.received += static_cast<uint32_t>(count);
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollMs));
+      }
+    });
+  }
+
+  // the "ISR": store the edge time and notify the acquisition task.
+  hx711.start([&](uint32_t readyUs) {
+    readyMicros.store(readyUs);
+    dataReady.give();
+  });
+  hx711.setLoadGrams(250.0f);
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  hx711.stop();
+  // let the readers drain the ring before stopping them.
+  std::this_thread::sleep_for(std::chrono::milliseconds(pollMs * 2 + 10));
+  running = false;
+  acquire.join();
+  for (std::thread &thread : readerThreads)
+  {
+    thread.join();
+  }
+
+  std::printf("acquisition: %u SPS for %u s, %d readers polling every %u ms\n", sps, seconds, readers, pollMs);
+  std::printf("  conversions produced        %u\n", hx711.producedCount());
+  std::printf("  samples acquired            %u\n", acquisition.sampleCount());
+  std::printf("  overwritten in the HX711    %u\n", hx711.overwrittenCount());
+  std::printf("  edges without data          %u\n", acquisition.missedCount());
+  for (int i = 0; i < readers; i++)
+  {
+    ReaderResult &result = results[static_cast<size_t>(i)];
+    char label[32];
+    std::snprintf(label, sizeof(label), "reader %d (lost %u)", i, result.lost);
+    result.latency.print(label);
+  }
+
+  // a reader that comes back before the producer went once around the ring (twice the samples of one poll
+  // interval, for the scheduling of the host) must get every sample.
+  const uint32_t perPoll = sps * pollMs / 1000 + 1;
+  bool ok = true;
+  printChecks();
+  if (perPoll * 2 <= Hx711Acquisition::Ring::capacity)
+  {
+    bool complete = true;
+    for (const ReaderResult &result : results)
+    {
+      complete &= result.lost == 0 && result.received == acquisition.sampleCount();
+    }
+    ok &= check(complete, "no reader loses a sample below the ring capacity");
+  }
+  else
+  {
+    std::printf("  (%u samples per poll: more than half the ring, losses are expected)\n", perPoll);
+  }
+  ok &= check(acquisition.sampleCount() > 0, "the acquisition task reads the conversions");
+  return ok ? 0 : 1;
+}
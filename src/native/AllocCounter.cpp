@@ -0,0 +1,78 @@
+/**
+ * AllocCounter.cpp
+ *  Replaces the global operator new / delete of the native build with counting versions.
+ */
+#include "AllocCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "HeapGuard.h"
+
+namespace
+{
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> bytes{0};
+std::atomic<uint64_t> deallocations{0};
+thread_local HeapGuard *guard = nullptr;
+thread_local uint8_t guardOwner = 0;
+
+void *countedAlloc(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  if (guard != nullptr)
+  {
+    guard->onAllocate(guardOwner, size);
+  }
+  void *pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void countedFree(void *pointer)
+{
+  if (pointer != nullptr)
+  {
+    deallocations.fetch_add(1, std::memory_order_relaxed);
+    std::free(pointer);
+  }
+}
+
+}  // namespace
+
+uint64_t allocationCount() { return allocations.load(std::memory_order_relaxed); }
+uint64_t allocatedBytes() { return bytes.load(std::memory_order_relaxed); }
+uint64_t deallocationCount() { return deallocations.load(std::memory_order_relaxed); }
+
+void guardAllocations(HeapGuard *heapGuard, uint8_t owner)
+{
+  guard = heapGuard;
+  guardOwner = owner;
+}
+
+void *operator new(std::size_t size) { return countedAlloc(size); }
+void *operator new[](std::size_t size) { return countedAlloc(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+  try
+  {
+    return countedAlloc(size);
+  }
+  catch (...)
+  {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+void operator delete(void *pointer) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { countedFree(pointer); }
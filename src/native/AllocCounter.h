@@ -0,0 +1,20 @@
+/**
+ * AllocCounter.h
+ *  Counts the heap allocations of the native build (global operator new / delete are replaced in
+ *  AllocCounter.cpp), so a scenario can check that a code path does not allocate.
+ */
+#pragma once
+
+#include <cstdint>
+
+class HeapGuard;
+
+uint64_t allocationCount();
+uint64_t allocatedBytes();
+uint64_t deallocationCount();
+
+/**
+ * @brief Shows every allocation of the calling thread to a heap guard as well, as the owner given (the malloc
+ *        wrappers of the firmware do it per task). A trap is only counted (HeapGuard::traps()). nullptr: stop.
+ */
+void guardAllocations(HeapGuard *guard, uint8_t owner);
@@ -0,0 +1,339 @@
+/**
+ * BootScenario.cpp
+ *  Startup with and without a network: the old setup() (WiFi.begin(), 1 s delay, Blynk.begin() waiting for
+ *  WiFi and the cloud, then the tasks) against the staged startup (display and load cells, tasks, then WiFi,
+ *  web server and cloud in the background through the ConnectivityManager), on a simulated access point and
+ *  cloud:
+ *    - when the display, the first weight, WiFi, the web server and the cloud are up,
+ *    - connection attempts over the run (backoff) and cloud attempts without WiFi,
+ *    - how long the reconnect takes after the access point was away,
+ *    - the boot timeline in the metrics text.
+ *  The setup() costs are estimates for the ESP32-S3 (display, NVS, LittleFS scan); the first stable weight
+ *  is the one measured by the "calibration" scenario (offsets from NVS, 10 SPS).
+ *  The simulation steps Task4's 100 ms period, it runs much faster than real time.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Check.h"
+#include "Connectivity.h"
+#include "Metrics.h"
+#include "Scenarios.h"
+
+namespace
+{
+
+const uint32_t never = 0xFFFFFFFFu;
+
+// estimated costs of setup() (ms).
+const uint32_t serialMs = 1;
+const uint32_t displayInitMs = 3;         // TM1637 init and the first "----"
+const uint32_t loadCellsMs = 8;           // HX711 pins, NVS record
+const uint32_t historyMountMs = 60;       // LittleFS mount and scan of the history segments
+const uint32_t tasksMs = 4;               // creating the 7 tasks
+const uint32_t firstStableMs = 800;       // HX711 settling + filter, from reset (calibration scenario, 10 SPS)
+const uint32_t taskPeriodMs = 100;        // Task4
+
+const uint32_t associationMs = 2500;      // WiFi association + DHCP once the access point is there
+const uint32_t loginMs = 400;             // Blynk connect and login
+
+struct Case
+{
+  const char *name;
+  uint32_t apFromMs;     // the access point is there from then on (never: not at all)
+  uint32_t dropAtMs;     // ... except for dropForMs from then on (never: no drop)
+  uint32_t dropForMs;
+  bool cloud;            // the cloud answers
+};
+
+const Case cases[] = {
+    {"normal", 0, never, 0, true},
+    {"AP up after 2 min", 120000, never, 0, true},
+    {"cloud unreachable", 0, never, 0, false},
+    {"AP away 45 s at 5 min", 0, 300000, 45000, true},
+    {"no network", never, never, 0, false},
+};
+
+struct Network
+{
+  const Case &c;
+  uint32_t nowMs = 0;
+
+  bool apUp(uint32_t t) const { return t >= c.apFromMs && !(t >= c.dropAtMs && t - c.dropAtMs < c.dropForMs); }
+  // since when the access point is there without a break (valid if apUp(t)).
+  uint32_t apUpSince(uint32_t t) const
+  {
+    return c.dropAtMs != never && t >= c.dropAtMs + c.dropForMs ? c.dropAtMs + c.dropForMs : c.apFromMs;
+  }
+};
+
+// the WiFi station: associated associationMs after an attempt started and the access point is there.
+class SimWifi : public NetworkLink
+{
+public:
+  explicit SimWifi(Network &net) : net_(net) {}
+
+  bool connected() override
+  {
+    const uint32_t t = net_.nowMs;
+    if (!net_.apUp(t))
+    {
+      associated_ = false;
+      return false;
+    }
+    if (!associated_ && trying_)
+    {
+      const uint32_t from = attemptMs_ > net_.apUpSince(t) ? attemptMs_ : net_.apUpSince(t);
+      associated_ = t - from >= associationMs;
+    }
+    return associated_;
+  }
+  void connect() override
+  {
+    trying_ = true;
+    associated_ = false;
+    attemptMs_ = net_.nowMs;
+  }
+  void disconnect() override
+  {
+    trying_ = false;
+    associated_ = false;
+  }
+
+private:
+  Network &net_;
+  bool trying_ = false;
+  bool associated_ = false;
+  uint32_t attemptMs_ = 0;
+};
+
+// the cloud: connect() blocks (Blynk.connect()) for the login or the whole timeout.
+class SimCloud : public NetworkLink
+{
+public:
+  SimCloud(Network &net, SimWifi &wifi, uint32_t timeoutMs) : net_(net), wifi_(wifi), timeoutMs_(timeoutMs) {}
+
+  bool connected() override { return up_ && net_.c.cloud && wifi_.connected(); }
+  void connect() override
+  {
+    withoutWifi += wifi_.connected() ? 0 : 1;
+    up_ = net_.c.cloud && wifi_.connected();
+    blockedMs += up_ ? loginMs : timeoutMs_;
+  }
+  void disconnect() override { up_ = false; }
+
+  uint32_t withoutWifi = 0;   // attempts made while WiFi was down
+  uint32_t blockedMs = 0;     // time connect() blocked the calling task (taken by the loop)
+
+private:
+  Network &net_;
+  SimWifi &wifi_;
+  uint32_t timeoutMs_;
+  bool up_ = false;
+};
+
+struct Timeline
+{
+  uint32_t display = never;
+  uint32_t firstWeight = never;
+  uint32_t wifi = never;
+  uint32_t webServer = never;
+  uint32_t cloud = never;
+  uint32_t wifiAttempts = 0;
+  uint32_t cloudAttempts = 0;
+  uint32_t cloudWithoutWifi = 0;
+  uint32_t reconnectMs = never;   // access point back -> WiFi up again (drop case)
+  uint32_t task4BlockedMs = 0;
+};
+
+// old setup(): WiFi.begin() first, one delay(1000), Blynk.begin() waits for WiFi and the cloud, then the tasks.
+Timeline oldBoot(const Case &c)
+{
+  Timeline t;
+  uint32_t now = serialMs + displayInitMs;   // initialized, but nothing shown until Task2 runs
+  now += loadCellsMs + 1000 /* tare */ + historyMountMs + 1000 /* delay(1000) */;
+  if (c.apFromMs == never)
+  {
+    return t;   // Blynk.begin() never returns
+  }
+  const uint32_t wifiUp = c.apFromMs + associationMs;   // WiFi.begin() at 0, the driver keeps trying
+  now = now > wifiUp ? now : wifiUp;
+  t.wifi = wifiUp;
+  if (!c.cloud)
+  {
+    return t;   // Blynk.begin() keeps trying to log in
+  }
+  now += loginMs;
+  t.cloud = now;
+  now += tasksMs;
+  t.display = now + taskPeriodMs;
+  t.webServer = now;                     // served from loop() once setup() returned
+  t.firstWeight = now + firstStableMs;   // the HX711 task starts only now
+  return t;
+}
+
+// staged setup(): display, load cells (offsets from NVS), tasks; Task4 connects in the background.
+Timeline newBoot(const Case &c, uint32_t runMs, Metrics &metrics)
+{
+  Timeline t;
+  Network net{c};
+  SimWifi wifi(net);
+  LinkConfig wifiConfig;
+  wifiConfig.attemptTimeoutMs = 15000;
+  LinkConfig cloudConfig;
+  cloudConfig.attemptTimeoutMs = 3000;
+  SimCloud cloud(net, wifi, cloudConfig.attemptTimeoutMs);
+  ConnectivityManager manager;
+  const int8_t wifiId = manager.addLink(wifi, wifiConfig);
+  const int8_t cloudId = manager.addLink(cloud, cloudConfig, wifiId);
+
+  uint32_t now = serialMs + displayInitMs;
+  t.display = now;
+  metrics.markBoot(BootStage::Display, now);
+  now += loadCellsMs;
+  metrics.markBoot(BootStage::LoadCells, now);
+  now += tasksMs;
+  metrics.markBoot(BootStage::Tasks, now);
+  t.firstWeight = now > firstStableMs ? now : firstStableMs;   // Task1 runs from here, the HX711 settles meanwhile
+  metrics.markBoot(BootStage::FirstWeight, t.firstWeight);
+
+  const uint32_t apBackMs = c.dropAtMs != never ? c.dropAtMs + c.dropForMs : never;
+  bool droppedSeen = false;
+  while (now < runMs)
+  {
+    net.nowMs = now;
+    const uint8_t changed = manager.service(now);
+    if ((changed & (1u << wifiId)) && manager.up(wifiId))
+    {
+      if (t.wifi == never)
+      {
+        t.wifi = now;
+        t.webServer = now + 5;   // server.begin(), webSocket.begin(), configTime()
+        metrics.markBoot(BootStage::WifiUp, t.wifi);
+        metrics.markBoot(BootStage::WebServer, t.webServer);
+      }
+      if (droppedSeen && t.reconnectMs == never)
+      {
+        t.reconnectMs = now - apBackMs;
+      }
+    }
+    if ((changed & (1u << wifiId)) && !manager.up(wifiId))
+    {
+      droppedSeen = true;
+    }
+    if ((changed & (1u << cloudId)) && manager.up(cloudId) && t.cloud == never)
+    {
+      t.cloud = now + cloud.blockedMs;   // up when Blynk.connect() returned
+      metrics.markBoot(BootStage::CloudUp, t.cloud);
+    }
+    now += taskPeriodMs + cloud.blockedMs;
+    t.task4BlockedMs += cloud.blockedMs;
+    cloud.blockedMs = 0;
+  }
+  t.wifiAttempts = manager.attempts(wifiId);
+  t.cloudAttempts = manager.attempts(cloudId);
+  t.cloudWithoutWifi = cloud.withoutWifi;
+  return t;
+}
+
+void printMs(uint32_t ms)
+{
+  if (ms == never)
+  {
+    std::printf(" %8s", "never");
+  }
+  else
+  {
+    std::printf(" %8.3f", ms / 1000.0);
+  }
+}
+
+}  // namespace
+
+int runBootScenario(const Options &options)
+{
+  const uint32_t runS = static_cast<uint32_t>(options.get("seconds", 600));
+  bool ok = true;
+  bool weightEarly = true;
+  bool displayEarly = true;
+  bool noBlindCloud = true;
+  bool backedOff = true;
+  bool reconnected = true;
+  bool exported = true;
+
+  std::printf("boot: %u s per case, Task4 every %u ms, WiFi association %u ms, cloud login %u ms\n", runS,
+              taskPeriodMs, associationMs, loginMs);
+  std::printf("  %-24s %-4s %8s %8s %8s %8s %8s %7s %7s %8s\n", "", "", "display", "weight", "wifi", "web", "cloud",
+              "wifi #", "cloud #", "Task4 s");
+  for (const Case &c : cases)
+  {
+    Metrics metrics;
+    const Timeline before = oldBoot(c);
+    const Timeline after = newBoot(c, runS * 1000u, metrics);
+    const Timeline *rows[] = {&before, &after};
+    const char *labels[] = {"old", "new"};
+    for (int i = 0; i < 2; i++)
+    {
+      const Timeline &t = *rows[i];
+      std::printf("  %-24s %-4s", i == 0 ? c.name : "", labels[i]);
+      printMs(t.display);
+      printMs(t.firstWeight);
+      printMs(t.wifi);
+      printMs(t.webServer);
+      printMs(t.cloud);
+      if (i == 0)
+      {
+        std::printf(" %7s %7s %8s\n", "-", "-", "-");   // Blynk.begin() retries inside setup()
+      }
+      else
+      {
+        std::printf(" %7u %7u %8.1f\n", t.wifiAttempts, t.cloudAttempts, t.task4BlockedMs / 1000.0);
+      }
+    }
+    if (after.reconnectMs != never)
+    {
+      std::printf("  %-29s WiFi back %.1f s after the access point\n", "", after.reconnectMs / 1000.0);
+    }
+
+    weightEarly &= after.firstWeight < 1000;
+    displayEarly &= after.display < 300;
+    noBlindCloud &= after.cloudWithoutWifi == 0;
+    // without a backoff, a 3 s attempt every 100 ms period would be ~1 attempt per 3.1 s.
+    backedOff &= after.cloudAttempts * 3100 < runS * 1000u / 4 && after.wifiAttempts * 15100 < runS * 1000u / 2;
+    if (c.dropAtMs != never)
+    {
+      reconnected &= after.reconnectMs != never && after.reconnectMs <= 60000 + 15000;
+    }
+
+    // the timeline in the metrics text: one line per stage reached.
+    std::string text;
+    MetricsExporter exporter(metrics, runS);
+    char chunk[256];
+    size_t n;
+    while ((n = exporter.read(chunk, sizeof(chunk))) != 0)
+    {
+      text.append(chunk, n);
+    }
+    exported &= text.find("scale_boot_stage_seconds{stage=\"first_weight\"}") != std::string::npos &&
+                (text.find("scale_boot_stage_seconds{stage=\"cloud\"}") != std::string::npos) == (after.cloud != never);
+    if (c.cloud && c.apFromMs == 0 && c.dropAtMs == never)
+    {
+      std::printf("  metrics:\n");
+      for (size_t pos = text.find("scale_boot_stage_seconds{"); pos != std::string::npos;
+           pos = text.find("scale_boot_stage_seconds{", pos + 1))
+      {
+        std::printf("    %s\n", text.substr(pos, text.find('\n', pos) - pos).c_str());
+      }
+    }
+  }
+
+  printChecks();
+  ok &= check(displayEarly, "display up within 300 ms, with or without network");
+  ok &= check(weightEarly, "first weight within 1 s, with or without network");
+  ok &= check(noBlindCloud, "no cloud attempt while WiFi is down");
+  ok &= check(backedOff, "failed attempts back off");
+  ok &= check(reconnected, "WiFi back within backoff max + attempt timeout");
+  ok &= check(exported, "boot timeline in the metrics text");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/**
+ * CalibrationScenario.cpp
+ *  Calibration (Calibration.h) on a simulated platform whose true factor is off the default one:
+ *    - the old single 50 g point (getCalibrateFactor(): 10 readings empty, 10 readings with 50 g) against the
+ *      Calibrator with 5 points up to the capacity, fed sample by sample while each load still swings in:
+ *      factor error and worst weight error over the range,
+ *    - points taken while the temperature changes, fitted with and without the drift term: zero error at
+ *      other temperatures,
+ *    - a load that never settles, too few points, a corrupted NVS record,
+ *    - boot to the first stable weight: tare in setup() (10 conversions) against the offsets stored in NVS.
+ *  Returns 1 if a check fails.
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "Calibration.h"
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "Scenarios.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+const double defaultCountsPerGram = -396.99;
+const double capacityGrams = 5000.0;
+
+// the true platform: counts (offsets removed) = zero + countsPerGram * grams + drift * (t - 25) + noise.
+struct Platform
+{
+  double zero = 1500.0;                           // the zero moved since the last tare
+  double countsPerGram = defaultCountsPerGram * 1.013;
+  double countsPerDegree = 30.0;
+  double noiseCounts = 60.0;
+  std::minstd_rand rng{15};
+  std::normal_distribution<double> noise{0.0, 1.0};
+
+  // a load put on at 0 s swings in (ringing at 3 Hz, settled after about 2 s).
+  double counts(double grams, double previousGrams, double sinceS, double temperatureC)
+  {
+    const double swing = (previousGrams - grams) * std::exp(-sinceS / 0.4) +
+                         0.05 * grams * std::exp(-sinceS / 0.5) * std::sin(2.0 * M_PI * 3.0 * sinceS);
+    return zero + countsPerGram * (grams + swing) + countsPerDegree * (temperatureC - 25.0) + noiseCounts * noise(rng);
+  }
+
+  double ideal(double grams, double temperatureC) const
+  {
+    return zero + countsPerGram * grams + countsPerDegree * (temperatureC - 25.0);
+  }
+};
+
+double gramsFrom(const CalibrationResult &fit, double counts, double temperatureC)
+{
+  return (counts - fit.zeroCounts - fit.countsPerDegree * (temperatureC - fit.refTemperatureC)) / fit.countsPerGram;
+}
+
+struct Session
+{
+  CalibrationResult fit = {};
+  bool ok = false;
+  double longestPointS = 0.0;
+};
+
+// the web page flow: start, put a weight on and take the point at once, ..., finish.
+Session calibrate(Platform &platform, const double *weights, const double *temperatures, uint8_t count,
+                  bool withTemperature, uint32_t sps)
+{
+  CalibrationConfig config;
+  config.samplesPerPoint = static_cast<uint8_t>(16 * sps / 10);   // 1.6 s and 30 s as in the firmware
+  config.timeoutSamples = static_cast<uint16_t>(300 * sps / 10);
+  config.temperatureCompensation = withTemperature;
+  Calibrator calibrator(config);
+  Session session;
+  calibrator.start();
+  double previous = 0.0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    calibrator.addPoint(static_cast<float>(weights[i]));
+    double t = 0.0;
+    while (calibrator.state() == CalibrationState::Sampling)
+    {
+      t += 1.0 / sps;
+      calibrator.onSample(static_cast<int32_t>(std::lround(platform.counts(weights[i], previous, t, temperatures[i]))),
+                          static_cast<float>(temperatures[i]));
+    }
+    session.longestPointS = t > session.longestPointS ? t : session.longestPointS;
+    previous = weights[i];
+  }
+  session.ok = calibrator.finish() && calibrator.takeResult(session.fit);
+  return session;
+}
+
+// worst error (grams) over 0..capacity at a temperature.
+double worstError(const CalibrationResult &fit, const Platform &platform, double temperatureC)
+{
+  double worst = 0.0;
+  for (double grams = 0.0; grams <= capacityGrams; grams += 250.0)
+  {
+    const double error = std::fabs(gramsFrom(fit, platform.ideal(grams, temperatureC), temperatureC) - grams);
+    worst = error > worst ? error : worst;
+  }
+  return worst;
+}
+
+// time from power-up to the first stable weight, the HX711 part of the boot only.
+uint32_t firstStableMs(uint32_t sps, bool tare)
+{
+  Platform platform;
+  platform.zero = 0.0;
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(static_cast<int32_t>(capacityGrams), 500000);
+  processor.filter().converter().setCalibration(0, static_cast<float>(platform.countsPerGram));
+  const uint32_t periodUs = 1000000u / sps;
+  uint32_t nowUs = sps >= 80 ? 50000 : 400000;   // HX711 output settling after power-up
+  if (tare)
+  {
+    nowUs += 10 * periodUs;   // tare(): read_average(10) in setup(), before the tasks run
+  }
+  for (uint32_t i = 0; i < 50 * sps; i++)
+  {
+    nowUs += periodUs;
+    acquisition.onSample(static_cast<int32_t>(std::lround(platform.counts(0.0, 0.0, 10.0, 25.0))), nowUs);
+    const ScaleState state = processor.update(acquisition, 0, nowUs);
+    if (state.isReady() && state.isStable())
+    {
+      return nowUs / 1000;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+int runCalibrationScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 10));
+  const double noise = static_cast<double>(options.get("noise", 60));
+  bool ok = true;
+
+  // old: one 50 g point, 10 readings each, after waiting 5 s (settled).
+  Platform platform;
+  platform.noiseCounts = noise;
+  double empty = 0.0;
+  double loaded = 0.0;
+  for (int i = 0; i < 10; i++)
+  {
+    empty += platform.counts(0.0, 0.0, 10.0, 25.0) / 10.0;
+  }
+  for (int i = 0; i < 10; i++)
+  {
+    loaded += platform.counts(50.0, 0.0, 10.0, 25.0) / 10.0;
+  }
+  CalibrationResult single = {};
+  single.zeroCounts = static_cast<float>(empty);
+  single.countsPerGram = static_cast<float>((loaded - empty) / 50.0);
+  single.refTemperatureC = 25.0f;
+
+  const double weights[] = {0.0, 500.0, 1000.0, 2500.0, 5000.0};
+  const double constant[] = {25.0, 25.0, 25.0, 25.0, 25.0};
+  const Session multi = calibrate(platform, weights, constant, 5, false, sps);
+
+  std::printf("calibration: true factor %.3f counts/g (default %.2f), noise %.0f counts, %u SPS\n",
+              platform.countsPerGram, defaultCountsPerGram, noise, sps);
+  std::printf("  %-34s %14s %12s %16s\n", "", "counts/g", "error ppm", "worst 0..5 kg g");
+  const double singlePpm = std::fabs(single.countsPerGram / platform.countsPerGram - 1.0) * 1e6;
+  const double multiPpm = std::fabs(multi.fit.countsPerGram / platform.countsPerGram - 1.0) * 1e6;
+  const double defaultWorst = capacityGrams * std::fabs(platform.countsPerGram / defaultCountsPerGram - 1.0);
+  const double singleWorst = worstError(single, platform, 25.0);
+  const double multiWorst = worstError(multi.fit, platform, 25.0);
+  std::printf("  %-34s %14.3f %12.0f %16.2f\n", "default factor, tared", defaultCountsPerGram,
+              std::fabs(defaultCountsPerGram / platform.countsPerGram - 1.0) * 1e6, defaultWorst);
+  std::printf("  %-34s %14.3f %12.0f %16.2f\n", "one 50 g point (old)", single.countsPerGram, singlePpm, singleWorst);
+  std::printf("  %-34s %14.3f %12.0f %16.2f\n", "5 points, least squares", multi.fit.countsPerGram, multiPpm,
+              multiWorst);
+  std::printf("  fit residuals %.3f g rms, %.3f g max; longest point %.1f s (load swinging in)\n", multi.fit.rmsErrorG,
+              multi.fit.maxErrorG, multi.longestPointS);
+
+  // points taken while the room warms up from 20 to 30 degrees.
+  const double warming[] = {20.0, 22.5, 25.0, 27.5, 30.0};
+  const double mixed[] = {0.0, 5000.0, 1000.0, 0.0, 2500.0};
+  const Session plain = calibrate(platform, mixed, warming, 5, false, sps);
+  const Session compensated = calibrate(platform, mixed, warming, 5, true, sps);
+  std::printf("points at 20..30 C, drift %.0f counts/C (%.3f g/C)\n", platform.countsPerDegree,
+              std::fabs(platform.countsPerDegree / platform.countsPerGram));
+  std::printf("  %-34s %16s %16s %16s\n", "", "worst g at 15 C", "worst g at 25 C", "worst g at 35 C");
+  const Session *sessions[] = {&plain, &compensated};
+  const char *names[] = {"without the drift term", "with the drift term"};
+  double worst35[2];
+  for (int i = 0; i < 2; i++)
+  {
+    worst35[i] = worstError(sessions[i]->fit, platform, 35.0);
+    std::printf("  %-34s %16.2f %16.2f %16.2f\n", names[i], worstError(sessions[i]->fit, platform, 15.0),
+                worstError(sessions[i]->fit, platform, 25.0), worst35[i]);
+  }
+  std::printf("  fitted drift %.2f counts/C\n", compensated.fit.countsPerDegree);
+
+  // failures.
+  Calibrator calibrator;
+  calibrator.start();
+  calibrator.addPoint(100.0f);
+  Platform shaky;
+  shaky.noiseCounts = 5000.0;
+  uint32_t samples = 0;
+  while (calibrator.state() == CalibrationState::Sampling && samples < 10000)
+  {
+    calibrator.onSample(static_cast<int32_t>(shaky.counts(100.0, 100.0, 10.0, 25.0)), 25.0f);
+    samples++;
+  }
+  const bool unstable = calibrator.error() == CalibrationError::Unstable && calibrator.pointCount() == 0 &&
+                        samples >= calibrator.config().timeoutSamples &&
+                        samples < calibrator.config().timeoutSamples + calibrator.config().samplesPerPoint;
+  const bool tooFew = !calibrator.finish() && calibrator.error() == CalibrationError::TooFewPoints;
+
+  CalibrationRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.channels = 1;
+  record.fitted = 1;
+  record.offsets[0] = 84123;
+  record.countsPerGram = multi.fit.countsPerGram;
+  sealCalibrationRecord(record);
+  const bool intact = calibrationRecordValid(record, 1) && !calibrationRecordValid(record, 4);
+  record.offsets[0] ^= 0x100;
+  const bool corrupted = !calibrationRecordValid(record, 1);
+
+  std::printf("boot to the first stable weight (HX711 settling + tare + filter; WiFi not included)\n");
+  const uint32_t rates[] = {10, 80};
+  uint32_t saved10 = 0;
+  for (uint32_t rate : rates)
+  {
+    const uint32_t tared = firstStableMs(rate, true);
+    const uint32_t stored = firstStableMs(rate, false);
+    saved10 = rate == 10 ? tared - stored : saved10;
+    std::printf("  %2u SPS: tare in setup() %5u ms, offsets from NVS %5u ms\n", rate, tared, stored);
+  }
+
+  printChecks();
+  ok &= check(multi.ok && multiWorst < 0.5, "5 point fit within 0.5 g over 0..5 kg");
+  ok &= check(multiWorst < singleWorst, "more accurate than the single 50 g point");
+  ok &= check(compensated.ok && worst35[1] * 2 < worst35[0], "drift term halves the error at 35 C");
+  ok &= check(unstable, "a load that never settles is reported, no point");
+  ok &= check(tooFew, "one point is not enough");
+  ok &= check(intact && corrupted, "NVS record: channels and CRC checked");
+  ok &= check(saved10 >= 900, "stored offsets save the tare (>= 0.9 s at 10 SPS)");
+  return ok ? 0 : 1;
+}
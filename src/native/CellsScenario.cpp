@@ -0,0 +1,201 @@
+/**
+ * CellsScenario.cpp
+ *  Multi load cell platform: N simulated HX711s, each on its own (slightly different) conversion clock
+ *  and with its own calibration, read by one acquisition thread the way Task1 does it in the firmware:
+ *  the data-ready "interrupt" of every chip sets its bit and wakes the thread, the thread reads the ready
+ *  chips, FrameAligner groups the conversions into frames and LoadCellArray combines them.
+ *  For 1, 2, 4 and 8 channels it reports the aggregate samples per second, frames per second, partial
+ *  frames, conversions lost in the chips, the skew inside a frame and the processing cost per frame.
+ *  It also checks the combined weight and the corner balancing. Returns 1 if a check fails.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "HostClock.h"
+#include "HostNotify.h"
+#include "Hx711Acquisition.h"
+#include "LoadCellArray.h"
+#include "Scenarios.h"
+#include "SimulatedHx711.h"
+#include "Stats.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+const float nominalCountsPerGram = -396.99f;
+
+float channelCountsPerGram(uint8_t channel) { return nominalCountsPerGram * (1.0f + 0.05f * channel); }
+int32_t channelOffset(uint8_t channel) { return 84000 + 1500 * channel; }
+
+struct RunResult
+{
+  uint32_t samples = 0;
+  uint32_t frames = 0;
+  uint32_t partial = 0;
+  uint32_t overwritten = 0;
+  LatencyStats skewUs;
+  LatencyStats processNs;
+  int32_t finalWeight = 0;
+};
+
+RunResult runChannels(uint8_t channels, uint32_t sps, uint32_t seconds, float loadGrams)
+{
+  LoadCellArray cells(channels);
+  FrameAligner aligner(channels);
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(5000 * channels, 500000);
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    cells.setCalibration(i, channelOffset(i), channelCountsPerGram(i));
+  }
+  // the filter chain sees the combined signal: offset 0, counts per gram of channel 0.
+  processor.filter().converter().setCalibration(0, cells.countsPerGram());
+
+  std::vector<std::unique_ptr<SimulatedHx711>> chips;
+  std::vector<std::atomic<uint32_t>> readyUs(channels);
+  std::atomic<uint32_t> readyMask{0};
+  HostNotify dataReady;
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    chips.emplace_back(new SimulatedHx711(sps, channelOffset(i), channelCountsPerGram(i), 40, 100 + i));
+    // +/-0.2 % per chip: the HX711 oscillators are not synchronized.
+    const int32_t spread = static_cast<int32_t>(i) - channels / 2;
+    chips.back()->setPeriodUs(static_cast<uint32_t>(1000000.0 / sps * (1.0 + 0.002 * spread)));
+  }
+
+  RunResult result;
+  result.skewUs.reserve(sps * seconds + 16);
+  result.processNs.reserve(sps * seconds + 16);
+  std::atomic<bool> running{true};
+  std::thread acquire([&]() {
+    CellFrame frame;
+    while (running)
+    {
+      if (dataReady.take(100000) == 0)
+      {
+        continue;
+      }
+      const uint32_t mask = readyMask.exchange(0);
+      for (uint8_t i = 0; i < channels; i++)
+      {
+        if (!(mask & (1u << i)) || !chips[i]->isReady())
+        {
+          continue;
+        }
+        result.samples++;
+        if (!aligner.onSample(i, chips[i]->read(), readyUs[i].load(), frame))
+        {
+          continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        acquisition.onSample(cells.combine(frame), frame.timestampUs);
+        const ScaleState state = processor.update(acquisition, 0, hostMicros());
+        result.processNs.add(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        result.skewUs.add(frame.skewUs);
+        result.finalWeight = state.weight;
+      }
+    }
+  });
+
+  for (uint8_t i = 0; i < channels; i++)
+  {
+    chips[i]->setLoadGrams(loadGrams / channels);
+    chips[i]->start([&, i](uint32_t us) {
+      readyUs[i].store(us);
+      readyMask.fetch_or(1u << i);
+      dataReady.give();
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  for (auto &chip : chips)
+  {
+    chip->stop();
+    result.overwritten += chip->overwrittenCount();
+  }
+  running = false;
+  acquire.join();
+  result.frames = aligner.frameCount();
+  result.partial = aligner.partialCount();
+  return result;
+}
+
+// the same weight on every corner of a 4 cell platform whose cells are a few percent off their nominal factor.
+bool checkCornerBalance()
+{
+  const float actualError[4] = {0.03f, -0.02f, 0.01f, -0.04f};
+  const float gramsOnCorner = 1000.0f;
+  int32_t readings[4 * LOAD_CELL_MAX_CHANNELS] = {};
+  for (int corner = 0; corner < 4; corner++)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      // 70 % of the weight on the cell under the corner, 10 % on each of the others.
+      const float grams = gramsOnCorner * (i == corner ? 0.7f : 0.1f);
+      readings[corner * LOAD_CELL_MAX_CHANNELS + i] =
+          static_cast<int32_t>(grams * channelCountsPerGram(static_cast<uint8_t>(i)) * (1.0f + actualError[i]));
+    }
+  }
+  LoadCellArray cells(4);
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    cells.setCalibration(i, 0, channelCountsPerGram(i));
+  }
+  auto spread = [&]() {
+    float lowest = 1e9f;
+    float highest = -1e9f;
+    for (int corner = 0; corner < 4; corner++)
+    {
+      CellFrame frame = {};
+      for (int i = 0; i < 4; i++)
+      {
+        frame.raw[i] = readings[corner * LOAD_CELL_MAX_CHANNELS + i];
+      }
+      const float grams = cells.combine(frame) / cells.countsPerGram();
+      lowest = grams < lowest ? grams : lowest;
+      highest = grams > highest ? grams : highest;
+    }
+    return highest - lowest;
+  };
+  const float before = spread();
+  const bool solved = cells.balanceCorners(readings);
+  const float after = spread();
+  std::printf("  corner test, 1000 g: spread %.2f g summed, %.2f g balanced (trims %.3f %.3f %.3f %.3f)\n", before,
+              after, cells.trim(0), cells.trim(1), cells.trim(2), cells.trim(3));
+  return check(solved && after < 0.5f, "corner balancing: every corner within 0.5 g");
+}
+
+}  // namespace
+
+int runCellsScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 2));
+  const uint32_t maxChannels = static_cast<uint32_t>(options.get("channels", 8));
+  const float loadGrams = 1000.0f;
+  bool ok = true;
+
+  std::printf("cells: %u SPS per HX711, %u s per run, %.0f g spread over the cells\n", sps, seconds, loadGrams);
+  std::printf("  %-8s %11s %11s %9s %8s %6s %17s %15s %8s\n", "channels", "samples/s", "per chan", "frames/s",
+              "partial", "lost", "skew p50/max us", "process p50 ns", "weight");
+  for (uint32_t channels = 1; channels <= maxChannels && channels <= LOAD_CELL_MAX_CHANNELS; channels *= 2)
+  {
+    RunResult r = runChannels(static_cast<uint8_t>(channels), sps, seconds, loadGrams);
+    std::printf("  %-8u %11.1f %11.1f %9.1f %8u %6u %8u/%-8u %15u %6d g\n", channels,
+                static_cast<double>(r.samples) / seconds, static_cast<double>(r.samples) / seconds / channels,
+                static_cast<double>(r.frames) / seconds, r.partial, r.overwritten, r.skewUs.percentile(50),
+                r.skewUs.percentile(100), r.processNs.percentile(50), r.finalWeight);
+    char what[64];
+    std::snprintf(what, sizeof(what), "%u channels: combined weight within 2 g", channels);
+    ok &= check(std::abs(r.finalWeight - static_cast<int32_t>(loadGrams)) <= 2, what);
+  }
+  ok &= checkCornerBalance();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/**
+ * Check.h
+ *  The pass/fail lines at the end of a scenario. Every scenario prints them the same way, so the output of
+ *  the runner reads alike and a "FAIL" is easy to find:
+ *
+ *    checks
+ *      <what is checked, padded>                           ok
+ *
+ *  Usage: printChecks(); ok &= check(condition, "what"); ... return ok ? 0 : 1;
+ */
+#pragma once
+
+#include <cstdio>
+
+inline void printChecks()
+{
+  std::printf("checks\n");
+}
+
+/**
+ * @brief Prints one check and returns its result.
+ */
+inline bool check(bool passed, const char *what)
+{
+  std::printf("  %-52s %s\n", what, passed ? "ok" : "FAIL");
+  return passed;
+}
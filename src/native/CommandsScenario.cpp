@@ -0,0 +1,359 @@
+/**
+ * CommandsScenario.cpp
+ *  Typed commands (Commands.h): decoded by the network task, queued, executed by the acquisition task
+ *  between two samples and acknowledged.
+ *    - the decoder on a table of valid and malformed messages, and its cost per command,
+ *    - live, with a simulated HX711 and two threads (Task1 and Task5): a mix of commands every interval ms,
+ *      the time the network handler takes (decode + push), the request -> ack latency per command, the
+ *      offset found by the queued tare and the samples Task1 weighed,
+ *    - the same mix with the tare of the old firmware: the handler reads the HX711 itself (HX711::tare(),
+ *      10 conversions) while holding the hardware lock, so Task5 blocks and Task1 misses samples.
+ *  Returns 1 if a check fails.
+ */
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "Check.h"
+#include "Commands.h"
+#include "HostClock.h"
+#include "HostNotify.h"
+#include "LoadCellArray.h"
+#include "RawTrace.h"
+#include "Scenarios.h"
+#include "SimulatedHx711.h"
+#include "Stats.h"
+#include "Subscriptions.h"
+
+namespace
+{
+
+const uint8_t tareFrames = 10;         // TARE_FRAMES
+const int32_t chipOffset = 84000;      // raw value of the empty platform
+const float countsPerGram = 420.0f;
+const int32_t noiseCounts = 200;       // peak to peak
+
+struct ParseCase
+{
+  const char *text;
+  bool valid;
+  CommandType type;
+  uint8_t argument;
+  int32_t value;
+};
+
+const ParseCase parseCases[] = {
+    {"7 tare", true, CommandType::Tare, 0, 0},
+    {"8 zero on", true, CommandType::ZeroTrack, 0, 1},
+    {"9 zero 0", true, CommandType::ZeroTrack, 0, 0},
+    {"10 rate 80", true, CommandType::SetRate, 0, 80},
+    {"11 filter median 5", true, CommandType::SetFilter, (uint8_t)FilterParam::Median, 5},
+    {"12 filter kalman", true, CommandType::SetFilter, (uint8_t)FilterParam::Kalman, 0},
+    {"13 filter none", true, CommandType::SetFilter, (uint8_t)FilterParam::None, 0},
+    {"14 cal point 500.25", true, CommandType::Calibrate, (uint8_t)CalibrationCommand::Point, 500250},
+    {"15 cal status", true, CommandType::Calibrate, (uint8_t)CalibrationCommand::Status, 0},
+    {"16 sub 3\r\n", true, CommandType::Subscribe, 0, 3},
+    {"{\"rand\":\"Taring the Scale\"}", true, CommandType::Tare, 0, 0},
+    {"26 sub rate 10", true, CommandType::Subscribe, (uint8_t)SubscribeParam::Rate, 10},
+    {"27 sub alarm 250.5", true, CommandType::Subscribe, (uint8_t)SubscribeParam::Alarm, 250500},
+    {"28 sub alarm off", true, CommandType::Subscribe, (uint8_t)SubscribeParam::Alarm, SUBSCRIPTION_NO_ALARM},
+    {"29 sub format bin", true, CommandType::Subscribe, (uint8_t)SubscribeParam::Format, SUBSCRIPTION_BINARY},
+    {"30 sub fields 63", true, CommandType::Subscribe, (uint8_t)SubscribeParam::Fields, 63},
+    {"34 trace start", true, CommandType::Trace, (uint8_t)TraceCommand::Start, 0},
+    {"35 trace mark 250.5", true, CommandType::Trace, (uint8_t)TraceCommand::Mark, 250500},
+    {"36 trace mark off", true, CommandType::Trace, (uint8_t)TraceCommand::Mark, TRACE_NO_REFERENCE},
+    {"", false, CommandType::Tare, 0, 0},
+    {"tare", false, CommandType::Tare, 0, 0},
+    {"-1 tare", false, CommandType::Tare, 0, 0},
+    {"17 tare now", false, CommandType::Tare, 0, 0},
+    {"18 zero maybe", false, CommandType::Tare, 0, 0},
+    {"19 rate", false, CommandType::Tare, 0, 0},
+    {"20 filter median", false, CommandType::Tare, 0, 0},
+    {"21 filter median x", false, CommandType::Tare, 0, 0},
+    {"22 cal point 1.2345", false, CommandType::Tare, 0, 0},
+    {"23 cal point -5", false, CommandType::Tare, 0, 0},
+    {"24 sub 256", false, CommandType::Tare, 0, 0},
+    {"25 reboot", false, CommandType::Tare, 0, 0},
+    {"99999999999 tare", false, CommandType::Tare, 0, 0},
+    {"{\"weight\":1}", false, CommandType::Tare, 0, 0},
+    {"31 sub rate 101", false, CommandType::Tare, 0, 0},
+    {"32 sub format xml", false, CommandType::Tare, 0, 0},
+    {"33 sub fields 0", false, CommandType::Tare, 0, 0},
+    {"37 trace mark -5", false, CommandType::Tare, 0, 0},
+};
+
+// the commands the clients send, one in ten is a tare.
+const char *const commandMix[] = {"tare", "zero on", "filter median 5", "cal status", "zero off",
+                                  "rate 80", "filter ema 3", "cal status", "zero on", "filter none"};
+
+struct LiveRun
+{
+  LatencyStats handlerUs;        // network task: decode + queue (or the whole blocking tare)
+  LatencyStats tareAckUs;        // request -> ack
+  LatencyStats otherAckUs;
+  uint32_t sent = 0;
+  uint32_t acked = 0;
+  uint32_t rejected = 0;         // queue full, busy
+  uint32_t produced = 0;         // conversions of the chip
+  uint32_t weighed = 0;          // samples Task1 processed
+  int32_t lastTareOffset = 0;
+  uint32_t tares = 0;
+};
+
+/**
+ * @brief Runs the mix for seconds. blockingTare: the old tare in the network handler.
+ */
+void runLive(uint32_t sps, uint32_t seconds, uint32_t intervalMs, bool blockingTare, LiveRun &run)
+{
+  SimulatedHx711 chip(sps, chipOffset, countsPerGram, noiseCounts);
+  HostNotify dataReady;
+  std::mutex hardware;   // the hardware semaphore
+  CommandQueue commands;
+  AckQueue acks;
+  std::atomic<bool> running{true};
+  std::atomic<uint32_t> weighed{0};
+  const uint32_t periodUs = 1000000u / sps;
+
+  // Task1: weighs every conversion, runs the queued commands between two samples.
+  std::thread acquisition([&]() {
+    TareAverager tareAverager;
+    Command tareCommand = {};
+    bool zeroTracking = false;
+    while (running)
+    {
+      const bool woken = dataReady.take(2 * periodUs) != 0;
+      if (woken)
+      {
+        std::unique_lock<std::mutex> lock(hardware);
+        if (chip.isReady())
+        {
+          CellFrame frame = {};
+          frame.raw[0] = chip.read();
+          frame.timestampUs = hostMicros();
+          lock.unlock();
+          weighed++;
+          int32_t offsets[LOAD_CELL_MAX_CHANNELS];
+          if (tareAverager.onFrame(frame, offsets))
+          {
+            acks.push(makeAck(tareCommand, CommandStatus::Ok, offsets[0], hostMicros()));
+          }
+        }
+      }
+      Command command;
+      while (commands.pop(command))
+      {
+        CommandStatus status = CommandStatus::Ok;
+        switch (command.type)
+        {
+          case CommandType::Tare:
+            if (tareAverager.active())
+            {
+              status = CommandStatus::Busy;
+              break;
+            }
+            tareCommand = command;
+            tareAverager.start(1, tareFrames);
+            continue;   // acknowledged when the average is complete
+          case CommandType::ZeroTrack:
+            zeroTracking = command.value != 0;
+            break;
+          case CommandType::SetRate:
+            status = CommandStatus::Unsupported;   // no RATE pin
+            break;
+          default:
+            break;
+        }
+        acks.push(makeAck(command, status, command.value, hostMicros()));
+      }
+      (void)zeroTracking;
+    }
+  });
+  chip.start([&](uint32_t) { dataReady.give(); });
+
+  // Task5: a command every intervalMs, the acknowledgements polled every millisecond.
+  const uint32_t startUs = hostMicros();
+  uint32_t nextSendUs = startUs + intervalMs * 1000u;
+  uint32_t id = 1;
+  uint32_t pending = 0;
+  char text[32];
+  while (hostMicros() - startUs < seconds * 1000000u || (pending > 0 && hostMicros() - startUs < (seconds + 2) * 1000000u))
+  {
+    const uint32_t nowUs = hostMicros();
+    if (nowUs - startUs < seconds * 1000000u && static_cast<int32_t>(nowUs - nextSendUs) >= 0)
+    {
+      nextSendUs += intervalMs * 1000u;
+      const int length = std::snprintf(text, sizeof(text), "%u %s", id, commandMix[id % 10]);
+      id++;
+      const uint32_t t0 = hostMicros();
+      Command command;
+      if (parseCommand(text, static_cast<size_t>(length), 0, command))
+      {
+        command.queuedUs = t0;
+        run.sent++;
+        if (blockingTare && command.type == CommandType::Tare)
+        {
+          // HX711::tare(): average 10 conversions, waiting for each one, with the hardware locked.
+          std::lock_guard<std::mutex> lock(hardware);
+          int64_t sum = 0;
+          for (uint8_t i = 0; i < tareFrames; i++)
+          {
+            while (!chip.isReady())
+            {
+              std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            sum += chip.read();
+          }
+          run.lastTareOffset = static_cast<int32_t>(sum / tareFrames);
+          run.tares++;
+          run.acked++;
+          run.tareAckUs.add(hostMicros() - t0);
+        }
+        else if (commands.push(command))
+        {
+          pending++;
+        }
+        else
+        {
+          run.rejected++;
+          run.acked++;
+        }
+      }
+      run.handlerUs.add(hostMicros() - t0);
+    }
+    CommandAck ack;
+    while (acks.pop(ack))
+    {
+      pending--;
+      run.acked++;
+      const uint32_t latencyUs = hostMicros() - ack.queuedUs;
+      if (ack.type == CommandType::Tare)
+      {
+        if (ack.status == CommandStatus::Ok)
+        {
+          run.lastTareOffset = ack.value;
+          run.tares++;
+          run.tareAckUs.add(latencyUs);
+        }
+        else
+        {
+          run.rejected++;
+        }
+      }
+      else
+      {
+        run.otherAckUs.add(latencyUs);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  chip.stop();
+  running = false;
+  acquisition.join();
+  run.produced = chip.producedCount();
+  run.weighed = weighed.load();
+}
+
+void printLive(const char *title, LiveRun &run)
+{
+  std::printf("%s\n", title);
+  run.handlerUs.print("network handler");
+  run.tareAckUs.print("tare request -> ack");
+  if (run.otherAckUs.count() > 0)
+  {
+    run.otherAckUs.print("other request -> ack");
+  }
+  std::printf("  commands %u, acknowledged %u, rejected %u, tares %u (offset %d, true %d)\n", run.sent, run.acked,
+              run.rejected, run.tares, (int)run.lastTareOffset, (int)chipOffset);
+  std::printf("  conversions %u, weighed by Task1 %u (%u missed)\n", run.produced, run.weighed,
+              run.produced - run.weighed);
+}
+
+}  // namespace
+
+int runCommandsScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 4));
+  const uint32_t intervalMs = static_cast<uint32_t>(options.get("interval", 20));
+  const uint32_t periodUs = 1000000u / sps;
+
+  std::printf("commands: %u SPS, a command every %u ms for %u s, tare over %u conversions\n\n", sps, intervalMs,
+              seconds, tareFrames);
+
+  // the decoder.
+  uint32_t parseErrors = 0;
+  for (const ParseCase &c : parseCases)
+  {
+    Command command;
+    const bool valid = parseCommand(c.text, std::strlen(c.text), 3, command);
+    const bool ok = valid == c.valid &&
+                    (!valid || (command.type == c.type && command.argument == c.argument &&
+                                command.value == c.value && command.client == 3));
+    if (!ok)
+    {
+      std::printf("  decoder: \"%s\" %s\n", c.text, valid ? "accepted" : "rejected");
+      parseErrors++;
+    }
+  }
+  const size_t caseCount = sizeof(parseCases) / sizeof(parseCases[0]);
+  const uint32_t rounds = 20000;
+  uint32_t accepted = 0;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rounds; r++)
+  {
+    for (const ParseCase &c : parseCases)
+    {
+      Command command;
+      accepted += parseCommand(c.text, std::strlen(c.text), 0, command) ? 1 : 0;
+    }
+  }
+  const double decodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() /
+                          (static_cast<double>(rounds) * caseCount);
+  CommandAck longest = {};
+  longest.id = 0xFFFFFFFFu;
+  longest.queuedUs = 0;
+  longest.doneUs = 0xFFFFFFFFu;
+  longest.value = -2147483647 - 1;
+  longest.type = CommandType::SetFilter;
+  longest.status = CommandStatus::Unsupported;
+  char json[112];
+  const size_t jsonLength = encodeAckJson(longest, json, sizeof(json));
+  std::printf("decoder: %zu messages, %u wrong, %.0f ns per message on this host (%u accepted)\n", caseCount,
+              parseErrors, decodeNs, accepted / rounds);
+  std::printf("  longest acknowledgement %zu bytes: %s\n\n", jsonLength, json);
+
+  LiveRun queued;
+  runLive(sps, seconds, intervalMs, false, queued);
+  printLive("queued (Task1 runs the commands between two samples):", queued);
+  LiveRun blocking;
+  runLive(sps, seconds, intervalMs, true, blocking);
+  printLive("blocking tare (old firmware: HX711::tare() in the network handler):", blocking);
+
+  const uint32_t handlerMaxUs = queued.handlerUs.percentile(100);
+  const uint32_t otherMaxUs = queued.otherAckUs.percentile(100);
+  const uint32_t tareMaxUs = queued.tareAckUs.percentile(100);
+  const uint32_t otherBoundUs = 2 * periodUs + 5000;
+  const uint32_t tareBoundUs = (tareFrames + 2) * periodUs + 5000;
+  const int32_t tareError = queued.lastTareOffset - chipOffset;
+  const uint32_t missed = queued.produced - queued.weighed;
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  ok &= check(parseErrors == 0, "the decoder accepts every valid message and rejects every malformed one");
+  ok &= check(jsonLength > 0, "the longest acknowledgement fits the 112 byte buffer");
+  ok &= check(handlerMaxUs < 1000, "the network handler never takes 1 ms (decode + queue)");
+  ok &= check(queued.sent > 0 && queued.acked == queued.sent, "every queued command is acknowledged");
+  ok &= check(otherMaxUs <= otherBoundUs, "other commands are acknowledged within 2 sample periods (+5 ms)");
+  ok &= check(queued.tares > 0 && tareMaxUs <= tareBoundUs,
+              "a tare is acknowledged within its conversions + 2 periods (+5 ms)");
+  ok &= check(std::abs(tareError) <= noiseCounts / 2, "the queued tare finds the offset of the empty platform");
+  ok &= check(missed <= 1, "Task1 weighs every conversion while commands run");
+  ok &= check(blocking.handlerUs.percentile(100) >= tareFrames * periodUs / 2,
+               "the blocking tare holds the network task for its conversions (comparison)");
+  return ok ? 0 : 1;
+}
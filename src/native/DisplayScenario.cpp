@@ -0,0 +1,248 @@
+/**
+ * DisplayScenario.cpp
+ *  Compares the old display update (Task2 woken by every change and at least every second, writing "----"
+ *  and then the value: two full writes of the TM1637) with DisplayStage (woken when the digits to show change,
+ *  DisplayChangeDetector as in the firmware, writes the digits that changed), on the same simulated weighing
+ *  session:
+ *    - bus transactions, bytes and bit-bang time, in total and per update,
+ *    - how often "----" flashed while a weight was shown (flicker),
+ *    - the formatting (g, kg, hysteresis, glyphs), that the display holds the formatted state after every
+ *      sample (never a stale value) and that a step below the publish deadband reaches the digits.
+ *  The simulation uses sample times only and runs much faster than real time.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "DisplayStage.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+
+namespace
+{
+
+struct Step
+{
+  uint32_t atS;
+  int32_t grams;
+  uint8_t flags;   // SCALE_FLAG_NOT_READY / SCALE_FLAG_OVERLOAD for the whole step
+};
+
+// a morning of weighing: boot, a few loads in g and kg (one inside the kg hysteresis), an overload.
+const Step session[] = {
+    {0, 0, SCALE_FLAG_NOT_READY}, {3, 0, 0},      {20, 1234, 0}, {60, 250, 0},   {90, 12500, 0},
+    {130, 9600, 0},               {150, 8000, 0}, {170, 0, 0},   {200, 0, SCALE_FLAG_OVERLOAD}, {210, 0, 0},
+    {240, 57, 0},                 {300, 0, 0},
+};
+
+struct Case
+{
+  int32_t grams;
+  uint8_t flags;
+  const char *expected;   // 'O' and 'L' for the overload glyph, '.' lights the point of the digit before
+};
+
+// in order: the unit carries over from one case to the next (hysteresis).
+const Case cases[] = {
+    {0, SCALE_FLAG_STABLE, "   0"},       {50, SCALE_FLAG_STABLE, "  50"},      {50, 0, "  50."},
+    {-12, SCALE_FLAG_OVERLOAD, "-OL-"},   {9999, SCALE_FLAG_STABLE, "9999"},    {10000, SCALE_FLAG_STABLE, "10.00"},
+    {12345, SCALE_FLAG_STABLE, "12.35"},  {9500, SCALE_FLAG_STABLE, "9.500"},   {9500, 0, "9.500."},
+    {8999, SCALE_FLAG_STABLE, "8999"},    {99994, SCALE_FLAG_STABLE, "99.99"},  {99995, SCALE_FLAG_STABLE, "100.0"},
+    {123456, SCALE_FLAG_STABLE, "123.5"}, {999949, SCALE_FLAG_STABLE, "999.9"}, {999950, SCALE_FLAG_STABLE, "-OL-"},
+    {0, SCALE_FLAG_NOT_READY, "----"},    {80, SCALE_FLAG_OVERLOAD, "-OL-"},    {-1, SCALE_FLAG_STABLE, "-OL-"},
+};
+
+void encode(const char *text, uint8_t segments[DISPLAY_DIGITS])
+{
+  uint8_t n = 0;
+  std::memset(segments, 0, DISPLAY_DIGITS);
+  for (const char *p = text; *p != '\0' && n <= DISPLAY_DIGITS; p++)
+  {
+    if (*p == '.')
+    {
+      segments[n - 1] |= SEGMENT_DP;
+      continue;
+    }
+    if (n == DISPLAY_DIGITS)
+    {
+      break;
+    }
+    segments[n++] = *p >= '0' && *p <= '9' ? DisplayStage::digitSegments(static_cast<uint8_t>(*p - '0'))
+                    : *p == '-'            ? SEGMENT_MINUS
+                    : *p == 'O'            ? 0x3f
+                    : *p == 'L'            ? 0x38
+                                           : SEGMENT_BLANK;
+  }
+}
+
+struct Run
+{
+  SimDisplay display;
+  uint32_t updates = 0;       // wake-ups that wrote something
+  uint32_t flashes = 0;       // "----" written while the scale had a weight to show
+  uint32_t mismatches = 0;    // display content != formatted state after a sample (a stale display)
+  uint32_t singleDigit = 0;   // updates that wrote one digit
+};
+
+}  // namespace
+
+int runDisplayScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 10));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 900));
+  const double noiseMg = static_cast<double>(options.get("noise", 300));
+  bool ok = true;
+
+  Run oldRun;
+  Run newRun;
+  DisplayStage stage(newRun.display);
+  ChangeDetector detector(1000, 10000000u);   // the old Task2 was woken by the publish deadband
+  DisplayChangeDetector displayChange;
+  std::minstd_rand rng(14);
+  std::normal_distribution<double> noise(0.0, noiseMg);
+
+  const uint32_t periodUs = 1000000u / sps;
+  size_t step = 0;
+  double previousMg = 0.0;
+  uint32_t stepUs = 0;
+  uint32_t lastOldWakeUs = 0;
+  uint32_t resyncUs = 0;
+  bool kilograms = false;
+  for (uint32_t nowUs = 0; nowUs < seconds * 1000000u; nowUs += periodUs)
+  {
+    const size_t count = sizeof(session) / sizeof(session[0]);
+    while (step + 1 < count && session[step + 1].atS * 1000000u <= nowUs)
+    {
+      previousMg = session[step].grams * 1000.0;
+      stepUs = session[++step].atS * 1000000u;
+    }
+    // the filtered weight settles exponentially (tau 300 ms) and is stable 1 s after the load changed.
+    const double targetMg = session[step].grams * 1000.0;
+    const double sinceS = (nowUs - stepUs) / 1e6;
+    ScaleState state = {};
+    state.flags = session[step].flags;
+    if (state.flags == 0)
+    {
+      state.weightMg = static_cast<int32_t>(targetMg + (previousMg - targetMg) * std::exp(-sinceS / 0.3) + noise(rng));
+      state.weight = (state.weightMg + (state.weightMg >= 0 ? 500 : -500)) / 1000;
+      state.flags = sinceS >= 1.0 ? SCALE_FLAG_STABLE : 0;
+    }
+    const bool changed = detector.check(state, nowUs) != ChangeReason::None;
+
+    // old Task2: woken by a change or after 1 s, "----" and then the value.
+    if (changed || nowUs - lastOldWakeUs >= 1000000u)
+    {
+      lastOldWakeUs = nowUs;
+      oldRun.display.showText("----");
+      oldRun.flashes += state.isReady() ? 1 : 0;
+      oldRun.display.showNumber(state.weight);
+      oldRun.updates++;
+    }
+    // new Task2: woken when the digits change, all the digits again every 60 s.
+    if (displayChange.check(state))
+    {
+      if (nowUs - resyncUs >= 60000000u)
+      {
+        stage.invalidate();
+        resyncUs = nowUs;
+      }
+      const uint8_t digits = stage.show(state);
+      newRun.updates += digits != 0 ? 1 : 0;
+      newRun.singleDigit += digits == 1 ? 1 : 0;
+      newRun.flashes += state.isReady() && std::memcmp(newRun.display.segments(), "\x40\x40\x40\x40", 4) == 0 ? 1 : 0;
+    }
+    uint8_t expected[DISPLAY_DIGITS];
+    DisplayStage::format(state, kilograms, expected);
+    newRun.mismatches += std::memcmp(expected, newRun.display.segments(), DISPLAY_DIGITS) != 0 ? 1 : 0;
+  }
+
+  // a drift below the publish deadband (100.4 g -> 101.3 g): the web clients are not woken, the digits are.
+  SimDisplay driftDisplay;
+  DisplayStage driftStage(driftDisplay);
+  DisplayChangeDetector driftChange;
+  ChangeDetector driftDetector(1000, 10000000u);
+  ScaleState before = {};
+  before.weightMg = 100400;
+  before.weight = 100;
+  before.flags = SCALE_FLAG_STABLE;
+  ScaleState after = before;
+  after.weightMg = 101300;
+  after.weight = 101;
+  driftDetector.check(before, 0);
+  driftChange.check(before);
+  driftStage.show(before);
+  const bool driftPublished = driftDetector.check(after, 100000u) != ChangeReason::None;
+  const bool driftShown = driftChange.check(after) && driftStage.show(after) != 0;
+  uint8_t driftExpected[DISPLAY_DIGITS];
+  encode(" 101", driftExpected);
+  const bool driftOk = !driftPublished && driftShown &&
+                       std::memcmp(driftDisplay.segments(), driftExpected, DISPLAY_DIGITS) == 0;
+
+  std::printf("display: %u s weighing session at %u SPS, noise %.0f mg\n", seconds, sps, noiseMg);
+  std::printf("  %-28s %8s %8s %13s %8s %11s %8s\n", "", "writes", "trans.", "bytes on bus", "bus ms", "us/update",
+              "flicker");
+  const Run *runs[] = {&oldRun, &newRun};
+  const char *names[] = {"reset + value every wake", "changed digits only"};
+  for (int i = 0; i < 2; i++)
+  {
+    const Run &run = *runs[i];
+    std::printf("  %-28s %8u %8u %13u %8.1f %11.1f %8u\n", names[i], run.display.writes(), run.display.transactions(),
+                run.display.bytes(), run.display.busTimeUs() / 1000.0,
+                run.updates != 0 ? run.display.busTimeUs() / run.updates : 0.0, run.flashes);
+  }
+  std::printf("  %u of %u updates wrote a single digit\n", newRun.singleDigit, newRun.updates);
+
+  // formatting cases and the cost of one update.
+  bool formatOk = true;
+  bool unit = false;
+  for (const Case &c : cases)
+  {
+    ScaleState state = {};
+    state.weight = c.grams;
+    state.weightMg = c.grams * 1000;
+    state.flags = c.flags;
+    uint8_t got[DISPLAY_DIGITS];
+    uint8_t expected[DISPLAY_DIGITS];
+    DisplayStage::format(state, unit, got);
+    encode(c.expected, expected);
+    if (std::memcmp(got, expected, DISPLAY_DIGITS) != 0)
+    {
+      std::printf("  format %d g flags %u: expected \"%s\", got %02x %02x %02x %02x\n", static_cast<int>(c.grams), c.flags,
+                  c.expected, got[0], got[1], got[2], got[3]);
+      formatOk = false;
+    }
+  }
+  SimDisplay sink;
+  DisplayStage timed(sink);
+  const uint32_t count = 1000000;
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    ScaleState state = {};
+    state.weight = static_cast<int32_t>((i >> 3) % 20000);
+    state.flags = SCALE_FLAG_STABLE;
+    timed.show(state);
+  }
+  const double showNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+  std::printf("  format + diff: %.1f ns per show() (without the bus)\n", showNs);
+
+  printChecks();
+  ok &= check(formatOk, "formatting (g, kg, hysteresis, glyphs, unstable)");
+  ok &= check(newRun.mismatches == 0, "display holds the formatted state after every sample");
+  ok &= check(driftOk, "a 0.9 g step below the deadband updates the digits");
+  ok &= check(newRun.flashes == 0, "no \"----\" while a weight is shown");
+  // the display follows every gram (a noisy last gram is written more often than the old 1 g deadband woke
+  // it): the saving is per update, and in total still fewer transactions and bytes.
+  const double oldPerUpdateUs = oldRun.updates != 0 ? oldRun.display.busTimeUs() / oldRun.updates : 0.0;
+  const double newPerUpdateUs = newRun.updates != 0 ? newRun.display.busTimeUs() / newRun.updates : 0.0;
+  ok &= check(newPerUpdateUs * 3 < oldPerUpdateUs, "at least 3x less bus time per update");
+  ok &= check(newRun.display.transactions() < oldRun.display.transactions() &&
+                  newRun.display.bytes() < oldRun.display.bytes(),
+              "fewer bus transactions and bytes in total");
+  return ok ? 0 : 1;
+}
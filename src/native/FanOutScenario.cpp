@@ -0,0 +1,439 @@
+/**
+ * FanOutScenario.cpp
+ *  The weight for 1, 8 and 32 web clients with their own subscriptions (Subscriptions.h): the page (every
+ *  gram, heartbeat), dashboards at 10 Hz (JSON and binary), loggers at 1 Hz with every field and alarm
+ *  clients that only hear of a threshold crossing. Three ways to send it, on the same 80 SPS trace (a load
+ *  put on and taken off, noise):
+ *    - old      : the same {"weight":..} to every client on every change (ChangeDetector + broadcastTXT),
+ *    - naive    : per client subscriptions, the message encoded for every client it goes to,
+ *    - fan-out  : per client subscriptions, every distinct message encoded once per tick and shared.
+ *  Reported: messages, bytes and encodes per second, the host time per sample and an estimate of Task3
+ *  on the ESP32-S3 (same send cost as the "stream" scenario, ~8 us to encode a message). Then one client
+ *  stops reading (its socket buffer fills): the old broadcast waits for it, the fan-out drops its oldest
+ *  messages and the other clients do not notice.
+ *  Returns 1 if a check fails.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "Scenarios.h"
+#include "Subscriptions.h"
+#include "Telemetry.h"
+
+namespace
+{
+
+const uint32_t sps = 80;
+const uint32_t periodUs = 1000000u / sps;
+const double sendMessageUs = 300.0;   // per message and client (lwIP + WebSocket header)
+const double sendByteUs = 0.8;        // ~10 Mbit/s of WiFi
+const double encodeUs = 8.0;          // a JSON message on the ESP32-S3
+const int32_t alarmMg = 500000;       // the alarm clients watch 500 g
+const size_t depth = 4;               // FANOUT_QUEUE_DEPTH
+const size_t slowBufferBytes = 512;   // socket buffer of the client that stops reading
+const uint32_t sendTimeoutUs = 5000000;   // how long a blocking write waits (WebSockets library)
+
+enum class Role : uint8_t
+{
+  Page,
+  Dashboard,
+  Logger,
+  Alarm,
+  BinaryDashboard,
+};
+const char *const roleNames[] = {"page", "dashboard", "logger", "alarm", "binary dashboard"};
+
+Role roleOf(size_t client) { return static_cast<Role>(client % 5); }
+
+Subscription subscriptionOf(Role role)
+{
+  Subscription subscription = defaultSubscription(1000, 10000000u, SUBSCRIPTION_JSON);   // the page
+  switch (role)
+  {
+    case Role::Page:
+      break;
+    case Role::Dashboard:
+    case Role::BinaryDashboard:
+      subscription.intervalUs = 100000;
+      subscription.heartbeatUs = 1000000;
+      subscription.deadbandMg = 100;
+      subscription.fields = TELEMETRY_FIELD_WEIGHT | TELEMETRY_FIELD_MG | TELEMETRY_FIELD_FLAGS;
+      subscription.format = role == Role::BinaryDashboard ? SUBSCRIPTION_BINARY : SUBSCRIPTION_JSON;
+      break;
+    case Role::Logger:
+      subscription.intervalUs = 1000000;
+      subscription.heartbeatUs = 1000000;
+      subscription.deadbandMg = 0;
+      subscription.fields = TELEMETRY_FIELD_ALL;
+      break;
+    case Role::Alarm:
+      subscription.alarmMg = alarmMg;
+      subscription.heartbeatUs = 0;
+      subscription.fields = TELEMETRY_FIELD_WEIGHT | TELEMETRY_FIELD_FLAGS;
+      break;
+  }
+  return subscription;
+}
+
+// 0 g, ramp to 1 kg in 0.5 s, 1.5 s on the platform, ramp down, 0.5 s empty; +-200 mg of noise.
+std::vector<ScaleState> makeTrace(uint32_t seconds)
+{
+  std::vector<ScaleState> trace;
+  std::minstd_rand rng(7);
+  std::uniform_int_distribution<int32_t> noise(-200, 200);
+  for (uint32_t k = 0; k < sps * seconds; k++)
+  {
+    const uint32_t t = (k * periodUs) % 4000000u;
+    int32_t mg = 0;
+    bool stable = true;
+    if (t >= 1000000 && t < 1500000)
+    {
+      mg = static_cast<int32_t>((t - 1000000) * 2);
+      stable = false;
+    }
+    else if (t >= 1500000 && t < 3000000)
+    {
+      mg = 1000000;
+    }
+    else if (t >= 3000000 && t < 3500000)
+    {
+      mg = static_cast<int32_t>(1000000 - (t - 3000000) * 2);
+      stable = false;
+    }
+    ScaleState state = {};
+    state.weightMg = mg + noise(rng);
+    state.weight = (state.weightMg + 500) / 1000;
+    state.raw = 84000 + state.weightMg * 42 / 100;
+    state.seq = k;
+    state.timestampUs = k * periodUs;
+    state.flags = stable ? SCALE_FLAG_STABLE : 0;
+    trace.push_back(state);
+  }
+  return trace;
+}
+
+// the web clients: counts what each one got; one of them can stop reading.
+class BenchTransport : public Transport
+{
+public:
+  explicit BenchTransport(size_t clients) : clients_(clients) {}
+
+  void setNow(uint32_t nowUs) { nowUs_ = nowUs; }
+  void setSlowClient(int client) { slow_ = client; }
+
+  size_t clientCount() override { return clients_.size(); }
+  bool broadcastText(const char *, size_t length) override { return broadcast(length); }
+  bool broadcastBinary(const uint8_t *, size_t length) override { return broadcast(length); }
+  bool sendText(uint8_t client, const char *, size_t length) override { return send(client, length, false); }
+  bool sendBinary(uint8_t client, const uint8_t *, size_t length) override { return send(client, length, false); }
+
+  struct Client
+  {
+    uint32_t messages = 0;
+    uint64_t bytes = 0;
+    uint32_t lastUs = 0;
+    uint32_t minGapUs = UINT32_MAX;
+  };
+  const Client &client(size_t index) const { return clients_[index]; }
+  uint32_t messages() const { return messages_; }
+  uint64_t bytes() const { return bytes_; }
+  double blockedUs() const { return blockedUs_; }
+
+private:
+  bool broadcast(size_t length)
+  {
+    bool ok = true;
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+      ok &= send(static_cast<uint8_t>(i), length, true);   // broadcastTXT writes to every client in turn
+    }
+    return ok;
+  }
+
+  bool send(uint8_t index, size_t length, bool blocking)
+  {
+    const size_t frame = length + (length < 126 ? 2 : 4);
+    if (index == slow_)
+    {
+      // the client stopped reading: its socket buffer fills and stays full.
+      if (slowGone_ || slowUsed_ + frame > slowBufferBytes)
+      {
+        if (blocking && !slowGone_)
+        {
+          blockedUs_ += sendTimeoutUs;   // the write waits for its timeout, then the client is closed
+          slowGone_ = true;
+        }
+        return false;
+      }
+      slowUsed_ += frame;
+    }
+    Client &client = clients_[index];
+    if (client.messages > 0 && nowUs_ - client.lastUs < client.minGapUs)
+    {
+      client.minGapUs = nowUs_ - client.lastUs;
+    }
+    client.lastUs = nowUs_;
+    client.messages++;
+    client.bytes += frame;
+    messages_++;
+    bytes_ += frame;
+    return true;
+  }
+
+  std::vector<Client> clients_;
+  uint32_t nowUs_ = 0;
+  int slow_ = -1;
+  size_t slowUsed_ = 0;
+  bool slowGone_ = false;
+  uint32_t messages_ = 0;
+  uint64_t bytes_ = 0;
+  double blockedUs_ = 0;
+};
+
+struct Run
+{
+  uint32_t messages = 0;
+  uint64_t bytes = 0;
+  uint32_t encodes = 0;
+  double hostNsPerSample = 0;
+  double task3MsPerS = 0;          // estimate for the ESP32-S3
+  double blockedMs = 0;            // Task3 waiting for a client that does not read
+  uint32_t maxEncodesPerTick = 0;
+  uint32_t drops = 0;
+  size_t maxQueued = 0;            // of the slow client
+  std::vector<BenchTransport::Client> clients;
+};
+
+void finish(Run &run, const BenchTransport &transport, size_t clients, double hostNs, size_t samples, uint32_t seconds)
+{
+  run.messages = transport.messages();
+  run.bytes = transport.bytes();
+  run.hostNsPerSample = hostNs / samples;
+  run.task3MsPerS = (run.messages * sendMessageUs + run.bytes * sendByteUs + run.encodes * encodeUs) / seconds / 1000.0;
+  run.blockedMs = transport.blockedUs() / 1000.0;
+  for (size_t i = 0; i < clients; i++)
+  {
+    run.clients.push_back(transport.client(i));
+  }
+}
+
+Run runOld(const std::vector<ScaleState> &trace, size_t clients, uint32_t seconds, int slow)
+{
+  BenchTransport transport(clients);
+  transport.setSlowClient(slow);
+  ChangeDetector detector(1000, 10000000u);
+  char json[32];
+  Run run;
+  const auto start = std::chrono::steady_clock::now();
+  for (const ScaleState &state : trace)
+  {
+    transport.setNow(state.timestampUs);
+    if (detector.check(state, state.timestampUs) != ChangeReason::None)
+    {
+      transport.broadcastText(json, encodeWeightJson(state, json, sizeof(json)));
+      run.encodes++;
+    }
+  }
+  const double hostNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  finish(run, transport, clients, hostNs, trace.size(), seconds);
+  return run;
+}
+
+Run runNaive(const std::vector<ScaleState> &trace, size_t clients, uint32_t seconds)
+{
+  BenchTransport transport(clients);
+  std::vector<Subscription> subscriptions;
+  std::vector<SubscriberState> states(clients);
+  for (size_t i = 0; i < clients; i++)
+  {
+    subscriptions.push_back(subscriptionOf(roleOf(i)));
+  }
+  uint8_t buffer[TELEMETRY_JSON_MAX];
+  Run run;
+  const auto start = std::chrono::steady_clock::now();
+  for (const ScaleState &state : trace)
+  {
+    transport.setNow(state.timestampUs);
+    for (size_t i = 0; i < clients; i++)
+    {
+      uint32_t waitUs = UINT32_MAX;
+      if (states[i].due(subscriptions[i], state, state.timestampUs, waitUs))
+      {
+        states[i].sent(subscriptions[i], state, state.timestampUs);
+        run.encodes++;
+        const uint8_t client = static_cast<uint8_t>(i);
+        if (subscriptions[i].format == SUBSCRIPTION_BINARY)
+        {
+          transport.sendBinary(client, buffer, encodeWeightFrame(state, buffer, sizeof(buffer)));
+        }
+        else
+        {
+          char *json = reinterpret_cast<char *>(buffer);
+          transport.sendText(client, json, encodeWeightJsonFields(state, subscriptions[i].fields, json, sizeof(buffer)));
+        }
+      }
+    }
+  }
+  const double hostNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  finish(run, transport, clients, hostNs, trace.size(), seconds);
+  return run;
+}
+
+template <size_t Clients>
+Run runFanOut(const std::vector<ScaleState> &trace, size_t clients, uint32_t seconds, int slow)
+{
+  BenchTransport transport(clients);
+  transport.setSlowClient(slow);
+  std::unique_ptr<FanOut<Clients, depth>> pointer(new FanOut<Clients, depth>());   // ~15 KB for 32 clients
+  FanOut<Clients, depth> &fanOut = *pointer;
+  for (size_t i = 0; i < clients; i++)
+  {
+    fanOut.subscribe(static_cast<uint8_t>(i), subscriptionOf(roleOf(i)));
+  }
+  fanOut.setActive(clients == 32 ? 0xFFFFFFFFu : (1u << clients) - 1u);
+  Run run;
+  const auto start = std::chrono::steady_clock::now();
+  for (const ScaleState &state : trace)
+  {
+    transport.setNow(state.timestampUs);
+    const uint32_t encodes = fanOut.stats().encodes;
+    fanOut.publish(state, state.timestampUs, transport);
+    const uint32_t tickEncodes = fanOut.stats().encodes - encodes;
+    run.maxEncodesPerTick = tickEncodes > run.maxEncodesPerTick ? tickEncodes : run.maxEncodesPerTick;
+    if (slow >= 0 && fanOut.queued(static_cast<uint8_t>(slow)) > run.maxQueued)
+    {
+      run.maxQueued = fanOut.queued(static_cast<uint8_t>(slow));
+    }
+  }
+  const double hostNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  run.encodes = fanOut.stats().encodes;
+  run.drops = fanOut.stats().drops;
+  finish(run, transport, clients, hostNs, trace.size(), seconds);
+  return run;
+}
+
+Run runFanOut(const std::vector<ScaleState> &trace, size_t clients, uint32_t seconds, int slow = -1)
+{
+  return clients <= 8 ? runFanOut<8>(trace, clients, seconds, slow) : runFanOut<32>(trace, clients, seconds, slow);
+}
+
+void printRun(const char *name, const Run &run, uint32_t seconds)
+{
+  std::printf("  %-8s %8.1f %9.0f %8.1f %9.0f %10.2f\n", name, static_cast<double>(run.messages) / seconds,
+              static_cast<double>(run.bytes) / seconds, static_cast<double>(run.encodes) / seconds,
+              run.hostNsPerSample, run.task3MsPerS);
+}
+
+}  // namespace
+
+int runFanOutScenario(const Options &options)
+{
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 60));
+  const std::vector<ScaleState> trace = makeTrace(seconds);
+  uint32_t crossings = 0;
+  for (size_t k = 1; k < trace.size(); k++)
+  {
+    crossings += (trace[k].weightMg >= alarmMg) != (trace[k - 1].weightMg >= alarmMg) ? 1 : 0;
+  }
+  std::printf("fanout: %u s at %u SPS, clients by turn: page, dashboard 10 Hz, logger 1 Hz, alarm at %d g, "
+              "binary dashboard 10 Hz\n",
+              seconds, sps, (int)(alarmMg / 1000));
+
+  bool ok = true;
+  bool compatible = true;
+  bool rates = true;
+  bool alarms = true;
+  bool shared = true;
+  Run fanOut8;
+  for (size_t clients : {static_cast<size_t>(1), static_cast<size_t>(8), static_cast<size_t>(32)})
+  {
+    const Run old = runOld(trace, clients, seconds, -1);
+    const Run naive = runNaive(trace, clients, seconds);
+    const Run fanOut = runFanOut(trace, clients, seconds);
+    std::printf("\n%zu client%s        msg/s     byte/s  encode/s  ns/sample  Task3 ms/s (ESP32-S3, est.)\n", clients,
+                clients == 1 ? " " : "s");
+    printRun("old", old, seconds);
+    printRun("naive", naive, seconds);
+    printRun("fan-out", fanOut, seconds);
+    std::printf("  fan-out: at most %u encodes per tick\n", fanOut.maxEncodesPerTick);
+    if (clients == 1)
+    {
+      compatible = fanOut.messages == old.messages && fanOut.bytes == old.bytes;
+    }
+    shared &= fanOut.maxEncodesPerTick <= 5 && fanOut.encodes <= naive.encodes &&
+              fanOut.messages == naive.messages && (clients < 32 || fanOut.encodes * 2 <= naive.encodes);
+    for (size_t i = 0; i < clients; i++)
+    {
+      const BenchTransport::Client &client = fanOut.clients[i];
+      const Subscription subscription = subscriptionOf(roleOf(i));
+      if (client.messages > 1 && client.minGapUs < subscription.intervalUs)
+      {
+        std::printf("  client %zu (%s): %u us between two messages\n", i, roleNames[(size_t)roleOf(i)], client.minGapUs);
+        rates = false;
+      }
+      if (roleOf(i) == Role::Alarm && client.messages != crossings)
+      {
+        std::printf("  client %zu (alarm): %u messages, %u crossings\n", i, client.messages, crossings);
+        alarms = false;
+      }
+    }
+    if (clients == 8)
+    {
+      fanOut8 = fanOut;
+    }
+  }
+
+  // client 1 (a dashboard) stops reading.
+  const int slow = 1;
+  const Run oldSlow = runOld(trace, 8, seconds, slow);
+  const Run fanOutSlow = runFanOut(trace, 8, seconds, slow);
+  bool othersUnaffected = true;
+  for (size_t i = 0; i < 8; i++)
+  {
+    othersUnaffected &= static_cast<int>(i) == slow || fanOutSlow.clients[i].messages == fanOut8.clients[i].messages;
+  }
+  std::printf("\n8 clients, client %d stops reading (%zu byte socket buffer):\n", slow, slowBufferBytes);
+  std::printf("  old      Task3 waited %.0f ms for it (the write timeout), then the client was closed\n",
+              oldSlow.blockedMs);
+  std::printf("  fan-out  Task3 waited %.0f ms, %u messages dropped (oldest first), at most %zu queued, "
+              "the other clients got %s\n",
+              fanOutSlow.blockedMs, fanOutSlow.drops, fanOutSlow.maxQueued,
+              othersUnaffected ? "every message" : "fewer messages");
+
+  // the encoder of the fields.
+  ScaleState extreme = {};
+  extreme.weight = INT32_MIN;
+  extreme.weightMg = INT32_MIN;
+  extreme.raw = INT32_MIN;
+  extreme.seq = UINT32_MAX;
+  extreme.timestampUs = UINT32_MAX;
+  extreme.flags = 0xFF;
+  char fields[TELEMETRY_JSON_MAX];
+  char plain[32];
+  const size_t longest = encodeWeightJsonFields(extreme, TELEMETRY_FIELD_ALL, fields, sizeof(fields));
+  const bool sameAsPlain = encodeWeightJsonFields(trace[100], TELEMETRY_FIELD_WEIGHT, fields, sizeof(fields)) ==
+                               encodeWeightJson(trace[100], plain, sizeof(plain)) &&
+                           std::string(fields) == std::string(plain);
+  std::printf("\nlongest JSON weight message: %zu bytes\n", longest);
+
+  std::printf("\n");
+  printChecks();
+  ok &= check(compatible, "a client that did not subscribe gets what the old broadcast sent");
+  ok &= check(shared, "every distinct message is encoded once per tick (32 clients: half the encodes or less)");
+  ok &= check(rates, "no client gets messages faster than its rate");
+  ok &= check(alarms, "alarm clients get exactly the threshold crossings");
+  ok &= check(fanOutSlow.blockedMs == 0 && oldSlow.blockedMs > 0, "a client that does not read never makes Task3 wait");
+  ok &= check(fanOutSlow.drops > 0 && fanOutSlow.maxQueued <= depth,
+              "its queue keeps the newest messages (drop oldest)");
+  ok &= check(othersUnaffected, "the other clients get every message");
+  ok &= check(longest > 0 && longest < TELEMETRY_JSON_MAX && sameAsPlain,
+               "the JSON weight message fits its buffer, the weight alone is the old message");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/**
+ * FileHistoryStorage.h
+ *  Stand-in for the LittleFS history segments in the native build: one plain file per segment in a
+ *  directory of the host. Counts the flash operations so the scenario can report the write and erase load.
+ *  Like FsHistoryStorage, the segment being written stays open between the appends.
+ */
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "HistoryStore.h"
+
+class FileHistoryStorage : public HistoryStorage
+{
+public:
+  FileHistoryStorage(const std::string &directory, uint16_t segmentCount)
+      : directory_(directory), erases_(segmentCount, 0)
+  {
+    ::mkdir(directory.c_str(), 0755);
+  }
+  ~FileHistoryStorage() { closeAppend(); }
+
+  uint32_t size(uint16_t segment) override
+  {
+    struct stat info;
+    return ::stat(path(segment), &info) == 0 ? static_cast<uint32_t>(info.st_size) : 0;
+  }
+
+  size_t read(uint16_t segment, uint32_t offset, uint8_t *out, size_t length) override
+  {
+    std::FILE *file = std::fopen(path(segment), "rb");
+    if (!file)
+    {
+      return 0;
+    }
+    size_t got = 0;
+    if (std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0)
+    {
+      got = std::fread(out, 1, length, file);
+    }
+    std::fclose(file);
+    reads++;
+    return got;
+  }
+
+  bool append(uint16_t segment, const uint8_t *data, size_t length) override
+  {
+    if (appendFile_ == nullptr || appendSegment_ != segment)
+    {
+      closeAppend();
+      appendFile_ = std::fopen(path(segment), "ab");
+      appendSegment_ = segment;
+      if (appendFile_ == nullptr)
+      {
+        return false;
+      }
+    }
+    const bool ok = std::fwrite(data, 1, length, appendFile_) == length;
+    std::fflush(appendFile_);
+    writes++;
+    bytesWritten += length;
+    return ok;
+  }
+
+  bool erase(uint16_t segment) override
+  {
+    if (appendFile_ != nullptr && appendSegment_ == segment)
+    {
+      closeAppend();
+    }
+    if (size(segment) != 0)
+    {
+      erases_[segment]++;
+    }
+    std::remove(path(segment));
+    return true;
+  }
+
+  /**
+   * @brief Removes every segment (start of a run).
+   */
+  void clear()
+  {
+    closeAppend();
+    for (uint16_t segment = 0; segment < erases_.size(); segment++)
+    {
+      std::remove(path(segment));
+      erases_[segment] = 0;
+    }
+  }
+
+  uint32_t totalSize()
+  {
+    uint32_t total = 0;
+    for (uint16_t segment = 0; segment < erases_.size(); segment++)
+    {
+      total += size(segment);
+    }
+    return total;
+  }
+
+  const std::vector<uint32_t> &erases() const { return erases_; }
+
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+  uint64_t bytesWritten = 0;
+
+private:
+  const char *path(uint16_t segment)
+  {
+    std::snprintf(path_, sizeof(path_), "%s/seg%02u.bin", directory_.c_str(), static_cast<unsigned>(segment));
+    return path_;
+  }
+
+  void closeAppend()
+  {
+    if (appendFile_ != nullptr)
+    {
+      std::fclose(appendFile_);
+      appendFile_ = nullptr;
+    }
+  }
+
+  std::string directory_;
+  std::vector<uint32_t> erases_;
+  char path_[256];
+  std::FILE *appendFile_ = nullptr;
+  uint16_t appendSegment_ = 0;
+};
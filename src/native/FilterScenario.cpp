@@ -0,0 +1,179 @@
+/**
+ * FilterScenario.cpp
+ *  Checks and benchmarks the fixed-point filter chain:
+ *    - throughput of every kernel (samples per second on one core), next to the float get_units() path,
+ *    - spike rejection and step response on a synthetic trace,
+ *    - settle time: how long after a load is put on the platform the weight is reported stable.
+ *  Returns 1 if one of the checks fails.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "FilterChain.h"
+#include "Scenarios.h"
+
+namespace
+{
+
+const int32_t offset = 84000;
+const float countsPerGram = -396.99f;
+
+// synthetic HX711 trace: empty platform, then loadGrams from stepIndex on, with noise.
+std::vector<int32_t> makeTrace(size_t count, size_t stepIndex, float loadGrams, int32_t noise)
+{
+  std::minstd_rand rng(42);
+  std::uniform_int_distribution<int32_t> dist(-noise, noise);
+  std::vector<int32_t> trace(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    const float grams = i >= stepIndex ? loadGrams : 0.0f;
+    trace[i] = offset + static_cast<int32_t>(grams * countsPerGram) + dist(rng);
+  }
+  return trace;
+}
+
+// the original path: HX711::get_units() in float, truncated to long.
+long floatPath(int32_t raw)
+{
+  return static_cast<long>(static_cast<float>(static_cast<double>(raw - offset) / countsPerGram));
+}
+
+template <typename Kernel>
+void benchmark(const char *label, const std::vector<int32_t> &trace, Kernel kernel)
+{
+  const auto start = std::chrono::steady_clock::now();
+  int64_t checksum = 0;
+  for (int32_t raw : trace)
+  {
+    checksum += kernel(raw);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::printf("  %-26s %8.2f Msamples/s  %6.1f ns/sample  (checksum %lld)\n", label,
+              static_cast<double>(trace.size()) / seconds / 1e6, seconds * 1e9 / static_cast<double>(trace.size()),
+              static_cast<long long>(checksum));
+}
+
+FilterChain makeChain(Smoothing smoothing, uint8_t median)
+{
+  FilterConfig config;
+  config.smoothing = smoothing;
+  config.medianWindow = median;
+  FilterChain chain(config);
+  chain.converter().setCalibration(offset, countsPerGram);
+  return chain;
+}
+
+const char *smoothingName(Smoothing smoothing)
+{
+  switch (smoothing)
+  {
+    case Smoothing::Ema: return "ema";
+    case Smoothing::MovingAverage: return "average";
+    case Smoothing::Kalman: return "kalman";
+    default: return "none";
+  }
+}
+
+}  // namespace
+
+int runFilterScenario(const Options &options)
+{
+  const size_t samples = static_cast<size_t>(options.get("samples", 5000000));
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 10));
+  const int32_t noise = static_cast<int32_t>(options.get("noise", 200));
+  bool ok = true;
+
+  std::printf("filter throughput (%zu samples, one core)\n", samples);
+  const std::vector<int32_t> trace = makeTrace(samples, samples / 2, 250.0f, noise);
+  benchmark("float get_units()", trace, floatPath);
+  {
+    WeightConverter converter;
+    converter.setCalibration(offset, countsPerGram);
+    benchmark("fixed-point convert", trace, [&](int32_t raw) { return converter.toMilligrams(raw); });
+  }
+  {
+    MedianFilter median(5);
+    benchmark("median 5", trace, [&](int32_t raw) { return median.update(raw); });
+  }
+  {
+    EmaFilter ema(3);
+    benchmark("ema 1/8", trace, [&](int32_t raw) { return ema.update(raw); });
+  }
+  {
+    MovingAverage average(8);
+    benchmark("moving average 8", trace, [&](int32_t raw) { return average.update(raw); });
+  }
+  {
+    KalmanFilter kalman;
+    benchmark("kalman", trace, [&](int32_t raw) { return kalman.update(raw); });
+  }
+  for (Smoothing smoothing : {Smoothing::Ema, Smoothing::MovingAverage, Smoothing::Kalman})
+  {
+    FilterChain chain = makeChain(smoothing, 3);
+    uint32_t t = 0;
+    char label[40];
+    std::snprintf(label, sizeof(label), "chain median3+%s", smoothingName(smoothing));
+    benchmark(label, trace, [&](int32_t raw) { return chain.update(raw, t += 100000).weightMg; });
+  }
+
+  printChecks();
+  {
+    // a single spike of 100 g must not get through a median of 3.
+    MedianFilter median(3);
+    int32_t worst = 0;
+    for (int i = 0; i < 20; i++)
+    {
+      const int32_t raw = offset + (i == 10 ? static_cast<int32_t>(100 * countsPerGram) : 0);
+      worst = std::max(worst, std::abs(median.update(raw) - offset));
+    }
+    ok &= check(worst == 0, "median 3 rejects a single spike");
+  }
+  {
+    WeightConverter converter;
+    converter.setCalibration(offset, countsPerGram);
+    int32_t worst = 0;
+    for (int32_t grams = 0; grams <= 5000; grams += 7)
+    {
+      const int32_t raw = offset + static_cast<int32_t>(static_cast<float>(grams) * countsPerGram);
+      const double exactMg = static_cast<double>(raw - offset) * 1000.0 / countsPerGram;
+      worst = std::max(worst, static_cast<int32_t>(std::abs(converter.toMilligrams(raw) - exactMg) + 0.5));
+    }
+    // get_units() truncates to whole grams, the fixed-point path keeps milligrams.
+    ok &= check(worst <= 10, "fixed-point conversion within 10 mg up to 5 kg");
+  }
+
+  std::printf("settle time after a 250 g load at %u SPS (noise +/-%d counts)\n", sps, noise);
+  const uint32_t periodUs = 1000000u / sps;
+  const size_t stepIndex = sps * 2u;
+  const std::vector<int32_t> stepTrace = makeTrace(sps * 6u, stepIndex, 250.0f, noise);
+  for (Smoothing smoothing : {Smoothing::None, Smoothing::Ema, Smoothing::MovingAverage, Smoothing::Kalman})
+  {
+    FilterChain chain = makeChain(smoothing, 3);
+    uint32_t settleUs = 0;
+    int32_t weightMg = 0;
+    bool settled = false;
+    for (size_t i = 0; i < stepTrace.size(); i++)
+    {
+      const FilterOutput out = chain.update(stepTrace[i], static_cast<uint32_t>(i) * periodUs);
+      if (i > stepIndex && out.stable && !settled)
+      {
+        settled = true;
+        settleUs = static_cast<uint32_t>(i - stepIndex) * periodUs;
+        weightMg = out.weightMg;
+      }
+    }
+    std::printf("  %-10s stable after %6u ms, weight %8.3f g\n", smoothingName(smoothing), settleUs / 1000,
+                weightMg / 1000.0);
+    if (smoothing != Smoothing::None)
+    {
+      ok &= check(settled && std::abs(weightMg - 250000) < 2000, "  settles within 2 g of the load");
+    }
+  }
+  return ok ? 0 : 1;
+}
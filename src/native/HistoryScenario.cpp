@@ -0,0 +1,211 @@
+/**
+ * HistoryScenario.cpp
+ *  Fills the history store with days of change-driven weight points (a heartbeat every minute plus
+ *  weighings that settle over a few points) on a file-backed stand-in for LittleFS, then reports:
+ *    - the cost of one append (buffering and the file writes included) and the bytes per point,
+ *    - how many days of history the configured flash holds, and the erases per segment (wear),
+ *    - query throughput for the full range (CSV and binary), the last day, and hourly buckets,
+ *    - that everything still in the store reads back exactly, also after a "reboot" (begin()).
+ *  Returns 1 if a check fails.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "FileHistoryStorage.h"
+#include "HistoryStore.h"
+#include "Scenarios.h"
+
+namespace
+{
+
+const uint64_t minuteMs = 60000u;
+const uint64_t dayMs = 24u * 60u * minuteMs;
+
+// points as the firmware records them: on every change past the deadband and once a minute otherwise.
+std::vector<HistoryPoint> makeHistory(uint32_t days, uint32_t weighingsPerHour)
+{
+  std::minstd_rand rng(11);
+  std::uniform_int_distribution<uint32_t> gap(0, 2 * 3600000u / (weighingsPerHour ? weighingsPerHour : 1));
+  std::uniform_int_distribution<int32_t> grams(50, 3000);
+  std::vector<HistoryPoint> points;
+  const uint64_t startMs = 1760000000000ull;   // an epoch time in ms, like the firmware records
+  const uint64_t endMs = startMs + days * dayMs;
+  uint64_t now = startMs;
+  uint64_t nextWeighing = now + gap(rng);
+  int32_t weight = 0;
+  while (now < endMs)
+  {
+    if (now >= nextWeighing)
+    {
+      // the load goes on (or comes off) and settles over 8 points, 100 ms apart.
+      const int32_t target = weight == 0 ? grams(rng) : 0;
+      for (int i = 1; i <= 8; i++)
+      {
+        points.push_back({now, weight + (target - weight) * i / 8});
+        now += 100;
+      }
+      weight = target;
+      nextWeighing = now + gap(rng);
+    }
+    else
+    {
+      points.push_back({now, weight});   // heartbeat
+      now += std::min<uint64_t>(minuteMs, nextWeighing - now + 1);
+    }
+  }
+  return points;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct QueryResult
+{
+  uint32_t items;
+  uint64_t bytes;
+  double seconds;
+};
+
+QueryResult query(HistoryStore &store, uint64_t fromMs, uint64_t toMs, uint32_t bucketMs, HistoryFormat format)
+{
+  const auto start = std::chrono::steady_clock::now();
+  HistoryStream stream(store, fromMs, toMs, bucketMs, format);
+  uint8_t chunk[512];   // the size of one HTTP chunk in the firmware
+  uint64_t bytes = 0;
+  size_t n;
+  while ((n = stream.read(chunk, sizeof(chunk))) != 0)
+  {
+    bytes += n;
+  }
+  return {stream.itemCount(), bytes, secondsSince(start)};
+}
+
+void printQuery(const char *label, const QueryResult &result)
+{
+  std::printf("  %-28s %8u items %9llu bytes %8.2f ms  %7.2f Mitems/s\n", label, result.items,
+              static_cast<unsigned long long>(result.bytes), result.seconds * 1e3,
+              result.items / result.seconds / 1e6);
+}
+
+}  // namespace
+
+int runHistoryScenario(const Options &options)
+{
+  const uint32_t days = static_cast<uint32_t>(options.get("days", 14));
+  const uint32_t weighings = static_cast<uint32_t>(options.get("weighings", 6));
+  HistoryConfig config;
+  config.segmentCount = static_cast<uint16_t>(options.get("segments", config.segmentCount));
+  config.segmentBytes = static_cast<uint32_t>(options.get("segkb", config.segmentBytes / 1024)) * 1024u;
+  const char *directory = options.getString("dir", "/tmp/scale-history");
+  bool ok = true;
+
+  const std::vector<HistoryPoint> points = makeHistory(days, weighings);
+  FileHistoryStorage storage(directory, config.segmentCount);
+  storage.clear();
+  HistoryStore store(storage, config);
+  store.begin();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (const HistoryPoint &point : points)
+  {
+    store.append(point.timeMs, point.value);
+  }
+  store.flush();
+  const double appendSeconds = secondsSince(start);
+
+  std::printf("history: %u days, %u weighings per hour, %u segments x %u KB in %s\n", days, weighings,
+              static_cast<unsigned>(config.segmentCount), static_cast<unsigned>(config.segmentBytes / 1024), directory);
+  std::printf("  points appended             %zu (%.0f per day)\n", points.size(),
+              static_cast<double>(points.size()) / days);
+  std::printf("  append cost                 %.0f ns per point (%u file writes)\n",
+              appendSeconds * 1e9 / static_cast<double>(points.size()), storage.writes);
+  std::printf("  encoded size                %.2f bytes per point (raw %u bytes)\n",
+              static_cast<double>(storage.bytesWritten) / static_cast<double>(points.size()), HISTORY_POINT_SIZE);
+
+  // what is still in the store: the newest points, as many as fit.
+  std::vector<HistoryPoint> kept;
+  {
+    HistoryReader reader(store, 0, UINT64_MAX);
+    HistoryPoint point;
+    while (reader.next(point))
+    {
+      kept.push_back(point);
+    }
+  }
+  const double keptDays = kept.empty() ? 0.0 : (kept.back().timeMs - kept.front().timeMs) / static_cast<double>(dayMs);
+  const std::vector<uint32_t> &erases = storage.erases();
+  std::printf("  flash used                  %u bytes, %.1f days kept (%.0f KB per week)\n", storage.totalSize(),
+              keptDays, keptDays > 0 ? storage.totalSize() / keptDays * 7.0 / 1024.0 : 0.0);
+  std::printf("  erases per segment          min %u max %u\n", *std::min_element(erases.begin(), erases.end()),
+              *std::max_element(erases.begin(), erases.end()));
+
+  std::printf("queries (512 byte chunks)\n");
+  const uint64_t lastMs = points.back().timeMs;
+  printQuery("all points, csv", query(store, 0, UINT64_MAX, 0, HistoryFormat::Csv));
+  printQuery("all points, binary", query(store, 0, UINT64_MAX, 0, HistoryFormat::Binary));
+  const uint32_t readsBefore = storage.reads;
+  printQuery("last day, csv", query(store, lastMs - dayMs, lastMs, 0, HistoryFormat::Csv));
+  std::printf("  %-28s %8u file reads (older segments skipped)\n", "", storage.reads - readsBefore);
+  printQuery("all, 1 h buckets, csv", query(store, 0, UINT64_MAX, 3600000u, HistoryFormat::Csv));
+
+  printChecks();
+  const size_t first = points.size() - kept.size();
+  ok &= check(!kept.empty() && std::equal(kept.begin(), kept.end(), points.begin() + static_cast<long>(first),
+                                          [](const HistoryPoint &a, const HistoryPoint &b) {
+                                            return a.timeMs == b.timeMs && a.value == b.value;
+                                          }),
+              "kept points read back exactly");
+  ok &= check(points.size() < 1000 || keptDays >= 7.0, "at least a week of history kept");
+  {
+    // "reboot": a new store on the same files finds the last point and continues after it.
+    HistoryStore rebooted(storage, config);
+    rebooted.begin();
+    const HistoryPoint extra = {lastMs + minuteMs, -5};
+    rebooted.append(extra.timeMs, extra.value);
+    rebooted.flush();
+    HistoryReader reader(rebooted, lastMs, UINT64_MAX);
+    HistoryPoint point;
+    HistoryPoint lastRead = {};
+    uint32_t count = 0;
+    while (reader.next(point))
+    {
+      lastRead = point;
+      count++;
+    }
+    ok &= check(count == 2 && lastRead.timeMs == extra.timeMs && lastRead.value == extra.value,
+                "append continues after a reboot");
+  }
+  {
+    // a torn record (power loss during a write) ends the segment, the next point opens a new one.
+    const uint8_t torn = 0x80;
+    HistoryStore rebooted(storage, config);
+    rebooted.begin();
+    uint32_t seq;
+    HistoryPoint base;
+    uint16_t newest = 0;
+    uint32_t newestSeq = 0;
+    for (uint16_t segment = 0; segment < config.segmentCount; segment++)
+    {
+      if (rebooted.readHeader(segment, seq, base) && seq > newestSeq)
+      {
+        newestSeq = seq;
+        newest = segment;
+      }
+    }
+    storage.append(newest, &torn, 1);
+    HistoryStore afterTear(storage, config);
+    afterTear.begin();
+    afterTear.append(lastMs + 2 * minuteMs, 7);
+    afterTear.flush();
+    HistoryReader reader(afterTear, lastMs + 2 * minuteMs, UINT64_MAX);
+    HistoryPoint point = {};
+    ok &= check(reader.next(point) && point.value == 7, "torn record is skipped, history continues");
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+/**
+ * HostClock.h
+ *  micros()/millis() replacements for the native (host) build.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+inline uint32_t hostMicros()
+{
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return static_cast<uint32_t>(duration_cast<microseconds>(steady_clock::now() - start).count());
+}
+
+inline void hostSleepUntilMicros(uint32_t targetUs)
+{
+  const int32_t remaining = static_cast<int32_t>(targetUs - hostMicros());
+  if (remaining > 0)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(remaining));
+  }
+}
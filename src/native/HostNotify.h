@@ -0,0 +1,42 @@
+/**
+ * HostNotify.h
+ *  Host stand-in for a FreeRTOS direct-to-task notification used as a counting semaphore
+ *  (vTaskNotifyGiveFromISR / ulTaskNotifyTake).
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+class HostNotify
+{
+public:
+  void give()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      count_++;
+    }
+    cv_.notify_one();
+  }
+
+  /**
+   * @brief Waits for a notification and clears the count (like ulTaskNotifyTake(pdTRUE, timeout)).
+   * @return the notification count before it was cleared, 0 on timeout.
+   */
+  uint32_t take(uint32_t timeoutUs)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::microseconds(timeoutUs), [this]() { return count_ != 0; });
+    const uint32_t count = count_;
+    count_ = 0;
+    return count;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  uint32_t count_ = 0;
+};
@@ -0,0 +1,209 @@
+/**
+ * LogScenario.cpp
+ *  Deferred logging (DeferredLog.h):
+ *    - the cost of a LOG_INFO call in the calling task, next to formatting the same line synchronously and
+ *      to the time the old Serial.println would block at 115200 baud,
+ *    - that a level below LOG_LEVEL is removed at compile time (its arguments are not evaluated),
+ *    - several producer threads logging in bursts (one burst per millisecond) while one drain thread formats
+ *      every drainus: every record arrives once and in order per producer, or is counted as dropped,
+ *    - the formatting of the conversions the firmware uses,
+ *    - that a %s from a buffer is copied by the log call (the buffer may be reused at once), cut to
+ *      LOG_TEXT_SIZE, and that a string literal is not copied.
+ *  Returns 1 if a check fails.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "DeferredLog.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+
+namespace
+{
+
+static_assert(!LogCopiesText<const char (&)[8]>::value && LogCopiesText<char (&)[8]>::value &&
+                  LogCopiesText<const char *&>::value && LogCopiesText<const char *>::value &&
+                  !LogCopiesText<int &>::value,
+              "a string literal is kept as a pointer, any other string is copied");
+
+const double uartUsPerChar = 10.0 * 1e6 / 115200.0;   // start + 8 data + stop bits
+
+}  // namespace
+
+int runLogScenario(const Options &options)
+{
+  const uint32_t count = static_cast<uint32_t>(options.get("count", 1000000));
+  const uint32_t producers = static_cast<uint32_t>(options.get("producers", 4));
+  const uint32_t perProducer = static_cast<uint32_t>(options.get("records", 20000));
+  const uint32_t burst = static_cast<uint32_t>(options.get("burst", 8));
+  const uint32_t drainUs = static_cast<uint32_t>(options.get("drainus", 1000));
+  bool ok = true;
+  HostClock clock;
+  systemLog.setClock(&clock);
+  char line[128];
+
+  // cost in the calling task: the ring is drained between batches, only the log calls are timed.
+  double pushNs = 0.0;
+  for (uint32_t done = 0; done < count; done += LOG_RING_SIZE)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+      LOG_INFO("Client %u connected, weight %d g", i, static_cast<int>(done));
+    }
+    pushNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    while (systemLog.drain(line, sizeof(line)) != 0)
+    {
+    }
+  }
+  pushNs /= static_cast<double>(count);
+
+  FILE *devNull = std::fopen("/dev/null", "w");
+  size_t chars = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const int n = std::snprintf(line, sizeof(line), "Client %u connected, weight %d g\n", i & 63, static_cast<int>(i));
+    std::fwrite(line, 1, static_cast<size_t>(n), devNull);
+    chars += static_cast<size_t>(n);
+  }
+  const double syncNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+  std::fclose(devNull);
+  const double charsPerLine = static_cast<double>(chars) / count;
+
+  std::printf("log: cost in the calling task (%u calls, 2 arguments)\n", count);
+  std::printf("  %-44s %10.1f ns\n", "LOG_INFO (binary record into the ring)", pushNs);
+  std::printf("  %-44s %10.1f ns\n", "snprintf + write (formatted in the task)", syncNs);
+  std::printf("  %-44s %10.1f us (%.0f characters at 115200 baud)\n", "Serial.println blocking on the UART",
+              charsPerLine * uartUsPerChar, charsPerLine);
+
+  // LOG_DEBUG is compiled out at the default LOG_LEVEL (INFO): the argument must not be evaluated.
+  int evaluated = 0;
+  const uint32_t writtenBefore = systemLog.written();
+  LOG_DEBUG("Reading: %d", ++evaluated);
+  const bool stripped = evaluated == 0 && systemLog.written() == writtenBefore;
+
+  // multi-producer run.
+  std::atomic<bool> producing{true};
+  std::vector<uint32_t> next(producers, 0);
+  uint32_t received = 0;
+  uint32_t outOfOrder = 0;
+  uint32_t droppedLines = 0;
+  std::thread drain([&]() {
+    char text[128];
+    for (;;)
+    {
+      const bool last = !producing.load();
+      size_t length;
+      while ((length = systemLog.drain(text, sizeof(text))) != 0)
+      {
+        text[length] = '\0';
+        unsigned producer;
+        unsigned seq;
+        const char *message = std::strchr(text, ']');
+        if (message != nullptr && std::sscanf(message, "] I producer %u record %u", &producer, &seq) == 2 &&
+            producer < producers)
+        {
+          outOfOrder += seq < next[producer] ? 1 : 0;
+          next[producer] = seq + 1;
+          received++;
+        }
+        else if (std::strstr(text, "log records dropped") != nullptr)
+        {
+          droppedLines++;
+        }
+      }
+      if (last)
+      {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(drainUs));   // a drain task with a period
+    }
+  });
+  const uint32_t droppedBefore = systemLog.dropped();
+  const auto producersStart = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < producers; p++)
+  {
+    threads.emplace_back([p, perProducer, burst]() {
+      for (uint32_t i = 0; i < perProducer; i++)
+      {
+        LOG_INFO("producer %u record %u", p, i);
+        if ((i + 1) % burst == 0)
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+  const double producersSeconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - producersStart).count();
+  producing = false;
+  drain.join();
+  const uint32_t dropped = systemLog.dropped() - droppedBefore;
+  const uint32_t total = producers * perProducer;
+  std::printf("%u producers x %u records in bursts of %u per ms, drain every %u us, ring of %u\n", producers,
+              perProducer, burst, drainUs, LOG_RING_SIZE);
+  std::printf("  received %u, dropped %u (ring full, %u drop reports), %.0f records/s offered\n", received, dropped,
+              droppedLines, total / producersSeconds);
+
+  // formatting.
+  LogRecord record = {};
+  record.format = "w=%d g, %.2f cpg, %-5s|0x%04x %%";
+  record.timestampUs = 12345678;
+  record.level = LOG_LEVEL_WARN;
+  record.argCount = 4;
+  record.args[0] = toLogArg(-1234);
+  record.args[1] = toLogArg(-396.99f);
+  record.args[2] = toLogArg("tare");
+  record.args[3] = toLogArg(0xbeefu);
+  const size_t length = DeferredLog::format(record, line, sizeof(line));
+  const char *expected = "[    12.345678] W w=-1234 g, -396.99 cpg, tare |0xbeef %\n";
+  std::printf("formatted: %.*s", static_cast<int>(length), line);
+  char small[16];
+  const size_t cut = DeferredLog::format(record, small, sizeof(small));
+
+  // %s arguments that do not live forever: a buffer overwritten right after the call, a pointer into it, and
+  // a string longer than the record holds.
+  while (systemLog.drain(line, sizeof(line)) != 0)
+  {
+  }
+  char buffer[48];
+  std::snprintf(buffer, sizeof(buffer), "client-%d", 7);
+  const char *name = buffer;
+  LOG_INFO("%s %s %s", buffer, name, "literal");
+  std::memset(buffer, 'x', sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+  LOG_INFO("%s|%s", name, "end");
+  std::memset(buffer, 'y', sizeof(buffer) - 1);
+  char copiedLine[128] = {};
+  char cutLine[128] = {};
+  systemLog.drain(copiedLine, sizeof(copiedLine));
+  const size_t cutLength = systemLog.drain(cutLine, sizeof(cutLine));
+  const char *copiedText = std::strstr(copiedLine, "] I ");
+  const char *cutText = std::strstr(cutLine, "] I ");
+  std::printf("copied: %s", copiedLine);
+  const bool copiedOk = copiedText != nullptr && std::strcmp(copiedText + 4, "client-7 client-7 literal\n") == 0;
+  const bool cutOk = cutText != nullptr && cutLength != 0 &&
+                     std::strlen(cutText + 4) == LOG_TEXT_SIZE - 1 + std::strlen("|end\n") &&
+                     std::strspn(cutText + 4, "x") == LOG_TEXT_SIZE - 1;
+
+  printChecks();
+  ok &= check(stripped, "LOG_DEBUG removed at compile time");
+  ok &= check(received + dropped == total, "every record received or counted as dropped");
+  ok &= check(outOfOrder == 0, "records in order per producer");
+  ok &= check(length == std::strlen(expected) && std::memcmp(line, expected, length) == 0, "formatting");
+  ok &= check(cut == sizeof(small) - 1 && small[cut - 1] == '\n', "long line cut, still ends in a newline");
+  ok &= check(copiedOk, "a %s buffer is copied by the log call");
+  ok &= check(cutOk, "a %s longer than the record is cut");
+  return ok ? 0 : 1;
+}
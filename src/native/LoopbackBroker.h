@@ -0,0 +1,360 @@
+/**
+ * LoopbackBroker.h
+ *  A small MQTT 3.1.1 broker on 127.0.0.1 for the native build, so the "mqtt" scenario runs without
+ *  mosquitto: CONNECT/CONNACK, PUBLISH (PUBACK for QoS 1), retained messages, SUBSCRIBE with + and #
+ *  (forwarded at QoS 0), the last will on a connection lost without DISCONNECT, PINGREQ/PINGRESP.
+ *  No persistent sessions: CONNACK never says "session present", the client sends its unacknowledged
+ *  QoS 1 messages again anyway. One thread per connection, one lock for the broker state.
+ */
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Mqtt.h"
+#include "PosixTcp.h"
+
+class LoopbackBroker
+{
+public:
+  LoopbackBroker() = default;
+  LoopbackBroker(const LoopbackBroker &) = delete;
+  LoopbackBroker &operator=(const LoopbackBroker &) = delete;
+  ~LoopbackBroker() { stop(); }
+
+  /**
+   * @brief Listens on an ephemeral port of 127.0.0.1 (port()).
+   */
+  bool start()
+  {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0)
+    {
+      return false;
+    }
+    const int on = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listenFd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd_, 8) != 0 ||
+        getsockname(listenFd_, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+      ::close(listenFd_);
+      listenFd_ = -1;
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    acceptThread_ = std::thread([this]() { acceptLoop(); });
+    return true;
+  }
+
+  void stop()
+  {
+    if (listenFd_ < 0)
+    {
+      return;
+    }
+    stopping_ = true;
+    shutdown(listenFd_, SHUT_RDWR);
+    ::close(listenFd_);
+    listenFd_ = -1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const std::shared_ptr<Session> &session : sessions_)
+      {
+        shutdown(session->fd, SHUT_RDWR);
+      }
+    }
+    acceptThread_.join();
+    for (std::thread &thread : sessionThreads_)
+    {
+      thread.join();
+    }
+    sessionThreads_.clear();
+  }
+
+  uint16_t port() const { return port_; }
+  uint32_t publishesReceived() const { return publishes_; }
+  uint32_t willsPublished() const { return wills_; }
+
+private:
+  struct Session
+  {
+    int fd = -1;
+    bool clean = false;   // DISCONNECT received: no will
+    std::string willTopic;
+    std::vector<uint8_t> willMessage;
+    bool willRetain = false;
+    std::vector<std::string> filters;
+  };
+
+  static std::vector<std::string> levels(const std::string &name)
+  {
+    std::vector<std::string> out;
+    size_t start = 0;
+    for (size_t slash = name.find('/'); slash != std::string::npos; slash = name.find('/', start))
+    {
+      out.push_back(name.substr(start, slash - start));
+      start = slash + 1;
+    }
+    out.push_back(name.substr(start));
+    return out;
+  }
+
+  // "+" matches one level, "#" the rest (also none: "a/#" matches "a").
+  static bool matches(const std::string &filter, const std::string &topic)
+  {
+    const std::vector<std::string> filterLevels = levels(filter);
+    const std::vector<std::string> topicLevels = levels(topic);
+    for (size_t i = 0; i < filterLevels.size(); i++)
+    {
+      if (filterLevels[i] == "#")
+      {
+        return true;
+      }
+      if (i >= topicLevels.size() || (filterLevels[i] != "+" && filterLevels[i] != topicLevels[i]))
+      {
+        return false;
+      }
+    }
+    return filterLevels.size() == topicLevels.size();
+  }
+
+  static void sendPacket(int fd, const uint8_t *packet, size_t length) { writeAll(fd, packet, length); }
+
+  // forwards to the subscribers (QoS 0) and keeps it if retained; called with the lock held.
+  void route(const std::string &topic, const uint8_t *payload, size_t length, bool retain)
+  {
+    if (retain)
+    {
+      if (length == 0)
+      {
+        retained_.erase(topic);
+      }
+      else
+      {
+        retained_[topic].assign(payload, payload + length);
+      }
+    }
+    std::vector<uint8_t> packet(length + topic.size() + 16);
+    const size_t packetLength = encodeMqttPublish(topic.c_str(), payload, length, 0, false, 0, packet.data(), packet.size());
+    for (const std::shared_ptr<Session> &session : sessions_)
+    {
+      for (const std::string &filter : session->filters)
+      {
+        if (matches(filter, topic))
+        {
+          sendPacket(session->fd, packet.data(), packetLength);
+          break;
+        }
+      }
+    }
+  }
+
+  static bool readString(const uint8_t *body, size_t length, size_t &at, std::string &out)
+  {
+    if (at + 2 > length)
+    {
+      return false;
+    }
+    const size_t size = (static_cast<size_t>(body[at]) << 8) | body[at + 1];
+    if (at + 2 + size > length)
+    {
+      return false;
+    }
+    out.assign(reinterpret_cast<const char *>(body + at + 2), size);
+    at += 2 + size;
+    return true;
+  }
+
+  // returns false to close the connection.
+  bool onPacket(Session &session, const MqttReader &reader)
+  {
+    const uint8_t *body = reader.body();
+    const size_t length = reader.length();
+    switch (reader.type())
+    {
+    case MqttPacket::Connect:
+    {
+      std::string protocol;
+      std::string clientId;
+      size_t at = 0;
+      if (!readString(body, length, at, protocol) || at + 4 > length)
+      {
+        return false;
+      }
+      const uint8_t flags = body[at + 1];
+      at += 4;
+      if (!readString(body, length, at, clientId))
+      {
+        return false;
+      }
+      if (flags & 0x04)
+      {
+        std::string willMessage;
+        if (!readString(body, length, at, session.willTopic) || !readString(body, length, at, willMessage))
+        {
+          return false;
+        }
+        session.willMessage.assign(willMessage.begin(), willMessage.end());
+        session.willRetain = (flags & 0x20) != 0;
+      }
+      const uint8_t connack[4] = {static_cast<uint8_t>(MqttPacket::Connack) << 4, 2, 0, 0};
+      sendPacket(session.fd, connack, sizeof(connack));
+      return true;
+    }
+    case MqttPacket::Publish:
+    {
+      char topic[128];
+      uint16_t packetId;
+      const uint8_t *payload;
+      size_t payloadLength;
+      if (reader.truncated() ||
+          !decodeMqttPublish(body, length, reader.flags(), topic, sizeof(topic), packetId, payload, payloadLength))
+      {
+        return false;
+      }
+      publishes_++;
+      route(topic, payload, payloadLength, (reader.flags() & 0x01) != 0);
+      if (((reader.flags() >> 1) & 0x03) == 1)
+      {
+        const uint8_t puback[4] = {static_cast<uint8_t>(MqttPacket::Puback) << 4, 2, static_cast<uint8_t>(packetId >> 8),
+                                   static_cast<uint8_t>(packetId)};
+        sendPacket(session.fd, puback, sizeof(puback));
+      }
+      return true;
+    }
+    case MqttPacket::Subscribe:
+    {
+      if (length < 2)
+      {
+        return false;
+      }
+      size_t at = 2;
+      std::vector<uint8_t> suback = {static_cast<uint8_t>(MqttPacket::Suback) << 4, 2, body[0], body[1]};
+      std::vector<std::string> filters;
+      std::string filter;
+      while (at < length && readString(body, length, at, filter) && at < length)
+      {
+        at++;   // requested QoS, granted 0
+        filters.push_back(filter);
+        session.filters.push_back(filter);
+        suback.push_back(0);
+        suback[1]++;
+      }
+      sendPacket(session.fd, suback.data(), suback.size());
+      // the retained messages of the new filters go to the new subscriber only.
+      for (const auto &message : retained_)
+      {
+        bool wanted = false;
+        for (const std::string &newFilter : filters)
+        {
+          wanted = wanted || matches(newFilter, message.first);
+        }
+        if (wanted)
+        {
+          std::vector<uint8_t> packet(message.second.size() + message.first.size() + 16);
+          const size_t packetLength = encodeMqttPublish(message.first.c_str(), message.second.data(), message.second.size(),
+                                                        0, true, 0, packet.data(), packet.size());
+          sendPacket(session.fd, packet.data(), packetLength);
+        }
+      }
+      return true;
+    }
+    case MqttPacket::Pingreq:
+    {
+      const uint8_t pingresp[2] = {static_cast<uint8_t>(MqttPacket::Pingresp) << 4, 0};
+      sendPacket(session.fd, pingresp, sizeof(pingresp));
+      return true;
+    }
+    case MqttPacket::Disconnect:
+      session.clean = true;
+      return false;
+    default:
+      return true;
+    }
+  }
+
+  void serve(std::shared_ptr<Session> session)
+  {
+    MqttReader reader;
+    uint8_t chunk[512];
+    bool open = true;
+    while (open)
+    {
+      const ssize_t count = recv(session->fd, chunk, sizeof(chunk), 0);
+      if (count <= 0)
+      {
+        if (count < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        break;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (ssize_t i = 0; i < count && open; i++)
+      {
+        open = !reader.push(chunk[i]) || onPacket(*session, reader);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < sessions_.size(); i++)
+    {
+      if (sessions_[i] == session)
+      {
+        sessions_.erase(sessions_.begin() + static_cast<long>(i));
+        break;
+      }
+    }
+    if (!session->clean && !session->willTopic.empty() && !stopping_)
+    {
+      // lost without DISCONNECT: the last will.
+      wills_++;
+      route(session->willTopic, session->willMessage.data(), session->willMessage.size(), session->willRetain);
+    }
+    ::close(session->fd);
+  }
+
+  void acceptLoop()
+  {
+    while (!stopping_)
+    {
+      const int fd = accept(listenFd_, nullptr, nullptr);
+      if (fd < 0)
+      {
+        if (stopping_)
+        {
+          break;
+        }
+        continue;
+      }
+      const int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      std::shared_ptr<Session> session = std::make_shared<Session>();
+      session->fd = fd;
+      std::lock_guard<std::mutex> lock(mutex_);
+      sessions_.push_back(session);
+      sessionThreads_.emplace_back([this, session]() { serve(session); });
+    }
+  }
+
+  int listenFd_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::thread acceptThread_;
+  std::vector<std::thread> sessionThreads_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Session>> sessions_;
+  std::map<std::string, std::vector<uint8_t>> retained_;
+  std::atomic<uint32_t> publishes_{0};
+  std::atomic<uint32_t> wills_{0};
+};
@@ -0,0 +1,222 @@
+/**
+ * MetricsScenario.cpp
+ *  Runtime metrics (Metrics.h):
+ *    - the cost of recording one event in a latency histogram, alone and with the two clock reads around
+ *      the measured stage, next to the cost of one formatted log line (what the Serial.println calls cost),
+ *    - a reader copying a histogram while the writer records at full speed: every copy is consistent (the
+ *      count is the sum of the buckets), and the count never goes back,
+ *    - the Prometheus text: size, export time, the same text for any chunk size, cumulative buckets,
+ *    - the binary metrics frame.
+ *  Returns 1 if a check fails.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "Check.h"
+#include "HostClock.h"
+#include "Metrics.h"
+#include "Scenarios.h"
+
+namespace
+{
+
+template <typename Body>
+double meanNanos(uint32_t count, Body body)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    body(i);
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+std::string exportText(const Metrics &metrics, size_t chunkSize)
+{
+  MetricsExporter exporter(metrics, 3600);
+  std::string text;
+  char chunk[512];
+  size_t length;
+  while ((length = exporter.read(chunk, chunkSize < sizeof(chunk) ? chunkSize : sizeof(chunk))) != 0)
+  {
+    text.append(chunk, length);
+  }
+  return text;
+}
+
+// the buckets of every series grow and end with +Inf = _count.
+bool bucketsCumulative(const std::string &text)
+{
+  unsigned long long previous = 0;
+  bool inSeries = false;
+  size_t pos = 0;
+  while (pos < text.size())
+  {
+    const size_t end = text.find('\n', pos);
+    const std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+    const size_t space = line.rfind(' ');
+    const unsigned long long value = std::strtoull(line.c_str() + space + 1, nullptr, 10);
+    if (line.find("_bucket{") != std::string::npos)
+    {
+      if (inSeries && value < previous)
+      {
+        return false;
+      }
+      inSeries = true;
+      previous = value;
+    }
+    else if (line.find("_count{") != std::string::npos)
+    {
+      if (!inSeries || value != previous)
+      {
+        return false;
+      }
+      inSeries = false;
+      previous = 0;
+    }
+  }
+  return true;
+}
+
+uint32_t readLe32(const uint8_t *in)
+{
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) | (static_cast<uint32_t>(in[2]) << 16) |
+         (static_cast<uint32_t>(in[3]) << 24);
+}
+
+}  // namespace
+
+int runMetricsScenario(const Options &options)
+{
+  const uint32_t count = static_cast<uint32_t>(options.get("count", 5000000));
+  const uint32_t copies = static_cast<uint32_t>(options.get("copies", 200000));
+  bool ok = true;
+
+  // stage times like the firmware sees them: mostly short, a few long ones.
+  std::minstd_rand rng(12);
+  std::exponential_distribution<double> shape(1.0 / 150.0);
+  static uint32_t values[4096];
+  for (uint32_t &value : values)
+  {
+    value = static_cast<uint32_t>(shape(rng));
+  }
+
+  std::printf("metrics: recording cost (%u events)\n", count);
+  LatencyHistogram histogram;
+  const double tRecord = meanNanos(count, [&](uint32_t i) { histogram.record(values[i & 4095]); });
+  LatencyHistogram timed;
+  volatile uint32_t sink = 0;
+  const double tTimed = meanNanos(count, [&](uint32_t i) {
+    const uint32_t start = hostMicros();
+    sink = sink + i;   // the "stage"
+    timed.record(hostMicros() - start);
+  });
+  char line[96];
+  FILE *devNull = std::fopen("/dev/null", "w");
+  const uint32_t lines = count / 10;
+  const double tLog = meanNanos(lines, [&](uint32_t i) {
+    const int n = std::snprintf(line, sizeof(line), "Task2: Displaying the current weight %u on the display\n", i);
+    std::fwrite(line, 1, static_cast<size_t>(n), devNull);
+    std::fflush(devNull);
+  });
+  std::fclose(devNull);
+  std::printf("  %-40s %8.1f ns\n", "record()", tRecord);
+  std::printf("  %-40s %8.1f ns\n", "micros() + stage + micros() + record()", tTimed);
+  std::printf("  %-40s %8.1f ns (no UART: 115200 baud adds ~87 us per byte)\n", "one log line (snprintf + write)",
+              tLog);
+
+  std::printf("snapshot under a full-speed writer (%u copies)\n", copies);
+  LatencyHistogram shared;
+  std::atomic<bool> running{true};
+  std::thread writer([&]() {
+    uint32_t i = 0;
+    while (running)
+    {
+      shared.record(values[i++ & 4095]);
+    }
+  });
+  uint32_t inconsistent = 0;
+  uint32_t lastCount = 0;
+  uint32_t wentBack = 0;
+  for (uint32_t i = 0; i < copies; i++)
+  {
+    const HistogramSnapshot s = shared.snapshot();
+    uint32_t total = 0;
+    for (uint32_t bucket : s.buckets)
+    {
+      total += bucket;
+    }
+    inconsistent += total != s.count ? 1 : 0;
+    wentBack += s.count < lastCount ? 1 : 0;
+    lastCount = s.count;
+  }
+  running = false;
+  writer.join();
+  std::printf("  %u events recorded meanwhile, %u copies inconsistent, %u went back\n", shared.snapshot().count,
+              inconsistent, wentBack);
+
+  // a metrics set like after a while of running.
+  Metrics metrics;
+  uint32_t now = 0;
+  for (uint32_t i = 0; i < 80 * 600; i++)   // 10 minutes at 80 SPS
+  {
+    now += 12500;
+    metrics.stage(MetricStage::SampleRead).record(60 + values[i & 4095] / 20);
+    metrics.stage(MetricStage::Filter).record(20 + values[(i + 1) & 4095] / 10);
+    metrics.lockWait(LockUser::Acquisition).record(values[(i + 2) & 4095] / 50);
+    metrics.onSample(now);
+    if (i % 8 == 0)
+    {
+      metrics.stage(MetricStage::Display).record(900 + values[i & 4095]);
+      metrics.lockWait(LockUser::Display).record(values[(i + 3) & 4095] / 30);
+      metrics.stage(MetricStage::Broadcast).record(300 + values[(i + 4) & 4095] * 2);
+    }
+  }
+  metrics.stage(MetricStage::Uplink).record(45000);
+  metrics.onDroppedSample();
+  metrics.setClients(2);
+  metrics.setHeap(183424, 110580);
+
+  std::printf("prometheus text\n");
+  const auto start = std::chrono::steady_clock::now();
+  const std::string text = exportText(metrics, 512);
+  const double exportUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  size_t lineCount = 0;
+  for (char c : text)
+  {
+    lineCount += c == '\n' ? 1 : 0;
+  }
+  std::printf("  %zu bytes, %zu lines, %.1f us to produce in 512 byte chunks\n", text.size(), lineCount, exportUs);
+  const size_t excerpt = text.find("scale_stage_latency_seconds_bucket{stage=\"filter\"");
+  if (excerpt != std::string::npos)
+  {
+    const size_t last = text.find('\n', text.find("_count{stage=\"filter\"", excerpt));
+    std::printf("%s", text.substr(excerpt, last + 1 - excerpt).c_str());
+  }
+  const size_t rate = text.find("\nscale_sample_rate_hz ");
+  if (rate != std::string::npos)
+  {
+    std::printf("%s\n", text.substr(rate + 1, text.find('\n', rate + 1) - rate - 1).c_str());
+  }
+
+  uint8_t frame[METRICS_FRAME_SIZE];
+  const size_t frameLength = encodeMetricsFrame(metrics, 3600, frame, sizeof(frame));
+
+  printChecks();
+  ok &= check(tRecord < 300.0, "record() costs less than 300 ns");
+  ok &= check(inconsistent == 0 && wentBack == 0, "every copy consistent");
+  ok &= check(exportText(metrics, 7) == text && exportText(metrics, 1) == text,
+              "same text for 512, 7 and 1 byte chunks");
+  ok &= check(bucketsCumulative(text), "buckets are cumulative and end at _count");
+  ok &= check(text.find("scale_sample_rate_hz 80.000") != std::string::npos, "sample rate 80 Hz");
+  ok &= check(frameLength == METRICS_FRAME_SIZE && frame[1] == TELEMETRY_FRAME_METRICS &&
+                  readLe32(frame + 8) == metrics.samples() && readLe32(frame + 32 + 12) == 80 * 600,
+              "metrics frame");
+  return ok ? 0 : 1;
+}
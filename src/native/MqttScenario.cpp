@@ -0,0 +1,684 @@
+/**
+ * MqttScenario.cpp
+ *  The MQTT backend of the uplink (Mqtt.h) against a real broker: the loopback broker of the native build
+ *  (LoopbackBroker.h), or mosquitto with broker=host:port. Task4 is stepped on a simulated millisecond clock
+ *  (100 ms per cycle, like UPLINK_TASK_PERIOD_MS) with the firmware uplink settings; the broker and a
+ *  subscriber (a dashboard) run in real time on sockets. The WiFi drops out for a while in the first half of the
+ *  run: the packets vanish without TCP noticing until the scale misses the answers of the other side, then the
+ *  connection is closed and cannot be opened again until the WiFi is back.
+ *  Compared, on the same weight trace:
+ *    - Blynk (a byte model of its protocol: 5 bytes header, "vw\0<pin>\0<value>" per point, a group around
+ *      every batch, a heartbeat every 45 s),
+ *    - MQTT compact and binary payloads, QoS 0 and QoS 1.
+ *  Reported: messages per second and bytes per sample sent by the scale, points delivered, lost and
+ *  delivered twice, then a burst: how many messages per second the client publishes at QoS 0 and QoS 1.
+ *  Returns 1 if a check fails.
+ */
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "Check.h"
+#include "Connectivity.h"
+#include "LoopbackBroker.h"
+#include "Mqtt.h"
+#include "PosixTcp.h"
+#include "Scenarios.h"
+#include "UplinkQueue.h"
+
+namespace
+{
+
+const uint32_t taskPeriodMs = 100;    // UPLINK_TASK_PERIOD_MS
+const uint32_t stepRealUs = 100;      // real time given to the broker per Task4 cycle
+const uint32_t deadLinkMs = 45000;    // both notice a dead connection after 45 s (MQTT: 1.5 keep alive, Blynk: heartbeat)
+
+UplinkConfig firmwareUplinkConfig()
+{
+  UplinkConfig config;
+  config.deadband = 2;            // UPLINK_DEADBAND_G
+  config.minIntervalMs = 1000;    // UPLINK_MIN_INTERVAL_MS
+  config.keepAliveMs = 60000;     // UPLINK_KEEPALIVE_MS
+  return config;
+}
+
+// the weight in grams: a load put on or taken off every few seconds, plus the 1 g flicker of the rounding.
+int32_t weightAt(uint32_t nowMs)
+{
+  const uint32_t item = nowMs / 7000;
+  std::minstd_rand rng(item + 1);
+  std::uniform_int_distribution<int32_t> grams(0, 2000);
+  return (item % 3 == 2 ? 0 : grams(rng)) + static_cast<int32_t>((nowMs / 300) % 2);
+}
+
+// the WiFi of the scale: during the outage the packets vanish and no connection can be opened.
+class FlakyConnection : public TcpConnection
+{
+public:
+  FlakyConnection(uint32_t outageFromMs, uint32_t outageToMs) : fromMs_(outageFromMs), toMs_(outageToMs) {}
+
+  void setNow(uint32_t nowMs)
+  {
+    nowMs_ = nowMs;
+    if (nowMs >= toMs_ && openedBeforeOutage_ && tcp_.isOpen())
+    {
+      // the connection did not survive the outage (the broker reset it).
+      tcp_.close();
+    }
+  }
+
+  bool open(const char *host, uint16_t port) override
+  {
+    if (down())
+    {
+      return false;
+    }
+    openedBeforeOutage_ = nowMs_ < fromMs_;
+    return tcp_.open(host, port);
+  }
+  void close() override { tcp_.close(); }
+  bool isOpen() override { return tcp_.isOpen(); }
+  size_t write(const uint8_t *data, size_t length) override
+  {
+    if (down())
+    {
+      swallowed += length;
+      return length;   // gone, and nobody knows yet
+    }
+    return tcp_.write(data, length);
+  }
+  size_t read(uint8_t *out, size_t max) override { return down() ? 0 : tcp_.read(out, max); }
+
+  uint64_t swallowed = 0;
+
+private:
+  bool down() const { return nowMs_ >= fromMs_ && nowMs_ < toMs_; }
+
+  PosixTcpConnection tcp_;
+  uint32_t fromMs_;
+  uint32_t toMs_;
+  uint32_t nowMs_ = 0;
+  bool openedBeforeOutage_ = false;
+};
+
+// a dashboard subscribed to <topic>/#: collects the weight points and the status messages.
+class Subscriber
+{
+public:
+  Subscriber(const char *host, uint16_t port, const std::string &topic, uint8_t format)
+      : topic_(topic), format_(format)
+  {
+    fd_ = openTcpSocket(host, port);
+    if (fd_ < 0)
+    {
+      return;
+    }
+    timeval timeout = {0, 50000};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t packet[128];
+    const std::string clientId = "sub-" + topic;
+    const std::string filter = topic + "/#";
+    size_t length = encodeMqttConnect(clientId.c_str(), 0, true, nullptr, nullptr, nullptr, nullptr, packet, sizeof(packet));
+    writeAll(fd_, packet, length);
+    length = encodeMqttSubscribe(1, filter.c_str(), 0, packet, sizeof(packet));
+    writeAll(fd_, packet, length);
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  ~Subscriber()
+  {
+    running_ = false;
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+    if (fd_ >= 0)
+    {
+      ::close(fd_);
+    }
+  }
+
+  bool ready()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return subscribed_;
+  }
+  std::vector<UplinkPoint> points()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return points_;
+  }
+  std::vector<std::string> statuses()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statuses_;
+  }
+  uint32_t invalid()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return invalid_;
+  }
+
+private:
+  void run()
+  {
+    MqttReader reader;
+    uint8_t chunk[1024];
+    while (running_)
+    {
+      const ssize_t count = recv(fd_, chunk, sizeof(chunk), 0);
+      if (count == 0)
+      {
+        break;
+      }
+      for (ssize_t i = 0; i < count; i++)
+      {
+        if (reader.push(chunk[i]))
+        {
+          onPacket(reader);
+        }
+      }
+    }
+  }
+
+  void onPacket(const MqttReader &reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reader.type() == MqttPacket::Suback)
+    {
+      subscribed_ = true;
+      return;
+    }
+    char topic[96];
+    uint16_t packetId;
+    const uint8_t *payload;
+    size_t length;
+    if (reader.type() != MqttPacket::Publish ||
+        !decodeMqttPublish(reader.body(), reader.length(), reader.flags(), topic, sizeof(topic), packetId, payload, length))
+    {
+      return;
+    }
+    const std::string name(topic);
+    if (name == topic_ + "/weight")
+    {
+      UplinkPoint decoded[MQTT_BATCH_POINTS];
+      const size_t count = decodeUplinkPayload(format_, payload, length, decoded, MQTT_BATCH_POINTS);
+      invalid_ += count == 0 ? 1 : 0;
+      points_.insert(points_.end(), decoded, decoded + count);
+    }
+    else if (name == topic_ + "/status")
+    {
+      statuses_.emplace_back(reinterpret_cast<const char *>(payload), length);
+    }
+  }
+
+  std::string topic_;
+  uint8_t format_;
+  int fd_ = -1;
+  std::atomic<bool> running_{true};
+  std::thread thread_;
+  std::mutex mutex_;
+  bool subscribed_ = false;
+  std::vector<UplinkPoint> points_;
+  std::vector<std::string> statuses_;
+  uint32_t invalid_ = 0;
+};
+
+// the sink of the uplink queue, remembers what it accepted.
+class RecordingSink : public UplinkSink
+{
+public:
+  explicit RecordingSink(UplinkSink &sink) : sink_(sink) {}
+  bool connected() override { return sink_.connected(); }
+  bool sendBatch(const UplinkPoint *points, size_t count) override
+  {
+    if (!sink_.sendBatch(points, count))
+    {
+      return false;
+    }
+    sent.insert(sent.end(), points, points + count);
+    return true;
+  }
+
+  std::vector<UplinkPoint> sent;
+
+private:
+  UplinkSink &sink_;
+};
+
+// Blynk: no broker here, the bytes of its protocol are counted instead (TCP payload, like the MQTT counts).
+class BlynkModel : public UplinkSink
+{
+public:
+  BlynkModel(uint32_t outageFromMs, uint32_t outageToMs) : fromMs_(outageFromMs), toMs_(outageToMs) {}
+
+  void setNow(uint32_t nowMs)
+  {
+    nowMs_ = nowMs;
+    if (connected() && nowMs - lastHeartbeatMs_ >= 45000)
+    {
+      lastHeartbeatMs_ = nowMs;
+      add(0);   // ping
+    }
+    if (!wasConnected_ && connected())
+    {
+      add(32);   // login with the auth token
+    }
+    wasConnected_ = connected();
+  }
+  // still "connected" until the missing heartbeat answers tell it otherwise.
+  bool connected() override { return nowMs_ < fromMs_ + deadLinkMs || nowMs_ >= toMs_; }
+  bool sendBatch(const UplinkPoint *points, size_t count) override
+  {
+    add(0);   // beginGroup
+    for (size_t i = 0; i < count; i++)
+    {
+      char body[32];
+      const int length = std::snprintf(body, sizeof(body), "vw%c%u%c%d", 0, static_cast<unsigned>(points[i].pin), 0,
+                                       static_cast<int>(points[i].value));
+      add(static_cast<size_t>(length));
+    }
+    add(0);   // endGroup
+    sentPoints += static_cast<uint32_t>(count);
+    lost += nowMs_ >= fromMs_ && nowMs_ < toMs_ ? static_cast<uint32_t>(count) : 0;
+    return true;
+  }
+
+  uint32_t messages = 0;
+  uint64_t bytes = 0;
+  uint32_t sentPoints = 0;
+  uint32_t lost = 0;
+
+private:
+  void add(size_t body)
+  {
+    messages++;
+    bytes += 5 + body;
+  }
+
+  uint32_t fromMs_;
+  uint32_t toMs_;
+  uint32_t nowMs_ = 0;
+  uint32_t lastHeartbeatMs_ = 0;
+  bool wasConnected_ = false;
+};
+
+struct RunResult
+{
+  const char *label = "";
+  uint32_t messages = 0;   // everything the scale sent (packets)
+  uint64_t bytes = 0;
+  uint32_t sent = 0;       // points accepted by the sink
+  uint32_t delivered = 0;  // distinct points the dashboard got
+  uint32_t lost = 0;
+  uint32_t duplicates = 0;
+  uint32_t dropped = 0;    // backlog overflow
+  uint32_t resends = 0;
+  bool inOrder = true;
+  bool statusSequence = false;
+  bool complete = true;    // no invalid payload, nothing delivered that was not sent
+};
+
+std::tuple<uint8_t, int32_t, uint32_t> keyOf(const UplinkPoint &point)
+{
+  return std::make_tuple(point.pin, point.value, point.timestampMs);
+}
+
+RunResult runBlynk(uint32_t durationMs, uint32_t outageFromMs, uint32_t outageToMs)
+{
+  BlynkModel blynk(outageFromMs, outageToMs);
+  UplinkQueue uplink(firmwareUplinkConfig());
+  for (uint32_t now = 0; now < durationMs; now += taskPeriodMs)
+  {
+    blynk.setNow(now);
+    uplink.offer(0, weightAt(now), now);
+    uplink.offer(1, weightAt(now), now);
+    uplink.service(blynk, now);
+  }
+  RunResult result;
+  result.label = "blynk (byte model)";
+  result.messages = blynk.messages;
+  result.bytes = blynk.bytes;
+  result.sent = blynk.sentPoints;
+  result.delivered = blynk.sentPoints - blynk.lost;
+  result.lost = blynk.lost;
+  result.dropped = uplink.droppedCount();
+  result.statusSequence = true;
+  return result;
+}
+
+RunResult runMqtt(const char *label, const char *host, uint16_t port, const std::string &topic, uint8_t qos, uint8_t format,
+                  uint32_t durationMs, uint32_t outageFromMs, uint32_t outageToMs)
+{
+  RunResult result;
+  result.label = label;
+  Subscriber dashboard(host, port, topic, format);
+  for (int wait = 0; wait < 100 && !dashboard.ready(); wait++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  FlakyConnection wifi(outageFromMs, outageToMs);
+  MqttConfig config;
+  const std::string clientId = "scale-" + topic;
+  config.clientId = clientId.c_str();
+  config.topic = topic.c_str();
+  config.info = format == UPLINK_PAYLOAD_BINARY ? "{\"format\":\"binary\",\"unit\":\"g\"}" : "{\"format\":\"compact\",\"unit\":\"g\"}";
+  MqttClient client(wifi, host, port, config);
+  MqttSink mqttSink(client, qos, format);
+  RecordingSink sink(mqttSink);
+  ConnectivityManager connectivity;
+  LinkConfig linkConfig;
+  linkConfig.attemptTimeoutMs = 3000;   // CLOUD_ATTEMPT_TIMEOUT_MS
+  linkConfig.backoffMinMs = 1000;
+  linkConfig.backoffMaxMs = 60000;
+  connectivity.addLink(client, linkConfig);
+  UplinkQueue uplink(firmwareUplinkConfig());
+
+  // Task4, then the same cycles without new values until the backlog is sent.
+  uint32_t now = 0;
+  for (; now < durationMs || ((uplink.backlogCount() != 0 || client.inflight() != 0) && now < durationMs * 2);
+       now += taskPeriodMs)
+  {
+    wifi.setNow(now);
+    connectivity.service(now);
+    client.poll(now);
+    if (now < durationMs)
+    {
+      uplink.offer(0, weightAt(now), now);
+      uplink.offer(1, weightAt(now), now);
+    }
+    uplink.service(sink, now);
+    std::this_thread::sleep_for(std::chrono::microseconds(stepRealUs));
+  }
+  for (int i = 0; i < 20; i++)
+  {
+    // the last PUBACKs
+    client.poll(now);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  client.disconnect();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  const MqttStats &stats = client.stats();
+  result.messages = stats.packetsSent;
+  result.bytes = stats.bytesSent;
+  result.resends = stats.resends;
+  result.sent = static_cast<uint32_t>(sink.sent.size());
+  result.dropped = uplink.droppedCount();
+
+  const std::vector<UplinkPoint> got = dashboard.points();
+  std::set<std::tuple<uint8_t, int32_t, uint32_t>> sentKeys;
+  for (const UplinkPoint &point : sink.sent)
+  {
+    sentKeys.insert(keyOf(point));
+  }
+  std::set<std::tuple<uint8_t, int32_t, uint32_t>> seen;
+  std::vector<UplinkPoint> firstCopies;
+  for (const UplinkPoint &point : got)
+  {
+    if (!seen.insert(keyOf(point)).second)
+    {
+      result.duplicates++;
+      continue;
+    }
+    result.complete = result.complete && sentKeys.count(keyOf(point)) != 0;
+    firstCopies.push_back(point);
+  }
+  result.complete = result.complete && dashboard.invalid() == 0;
+  result.delivered = static_cast<uint32_t>(firstCopies.size());
+  result.lost = result.sent > result.delivered ? result.sent - result.delivered : 0;
+  // in order: the first copies come in the order the uplink queue sent them.
+  size_t at = 0;
+  for (const UplinkPoint &point : firstCopies)
+  {
+    while (at < sink.sent.size() && keyOf(sink.sent[at]) != keyOf(point))
+    {
+      at++;
+    }
+    result.inOrder = result.inOrder && at < sink.sent.size();
+  }
+  // online, offline (the will, when the outage cut the connection), online again.
+  const std::vector<std::string> statuses = dashboard.statuses();
+  const char *expected[] = {"online", "offline", "online"};
+  size_t matched = 0;
+  for (const std::string &status : statuses)
+  {
+    matched += matched < 3 && status == expected[matched] ? 1 : 0;
+  }
+  result.statusSequence = matched == 3;
+  return result;
+}
+
+// how fast the client publishes full batches (MQTT_BATCH_POINTS points) when nothing else limits it.
+double burst(const char *host, uint16_t port, const std::string &topic, uint8_t qos, uint32_t messages, double &bytesPerSample)
+{
+  PosixTcpConnection tcp;
+  MqttConfig config;
+  const std::string clientId = "burst-" + topic;
+  config.clientId = clientId.c_str();
+  config.topic = topic.c_str();
+  MqttClient client(tcp, host, port, config);
+  client.connect();
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (!client.connected() && std::chrono::steady_clock::now() < deadline)
+  {
+    client.poll(0);
+  }
+  UplinkPoint points[MQTT_BATCH_POINTS];
+  uint8_t payload[MQTT_PACKET_MAX];
+  const uint32_t bytesBefore = client.stats().bytesSent;
+  uint32_t published = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while (published < messages && client.connected() && std::chrono::steady_clock::now() < start + std::chrono::seconds(10))
+  {
+    client.poll(0);
+    if (!client.canPublish(qos))
+    {
+      continue;
+    }
+    for (size_t i = 0; i < MQTT_BATCH_POINTS; i++)
+    {
+      points[i].pin = static_cast<uint8_t>(i % 2);
+      points[i].value = weightAt(published * 100u);
+      points[i].timestampMs = published * 1000u + static_cast<uint32_t>(i / 2) * 100u;
+    }
+    const size_t length = encodeUplinkPayload(UPLINK_PAYLOAD_BINARY, points, MQTT_BATCH_POINTS, payload, sizeof(payload));
+    published += client.publish("weight", payload, length, qos, false) ? 1 : 0;
+  }
+  while (client.inflight() != 0 && client.connected() && std::chrono::steady_clock::now() < start + std::chrono::seconds(12))
+  {
+    client.poll(0);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  bytesPerSample = published ? static_cast<double>(client.stats().bytesSent - bytesBefore) / (published * MQTT_BATCH_POINTS) : 0;
+  client.disconnect();
+  return published / seconds;
+}
+
+// the codecs against themselves: random batches, the longest values, a packet longer than 127 bytes.
+bool codecRoundTrip()
+{
+  std::minstd_rand rng(3);
+  std::uniform_int_distribution<int32_t> values(-3000000, 3000000);
+  std::uniform_int_distribution<uint32_t> steps(0, 70000);
+  bool ok = true;
+  for (int round = 0; round < 1000; round++)
+  {
+    UplinkPoint points[MQTT_BATCH_POINTS];
+    uint32_t timeMs = round == 0 ? 0xFFFFFF00u : rng();
+    const size_t count = 1 + static_cast<size_t>(round) % MQTT_BATCH_POINTS;
+    for (size_t i = 0; i < count; i++)
+    {
+      points[i].pin = static_cast<uint8_t>(i % 8);
+      points[i].value = round == 1 ? (i % 2 ? INT32_MIN : INT32_MAX) : values(rng);
+      points[i].timestampMs = timeMs;
+      timeMs += steps(rng);
+    }
+    for (uint8_t format : {UPLINK_PAYLOAD_COMPACT, UPLINK_PAYLOAD_BINARY})
+    {
+      uint8_t payload[MQTT_PACKET_MAX];
+      UplinkPoint decoded[MQTT_BATCH_POINTS];
+      const size_t length = encodeUplinkPayload(format, points, count, payload, sizeof(payload));
+      const size_t got = decodeUplinkPayload(format, payload, length, decoded, MQTT_BATCH_POINTS);
+      ok = ok && length != 0 && got == count;
+      for (size_t i = 0; i < got; i++)
+      {
+        ok = ok && keyOf(decoded[i]) == keyOf(points[i]);
+      }
+    }
+  }
+
+  uint8_t payload[200];
+  for (size_t i = 0; i < sizeof(payload); i++)
+  {
+    payload[i] = static_cast<uint8_t>(i);
+  }
+  uint8_t packet[MQTT_PACKET_MAX];
+  const size_t length = encodeMqttPublish("smartscale/weight", payload, sizeof(payload), 1, true, 0x1234, packet, sizeof(packet));
+  MqttReader reader;
+  size_t packets = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    packets += reader.push(packet[i]) ? 1 : 0;
+  }
+  char topic[32];
+  uint16_t packetId = 0;
+  const uint8_t *decoded = nullptr;
+  size_t decodedLength = 0;
+  ok = ok && packets == 1 && reader.type() == MqttPacket::Publish && reader.flags() == 0x03 &&
+       decodeMqttPublish(reader.body(), reader.length(), reader.flags(), topic, sizeof(topic), packetId, decoded,
+                         decodedLength) &&
+       std::strcmp(topic, "smartscale/weight") == 0 && packetId == 0x1234 && decodedLength == sizeof(payload) &&
+       std::memcmp(decoded, payload, sizeof(payload)) == 0;
+  return ok;
+}
+
+}  // namespace
+
+int runMqttScenario(const Options &options)
+{
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 600));
+  const uint32_t offlineS = static_cast<uint32_t>(options.get("offline", 120));
+  const uint32_t burstMessages = static_cast<uint32_t>(options.get("burst", 20000));
+  const std::string brokerOption = options.getString("broker", "");
+  const uint32_t durationMs = seconds * 1000u;
+  const uint32_t outageFromMs = durationMs / 3;
+  const uint32_t outageToMs = outageFromMs + offlineS * 1000u;
+
+  LoopbackBroker loopback;
+  std::string host = "127.0.0.1";
+  uint16_t port = 0;
+  if (brokerOption.empty())
+  {
+    if (!loopback.start())
+    {
+      std::printf("mqtt: cannot start the loopback broker\n");
+      return 1;
+    }
+    port = loopback.port();
+  }
+  else
+  {
+    const size_t colon = brokerOption.rfind(':');
+    host = brokerOption.substr(0, colon);
+    port = colon == std::string::npos ? 1883 : static_cast<uint16_t>(std::strtoul(brokerOption.c_str() + colon + 1, nullptr, 10));
+  }
+  // topics as long as the firmware one ("smartscale"); on a shared broker with the process id, so retained
+  // messages of an earlier run do not count.
+  const std::string prefix = brokerOption.empty() ? "smartscale-" : "smartscale-" + std::to_string(getpid()) + "-";
+
+  std::printf("mqtt: %u s of Task4 (every %u ms, uplink every %u ms, deadband %d g), WiFi lost at %u s for %u s "
+              "(noticed after %u s), broker %s:%u%s\n",
+              seconds, taskPeriodMs, firmwareUplinkConfig().minIntervalMs, firmwareUplinkConfig().deadband,
+              outageFromMs / 1000, offlineS, deadLinkMs / 1000, host.c_str(), static_cast<unsigned>(port),
+              brokerOption.empty() ? " (loopback)" : "");
+
+  std::vector<RunResult> results;
+  results.push_back(runBlynk(durationMs, outageFromMs, outageToMs));
+  struct Variant
+  {
+    const char *label;
+    const char *name;
+    uint8_t qos;
+    uint8_t format;
+  };
+  const Variant variants[] = {
+    {"mqtt compact, QoS 0", "c0", 0, UPLINK_PAYLOAD_COMPACT},
+    {"mqtt compact, QoS 1", "c1", 1, UPLINK_PAYLOAD_COMPACT},
+    {"mqtt binary, QoS 0", "b0", 0, UPLINK_PAYLOAD_BINARY},
+    {"mqtt binary, QoS 1", "b1", 1, UPLINK_PAYLOAD_BINARY},
+  };
+  for (const Variant &variant : variants)
+  {
+    results.push_back(runMqtt(variant.label, host.c_str(), port, prefix + variant.name, variant.qos, variant.format,
+                              durationMs, outageFromMs, outageToMs));
+  }
+
+  std::printf("\n  %-22s %8s %7s %9s %8s %9s %6s %5s %7s %8s\n", "path", "messages", "msg/s", "bytes", "B/sample",
+              "delivered", "lost", "dup", "resends", "dropped");
+  for (const RunResult &result : results)
+  {
+    std::printf("  %-22s %8u %7.2f %9llu %8.1f %9u %6u %5u %7u %8u\n", result.label, result.messages,
+                result.messages / static_cast<double>(seconds), static_cast<unsigned long long>(result.bytes),
+                result.delivered ? static_cast<double>(result.bytes) / result.delivered : 0.0, result.delivered,
+                result.lost, result.duplicates, result.resends, result.dropped);
+  }
+  std::printf("  (bytes: what the scale sends, protocol headers included, TCP/IP not; per delivered point)\n");
+
+  double bytesQos0 = 0;
+  double bytesQos1 = 0;
+  const double rateQos0 = burst(host.c_str(), port, prefix + "burst0", 0, burstMessages, bytesQos0);
+  const double rateQos1 = burst(host.c_str(), port, prefix + "burst1", 1, burstMessages, bytesQos1);
+  std::printf("\n  burst of %u binary messages of %u points:\n", burstMessages, static_cast<unsigned>(MQTT_BATCH_POINTS));
+  std::printf("    QoS 0  %9.0f msg/s  %9.0f samples/s  %5.1f B/sample\n", rateQos0, rateQos0 * MQTT_BATCH_POINTS, bytesQos0);
+  std::printf("    QoS 1  %9.0f msg/s  %9.0f samples/s  %5.1f B/sample  (window of %u)\n", rateQos1,
+              rateQos1 * MQTT_BATCH_POINTS, bytesQos1, static_cast<unsigned>(MQTT_INFLIGHT_MAX));
+  if (brokerOption.empty())
+  {
+    std::printf("  loopback broker: %u PUBLISH received, %u last wills\n", loopback.publishesReceived(),
+                loopback.willsPublished());
+  }
+
+  const RunResult &blynk = results[0];
+  bool qos1Complete = true;
+  bool qos0Sane = true;
+  bool inOrder = true;
+  bool status = true;
+  for (size_t i = 1; i < results.size(); i++)
+  {
+    const RunResult &result = results[i];
+    const bool qos1 = variants[i - 1].qos == 1;
+    qos1Complete = qos1Complete && (!qos1 || (result.lost == 0 && result.sent != 0));
+    qos0Sane = qos0Sane && result.complete && (qos1 || result.delivered != 0);
+    inOrder = inOrder && result.inOrder;
+    status = status && result.statusSequence;
+  }
+  const RunResult &binaryQos1 = results[4];
+  const double blynkPerSample = static_cast<double>(blynk.bytes) / blynk.delivered;
+  const double binaryPerSample = static_cast<double>(binaryQos1.bytes) / binaryQos1.delivered;
+  const double compactPerSample = static_cast<double>(results[2].bytes) / results[2].delivered;
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  ok &= check(codecRoundTrip(), "compact and binary payloads and MQTT packets decode to what was encoded");
+  ok &= check(qos1Complete, "QoS 1: every point taken before, during and after the outage reaches the dashboard");
+  ok &= check(inOrder, "the dashboard gets the points in the order they were taken (repeats aside)");
+  ok &= check(qos0Sane,
+              "QoS 0: only points that were sent arrive, what vanished before the outage was noticed is counted");
+  ok &= check(status, "the retained status goes online, offline (last will), online");
+  ok &= check(binaryPerSample < compactPerSample && bytesQos1 < blynkPerSample,
+               "binary payloads take fewer bytes per sample than compact ones and, in full batches, than Blynk");
+  return ok ? 0 : 1;
+}
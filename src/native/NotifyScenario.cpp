@@ -0,0 +1,178 @@
+/**
+ * NotifyScenario.cpp
+ *  Compares the old fixed-period publishing (Task1 samples every 500 ms, Task3 broadcasts every 1 s)
+ *  with change-driven publishing (every sample goes through WeightProcessor and ChangeDetector, the
+ *  web task is woken only when the detector says so), on the same simulated load trace:
+ *    - end-to-end latency: from a load change to the first message within 2 g of the new weight,
+ *    - network traffic while nothing happens on the platform.
+ *  The simulation uses a SimClock and runs much faster than real time.
+ *  Returns 1 if change-driven publishing misses a load change, is not faster than the fixed periods
+ *  (p50) or sends more than the heartbeats while idle.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+#include "Stats.h"
+#include "Telemetry.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+const int32_t offset = 84000;
+const float countsPerGram = -396.99f;
+const int32_t toleranceMg = 2000;
+
+struct LoadChange
+{
+  uint32_t atUs;
+  int32_t grams;
+};
+
+struct Result
+{
+  LatencyStats latencyMs;
+  uint32_t messages = 0;
+  uint32_t idleMessages = 0;
+  uint64_t bytes = 0;
+};
+
+// tracks when the published weight first matches the load after each change.
+class LatencyProbe
+{
+public:
+  explicit LatencyProbe(const std::vector<LoadChange> &changes) : changes_(changes) {}
+
+  void onMessage(uint32_t nowUs, int32_t weightMg, Result &result)
+  {
+    while (next_ < changes_.size() && changes_[next_].atUs <= nowUs)
+    {
+      pending_ = true;
+      current_ = next_++;
+    }
+    if (pending_ && std::abs(weightMg - changes_[current_].grams * 1000) <= toleranceMg)
+    {
+      result.latencyMs.add((nowUs - changes_[current_].atUs) / 1000u);
+      pending_ = false;
+    }
+  }
+
+private:
+  const std::vector<LoadChange> &changes_;
+  size_t next_ = 0;
+  size_t current_ = 0;
+  bool pending_ = false;
+};
+
+}  // namespace
+
+int runNotifyScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 10));
+  const uint32_t changes = static_cast<uint32_t>(options.get("changes", 200));
+  const uint32_t idleSeconds = static_cast<uint32_t>(options.get("idle", 600));
+  const int32_t deadbandMg = static_cast<int32_t>(options.get("deadband", 1000));
+  const uint32_t heartbeatMs = static_cast<uint32_t>(options.get("heartbeat", 10000));
+
+  // random loads every 5..15 s, then a long idle period with the last load left on the platform.
+  std::minstd_rand rng(3);
+  std::vector<LoadChange> loads;
+  uint32_t t = 2000000;
+  for (uint32_t i = 0; i < changes; i++)
+  {
+    loads.push_back({t, static_cast<int32_t>(rng() % 4000)});
+    t += 5000000u + static_cast<uint32_t>(rng() % 10000000u);
+  }
+  const uint32_t idleStartUs = t + 5000000u;
+  const uint32_t endUs = idleStartUs + idleSeconds * 1000000u;
+
+  const uint32_t periodUs = 1000000u / sps;
+  std::uniform_int_distribution<int32_t> noise(-200, 200);
+  Result fixed;
+  Result driven;
+  LatencyProbe fixedProbe(loads);
+  LatencyProbe drivenProbe(loads);
+
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(5000, 500000);
+  processor.filter().converter().setCalibration(offset, countsPerGram);
+  ChangeDetector detector(deadbandMg, heartbeatMs * 1000u);
+  char json[32];
+
+  size_t loadIndex = 0;
+  int32_t grams = 0;
+  int32_t lastRaw = offset;
+  long fixedWeight = 0;  // the old currentWeight
+  for (uint32_t now = 0; now < endUs; now += 500)  // 0.5 ms steps
+  {
+    while (loadIndex < loads.size() && loads[loadIndex].atUs <= now)
+    {
+      grams = loads[loadIndex++].grams;
+    }
+    // a new conversion every sample period.
+    if (now % periodUs == 0)
+    {
+      lastRaw = offset + static_cast<int32_t>(static_cast<float>(grams) * countsPerGram) + noise(rng);
+
+      // change-driven: every sample is filtered, the web task is woken on a change or a heartbeat.
+      acquisition.onSample(lastRaw, now);
+      const ScaleState state = processor.update(acquisition, offset, now);
+      if (detector.check(state, now) != ChangeReason::None)
+      {
+        driven.messages++;
+        driven.idleMessages += now >= idleStartUs ? 1 : 0;
+        driven.bytes += encodeWeightJson(state, json, sizeof(json)) + 2;
+        drivenProbe.onMessage(now, state.weightMg, driven);
+      }
+    }
+    // fixed: Task1 reads get_units() every 500 ms, Task3 broadcasts currentWeight every 1 s.
+    if (now % 500000u == 0)
+    {
+      fixedWeight = static_cast<long>(static_cast<float>(lastRaw - offset) / countsPerGram);
+    }
+    if (now % 1000000u == 250000u)
+    {
+      ScaleState state = {};
+      state.weight = static_cast<int32_t>(fixedWeight);
+      state.weightMg = state.weight * 1000;
+      fixed.messages++;
+      fixed.idleMessages += now >= idleStartUs ? 1 : 0;
+      fixed.bytes += encodeWeightJson(state, json, sizeof(json)) + 2;
+      fixedProbe.onMessage(now, state.weightMg, fixed);
+    }
+  }
+
+  const double totalMinutes = endUs / 60e6;
+  std::printf("notify: %u load changes then %u s idle, %u SPS, deadband %d mg, heartbeat %u ms\n", changes,
+              idleSeconds, sps, deadbandMg, heartbeatMs);
+  std::printf("  %-14s %-34s %-16s %s\n", "", "latency to within 2 g", "idle msgs/min", "total msgs/min (bytes)");
+  const struct
+  {
+    const char *name;
+    Result *result;
+  } rows[] = {{"fixed 500/1000", &fixed}, {"change-driven", &driven}};
+  for (const auto &row : rows)
+  {
+    Result &r = *row.result;
+    std::printf("  %-14s p50=%4u ms p99=%4u ms (n=%zu)      %6.2f          %7.1f (%llu)\n", row.name,
+                r.latencyMs.percentile(50), r.latencyMs.percentile(99), r.latencyMs.count(),
+                r.idleMessages / (idleSeconds / 60.0), r.messages / totalMinutes,
+                static_cast<unsigned long long>(r.bytes));
+  }
+
+  const uint32_t heartbeats = idleSeconds * 1000u / heartbeatMs + 1u;
+  bool ok = true;
+  printChecks();
+  ok &= check(driven.latencyMs.count() == changes, "change-driven: every load change is published");
+  ok &= check(driven.latencyMs.percentile(50) < fixed.latencyMs.percentile(50),
+              "change-driven latency (p50) below the fixed periods");
+  ok &= check(driven.idleMessages <= heartbeats, "change-driven: only the heartbeats while idle");
+  return ok ? 0 : 1;
+}
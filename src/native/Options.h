@@ -0,0 +1,43 @@
+/**
+ * Options.h
+ *  key=value command line options for the native scenarios, e.g. "acquisition sps=80 seconds=5".
+ */
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+class Options
+{
+public:
+  Options(int argc, char **argv) : argc_(argc), argv_(argv) {}
+
+  long get(const char *key, long defaultValue) const
+  {
+    const char *value = find(key);
+    return value ? std::strtol(value, nullptr, 10) : defaultValue;
+  }
+
+  const char *getString(const char *key, const char *defaultValue) const
+  {
+    const char *value = find(key);
+    return value ? value : defaultValue;
+  }
+
+private:
+  const char *find(const char *key) const
+  {
+    const size_t length = std::strlen(key);
+    for (int i = 0; i < argc_; i++)
+    {
+      if (std::strncmp(argv_[i], key, length) == 0 && argv_[i][length] == '=')
+      {
+        return argv_[i] + length + 1;
+      }
+    }
+    return nullptr;
+  }
+
+  int argc_;
+  char **argv_;
+};
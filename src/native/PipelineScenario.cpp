@@ -0,0 +1,147 @@
+/**
+ * PipelineScenario.cpp
+ *  Benchmark of the weighing pipeline on simulated hardware:
+ *    - sample -> filter -> publish latency (acquisition ring, WeightProcessor, snapshot, JSON, broadcast),
+ *    - JSON encode time,
+ *    - broadcast cost per WebSocket client.
+ *  Timestamps come from a SimClock, so the run does not depend on real time and runs as fast as it can.
+ *  Returns 1 if the pipeline does not weigh the load, drops a message or is slower than the sample period.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "ScaleState.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+#include "Stats.h"
+#include "Telemetry.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+const int32_t offset = 84000;
+const float countsPerGram = -396.99f;
+
+using SteadyClock = std::chrono::steady_clock;
+
+uint32_t nanosBetween(SteadyClock::time_point start, SteadyClock::time_point end)
+{
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// runs body count times and returns the mean time per call in ns.
+template <typename Body>
+double meanNanos(uint32_t count, Body body)
+{
+  const SteadyClock::time_point start = SteadyClock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    body(i);
+  }
+  return std::chrono::duration<double, std::nano>(SteadyClock::now() - start).count() / count;
+}
+
+}  // namespace
+
+int runPipelineScenario(const Options &options)
+{
+  const uint32_t samples = static_cast<uint32_t>(options.get("samples", 200000));
+  const size_t clients = static_cast<size_t>(options.get("clients", 4));
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+
+  std::minstd_rand rng(7);
+  std::uniform_int_distribution<int32_t> noise(-200, 200);
+  std::vector<int32_t> raw(samples);
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    // a 250 g load every other second.
+    const bool loaded = ((i / sps) & 1u) != 0;
+    raw[i] = offset + (loaded ? static_cast<int32_t>(250.0f * countsPerGram) : 0) + noise(rng);
+  }
+
+  SimClock clock;
+  const uint32_t periodUs = 1000000u / sps;
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(5000, 500000);
+  processor.filter().converter().setCalibration(offset, countsPerGram);
+  ScaleStateSnapshot snapshot;
+  SimTransport transport(clients);
+  char json[32];
+
+  // 1- end to end, one sample at a time. The weight at the end of every second (loaded or empty) is kept.
+  LatencyStats endToEnd;
+  endToEnd.reserve(samples);
+  bool sent = true;
+  int32_t loadedMg = 0;
+  int32_t emptyMg = 0;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    clock.advanceUs(periodUs);
+    const SteadyClock::time_point start = SteadyClock::now();
+    acquisition.onSample(raw[i], clock.micros());
+    const ScaleState state = processor.update(acquisition, offset, clock.micros());
+    snapshot.publish(state);
+    ScaleState copy;
+    snapshot.read(copy);
+    const size_t length = encodeWeightJson(copy, json, sizeof(json));
+    sent &= length > 0 && transport.broadcastText(json, length);
+    endToEnd.add(nanosBetween(start, SteadyClock::now()));
+    if (i % sps == sps - 1)
+    {
+      (((i / sps) & 1u) != 0 ? loadedMg : emptyMg) = copy.weightMg;
+    }
+  }
+  std::printf("pipeline: %u samples at %u SPS (simulated clock), %zu clients\n", samples, sps, clients);
+  endToEnd.print("sample->filter->publish", "ns");
+
+  // 2- the same stages one by one (mean, the clock overhead is spread over the whole loop).
+  Hx711Acquisition acquisition2;
+  WeightProcessor processor2(5000, 500000);
+  processor2.filter().converter().setCalibration(offset, countsPerGram);
+  std::vector<ScaleState> states(samples);
+  clock.setUs(0);
+  const double tAcquire = meanNanos(samples, [&](uint32_t i) { acquisition2.onSample(raw[i], i * periodUs); });
+  Hx711Acquisition acquisition3;
+  const double tProcess = meanNanos(samples, [&](uint32_t i) {
+    acquisition3.onSample(raw[i], i * periodUs);
+    states[i] = processor2.update(acquisition3, offset, i * periodUs);
+  }) - tAcquire;
+  const double tPublish = meanNanos(samples, [&](uint32_t i) {
+    snapshot.publish(states[i]);
+    ScaleState copy;
+    snapshot.read(copy);
+  });
+  size_t jsonBytes = 0;
+  const double tJson = meanNanos(samples, [&](uint32_t i) { jsonBytes += encodeWeightJson(states[i], json, sizeof(json)); });
+  std::printf("  stages (mean per sample)\n");
+  std::printf("    acquire (ring push)        %8.1f ns\n", tAcquire);
+  std::printf("    filter + convert           %8.1f ns\n", tProcess);
+  std::printf("    publish + read snapshot    %8.1f ns\n", tPublish);
+  std::printf("    JSON encode                %8.1f ns  (%.1f bytes)\n", tJson,
+              static_cast<double>(jsonBytes) / samples);
+
+  // 3- broadcast cost against the number of clients.
+  std::printf("  broadcast (JSON message)\n");
+  const size_t length = encodeWeightJson(states[0], json, sizeof(json));
+  for (size_t count : {1, 2, 4, 8, 16, 32})
+  {
+    SimTransport many(count);
+    const double t = meanNanos(samples / 4, [&](uint32_t) { many.broadcastText(json, length); });
+    std::printf("    %2zu clients                 %8.1f ns  (%.1f ns per client)\n", count, t,
+                t / static_cast<double>(count));
+  }
+
+  bool ok = true;
+  printChecks();
+  ok &= check(std::abs(loadedMg - 250000) <= 1000 && std::abs(emptyMg) <= 1000,
+              "the 250 g load and the empty platform weigh within 1 g");
+  ok &= check(sent, "every sample is encoded and sent to every client");
+  ok &= check(endToEnd.percentile(99) < periodUs * 1000u, "sample->filter->publish (p99) within one sample period");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/**
+ * PosixTcp.h
+ *  TcpConnection (Hal.h) on a POSIX socket for the native build: the MQTT client talks to a real broker
+ *  (the loopback broker of the scenario, or mosquitto with broker=host:port).
+ */
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+
+#include "Hal.h"
+
+// connects to host:port, TCP_NODELAY like WiFiClient::setNoDelay(). Returns the socket, -1 on failure.
+inline int openTcpSocket(const char *host, uint16_t port)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  char service[8];
+  std::snprintf(service, sizeof(service), "%u", static_cast<unsigned>(port));
+  addrinfo *found = nullptr;
+  if (getaddrinfo(host, service, &hints, &found) != 0)
+  {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo *at = found; at && fd < 0; at = at->ai_next)
+  {
+    fd = socket(at->ai_family, at->ai_socktype, at->ai_protocol);
+    if (fd >= 0 && connect(fd, at->ai_addr, at->ai_addrlen) != 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  if (fd >= 0)
+  {
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+// writes everything (blocking), returns false if the connection failed.
+inline bool writeAll(int fd, const uint8_t *data, size_t length)
+{
+  while (length != 0)
+  {
+    const ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+    if (written <= 0)
+    {
+      if (written < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+class PosixTcpConnection : public TcpConnection
+{
+public:
+  ~PosixTcpConnection() override { close(); }
+
+  bool open(const char *host, uint16_t port) override
+  {
+    close();
+    fd_ = openTcpSocket(host, port);
+    return fd_ >= 0;
+  }
+
+  void close() override
+  {
+    if (fd_ >= 0)
+    {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  bool isOpen() override { return fd_ >= 0; }
+
+  size_t write(const uint8_t *data, size_t length) override
+  {
+    if (fd_ < 0 || !writeAll(fd_, data, length))
+    {
+      return 0;
+    }
+    return length;
+  }
+
+  size_t read(uint8_t *out, size_t max) override
+  {
+    if (fd_ < 0)
+    {
+      return 0;
+    }
+    const ssize_t count = recv(fd_, out, max, MSG_DONTWAIT);
+    if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+      close();   // closed by the server
+      return 0;
+    }
+    return count > 0 ? static_cast<size_t>(count) : 0;
+  }
+
+private:
+  int fd_ = -1;
+};
@@ -0,0 +1,508 @@
+/**
+ * PowerScenario.cpp
+ *  The low-power mode (LOW_POWER, PowerScheduler.h) against the current firmware, on a simulated clock: a
+ *  day of a kitchen scale (loads put on and taken off in a few sessions, long quiet gaps) or a recorded trace
+ *  (file=, "trace start" on the scale) runs through the classes of Task1 (Hx711Acquisition, WeightProcessor,
+ *  ChangeDetector, DisplayChangeDetector) and the real PowerScheduler, millisecond by millisecond. The tasks
+ *  wake up as they do in main.cpp:
+ *    - current firmware: Task1 at every conversion, Task5 every 5 ms, Task7 every 50 ms, Task4 every 100 ms,
+ *      Task6 every 30 s, Task2 when the digits to show change, Task3 when Task1 publishes a change or a
+ *      heartbeat and every 5 s,
+ *    - low power: the same while Active; Idle and PowerDown batch Task4, Task5 and Task7 into one window per
+ *      batch=, powered down Task1 only wakes for the probes (power_up(), then the first conversion).
+ *  Tasks released in the same millisecond share one wake-up of the chip. Reported per run: wake-ups, the
+ *  awake time and duty cycle of the CPU with the cost model below, how long the HX711s and the display were
+ *  on, the time per power state, the reaction to every load (until the published weight moved half way to
+ *  it) and an average current estimated from the duty cycle. A load put on 1 ms after powering down (the
+ *  longest wait for the first probe) is run on its own.
+ *  Returns 1 if a check fails.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "DisplayStage.h"
+#include "Hx711Acquisition.h"
+#include "PowerScheduler.h"
+#include "RawTrace.h"
+#include "Scenarios.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+// the firmware's settings (main.cpp).
+const uint32_t readyTimeoutUs = 500000;        // HX711_READY_TIMEOUT_MS
+const int32_t publishDeadbandMg = 1000;        // PUBLISH_DEADBAND_MG
+const uint32_t publishHeartbeatUs = 10000000;  // PUBLISH_HEARTBEAT_MS
+const uint32_t uplinkPeriodMs = 100;           // UPLINK_TASK_PERIOD_MS (Task4)
+const uint32_t networkPeriodMs = 5;            // NETWORK_TASK_PERIOD_MS (Task5)
+const uint32_t logPeriodMs = 50;               // LOG_DRAIN_PERIOD_MS (Task7)
+const uint32_t reportPeriodMs = 30000;         // TASK_REPORT_MS (Task6)
+const uint32_t metricsPushMs = 5000;           // METRICS_PUSH_MS (Task3's timeout)
+const float defaultCountsPerGram = -396.99f;
+const int32_t capacityGrams = 5000;
+
+// cost model: CPU time of one run of a task and of one wake-up of the chip (leaving and entering the light
+// sleep). Assumed values of the order of the run times of the task report, not measurements.
+const uint32_t wakeCostUs = 400;
+const uint32_t task1ConversionUs = 150;   // read the HX711s, filter, publish
+const uint32_t task1ProbeUs = 50;         // power_up() of a probe
+const uint32_t task2Us = 300;             // display (bit-banged TM1637)
+const uint32_t task3Us = 120;             // web socket fan-out
+const uint32_t task4Us = 150;             // connectivity, uplink queue
+const uint32_t task5Us = 40;              // handleClient(), webSocket.loop()
+const uint32_t task6Us = 3000;            // task report
+const uint32_t task7Us = 20;              // log drain
+
+// current model (mA) for the estimate: CPU running, CPU waiting in the idle task (current firmware), chip in
+// light sleep (low power), one HX711 converting, the display lit.
+const double cpuRunMa = 45.0;
+const double cpuIdleMa = 22.0;
+const double lightSleepMa = 2.0;
+const double hx711Ma = 1.5;
+const double displayMa = 15.0;
+
+// the counts of the combined signal over time: a step at every change (the synthetic loads, every frame of
+// a trace), noise added at every conversion.
+struct SignalStep
+{
+  uint64_t timeMs;
+  int32_t counts;
+};
+
+// a load put on or taken off (synthetic signal only): the scale must show it.
+struct LoadEvent
+{
+  uint64_t timeMs;
+  int32_t fromMg;
+  int32_t toMg;
+};
+
+struct Signal
+{
+  std::vector<SignalStep> steps;
+  std::vector<LoadEvent> loads;
+  uint64_t durationMs = 0;
+  int32_t noise = 0;
+  float countsPerGram = defaultCountsPerGram;
+  uint8_t cells = 1;
+  uint32_t sps = 10;
+};
+
+// sessions at random times: a few loads put on, held and taken off; the platform is empty in between.
+Signal synthesize(uint32_t hours, uint32_t sessionsPerHour, int32_t noise, uint32_t sps)
+{
+  Signal signal;
+  signal.noise = noise;
+  signal.sps = sps;
+  signal.durationMs = static_cast<uint64_t>(hours) * 3600000u;
+  std::minstd_rand rng(11);
+  std::uniform_int_distribution<int32_t> gramsDist(50, capacityGrams * 9 / 10);
+  std::uniform_int_distribution<uint32_t> holdDist(5000, 60000);
+  std::uniform_int_distribution<uint32_t> loadsDist(1, 4);
+  const uint32_t sessions = hours * sessionsPerHour;
+  const uint64_t spacing = sessions != 0 ? signal.durationMs / sessions : signal.durationMs;
+  std::uniform_int_distribution<uint64_t> startDist(0, spacing / 2);
+  signal.steps.push_back({0, 0});
+  int32_t grams = 0;
+  auto put = [&](uint64_t timeMs, int32_t newGrams) {
+    signal.loads.push_back({timeMs, grams * 1000, newGrams * 1000});
+    signal.steps.push_back({timeMs, static_cast<int32_t>(static_cast<float>(newGrams) * signal.countsPerGram)});
+    grams = newGrams;
+  };
+  for (uint32_t session = 0; session < sessions; session++)
+  {
+    uint64_t timeMs = session * spacing + spacing / 4 + startDist(rng);
+    const uint32_t loads = loadsDist(rng);
+    for (uint32_t load = 0; load < loads; load++)
+    {
+      put(timeMs, gramsDist(rng));
+      timeMs += holdDist(rng);
+    }
+    put(timeMs, 0);
+  }
+  return signal;
+}
+
+bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+  FILE *file = std::fopen(path, "rb");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  uint8_t buffer[4096];
+  size_t length;
+  while ((length = std::fread(buffer, 1, sizeof(buffer), file)) != 0)
+  {
+    out.insert(out.end(), buffer, buffer + length);
+  }
+  std::fclose(file);
+  return true;
+}
+
+// a recorded trace: every frame (one conversion per load cell) combined like LoadCellArray does, in counts of
+// channel 0. The trace has its own noise and no known load times (no reaction is measured).
+bool loadTrace(const char *path, Signal &signal)
+{
+  std::vector<uint8_t> file;
+  if (!readFile(path, file))
+  {
+    return false;
+  }
+  TraceReader reader(file.data(), file.size());
+  if (!reader.valid())
+  {
+    return false;
+  }
+  const TraceHeader &header = reader.header();
+  signal.cells = header.channels;
+  signal.sps = header.sps;
+  signal.countsPerGram = header.countsPerGram;
+  int32_t latest[LOAD_CELL_MAX_CHANNELS] = {};
+  uint32_t seen = 0;
+  uint32_t lastUs = 0;
+  uint64_t timeUs = 0;
+  bool first = true;
+  TraceRecord record;
+  while (reader.next(record))
+  {
+    if (record.kind != TraceRecordKind::Sample || record.channel >= header.channels)
+    {
+      continue;
+    }
+    timeUs += first ? 0 : static_cast<uint32_t>(record.timeUs - lastUs);   // the trace time wraps after 71 minutes
+    lastUs = record.timeUs;
+    first = false;
+    latest[record.channel] = record.value;
+    seen |= 1u << record.channel;
+    if (seen == (1u << header.channels) - 1u)
+    {
+      float combined = 0;
+      for (uint8_t channel = 0; channel < header.channels; channel++)
+      {
+        combined += static_cast<float>(latest[channel] - header.offsets[channel]) * header.trims[channel] *
+                    header.channelCountsPerGram[0] / header.channelCountsPerGram[channel];
+      }
+      signal.steps.push_back({timeUs / 1000, static_cast<int32_t>(combined)});
+      seen = 0;
+    }
+  }
+  signal.durationMs = timeUs / 1000;
+  return !signal.steps.empty();
+}
+
+struct SimResult
+{
+  uint64_t wakes = 0;
+  uint64_t awakeUs = 0;
+  uint64_t conversions = 0;
+  uint64_t hx711OnMs = 0;
+  uint64_t displayOnMs = 0;
+  uint32_t reacted = 0;
+  uint64_t reactionSumMs = 0;
+  uint64_t reactionMaxMs = 0;
+  uint64_t firstPowerDownMs = 0;   // Idle -> PowerDown (0: never)
+  PowerStats power = {};
+};
+
+/**
+ * @brief One run over the whole signal, one step per millisecond.
+ * @param lowPower: false is the current firmware (the scheduler is not used).
+ */
+SimResult simulate(const Signal &signal, const PowerConfig &config, bool lowPower)
+{
+  SimResult result;
+  PowerScheduler scheduler(config);
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(capacityGrams * signal.cells, readyTimeoutUs);
+  processor.filter().converter().setCalibration(0, signal.countsPerGram);
+  ChangeDetector changeDetector(publishDeadbandMg, publishHeartbeatUs);
+  DisplayChangeDetector displayChange;
+  std::minstd_rand rng(5);
+  std::uniform_int_distribution<int32_t> noiseDist(-signal.noise, signal.noise);
+
+  const uint32_t periodMs = 1000u / signal.sps;
+  bool hx711On = true;
+  uint64_t nextConversionMs = periodMs;
+  uint64_t probeAtMs = 0;          // Task1's wait while the HX711s are powered down
+  uint64_t next4 = 0, next5 = 0, next6 = reportPeriodMs, next7 = 0, next3 = 0;
+  bool displayOn = true;
+  size_t step = 0;
+  size_t load = 0;
+  scheduler.begin(0);
+
+  auto apply = [&](PowerAction action, uint64_t nowMs) {
+    if (action == PowerAction::PowerUp)
+    {
+      hx711On = true;
+      nextConversionMs = nowMs + config.hx711SettleMs;   // the first conversion after the settling time
+      processor.filter().reset();
+    }
+    else if (action == PowerAction::PowerDown)
+    {
+      hx711On = false;
+      if (result.firstPowerDownMs == 0)
+      {
+        result.firstPowerDownMs = nowMs;
+      }
+    }
+    if (!hx711On)
+    {
+      probeAtMs = nowMs + std::max<uint32_t>(1, scheduler.msUntilProbe(static_cast<uint32_t>(nowMs)));
+    }
+  };
+
+  for (uint64_t t = 0; t < signal.durationMs; t++)
+  {
+    while (step + 1 < signal.steps.size() && signal.steps[step + 1].timeMs <= t)
+    {
+      step++;
+    }
+    const uint32_t nowMs = static_cast<uint32_t>(t);
+    const uint32_t nowUs = static_cast<uint32_t>(t * 1000);
+    uint64_t costUs = 0;
+    bool notify = false;
+    bool digits = false;
+
+    // Task1
+    if (hx711On && t >= nextConversionMs)
+    {
+      costUs += task1ConversionUs;
+      result.conversions++;
+      nextConversionMs += periodMs;
+      acquisition.onSample(signal.steps[step].counts + noiseDist(rng), nowUs);
+      if (lowPower)
+      {
+        apply(scheduler.poll(nowMs, false), t);
+      }
+      const ScaleState state = processor.update(acquisition, 0, nowUs);
+      bool publish = true;
+      if (lowPower)
+      {
+        apply(scheduler.onWeight(state.weightMg, state.isReady() && !state.isOverload(), nowMs), t);
+        publish = scheduler.state() != PowerState::PowerDown;
+      }
+      if (publish)
+      {
+        // the published weight moved half way to a new load: the scale showed it.
+        while (load < signal.loads.size() && signal.loads[load].timeMs <= t &&
+               std::abs(state.weightMg - signal.loads[load].fromMg) >
+                   std::abs(signal.loads[load].toMg - signal.loads[load].fromMg) / 2)
+        {
+          const uint64_t reactionMs = t - signal.loads[load].timeMs;
+          result.reacted++;
+          result.reactionSumMs += reactionMs;
+          result.reactionMaxMs = std::max(result.reactionMaxMs, reactionMs);
+          load++;
+        }
+        digits = displayChange.check(state);
+        notify = changeDetector.check(state, nowUs) != ChangeReason::None;
+      }
+    }
+    else if (lowPower && !hx711On && t >= probeAtMs)
+    {
+      costUs += task1ProbeUs;   // woken for a probe: poll() powers the HX711s up
+      apply(scheduler.poll(nowMs, false), t);
+    }
+    // the display follows the power state (runPowerAction() wakes Task2).
+    const bool displayShouldBeOn = !lowPower || scheduler.state() != PowerState::PowerDown;
+    bool task2 = digits && displayShouldBeOn;
+    if (displayShouldBeOn != displayOn)
+    {
+      displayOn = displayShouldBeOn;
+      task2 = true;
+    }
+    costUs += task2 ? task2Us : 0;
+    // Task3: woken by Task1 or its own timeout.
+    if (notify || t >= next3)
+    {
+      costUs += task3Us;
+      next3 = t + metricsPushMs;
+    }
+    // the network tasks: their period, or the next window while the low-power mode batches them.
+    const bool batched = lowPower && scheduler.networkBatched();
+    auto network = [&](uint64_t &next, uint32_t period, uint32_t cost) {
+      if (t >= next)
+      {
+        costUs += cost;
+        next = batched ? scheduler.nextNetworkMs(nowMs) : t + period;
+      }
+    };
+    network(next4, uplinkPeriodMs, task4Us);
+    network(next5, networkPeriodMs, task5Us);
+    network(next7, logPeriodMs, task7Us);
+    if (t >= next6)
+    {
+      costUs += task6Us;
+      next6 += reportPeriodMs;
+    }
+    if (costUs != 0)
+    {
+      result.wakes++;
+      result.awakeUs += wakeCostUs + costUs;
+    }
+    result.hx711OnMs += hx711On ? 1 : 0;
+    result.displayOnMs += displayOn ? 1 : 0;
+  }
+  result.power = scheduler.stats(static_cast<uint32_t>(signal.durationMs));
+  return result;
+}
+
+// the platform stays empty, then a load is put on at loadMs (0: never).
+Signal loadAt(const Signal &like, uint64_t loadMs, uint64_t durationMs)
+{
+  Signal signal;
+  signal.noise = like.noise;
+  signal.sps = like.sps;
+  signal.durationMs = durationMs;
+  signal.steps.push_back({0, 0});
+  if (loadMs != 0)
+  {
+    const int32_t grams = capacityGrams / 5;
+    signal.steps.push_back({loadMs, static_cast<int32_t>(static_cast<float>(grams) * signal.countsPerGram)});
+    signal.loads.push_back({loadMs, 0, grams * 1000});
+  }
+  return signal;
+}
+
+double percent(uint64_t part, uint64_t whole)
+{
+  return whole != 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+// average current of a run with the model above.
+double estimateMa(const SimResult &r, const Signal &signal, bool lowPower)
+{
+  const double totalUs = static_cast<double>(signal.durationMs) * 1000.0;
+  const double duty = static_cast<double>(r.awakeUs) / totalUs;
+  const double ms = static_cast<double>(signal.durationMs);
+  return duty * cpuRunMa + (1.0 - duty) * (lowPower ? lightSleepMa : cpuIdleMa) +
+         static_cast<double>(r.hx711OnMs) / ms * hx711Ma * signal.cells + static_cast<double>(r.displayOnMs) / ms * displayMa;
+}
+
+void printRun(const char *name, const SimResult &r, const Signal &signal, bool lowPower)
+{
+  const double seconds = static_cast<double>(signal.durationMs) / 1000.0;
+  std::printf("  %-13s %10llu %8.1f %9.1f s %6.2f %%  %7.1f %%  %7.1f %%  %6.1f mA  %4u  %6.0f/%-6llu\n", name,
+              static_cast<unsigned long long>(r.wakes), static_cast<double>(r.wakes) / seconds,
+              static_cast<double>(r.awakeUs) / 1e6, percent(r.awakeUs, signal.durationMs * 1000),
+              percent(r.hx711OnMs, signal.durationMs), percent(r.displayOnMs, signal.durationMs),
+              estimateMa(r, signal, lowPower), r.reacted,
+              r.reacted != 0 ? static_cast<double>(r.reactionSumMs) / r.reacted : 0.0,
+              static_cast<unsigned long long>(r.reactionMaxMs));
+}
+
+}  // namespace
+
+int runPowerScenario(const Options &options)
+{
+  const char *path = options.getString("file", nullptr);
+  Signal signal;
+  if (path != nullptr)
+  {
+    if (!loadTrace(path, signal))
+    {
+      std::printf("power: %s is not a trace\n", path);
+      return 1;
+    }
+  }
+  else
+  {
+    signal = synthesize(static_cast<uint32_t>(options.get("hours", 8)), static_cast<uint32_t>(options.get("sessions", 3)),
+                        static_cast<int32_t>(options.get("noise", 150)), static_cast<uint32_t>(options.get("sps", 10)));
+  }
+  PowerConfig config;   // the firmware's POWER_* settings
+  config.samplePeriodMs = 1000u / signal.sps;
+  config.hx711SettleMs = signal.sps == 80 ? 50 : 400;
+  config.maxReactionMs = static_cast<uint32_t>(options.get("reaction", 2000));
+  config.idleAfterMs = static_cast<uint32_t>(options.get("idle", 10000));
+  config.powerDownAfterMs = static_cast<uint32_t>(options.get("down", 60000));
+  config.networkBatchMs = static_cast<uint32_t>(options.get("batch", 1000));
+  config.changeBandMg = static_cast<int32_t>(options.get("band", 2000));
+  const PowerScheduler probe(config);
+
+  char probes[48];
+  std::snprintf(probes, sizeof(probes), probe.probeIntervalMs() != 0 ? "a probe every %u ms" : "too short to power down",
+                static_cast<unsigned>(probe.probeIntervalMs()));
+  std::printf("power: %.1f h, %s, %u SPS, %u load cell%s; reaction %u ms (%s), batch %u ms, "
+              "idle after %u s, powered down after %u s\n",
+              static_cast<double>(signal.durationMs) / 3600000.0, path != nullptr ? path : "synthetic sessions",
+              static_cast<unsigned>(signal.sps), static_cast<unsigned>(signal.cells), signal.cells > 1 ? "s" : "",
+              static_cast<unsigned>(config.maxReactionMs), probes,
+              static_cast<unsigned>(config.networkBatchMs), static_cast<unsigned>(config.idleAfterMs / 1000),
+              static_cast<unsigned>(config.powerDownAfterMs / 1000));
+  const SimResult current = simulate(signal, config, false);
+  const SimResult low = simulate(signal, config, true);
+
+  std::printf("                     wakes  wakes/s     awake   duty   HX711 on  display on   current  loads  reaction avg/max ms\n");
+  printRun("current fw", current, signal, false);
+  printRun("low power", low, signal, true);
+  const PowerStats &p = low.power;
+  std::printf("  low power: active %.1f %%, idle %.1f %%, powered down %.1f %%, %u probes, %u wake-ups, %llu conversions "
+              "(current fw %llu)\n",
+              percent(p.activeMs, signal.durationMs), percent(p.idleMs, signal.durationMs),
+              percent(p.powerDownMs, signal.durationMs), static_cast<unsigned>(p.probes), static_cast<unsigned>(p.wakeUps),
+              static_cast<unsigned long long>(low.conversions), static_cast<unsigned long long>(current.conversions));
+  std::printf("  model: %u us per wake-up, CPU %.0f mA running, %.0f mA idle task, %.0f mA light sleep, HX711 %.1f mA, "
+              "display %.0f mA (estimates, not measured)\n",
+              static_cast<unsigned>(wakeCostUs), cpuRunMa, cpuIdleMa, lightSleepMa, hx711Ma, displayMa);
+
+  // a reaction time that leaves no room for a probe: idle (batched) but never powered down.
+  Signal hour = signal;
+  hour.durationMs = std::min<uint64_t>(signal.durationMs, 3600000u);
+  PowerConfig tight = config;
+  tight.maxReactionMs = 2 * (config.hx711SettleMs + config.samplePeriodMs);
+  const SimResult tightRun = simulate(hour, tight, true);
+
+  // the worst case of the first probe: a load put on 1 ms after the last conversion before powering down.
+  const uint64_t quietMs = config.idleAfterMs + config.powerDownAfterMs + 10000;
+  const uint64_t downMs = simulate(loadAt(signal, 0, quietMs), config, true).firstPowerDownMs;
+  SimResult afterDown = {};
+  if (downMs != 0)
+  {
+    afterDown = simulate(loadAt(signal, downMs + 1, downMs + 10000), config, true);
+    std::printf("  a load 1 ms after powering down (at %.1f s): shown after %llu ms\n",
+                static_cast<double>(downMs) / 1000.0, static_cast<unsigned long long>(afterDown.reactionMaxMs));
+  }
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  if (!signal.loads.empty())
+  {
+    ok &= check(current.reacted == signal.loads.size(), "the current firmware shows every load");
+    ok &= check(low.reacted == signal.loads.size(), "the low-power mode shows every load");
+    ok &= check(low.reactionMaxMs <= config.maxReactionMs, "every load is shown within the maximum reaction time");
+  }
+  else
+  {
+    std::printf("  (a recorded trace has no known load times: the reaction is not checked)\n");
+  }
+  if (downMs != 0)
+  {
+    ok &= check(afterDown.reacted == 1 && afterDown.reactionMaxMs <= config.maxReactionMs,
+                "a load just after powering down is shown in time");
+  }
+  if (!signal.loads.empty())
+  {
+    ok &= check(low.wakes * 10 <= current.wakes, "at least 10 times fewer wake-ups than the current firmware");
+  }
+  else
+  {
+    ok &= check(low.wakes < current.wakes, "fewer wake-ups than the current firmware");   // a trace may never be quiet
+  }
+  ok &= check(low.awakeUs < current.awakeUs, "a lower duty cycle than the current firmware");
+  ok &= check(p.powerDownMs == 0 || low.hx711OnMs < current.hx711OnMs,
+              "the HX711s are off while powered down (probes aside)");
+  ok &= check(p.activeMs + p.idleMs + p.powerDownMs == signal.durationMs,
+              "the time per power state adds up to the run");
+  ok &= check(tightRun.power.powerDownMs == 0 && tightRun.hx711OnMs == hour.durationMs,
+              "a reaction time too short for a probe never powers the HX711s down");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/**
+ * ProfilesScenario.cpp
+ *  Compile-time scale profiles (ScaleProfile.h, ProfileFilter.h) against the run-time filter chain of the
+ *  default build, for the kitchen, platform and checkweigher profiles:
+ *    - the same trace (loads put on and taken off, noise, spikes) through Task1's per sample work
+ *      (acquisition ring + WeightProcessor) with FilterChain configured from the profile, and with
+ *      ProfileFilterChain<P>: every state must be identical,
+ *    - time and cycles per sample of both (best of a few runs), and the RAM of the processor.
+ *  The code size is measured on the firmware: "pio run -e esp32-s3-devkitm-1" against
+ *  "pio run -e esp32-s3-devkitm-1-kitchen" (same profile, run-time vs compiled-in filter settings).
+ *  Returns 1 if a check fails.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_HAVE_TSC 1
+#else
+#define PROFILE_HAVE_TSC 0
+#endif
+
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "ProfileFilter.h"
+#include "ScaleProfile.h"
+#include "Scenarios.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+// the constants a profile build works with are known to the compiler.
+static_assert(ProfileTraits<KitchenScale>::maxGrams == 5000, "kitchen: 5 kg");
+static_assert(ProfileTraits<PlatformScale>::maxGrams == 200000, "platform: 4 x 50 kg");
+static_assert(ProfileTraits<CheckweigherScale>::samplePeriodMs == 12, "checkweigher: 80 SPS");
+static_assert(ProfileTraits<KitchenScale>::calibrationSamples == 16, "1.6 s at 10 SPS");
+
+struct TraceSample
+{
+  int32_t raw;
+  uint32_t timestampUs;
+};
+
+// the combined signal of Task1 (offsets removed): loads between empty and 90 % of the capacity, held for a few
+// seconds, with noise and a spike now and then.
+template <class P>
+std::vector<TraceSample> makeTrace(size_t count, int32_t noise)
+{
+  std::minstd_rand rng(7);
+  std::uniform_int_distribution<int32_t> noiseDist(-noise, noise);
+  std::uniform_int_distribution<int32_t> loadDist(0, ProfileTraits<P>::maxGrams * 9 / 10);
+  std::uniform_int_distribution<uint32_t> dwellDist(2u * P::sps, 8u * P::sps);
+  std::vector<TraceSample> trace(count);
+  int32_t grams = 0;
+  size_t nextChange = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i == nextChange)
+    {
+      grams = grams == 0 ? loadDist(rng) : 0;
+      nextChange = i + dwellDist(rng);
+    }
+    int32_t raw = static_cast<int32_t>(static_cast<float>(grams) * P::countsPerGram[0]) + noiseDist(rng);
+    if (i % 997 == 500)
+    {
+      raw += 50000;   // a spike: the median takes it out
+    }
+    trace[i].raw = raw;
+    trace[i].timestampUs = static_cast<uint32_t>(i * ProfileTraits<P>::samplePeriodUs);
+  }
+  return trace;
+}
+
+struct Timing
+{
+  double nsPerSample;
+  double cyclesPerSample;   // 0: no cycle counter on this host
+};
+
+// Task1's work for one sample: into the ring, out through the processor.
+template <class Processor>
+int64_t runTrace(Processor &processor, Hx711Acquisition &acquisition, const std::vector<TraceSample> &trace,
+                 std::vector<ScaleState> *states)
+{
+  int64_t checksum = 0;
+  for (const TraceSample &sample : trace)
+  {
+    acquisition.onSample(sample.raw, sample.timestampUs);
+    const ScaleState state = processor.update(acquisition, 0, sample.timestampUs);
+    checksum += state.weightMg + state.flags;
+    if (states != nullptr)
+    {
+      states->push_back(state);
+    }
+  }
+  return checksum;
+}
+
+template <class Processor, class Make>
+Timing measure(Make make, const std::vector<TraceSample> &trace, int runs, int64_t &checksum)
+{
+  Timing best = {1e30, 0};
+  for (int run = 0; run < runs; run++)
+  {
+    Processor processor = make();
+    Hx711Acquisition acquisition;
+    const auto start = std::chrono::steady_clock::now();
+#if PROFILE_HAVE_TSC
+    const uint64_t startTicks = __rdtsc();
+#endif
+    checksum = runTrace(processor, acquisition, trace, nullptr);
+#if PROFILE_HAVE_TSC
+    const uint64_t ticks = __rdtsc() - startTicks;
+#endif
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double ns = seconds * 1e9 / static_cast<double>(trace.size());
+    if (ns < best.nsPerSample)
+    {
+      best.nsPerSample = ns;
+#if PROFILE_HAVE_TSC
+      best.cyclesPerSample = static_cast<double>(ticks) / static_cast<double>(trace.size());
+#endif
+    }
+  }
+  return best;
+}
+
+struct ProfileResult
+{
+  bool identical;
+  bool notSlower;
+};
+
+template <class P>
+ProfileResult compareProfile(size_t samples, int32_t noise, int runs)
+{
+  using Limits = ProfileTraits<P>;
+  using FixedProcessor = BasicWeightProcessor<ProfileFilterChain<P>>;
+  const std::vector<TraceSample> trace = makeTrace<P>(samples, noise);
+
+  auto makeRuntime = []() {
+    WeightProcessor processor(Limits::maxGrams, 500000);
+    processor.filter().configure(Limits::filterConfig());
+    processor.filter().converter().setCalibration(0, P::countsPerGram[0]);
+    return processor;
+  };
+  auto makeFixed = []() {
+    FixedProcessor processor(Limits::maxGrams, 500000);
+    processor.filter().converter().setCalibration(0, P::countsPerGram[0]);
+    return processor;
+  };
+
+  // the same states, sample by sample.
+  std::vector<ScaleState> runtimeStates;
+  std::vector<ScaleState> fixedStates;
+  runtimeStates.reserve(trace.size());
+  fixedStates.reserve(trace.size());
+  {
+    WeightProcessor runtime = makeRuntime();
+    FixedProcessor fixed = makeFixed();
+    Hx711Acquisition runtimeAcquisition;
+    Hx711Acquisition fixedAcquisition;
+    runTrace(runtime, runtimeAcquisition, trace, &runtimeStates);
+    runTrace(fixed, fixedAcquisition, trace, &fixedStates);
+  }
+  size_t differences = 0;
+  size_t stable = 0;
+  for (size_t i = 0; i < trace.size(); i++)
+  {
+    const ScaleState &a = runtimeStates[i];
+    const ScaleState &b = fixedStates[i];
+    if (a.weight != b.weight || a.weightMg != b.weightMg || a.flags != b.flags)
+    {
+      differences++;
+    }
+    stable += a.isStable() ? 1 : 0;
+  }
+
+  int64_t runtimeChecksum = 0;
+  int64_t fixedChecksum = 0;
+  const Timing runtime = measure<WeightProcessor>(makeRuntime, trace, runs, runtimeChecksum);
+  const Timing fixed = measure<FixedProcessor>(makeFixed, trace, runs, fixedChecksum);
+
+  std::printf("  %-13s %2u cell%s %3u SPS %7d g  median %u, %-7s  stable %4.1f %%  differences %zu\n", P::name,
+              static_cast<unsigned>(P::cells), P::cells > 1 ? "s" : " ", static_cast<unsigned>(P::sps),
+              static_cast<int>(Limits::maxGrams), static_cast<unsigned>(P::medianWindow),
+              P::smoothing == Smoothing::Ema ? "ema" : (P::smoothing == Smoothing::MovingAverage ? "average" :
+                                                        (P::smoothing == Smoothing::Kalman ? "kalman" : "none")),
+              100.0 * static_cast<double>(stable) / static_cast<double>(trace.size()), differences);
+  std::printf("    run-time chain   %6.1f ns/sample  %6.1f cycles/sample  %4zu bytes\n", runtime.nsPerSample,
+              runtime.cyclesPerSample, sizeof(WeightProcessor));
+  std::printf("    profile chain    %6.1f ns/sample  %6.1f cycles/sample  %4zu bytes  (%.2fx)\n", fixed.nsPerSample,
+              fixed.cyclesPerSample, sizeof(FixedProcessor), runtime.nsPerSample / fixed.nsPerSample);
+
+  ProfileResult result;
+  result.identical = differences == 0 && runtimeChecksum == fixedChecksum;
+  // a margin for the noise of a shared host: the point is that the constants cost nothing.
+  result.notSlower = fixed.nsPerSample <= runtime.nsPerSample * 1.10;
+  return result;
+}
+
+}  // namespace
+
+int runProfilesScenario(const Options &options)
+{
+  const size_t samples = static_cast<size_t>(options.get("samples", 2000000));
+  const int32_t noise = static_cast<int32_t>(options.get("noise", 200));
+  const int runs = static_cast<int>(options.get("runs", 5));
+
+  std::printf("profiles: %zu samples per profile (noise +/-%d counts), Task1's per sample work, best of %d runs%s\n",
+              samples, noise, runs, PROFILE_HAVE_TSC ? "" : " (no cycle counter on this host)");
+  const ProfileResult kitchen = compareProfile<KitchenScale>(samples, noise, runs);
+  const ProfileResult platform = compareProfile<PlatformScale>(samples, noise, runs);
+  const ProfileResult checkweigher = compareProfile<CheckweigherScale>(samples, noise, runs);
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  ok &= check(kitchen.identical && platform.identical && checkweigher.identical,
+               "the profile chains weigh exactly like the run-time chain (every state of every profile)");
+  ok &= check(kitchen.notSlower && platform.notSlower && checkweigher.notSlower,
+               "the profile chains are not slower than the run-time chain");
+  return ok ? 0 : 1;
+}
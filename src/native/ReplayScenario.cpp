@@ -0,0 +1,639 @@
+/**
+ * ReplayScenario.cpp
+ *  Replays a raw HX711 trace (RawTrace.h: "trace start" on the scale, then GET /trace) through the classes of
+ *  Task1, in the same order: FrameAligner, LoadCellArray, zero drift, Hx711Acquisition, TareAverager,
+ *  WeightProcessor (the body of getWeight(): filter chain, maxScaleValue overload check), ZeroTracker and
+ *  ChangeDetector. The trace time stands in for the clock, so it runs as fast as the host can.
+ *
+ *  For every known weight of the trace ("trace mark <g>") it reports:
+ *    - the settle time: from the mark until the weight is stable within +/- 1 g of it (or flagged as an
+ *      overload, for a weight above the capacity) and stays so,
+ *    - the mean and the largest error of the settled weight,
+ *  and for the whole trace the CPU per conversion, how much faster than real time the replay ran, and the
+ *  bytes per conversion of the file.
+ *
+ *  Without file= it synthesizes a trace with known weights (the load rings when it is put on, noise, spikes,
+ *  missed conversions, a tare of a drifted zero, one weight over the capacity) and records it with
+ *  TraceRecorder like Task1 does. out= writes the trace to a file. The filter options try another filter
+ *  configuration on the same trace.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Calibration.h"
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "Hx711Acquisition.h"
+#include "LoadCellArray.h"
+#include "RawTrace.h"
+#include "Scenarios.h"
+#include "Stats.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+// the firmware's settings (main.cpp).
+const uint32_t readyTimeoutUs = 500000;       // HX711_READY_TIMEOUT_MS
+const int32_t publishDeadbandMg = 1000;       // PUBLISH_DEADBAND_MG
+const uint32_t publishHeartbeatUs = 10000000; // PUBLISH_HEARTBEAT_MS
+const int32_t zeroTrackBandMg = 500;          // ZERO_TRACK_BAND_MG
+const uint32_t zeroTrackIntervalUs = 1000000; // ZERO_TRACK_INTERVAL_MS
+const int32_t toleranceMg = 1000;             // a settled weight is within +/- 1 g of the known one
+
+const float countsPerGram = -396.99f;
+const int32_t capacityGrams = 5000;
+
+using SteadyClock = std::chrono::steady_clock;
+
+// one known weight of the trace and how the replay weighed it.
+struct Reference
+{
+  int32_t referenceMg;
+  uint32_t startUs;
+  uint32_t endUs;
+  bool overload;            // above the capacity: the scale must say overload
+  uint32_t states;
+  bool settled;             // good at the end of the segment
+  uint32_t settledUs;       // first good state of the last good run
+  uint32_t goodStates;      // of the last good run
+  int64_t errorSumMg;       // of the last good run
+  int32_t maxErrorMg;       // of the last good run
+};
+
+/**
+ * @brief Task1 on the host: the same classes, fed from the records of a trace.
+ */
+class Replay
+{
+public:
+  Replay(const TraceHeader &header, const FilterConfig &filter)
+      : aligner_(header.channels), cells_(header.channels), processor_(header.maxGrams, readyTimeoutUs),
+        zeroTracker_(zeroTrackBandMg, zeroTrackIntervalUs), changes_(publishDeadbandMg, publishHeartbeatUs),
+        channels_(header.channels), maxGrams_(header.maxGrams)
+  {
+    for (uint8_t channel = 0; channel < header.channels; channel++)
+    {
+      cells_.setCalibration(channel, header.offsets[channel], header.channelCountsPerGram[channel]);
+      cells_.setTrim(channel, header.trims[channel]);
+    }
+    drift_.countsPerDegree = header.countsPerDegree;
+    drift_.refTemperatureC = header.refTemperatureC;
+    zeroTracker_.setEnabled((header.flags & TRACE_FLAG_ZERO_TRACK) != 0);
+    processor_.filter().configure(filter);
+    processor_.filter().converter().setCalibration(0, header.countsPerGram);
+  }
+
+  void onRecord(const TraceRecord &record)
+  {
+    // no conversion for longer than the timeout: Task1 wakes up anyway and publishes "not ready".
+    if (primed_ && static_cast<int32_t>(record.timeUs - lastUs_) > static_cast<int32_t>(readyTimeoutUs))
+    {
+      cycle(lastUs_ + readyTimeoutUs);
+    }
+    primed_ = true;
+    lastUs_ = record.timeUs;
+    switch (record.kind)
+    {
+      case TraceRecordKind::Sample:
+      {
+        CellFrame frame;
+        if (aligner_.onSample(record.channel, record.value, record.timeUs, frame))
+        {
+          const int32_t combined = cells_.combine(frame);
+          acquisition_.onSample(combined - drift_.correction(temperatureC_), frame.timestampUs);
+          int32_t offsets[LOAD_CELL_MAX_CHANNELS];
+          if (tare_.active() && tare_.onFrame(frame, offsets))
+          {
+            for (uint8_t channel = 0; channel < channels_; channel++)
+            {
+              cells_.setOffset(channel, offsets[channel]);
+            }
+            drift_.refTemperatureC = temperatureC_;
+            tares_++;
+          }
+          cycle(record.timeUs);
+        }
+        break;
+      }
+      case TraceRecordKind::Missed:
+        acquisition_.onMissedSample();
+        cycle(record.timeUs);
+        break;
+      case TraceRecordKind::Event:
+        onEvent(record);
+        break;
+    }
+  }
+
+  void finish()
+  {
+    if (haveReference_)
+    {
+      current_.endUs = lastUs_;
+      references_.push_back(current_);
+    }
+    haveReference_ = false;
+  }
+
+  const std::vector<Reference> &references() const { return references_; }
+  uint32_t published() const { return published_; }
+  uint32_t zeroShifts() const { return zeroShifts_; }
+  uint32_t tares() const { return tares_; }
+  uint32_t overloadStates() const { return overloadStates_; }
+  uint32_t notReadyStates() const { return notReadyStates_; }
+  uint64_t checksum() const { return checksum_; }
+
+private:
+  void onEvent(const TraceRecord &record)
+  {
+    switch (record.event)
+    {
+      case TraceEvent::Tare:
+        tare_.start(channels_, static_cast<uint8_t>(record.value));
+        break;
+      case TraceEvent::Reference:
+        finish();
+        if (record.value != TRACE_NO_REFERENCE)
+        {
+          current_ = Reference();
+          current_.referenceMg = record.value;
+          current_.startUs = record.timeUs;
+          current_.overload = record.value > maxGrams_ * 1000;
+          haveReference_ = true;
+        }
+        break;
+      case TraceEvent::ZeroTrack:
+        zeroTracker_.setEnabled(record.value != 0);
+        break;
+      case TraceEvent::Rate:
+        break;   // the timestamps carry the rate
+      case TraceEvent::Temperature:
+        temperatureC_ = static_cast<float>(record.value) / 100.0f;
+        break;
+    }
+  }
+
+  // the end of a cycle of Task1: getWeight(), zero tracking, change detector.
+  void cycle(uint32_t nowUs)
+  {
+    const ScaleState state = processor_.update(acquisition_, 0, nowUs);
+    const int32_t zeroCounts = zeroTracker_.update(state.weightMg, processor_.lastOutput().filteredRaw,
+                                                   state.isReady() && state.isStable(), state.timestampUs);
+    if (zeroCounts != 0)
+    {
+      cells_.shiftZero(zeroCounts);
+      processor_.filter().reset();
+      zeroShifts_++;
+    }
+    if (changes_.check(state, nowUs) != ChangeReason::None)
+    {
+      published_++;
+    }
+    overloadStates_ += state.isOverload() ? 1 : 0;
+    notReadyStates_ += state.isReady() ? 0 : 1;
+    checksum_ = checksum_ * 1099511628211ULL + (static_cast<uint64_t>(static_cast<uint32_t>(state.weightMg)) << 8) +
+                state.flags;
+    if (haveReference_)
+    {
+      score(state, nowUs);
+    }
+  }
+
+  void score(const ScaleState &state, uint32_t nowUs)
+  {
+    current_.states++;
+    const int32_t errorMg = std::abs(state.weightMg - current_.referenceMg);
+    const bool good = current_.overload ? state.isOverload()
+                                        : state.isReady() && state.isStable() && !state.isOverload() && errorMg <= toleranceMg;
+    if (!good)
+    {
+      current_.settled = false;
+      return;
+    }
+    if (!current_.settled)
+    {
+      current_.settled = true;
+      current_.settledUs = nowUs;
+      current_.goodStates = 0;
+      current_.errorSumMg = 0;
+      current_.maxErrorMg = 0;
+    }
+    current_.goodStates++;
+    if (!current_.overload)
+    {
+      current_.errorSumMg += errorMg;
+      current_.maxErrorMg = errorMg > current_.maxErrorMg ? errorMg : current_.maxErrorMg;
+    }
+  }
+
+  FrameAligner aligner_;
+  LoadCellArray cells_;
+  TareAverager tare_;
+  ZeroDrift drift_;
+  Hx711Acquisition acquisition_;
+  WeightProcessor processor_;
+  ZeroTracker zeroTracker_;
+  ChangeDetector changes_;
+  uint8_t channels_;
+  int32_t maxGrams_;
+  float temperatureC_ = 25.0f;
+  bool primed_ = false;
+  uint32_t lastUs_ = 0;
+  bool haveReference_ = false;
+  Reference current_ = {};
+  std::vector<Reference> references_;
+  uint32_t published_ = 0;
+  uint32_t zeroShifts_ = 0;
+  uint32_t tares_ = 0;
+  uint32_t overloadStates_ = 0;
+  uint32_t notReadyStates_ = 0;
+  uint64_t checksum_ = 14695981039346656037ULL;
+};
+
+struct ReplayResult
+{
+  std::vector<Reference> references;
+  LatencyStats nanosPerRecord;
+  uint32_t records = 0;
+  uint32_t samples = 0;
+  uint32_t durationUs = 0;
+  double wallSeconds = 0;
+  uint32_t published = 0;
+  uint32_t zeroShifts = 0;
+  uint32_t tares = 0;
+  uint32_t overloadStates = 0;
+  uint32_t notReadyStates = 0;
+  uint64_t checksum = 0;
+};
+
+ReplayResult replay(const std::vector<uint8_t> &file, const FilterConfig &filter)
+{
+  ReplayResult result;
+  TraceReader reader(file.data(), file.size());
+  std::unique_ptr<Replay> task1(new Replay(reader.header(), filter));
+  result.nanosPerRecord.reserve(file.size() / 4);
+  TraceRecord record;
+  bool first = true;
+  uint32_t firstUs = 0;
+  const SteadyClock::time_point start = SteadyClock::now();
+  while (reader.next(record))
+  {
+    const SteadyClock::time_point before = SteadyClock::now();
+    task1->onRecord(record);
+    const SteadyClock::time_point after = SteadyClock::now();
+    result.nanosPerRecord.add(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count()));
+    result.records++;
+    result.samples += record.kind == TraceRecordKind::Sample ? 1 : 0;
+    firstUs = first ? record.timeUs : firstUs;
+    first = false;
+    result.durationUs = record.timeUs - firstUs;
+  }
+  task1->finish();
+  result.wallSeconds = std::chrono::duration<double>(SteadyClock::now() - start).count();
+  result.references = task1->references();
+  result.published = task1->published();
+  result.zeroShifts = task1->zeroShifts();
+  result.tares = task1->tares();
+  result.overloadStates = task1->overloadStates();
+  result.notReadyStates = task1->notReadyStates();
+  result.checksum = task1->checksum();
+  return result;
+}
+
+// the blocks of a recorder, appended like writeTrace() of the firmware does.
+void drain(TraceRecorder &recorder, std::vector<uint8_t> &file, std::vector<std::vector<uint8_t>> &blocks)
+{
+  TraceBlock block;
+  while (recorder.take(block))
+  {
+    if (block.first)
+    {
+      file.clear();
+      blocks.clear();
+    }
+    file.insert(file.end(), block.data, block.data + block.length);
+    blocks.emplace_back(block.data, block.data + block.length);
+  }
+}
+
+/**
+ * @brief A synthetic trace: a platform of channels load cells, loads put on and taken off, each held for
+ *        holdS seconds. expected gets every record as it was recorded, for the round trip check.
+ */
+std::vector<uint8_t> synthesize(uint32_t sps, uint8_t channels, uint32_t rounds, uint32_t holdS, double noise, int spikes,
+                                std::vector<TraceRecord> &expected, std::vector<std::vector<uint8_t>> &blocks)
+{
+  static const double loadsGrams[] = {0, 100, 0, 500.5, 2500, 0, 1234, 6000, 0, 42};
+  std::mt19937 rng(21);
+  std::normal_distribution<double> gaussian(0.0, noise / std::sqrt(static_cast<double>(channels)));   // noise of the sum
+  std::uniform_int_distribution<int> percent(0, 999);
+
+  TraceHeader header;
+  header.channels = channels;
+  header.sps = static_cast<uint16_t>(sps);
+  header.maxGrams = capacityGrams;
+  header.countsPerGram = countsPerGram;
+  int32_t trueOffsets[LOAD_CELL_MAX_CHANNELS];
+  float channelCountsPerGram[LOAD_CELL_MAX_CHANNELS];
+  for (uint8_t channel = 0; channel < channels; channel++)
+  {
+    trueOffsets[channel] = 84000 + 1500 * channel;
+    channelCountsPerGram[channel] = countsPerGram * (1.0f + 0.03f * channel);
+    header.offsets[channel] = trueOffsets[channel] + 300;   // the zero drifted since the last tare
+    header.channelCountsPerGram[channel] = channelCountsPerGram[channel];
+  }
+
+  TraceRecorder recorder;
+  std::vector<uint8_t> file;
+  recorder.start(header);
+  auto note = [&](TraceRecordKind kind, uint8_t channel, TraceEvent event, int32_t value, uint32_t us) {
+    TraceRecord record = {kind, channel, event, value, us, 0};
+    expected.push_back(record);
+  };
+  uint32_t timeUs = 3000000000u;   // near the wrap of micros(), on purpose
+  recorder.event(TraceEvent::Temperature, 2500, timeUs);
+  note(TraceRecordKind::Event, 0, TraceEvent::Temperature, 2500, timeUs);
+
+  const uint32_t periodUs = 1000000 / sps;
+  double previousGrams = 0;
+  const size_t loads = sizeof(loadsGrams) / sizeof(loadsGrams[0]);
+  for (uint32_t step = 0; step < rounds * loads; step++)
+  {
+    const double grams = loadsGrams[step % loads];
+    const uint32_t putUs = timeUs;
+    const int32_t referenceMg = static_cast<int32_t>(std::lround(grams * 1000.0));
+    recorder.event(TraceEvent::Reference, referenceMg, putUs);
+    note(TraceRecordKind::Event, 0, TraceEvent::Reference, referenceMg, putUs);
+    for (uint32_t i = 0; i < holdS * sps; i++)
+    {
+      timeUs += periodUs;
+      // the platform rings when the load is put on: 4 Hz, damped in 0.15 s.
+      const double t = (timeUs - putUs) / 1e6;
+      const double load = grams + (previousGrams - grams) * std::exp(-t / 0.15) * std::cos(2 * M_PI * 4.0 * t);
+      for (uint8_t channel = 0; channel < channels; channel++)
+      {
+        const uint32_t readyUs = timeUs + 40 * channel;
+        if (percent(rng) == 0)
+        {
+          recorder.missed(channel, readyUs);
+          note(TraceRecordKind::Missed, channel, TraceEvent::Tare, 0, readyUs);
+          continue;
+        }
+        double counts = trueOffsets[channel] + load / channels * channelCountsPerGram[channel] + gaussian(rng);
+        if (percent(rng) * channels < spikes)   // spikes per 1000 frames
+        {
+          counts += (percent(rng) & 1 ? 1 : -1) * 40000.0;   // a spike (EMI, a knock)
+        }
+        const int32_t raw = static_cast<int32_t>(std::lround(counts));
+        recorder.sample(channel, raw, readyUs);
+        note(TraceRecordKind::Sample, channel, TraceEvent::Tare, raw, readyUs);
+      }
+      // the tare at the start, once the empty platform is quiet.
+      if (step == 0 && i == sps)
+      {
+        recorder.event(TraceEvent::Tare, 10, timeUs + 1000);
+        note(TraceRecordKind::Event, 0, TraceEvent::Tare, 10, timeUs + 1000);
+      }
+      drain(recorder, file, blocks);   // Task5 keeps up
+    }
+    previousGrams = grams;
+  }
+  recorder.stop();
+  drain(recorder, file, blocks);
+  return file;
+}
+
+bool sameRecord(const TraceRecord &a, const TraceRecord &b)
+{
+  return a.kind == b.kind && a.timeUs == b.timeUs && a.value == b.value &&
+         (a.kind == TraceRecordKind::Event ? a.event == b.event : a.channel == b.channel);
+}
+
+// decodes the file and compares with what was recorded; then again with one block left out.
+bool roundTrip(const std::vector<TraceRecord> &expected, const std::vector<std::vector<uint8_t>> &blocks,
+               uint32_t &gapsSeen)
+{
+  std::vector<uint8_t> file;
+  for (const std::vector<uint8_t> &block : blocks)
+  {
+    file.insert(file.end(), block.begin(), block.end());
+  }
+  TraceReader reader(file.data(), file.size());
+  std::vector<TraceRecord> decoded;
+  TraceRecord record;
+  while (reader.next(record))
+  {
+    decoded.push_back(record);
+  }
+  bool ok = reader.valid() && reader.gaps() == 0 && reader.corruptBlocks() == 0 && decoded.size() == expected.size();
+  for (size_t i = 0; ok && i < decoded.size(); i++)
+  {
+    ok = sameRecord(decoded[i], expected[i]);
+  }
+  if (!ok || blocks.size() < 5)
+  {
+    return false;
+  }
+  // block 3 (the 4th data block) lost: everything else still reads back.
+  const uint16_t lost = 3;
+  std::vector<uint8_t> holed;
+  for (size_t i = 0; i < blocks.size(); i++)
+  {
+    if (i != lost + 1u)   // blocks[0] is the header
+    {
+      holed.insert(holed.end(), blocks[i].begin(), blocks[i].end());
+    }
+  }
+  TraceReader holedReader(holed.data(), holed.size());
+  size_t at = 0;
+  while (holedReader.next(record))
+  {
+    while (at < decoded.size() && decoded[at].block == lost)
+    {
+      at++;
+    }
+    ok = ok && at < decoded.size() && sameRecord(record, decoded[at]) && record.block == decoded[at].block;
+    at++;
+  }
+  gapsSeen = holedReader.gaps();
+  return ok && at == decoded.size() && holedReader.gaps() == 1 && holedReader.corruptBlocks() == 0;
+}
+
+bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+  FILE *file = std::fopen(path, "rb");
+  if (!file)
+  {
+    return false;
+  }
+  uint8_t chunk[4096];
+  size_t length;
+  while ((length = std::fread(chunk, 1, sizeof(chunk), file)) != 0)
+  {
+    out.insert(out.end(), chunk, chunk + length);
+  }
+  std::fclose(file);
+  return true;
+}
+
+}  // namespace
+
+int runReplayScenario(const Options &options)
+{
+  const char *path = options.getString("file", nullptr);
+  const char *outPath = options.getString("out", nullptr);
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 10));
+  const uint8_t channels = static_cast<uint8_t>(options.get("channels", 1));
+  const uint32_t rounds = static_cast<uint32_t>(options.get("rounds", 3));
+  const uint32_t holdS = static_cast<uint32_t>(options.get("hold", 20));
+  const double noise = static_cast<double>(options.get("noise", 100));
+  const int spikes = static_cast<int>(options.get("spikes", 1));
+  const uint32_t maxSettleMs = static_cast<uint32_t>(options.get("maxsettle", 4000));
+
+  FilterConfig filter;
+  filter.medianWindow = static_cast<uint8_t>(options.get("median", filter.medianWindow));
+  filter.emaShift = static_cast<uint8_t>(options.get("ema", filter.emaShift));
+  filter.settleUs = static_cast<uint32_t>(options.get("settle", filter.settleUs / 1000)) * 1000;
+  filter.stableToleranceMg = static_cast<int32_t>(options.get("tolerance", filter.stableToleranceMg));
+
+  std::vector<uint8_t> file;
+  std::vector<TraceRecord> expected;
+  std::vector<std::vector<uint8_t>> blocks;
+  if (path)
+  {
+    if (!readFile(path, file))
+    {
+      std::printf("replay: cannot read %s\n", path);
+      return 1;
+    }
+  }
+  else
+  {
+    if (sps == 0 || channels < 1 || channels > LOAD_CELL_MAX_CHANNELS)
+    {
+      std::printf("replay: sps must be > 0 and channels 1..%u\n", static_cast<unsigned>(LOAD_CELL_MAX_CHANNELS));
+      return 1;
+    }
+    file = synthesize(sps, channels, rounds, holdS, noise, spikes, expected, blocks);
+  }
+  if (outPath)
+  {
+    FILE *out = std::fopen(outPath, "wb");
+    if (!out || std::fwrite(file.data(), 1, file.size(), out) != file.size())
+    {
+      std::printf("replay: cannot write %s\n", outPath);
+    }
+    if (out)
+    {
+      std::fclose(out);
+    }
+  }
+
+  TraceReader reader(file.data(), file.size());
+  if (!reader.valid())
+  {
+    std::printf("replay: %s is not a trace\n", path ? path : "the synthetic trace");
+    return 1;
+  }
+  const TraceHeader &header = reader.header();
+  TraceRecord record;
+  while (reader.next(record))
+  {
+  }
+  std::printf("replay: %s, %u channel(s) at %u SPS, capacity %d g, %.2f counts/g, zero tracking %s\n",
+              path ? path : "synthetic trace", static_cast<unsigned>(header.channels), static_cast<unsigned>(header.sps),
+              static_cast<int>(header.maxGrams), static_cast<double>(header.countsPerGram),
+              (header.flags & TRACE_FLAG_ZERO_TRACK) ? "on" : "off");
+  std::printf("  filter: median %u, ema 1/%u, stable within +/-%d mg for %u ms\n",
+              static_cast<unsigned>(filter.medianWindow), 1u << filter.emaShift, static_cast<int>(filter.stableToleranceMg),
+              static_cast<unsigned>(filter.settleUs / 1000));
+
+  ReplayResult first = replay(file, filter);
+  const ReplayResult again = replay(file, filter);
+  const double bytesPerSample = first.samples ? static_cast<double>(file.size()) / first.samples : 0.0;
+  std::printf("  %u bytes, %u blocks (%u missing, %u corrupt), %u records, %u conversions: %.2f bytes/conversion "
+              "(a RawSample is %zu)\n",
+              static_cast<unsigned>(file.size()), reader.blocks(), reader.gaps(), reader.corruptBlocks(), first.records,
+              first.samples, bytesPerSample, sizeof(RawSample));
+
+  std::printf("\n  %10s %9s %10s %10s %10s %7s\n", "known g", "at s", "settle ms", "mean err", "max err", "states");
+  uint32_t settledCount = 0;
+  uint32_t worstSettleMs = 0;
+  int32_t worstErrorMg = 0;
+  bool overloadFlagged = true;
+  bool haveOverload = false;
+  for (const Reference &reference : first.references)
+  {
+    const double atS = (reference.startUs - first.references.front().startUs) / 1e6;
+    if (!reference.settled)
+    {
+      std::printf("  %10.3f %9.1f %10s %10s %10s %7u\n", reference.referenceMg / 1000.0, atS, "never", "-", "-",
+                  reference.states);
+      overloadFlagged = overloadFlagged && !reference.overload;
+      haveOverload = haveOverload || reference.overload;
+      continue;
+    }
+    const uint32_t settleMs = (reference.settledUs - reference.startUs) / 1000;
+    settledCount++;
+    worstSettleMs = settleMs > worstSettleMs ? settleMs : worstSettleMs;
+    if (reference.overload)
+    {
+      haveOverload = true;
+      std::printf("  %10.3f %9.1f %10u %10s %10s %7u  overload\n", reference.referenceMg / 1000.0, atS, settleMs, "-",
+                  "-", reference.states);
+      continue;
+    }
+    worstErrorMg = reference.maxErrorMg > worstErrorMg ? reference.maxErrorMg : worstErrorMg;
+    std::printf("  %10.3f %9.1f %10u %8.3f g %8.3f g %7u\n", reference.referenceMg / 1000.0, atS, settleMs,
+                reference.goodStates ? reference.errorSumMg / 1000.0 / reference.goodStates : 0.0,
+                reference.maxErrorMg / 1000.0, reference.states);
+  }
+  if (first.references.empty())
+  {
+    std::printf("  (no known weights in the trace: send \"trace mark <g>\" while recording)\n");
+  }
+
+  const double traceSeconds = first.durationUs / 1e6;
+  const double speedUp = first.wallSeconds > 0 ? traceSeconds / first.wallSeconds : 0.0;
+  std::printf("\n  %.1f s of trace replayed in %.2f ms: %.0fx real time\n", traceSeconds, first.wallSeconds * 1e3, speedUp);
+  first.nanosPerRecord.print("CPU per record", "ns");
+  std::printf("  published %u states, %u tare(s), %u zero shifts, %u overload and %u not-ready states\n",
+              first.published, first.tares, first.zeroShifts, first.overloadStates, first.notReadyStates);
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  if (!path)
+  {
+    uint32_t gaps = 0;
+    ok &= check(roundTrip(expected, blocks, gaps),
+                "every record reads back exactly; with a block lost, only its records are missing");
+  }
+  else
+  {
+    ok &= check(reader.corruptBlocks() == 0, "every block of the file is readable");
+  }
+  ok &= check(first.checksum == again.checksum && first.published == again.published,
+              "two replays publish the same states");
+  if (!first.references.empty())
+  {
+    char text[160];
+    ok &= check(settledCount == first.references.size() && worstErrorMg <= toleranceMg,
+                 "every known weight settles and stays within +/- 1 g of it");
+    std::snprintf(text, sizeof(text), "every known weight settles within %u ms (slowest %u ms)", maxSettleMs, worstSettleMs);
+    ok &= check(worstSettleMs <= maxSettleMs, text);
+  }
+  if (!path)
+  {
+    ok &= check(haveOverload && overloadFlagged, "a weight above the capacity is flagged as overload");
+  }
+  ok &= check(speedUp >= 100.0, "the replay runs at least 100x faster than real time");
+  ok &= check(bytesPerSample < sizeof(RawSample), "the trace takes fewer bytes per conversion than a RawSample");
+  return ok ? 0 : 1;
+}
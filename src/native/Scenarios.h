@@ -0,0 +1,32 @@
+/**
+ * Scenarios.h
+ *  Simulations and benchmarks that run the firmware pipeline on the host (PlatformIO env:native).
+ *  Every scenario prints a short report to stdout and returns the process exit code.
+ */
+#pragma once
+
+#include "Options.h"
+
+int runAcquisitionScenario(const Options &options);
+int runSnapshotScenario(const Options &options);
+int runFilterScenario(const Options &options);
+int runPipelineScenario(const Options &options);
+int runTelemetryScenario(const Options &options);
+int runNotifyScenario(const Options &options);
+int runUplinkScenario(const Options &options);
+int runHistoryScenario(const Options &options);
+int runCellsScenario(const Options &options);
+int runTasksScenario(const Options &options);
+int runMetricsScenario(const Options &options);
+int runLogScenario(const Options &options);
+int runDisplayScenario(const Options &options);
+int runCalibrationScenario(const Options &options);
+int runBootScenario(const Options &options);
+int runStreamScenario(const Options &options);
+int runCommandsScenario(const Options &options);
+int runFanOutScenario(const Options &options);
+int runMqttScenario(const Options &options);
+int runReplayScenario(const Options &options);
+int runSoakScenario(const Options &options);
+int runProfilesScenario(const Options &options);
+int runPowerScenario(const Options &options);
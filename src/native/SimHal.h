@@ -0,0 +1,198 @@
+/**
+ * SimHal.h
+ *  Simulated implementations of the hardware abstraction (Hal.h) for the native build.
+ *  The load cell is SimulatedHx711 (SimulatedHx711.h).
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Hal.h"
+#include "HostClock.h"
+
+/**
+ * @brief The real (steady) clock of the host.
+ */
+class HostClock : public Clock
+{
+public:
+  uint32_t micros() const override { return hostMicros(); }
+};
+
+/**
+ * @brief A clock that only moves when the simulation advances it, so a run is reproducible and
+ *        can go faster than real time.
+ */
+class SimClock : public Clock
+{
+public:
+  uint32_t micros() const override { return nowUs_; }
+  void advanceUs(uint32_t us) { nowUs_ += us; }
+  void setUs(uint32_t us) { nowUs_ = us; }
+
+private:
+  uint32_t nowUs_ = 0;
+};
+
+/**
+ * @brief Keeps what a TM1637 would show and counts the writes and the bus traffic.
+ * @details The traffic is counted like the chip sees it: showNumber()/showText() are what the TM1637 library
+ *          sends for a value, all 4 digits in 3 transactions (data command, address + 4 digits, display
+ *          control), 7 bytes; writeSegments() is 2 transactions (data command, address + the digits).
+ *          busTimeUs() estimates the bit-bang time with the timing of Tm1637Display (5 us per clock edge).
+ */
+class SimDisplay : public SegmentDisplay
+{
+public:
+  void showNumber(long value) override
+  {
+    std::snprintf(text_, sizeof(text_), "%4ld", value);
+    count(3, 7);
+  }
+  void showText(const char *text) override
+  {
+    std::snprintf(text_, sizeof(text_), "%.4s", text);
+    count(3, 7);
+  }
+  void writeSegments(uint8_t position, const uint8_t *segments, uint8_t count) override
+  {
+    for (uint8_t i = 0; i < count && position + i < 4; i++)
+    {
+      segments_[position + i] = segments[i];
+    }
+    this->count(2, 2u + count);
+  }
+  const char *text() const { return text_; }
+  const uint8_t *segments() const { return segments_; }
+  uint32_t writes() const { return writes_; }
+  uint32_t transactions() const { return transactions_; }
+  uint32_t bytes() const { return bytes_; }
+  // a byte is 8 data clocks and the acknowledge, a transaction adds the start and stop conditions.
+  double busTimeUs() const { return bytes_ * 9 * 2 * 5.0 + transactions_ * 5 * 5.0; }
+
+private:
+  void count(uint32_t transactions, uint32_t bytes)
+  {
+    writes_++;
+    transactions_ += transactions;
+    bytes_ += bytes;
+  }
+
+  char text_[16] = "    ";
+  uint8_t segments_[4] = {};
+  uint32_t writes_ = 0;
+  uint32_t transactions_ = 0;
+  uint32_t bytes_ = 0;
+};
+
+/**
+ * @brief WebSocket server stand-in: every client has a send buffer, a broadcast writes the frame
+ *        (WebSocket header + payload) into each of them, like WebSocketsServer does per client.
+ */
+class SimTransport : public Transport
+{
+public:
+  explicit SimTransport(size_t clients = 1, size_t bufferSize = 4096) : clients_(clients)
+  {
+    for (Client &client : clients_)
+    {
+      client.buffer.resize(bufferSize);
+    }
+  }
+
+  void setClientCount(size_t clients)
+  {
+    const size_t bufferSize = clients_.empty() ? 4096 : clients_[0].buffer.size();
+    clients_.resize(clients);
+    for (Client &client : clients_)
+    {
+      client.buffer.resize(bufferSize);
+    }
+  }
+
+  size_t clientCount() override { return clients_.size(); }
+
+  bool broadcastText(const char *data, size_t length) override
+  {
+    bool ok = true;
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+      ok &= send(clients_[i], 0x1, reinterpret_cast<const uint8_t *>(data), length);
+    }
+    return ok;
+  }
+
+  bool broadcastBinary(const uint8_t *data, size_t length) override
+  {
+    bool ok = true;
+    for (size_t i = 0; i < clients_.size(); i++)
+    {
+      ok &= send(clients_[i], 0x2, data, length);
+    }
+    return ok;
+  }
+
+  bool sendText(uint8_t client, const char *data, size_t length) override
+  {
+    return client < clients_.size() && send(clients_[client], 0x1, reinterpret_cast<const uint8_t *>(data), length);
+  }
+
+  bool sendBinary(uint8_t client, const uint8_t *data, size_t length) override
+  {
+    return client < clients_.size() && send(clients_[client], 0x2, data, length);
+  }
+
+  uint64_t bytesSent() const { return bytes_; }
+  uint32_t framesSent() const { return frames_; }
+  /**
+   * @brief The last payload received by a client (without the WebSocket header).
+   */
+  const uint8_t *lastPayload(size_t client, size_t &length) const
+  {
+    length = clients_[client].lastLength;
+    return clients_[client].buffer.data() + clients_[client].lastOffset;
+  }
+
+private:
+  struct Client
+  {
+    std::vector<uint8_t> buffer;
+    size_t lastOffset = 0;
+    size_t lastLength = 0;
+  };
+
+  bool send(Client &client, uint8_t opcode, const uint8_t *data, size_t length)
+  {
+    const size_t header = length < 126 ? 2 : 4;
+    if (header + length > client.buffer.size())
+    {
+      return false;
+    }
+    // the socket drained the previous frame, the new one starts at the beginning of the buffer.
+    uint8_t *out = client.buffer.data();
+    out[0] = static_cast<uint8_t>(0x80 | opcode);
+    if (header == 2)
+    {
+      out[1] = static_cast<uint8_t>(length);
+    }
+    else
+    {
+      out[1] = 126;
+      out[2] = static_cast<uint8_t>(length >> 8);
+      out[3] = static_cast<uint8_t>(length);
+    }
+    std::memcpy(out + header, data, length);
+    client.lastOffset = header;
+    client.lastLength = length;
+    bytes_ += header + length;
+    frames_++;
+    return true;
+  }
+
+  std::vector<Client> clients_;
+  uint64_t bytes_ = 0;
+  uint32_t frames_ = 0;
+};
@@ -0,0 +1,132 @@
+/**
+ * SimulatedHx711.h
+ *  A software HX711 for the native (host) build.
+ *  A background thread produces conversions at the configured rate (10 or 80 SPS like the real chip),
+ *  "pulls DOUT low" by calling the data-ready handler, and keeps the value until it is read.
+ *  If a conversion is not read before the next one is ready, it is overwritten and counted as lost,
+ *  which is what the real chip does.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "Hal.h"
+#include "HostClock.h"
+
+class SimulatedHx711 : public LoadCell
+{
+public:
+  using ReadyHandler = std::function<void(uint32_t readyUs)>;
+
+  /**
+   * @param samplesPerSecond: conversion rate (10 or 80 on the real chip).
+   * @param offset: raw value with an empty platform.
+   * @param countsPerGram: raw counts per gram (the firmware calibration factor).
+   * @param noiseCounts: peak-to-peak noise added to every conversion.
+   * @param seed: noise generator seed (give every simulated chip of a multi-cell platform its own).
+   */
+  SimulatedHx711(uint32_t samplesPerSecond, int32_t offset, float countsPerGram, int32_t noiseCounts,
+                 uint32_t seed = 1234)
+      : periodUs_(1000000u / samplesPerSecond), offset_(offset), countsPerGram_(countsPerGram),
+        noise_(noiseCounts), seed_(seed)
+  {
+  }
+
+  ~SimulatedHx711() { stop(); }
+
+  /**
+   * @brief Starts producing conversions. handler runs on the simulator thread, like an ISR.
+   */
+  void start(ReadyHandler handler)
+  {
+    handler_ = handler;
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  /**
+   * @brief Changes the conversion period before start(): the internal oscillators of real chips differ by
+   *        a few percent, so the conversions of several chips drift against each other.
+   */
+  void setPeriodUs(uint32_t periodUs) { periodUs_ = periodUs; }
+
+  void stop()
+  {
+    running_ = false;
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+  /**
+   * @brief Puts a load on the simulated platform (grams).
+   */
+  void setLoadGrams(float grams) { loadGrams_.store(grams); }
+
+  /**
+   * @brief DOUT is low while an unread conversion is waiting.
+   */
+  bool isReady() override { return ready_.load(); }
+
+  /**
+   * @brief Clocks the conversion out (raises DOUT again).
+   */
+  int32_t read() override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_ = false;
+    return value_;
+  }
+
+  uint32_t producedCount() const { return produced_.load(); }
+  uint32_t overwrittenCount() const { return overwritten_.load(); }
+
+private:
+  void run()
+  {
+    std::minstd_rand rng(seed_);
+    std::uniform_int_distribution<int32_t> noise(-noise_ / 2, noise_ / 2);
+    uint32_t next = hostMicros() + periodUs_;
+    while (running_)
+    {
+      hostSleepUntilMicros(next);
+      next += periodUs_;
+      const uint32_t readyUs = hostMicros();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ready_)
+        {
+          overwritten_++;
+        }
+        value_ = offset_ + static_cast<int32_t>(loadGrams_.load() * countsPerGram_) + noise(rng);
+        ready_ = true;
+      }
+      produced_++;
+      if (handler_)
+      {
+        handler_(readyUs);
+      }
+    }
+  }
+
+  uint32_t periodUs_;
+  const int32_t offset_;
+  const float countsPerGram_;
+  const int32_t noise_;
+  const uint32_t seed_;
+  ReadyHandler handler_;
+  std::thread thread_;
+  std::mutex mutex_;
+  int32_t value_ = 0;
+  std::atomic<bool> running_{false};
+  std::atomic<bool> ready_{false};
+  std::atomic<float> loadGrams_{0.0f};
+  std::atomic<uint32_t> produced_{0};
+  std::atomic<uint32_t> overwritten_{0};
+};
@@ -0,0 +1,140 @@
+/**
+ * SnapshotScenario.cpp
+ *  Stress test for the published scale state: one writer publishes as fast as it can while the
+ *  readers copy the state in a loop. Reports the reader latency and checks that no reader ever sees
+ *  a torn state. The same load is then run with a mutex, like the old shared currentWeight.
+ *  Returns 1 if a reader sees a torn state.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "ScaleState.h"
+#include "Scenarios.h"
+#include "Stats.h"
+
+namespace
+{
+
+// every field is derived from seq, so a torn copy is easy to spot.
+ScaleState makeState(uint32_t seq)
+{
+  ScaleState state;
+  state.seq = seq;
+  state.raw = static_cast<int32_t>(seq * 3u);
+  state.weight = static_cast<int32_t>(seq * 5u);
+  state.timestampUs = seq * 7u;
+  state.flags = static_cast<uint8_t>(seq & SCALE_FLAG_STABLE);
+  return state;
+}
+
+bool isConsistent(const ScaleState &state)
+{
+  return state.raw == static_cast<int32_t>(state.seq * 3u) && state.weight == static_cast<int32_t>(state.seq * 5u) &&
+         state.timestampUs == state.seq * 7u && state.flags == (state.seq & SCALE_FLAG_STABLE);
+}
+
+uint32_t nanosSince(std::chrono::steady_clock::time_point start)
+{
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// runs the writer and the readers; read(state) is the access method under test. Returns the torn reads.
+template <typename Publish, typename Read>
+uint32_t stress(const char *label, int readers, uint32_t milliseconds, Publish publish, Read read)
+{
+  std::atomic<bool> running{true};
+  std::atomic<uint32_t> published{0};
+  std::thread writer([&]() {
+    uint32_t seq = 1;
+    while (running)
+    {
+      publish(makeState(seq++));
+    }
+    published = seq - 1;
+  });
+
+  std::vector<LatencyStats> latency(static_cast<size_t>(readers));
+  std::vector<uint32_t> torn(static_cast<size_t>(readers), 0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++)
+  {
+    threads.emplace_back([&, i]() {
+      LatencyStats &stats = latency[static_cast<size_t>(i)];
+      stats.reserve(1u << 20);
+      while (running)
+      {
+        ScaleState state = {};
+        const auto start = std::chrono::steady_clock::now();
+        read(state);
+        const uint32_t ns = nanosSince(start);
+        if (stats.count() < (1u << 20))
+        {
+          stats.add(ns);
+        }
+        if (state.seq != 0 && !isConsistent(state))
+        {
+          torn[static_cast<size_t>(i)]++;
+        }
+      }
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  running = false;
+  writer.join();
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+
+  uint32_t tornTotal = 0;
+  for (uint32_t count : torn)
+  {
+    tornTotal += count;
+  }
+  std::printf("%s: writer published %u states in %u ms, torn reads %u\n", label, published.load(), milliseconds,
+              tornTotal);
+  for (int i = 0; i < readers; i++)
+  {
+    char name[32];
+    std::snprintf(name, sizeof(name), "reader %d", i);
+    latency[static_cast<size_t>(i)].print(name, "ns");
+  }
+  return tornTotal;
+}
+
+}  // namespace
+
+int runSnapshotScenario(const Options &options)
+{
+  const int readers = static_cast<int>(options.get("readers", 3));
+  const uint32_t milliseconds = static_cast<uint32_t>(options.get("ms", 1000));
+
+  ScaleStateSnapshot snapshot;
+  const uint32_t snapshotTorn = stress("snapshot", readers, milliseconds, [&](const ScaleState &state) { snapshot.publish(state); },
+         [&](ScaleState &state) { snapshot.read(state); });
+
+  std::mutex mutex;
+  ScaleState shared = {};
+  const uint32_t mutexTorn = stress("mutex", readers, milliseconds,
+         [&](const ScaleState &state) {
+           std::lock_guard<std::mutex> lock(mutex);
+           shared = state;
+         },
+         [&](ScaleState &state) {
+           std::lock_guard<std::mutex> lock(mutex);
+           state = shared;
+         });
+
+  bool ok = true;
+  printChecks();
+  ok &= check(snapshotTorn == 0, "no reader sees a torn snapshot");
+  ok &= check(mutexTorn == 0, "no torn state behind the mutex either (comparison)");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,465 @@
+/**
+ * SoakScenario.cpp
+ *  "No heap after boot" soak test: millions of conversions through the steady state of every task of the
+ *  firmware, on a simulated clock (weighings every few seconds, an uplink outage every hour):
+ *    - Task1 : acquisition, filter chain, snapshot, change detector, sample stream, raw trace, the commands
+ *              and their acknowledgements, log records,
+ *    - Task2 : the display,
+ *    - Task3 : the weight fan-out to 4 clients with their own subscriptions, sample batches, metrics frames,
+ *    - Task4 : the uplink queue into MQTT packets (compact payload), store and forward while offline,
+ *    - Task5 : command parsing, acknowledgements, weight history on the file-backed stand-in (flushes, segment
+ *              rollovers, queries), the Prometheus text, the trace file,
+ *    - Task7 : the log drain.
+ *  After a warm-up every stage runs under a HeapGuard with the owner of its task (Trap for Task1, Task2 and
+ *  Task6 as in taskTable), so one operator new anywhere is reported per task. The C heap (malloc: the FILEs
+ *  of the history and the trace) is sampled with mallinfo2() during the run: what is in use, the size of the
+ *  heap and the number of free chunks must not grow, so the heap neither grows nor fragments.
+ *  Returns 1 if a check fails.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "AllocCounter.h"
+#include "ChangeDetector.h"
+#include "Check.h"
+#include "Commands.h"
+#include "DeferredLog.h"
+#include "DisplayStage.h"
+#include "FileHistoryStorage.h"
+#include "HeapGuard.h"
+#include "HistoryStore.h"
+#include "Hx711Acquisition.h"
+#include "Metrics.h"
+#include "Mqtt.h"
+#include "RawTrace.h"
+#include "SampleStream.h"
+#include "ScaleState.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+#include "Subscriptions.h"
+#include "UplinkQueue.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+const int32_t offset = 84000;
+const float countsPerGram = -396.99f;
+const uint64_t epochMs = 1760000000000ull;     // the wall clock of the history
+const uint32_t traceMaxBytes = 256 * 1024;     // TRACE_MAX_BYTES
+const uint32_t traceRestartMs = 3600000;       // a new trace every hour
+const uint32_t outageEveryMs = 3600000;        // the broker is not reachable for 5 minutes every hour
+const uint32_t outageMs = 300000;
+
+// the owners of the heap guard: the index of the task in taskTable.
+enum Owner : uint8_t
+{
+  Task1 = 0,
+  Task2 = 1,
+  Task3 = 2,
+  Task4 = 3,
+  Task5 = 4,
+  Task6 = 5,
+  Task7 = 6,
+};
+const char *const ownerNames[] = {"Task1 acquisition", "Task2 display", "Task3 web socket", "Task4 uplink",
+                                  "Task5 http/history", "Task6 monitor", "Task7 log drain", "-", "other"};
+
+// the messages the web clients send, one every 2 s.
+const char *const clientMessages[] = {"1 tare", "2 zero on", "3 sub rate 10", "4 filter median 5", "5 sub rate 0",
+                                      "6 zero off", "7 sub deadband 2", "8 filter ema 3"};
+
+// 0 g for 2 s, a load (50 g .. 3 kg) for 3 s, taken off again: 6 s per weighing, +-200 counts of noise.
+int32_t rawAt(uint64_t sample, uint32_t sps, std::minstd_rand &rng)
+{
+  static std::uniform_int_distribution<int32_t> noise(-200, 200);
+  const uint64_t weighing = sample / (6 * sps);
+  const uint64_t at = sample % (6 * sps);
+  const int32_t grams = at >= 2 * sps && at < 5 * sps ? static_cast<int32_t>(50 + (weighing * 7919u) % 2950u) : 0;
+  return offset + static_cast<int32_t>(grams * countsPerGram) + noise(rng);
+}
+
+/**
+ * @brief The MQTT sink of the firmware without the socket: every batch becomes a PUBLISH packet.
+ */
+class PacketSink : public UplinkSink
+{
+public:
+  bool connected() override { return online; }
+  bool sendBatch(const UplinkPoint *points, size_t count) override
+  {
+    const size_t length = encodeUplinkPayload(UPLINK_PAYLOAD_COMPACT, points, count, payload_, sizeof(payload_));
+    const size_t packet = encodeMqttPublish("smartscale/weight", payload_, length, 1, false, packetId_++, packet_,
+                                            sizeof(packet_));
+    bytes += packet;
+    batches++;
+    return packet != 0;
+  }
+
+  bool online = true;
+  uint64_t bytes = 0;
+  uint32_t batches = 0;
+
+private:
+  uint16_t packetId_ = 1;
+  uint8_t payload_[MQTT_PACKET_MAX];
+  uint8_t packet_[MQTT_PACKET_MAX];
+};
+
+struct HeapSample
+{
+  uint64_t cycle;
+  size_t inUse;        // malloc'd bytes
+  size_t heap;         // size of the heap (arena and mmapped blocks)
+  size_t freeChunks;   // holes in it
+  uint32_t guarded;    // operator new seen by the heap guard
+};
+
+HeapSample sampleHeap(uint64_t cycle, const HeapGuard &guard)
+{
+  HeapSample sample = {};
+  sample.cycle = cycle;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  sample.inUse = info.uordblks + info.hblkhd;
+  sample.heap = info.arena + info.hblkhd;
+  sample.freeChunks = info.ordblks + info.smblks;
+#endif
+  sample.guarded = guard.allocations();
+  return sample;
+}
+
+void printHeap(const HeapSample &sample, uint32_t sps)
+{
+  std::printf("    %10llu  %8.2f h  %10zu  %10zu  %8zu  %8u\n", static_cast<unsigned long long>(sample.cycle),
+              static_cast<double>(sample.cycle) / sps / 3600.0, sample.inUse, sample.heap, sample.freeChunks,
+              static_cast<unsigned>(sample.guarded));
+}
+
+}  // namespace
+
+int runSoakScenario(const Options &options)
+{
+  const uint64_t cycles = static_cast<uint64_t>(options.get("cycles", 2000000));
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  // every periodic job runs at least once in the warm-up (the first history query is at 10 minutes): the first
+  // fopen() of a file for reading leaves a few hundred bytes of the C library behind for good.
+  const uint64_t warmup = static_cast<uint64_t>(options.get("warmup", 900)) * sps;
+  const char *directory = options.getString("dir", "/tmp/scale-soak");
+  const uint32_t periodUs = 1000000u / sps;
+
+  // everything is built before the run, like the globals of the firmware and setup().
+  SimClock clock;
+  systemLog.setClock(&clock);
+  Hx711Acquisition acquisition;
+  WeightProcessor processor(5000, 500000);
+  processor.filter().converter().setCalibration(offset, countsPerGram);
+  ScaleStateSnapshot snapshot;
+  ChangeDetector changes(1000, 10000000u);
+  StreamRing streamRing;
+  StreamBatcher batcher(16, 250000);
+  TraceRecorder trace;
+  TraceHeader traceHeader;
+  traceHeader.sps = static_cast<uint16_t>(sps);
+  traceHeader.offsets[0] = offset;
+  traceHeader.countsPerGram = countsPerGram;
+  CommandQueue commands;
+  AckQueue acks;
+  SimDisplay display;
+  DisplayStage displayStage(display);
+  SimTransport transport(4);
+  FanOut<8, 4> fanOut(100000);
+  for (uint8_t client = 0; client < 4; client++)
+  {
+    Subscription subscription = defaultSubscription(1000, 10000000u, client == 3 ? SUBSCRIPTION_BINARY : SUBSCRIPTION_JSON);
+    subscription.intervalUs = client == 1 ? 100000 : 0;
+    fanOut.subscribe(client, subscription);
+  }
+  fanOut.setActive(0x0F);
+  Metrics metrics;
+  uint8_t metricsFrame[METRICS_FRAME_SIZE];
+  UplinkConfig uplinkConfig;
+  uplinkConfig.deadband = 2;
+  UplinkQueue uplink(uplinkConfig);
+  PacketSink sink;
+  FileHistoryStorage storage(directory, HistoryConfig().segmentCount);
+  storage.clear();
+  HistoryStore history(storage);
+  history.begin();
+  ChangeDetector historyChanges(1000, 60000000u);
+  char traceName[256];
+  std::snprintf(traceName, sizeof(traceName), "%s/trace.bin", directory);
+  std::FILE *traceFile = nullptr;
+  uint32_t traceFileBytes = 0;
+  std::minstd_rand rng(3);
+  HeapGuard guard;
+  guard.setPolicy(Task1, HeapPolicy::Trap);
+  guard.setPolicy(Task2, HeapPolicy::Trap);
+  guard.setPolicy(Task6, HeapPolicy::Trap);
+
+  char line[128];
+  uint8_t chunk[512];
+  char ack[112];
+  uint64_t logBytes = 0;
+  uint64_t httpBytes = 0;
+  uint32_t historyQueries = 0;
+  uint32_t commandsRun = 0;
+  uint32_t weighings = 0;
+  bool notified = false;
+  bool wasStable = false;
+  uint32_t lastMetricsMs = 0;
+  uint32_t lastExportMs = 0;
+  uint32_t lastFlushMs = 0;
+  uint32_t lastQueryMs = 0;
+  uint32_t lastCommandMs = 0;
+  uint32_t lastTraceMs = 0;
+  uint32_t messageIndex = 0;
+  HeapSample samples[12];
+  size_t sampleCount = 0;
+  const uint64_t sampleEvery = cycles > warmup ? (cycles - warmup) / 10 : 1;
+
+  std::printf("soak: %llu conversions at %u SPS (%.1f hours simulated), warm-up %llu s, history in %s\n",
+              static_cast<unsigned long long>(cycles), sps, static_cast<double>(cycles) / sps / 3600.0,
+              static_cast<unsigned long long>(warmup / sps), directory);
+  trace.start(traceHeader);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (uint64_t cycle = 0; cycle < cycles; cycle++)
+  {
+    if (cycle == warmup)
+    {
+      // the end of setup(): from here on nothing should allocate.
+      guard.arm();
+      samples[sampleCount++] = sampleHeap(cycle, guard);
+    }
+    else if (cycle > warmup && (cycle - warmup) % sampleEvery == 0 && sampleCount < 11)
+    {
+      samples[sampleCount++] = sampleHeap(cycle, guard);
+    }
+    clock.advanceUs(periodUs);
+    const uint32_t nowUs = clock.micros();
+    const uint64_t elapsedMs = cycle * periodUs / 1000;
+    const uint32_t nowMs = static_cast<uint32_t>(elapsedMs);
+
+    // Task1: one conversion.
+    guardAllocations(&guard, Task1);
+    const int32_t raw = rawAt(cycle, sps, rng);
+    trace.sample(0, raw, nowUs);
+    acquisition.onSample(raw, nowUs);
+    metrics.onSample(nowUs);
+    Command command;
+    while (commands.pop(command))
+    {
+      acks.push(makeAck(command, CommandStatus::Ok, command.type == CommandType::Tare ? offset : command.value, nowUs));
+      commandsRun++;
+    }
+    const ScaleState state = processor.update(acquisition, offset, nowUs);
+    snapshot.publish(state);
+    streamRing.push({state.weightMg, nowUs, static_cast<uint32_t>(cycle)});
+    if (changes.check(state, nowUs) != ChangeReason::None)
+    {
+      notified = true;
+    }
+    const bool stable = state.isStable();
+    if (stable && !wasStable && state.weight != 0)
+    {
+      LOG_INFO("Weighed %d g", static_cast<int>(state.weight));
+      trace.event(TraceEvent::Reference, state.weightMg, nowUs);
+      weighings++;
+    }
+    wasStable = stable;
+
+    ScaleState copy;
+    snapshot.read(copy);
+    if (notified)
+    {
+      // Task2: the display.
+      guardAllocations(&guard, Task2);
+      displayStage.show(copy);
+    }
+
+    // Task3: the web clients.
+    guardAllocations(&guard, Task3);
+    if (notified || fanOut.waitUs() != UINT32_MAX)
+    {
+      fanOut.publish(copy, nowUs, transport);
+      notified = false;
+    }
+    batcher.service(streamRing, transport, nowUs);
+    if (nowMs - lastMetricsMs >= 5000)
+    {
+      lastMetricsMs = nowMs;
+      transport.broadcastBinary(metricsFrame, encodeMetricsFrame(metrics, nowMs / 1000, metricsFrame, sizeof(metricsFrame)));
+    }
+
+    // Task4: the uplink, every 100 ms.
+    if (cycle % (sps / 10) == 0)
+    {
+      guardAllocations(&guard, Task4);
+      sink.online = nowMs % outageEveryMs >= outageMs;
+      uplink.offer(0, copy.weight, nowMs);
+      uplink.service(sink, nowMs);
+    }
+
+    // Task5: commands, acknowledgements, history, the metrics text, the trace file.
+    guardAllocations(&guard, Task5);
+    if (nowMs - lastCommandMs >= 2000)
+    {
+      lastCommandMs = nowMs;
+      const char *message = clientMessages[messageIndex++ % (sizeof(clientMessages) / sizeof(clientMessages[0]))];
+      if (parseCommand(message, std::strlen(message), static_cast<uint8_t>(messageIndex % 4), command))
+      {
+        command.queuedUs = nowUs;
+        commands.push(command);
+        if (command.type == CommandType::Subscribe && command.argument == static_cast<uint8_t>(SubscribeParam::Rate))
+        {
+          Subscription subscription = fanOut.subscription(command.client);
+          subscription.intervalUs = command.value != 0 ? 1000000u / static_cast<uint32_t>(command.value) : 0;
+          fanOut.subscribe(command.client, subscription);
+        }
+      }
+    }
+    CommandAck done;
+    while (acks.pop(done))
+    {
+      transport.sendText(done.client, ack, encodeAckJson(done, ack, sizeof(ack)));
+    }
+    if (historyChanges.check(copy, nowUs) != ChangeReason::None)
+    {
+      history.append(epochMs + elapsedMs, copy.weight);
+    }
+    if (nowMs - lastFlushMs >= 60000)
+    {
+      lastFlushMs = nowMs;
+      history.flush();
+    }
+    if (nowMs - lastQueryMs >= 600000)
+    {
+      // GET /history of the last hour in minute buckets.
+      lastQueryMs = nowMs;
+      history.flush();
+      HistoryStream stream(history, epochMs + elapsedMs - 3600000, epochMs + elapsedMs, 60000, HistoryFormat::Csv);
+      size_t length;
+      while ((length = stream.read(chunk, sizeof(chunk))) != 0)
+      {
+        httpBytes += length;
+      }
+      historyQueries++;
+    }
+    if (nowMs - lastExportMs >= 30000)
+    {
+      // GET /metrics.
+      lastExportMs = nowMs;
+      MetricsExporter exporter(metrics, nowMs / 1000);
+      size_t length;
+      while ((length = exporter.read(line, sizeof(line))) != 0)
+      {
+        httpBytes += length;
+      }
+    }
+    if (nowMs - lastTraceMs >= traceRestartMs)
+    {
+      lastTraceMs = nowMs;
+      trace.start(traceHeader);   // "trace start": a new file
+    }
+    TraceBlock block;
+    while (trace.take(block))
+    {
+      if (block.first)
+      {
+        if (traceFile != nullptr)
+        {
+          std::fclose(traceFile);
+        }
+        traceFile = std::fopen(traceName, "wb");
+        traceFileBytes = 0;
+      }
+      if (traceFile != nullptr && traceFileBytes + block.length <= traceMaxBytes)
+      {
+        traceFileBytes += static_cast<uint32_t>(std::fwrite(block.data, 1, block.length, traceFile));
+      }
+    }
+
+    // Task7: the log drain, every 50 ms.
+    if (cycle % 4 == 0)
+    {
+      guardAllocations(&guard, Task7);
+      size_t length;
+      while ((length = systemLog.drain(line, sizeof(line))) != 0)
+      {
+        logBytes += length;
+      }
+    }
+    guardAllocations(nullptr, 0);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  samples[sampleCount++] = sampleHeap(cycles, guard);
+  if (traceFile != nullptr)
+  {
+    std::fclose(traceFile);
+  }
+
+  std::printf("  %.1f s on the host, %.0f conversions/s (%.0fx real time)\n", seconds, cycles / seconds,
+              cycles / seconds / sps);
+  std::printf("  weighings %u, commands %u, web frames %u (%.1f MB), uplink batches %u, history points %u in %u "
+              "segments, history queries %u, log %.1f KB, trace blocks %u\n",
+              weighings, commandsRun, transport.framesSent(), transport.bytesSent() / 1e6, sink.batches,
+              history.appendCount(), history.segmentStarts(), historyQueries, logBytes / 1024.0, trace.stats().blocks);
+  std::printf("  heap allocations after the warm-up, per task (operator new)\n");
+  bool quiet = true;
+  for (uint8_t owner = 0; owner < HEAP_GUARD_OWNERS; owner++)
+  {
+    const HeapOwnerStats stats = guard.stats(owner);
+    if (owner == 7)
+    {
+      continue;
+    }
+    std::printf("    %-20s %-5s %8u allocations %10u bytes\n", ownerNames[owner],
+                guard.policy(owner) == HeapPolicy::Trap ? "trap" : "count", static_cast<unsigned>(stats.allocations),
+                static_cast<unsigned>(stats.bytes));
+    quiet = quiet && stats.allocations == 0;
+  }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const bool haveMallinfo = true;
+  std::printf("  C heap (mallinfo2)\n");
+  std::printf("         cycle  simulated      in use        heap  free chunks  new\n");
+  for (size_t i = 0; i < sampleCount; i++)
+  {
+    printHeap(samples[i], sps);
+  }
+#else
+  const bool haveMallinfo = false;
+  std::printf("  C heap: mallinfo2() is not available, only operator new is checked\n");
+#endif
+  const HeapSample &first = samples[0];
+  size_t maxInUse = 0;
+  size_t maxHeap = 0;
+  size_t maxFree = 0;
+  for (size_t i = 0; i < sampleCount; i++)
+  {
+    maxInUse = samples[i].inUse > maxInUse ? samples[i].inUse : maxInUse;
+    maxHeap = samples[i].heap > maxHeap ? samples[i].heap : maxHeap;
+    maxFree = samples[i].freeChunks > maxFree ? samples[i].freeChunks : maxFree;
+  }
+
+  bool ok = true;
+  std::printf("\n");
+  printChecks();
+  ok &= check(quiet && guard.traps() == 0, "no task allocates after the warm-up (no operator new, no trap)");
+  if (haveMallinfo)
+  {
+    ok &= check(maxInUse <= first.inUse, "the C heap in use does not grow (the FILEs are reused, not leaked)");
+    ok &= check(maxHeap <= first.heap, "the heap does not grow");
+    ok &= check(maxFree <= first.freeChunks, "the free chunks do not multiply (no fragmentation)");
+  }
+  ok &= check(weighings > 0 && commandsRun > 0 && sink.batches > 0 && historyQueries > 0 && history.segmentStarts() > 1,
+               "every stage ran (weighings, commands, uplink, history queries and segment rollovers)");
+  ok &= check(uplink.droppedCount() == 0, "the uplink outages were bridged by the backlog");
+  return ok ? 0 : 1;
+}
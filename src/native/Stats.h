@@ -0,0 +1,43 @@
+/**
+ * Stats.h
+ *  Small helpers to summarise latency measurements in the native build.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class LatencyStats
+{
+public:
+  void reserve(size_t count) { values_.reserve(count); }
+  void add(uint32_t valueUs) { values_.push_back(valueUs); }
+  size_t count() const { return values_.size(); }
+
+  /**
+   * @brief Returns the given percentile (0..100) of the recorded values.
+   */
+  uint32_t percentile(double pct)
+  {
+    if (values_.empty())
+    {
+      return 0;
+    }
+    std::sort(values_.begin(), values_.end());
+    const size_t index = static_cast<size_t>((pct / 100.0) * static_cast<double>(values_.size() - 1));
+    return values_[index];
+  }
+
+  void print(const char *label, const char *unit = "us")
+  {
+    const uint32_t p50 = percentile(50);
+    const uint32_t p99 = percentile(99);
+    const uint32_t max = percentile(100);
+    std::printf("  %-28s n=%-8zu p50=%u%s p99=%u%s max=%u%s\n", label, count(), p50, unit, p99, unit, max, unit);
+  }
+
+private:
+  std::vector<uint32_t> values_;
+};
@@ -0,0 +1,334 @@
+/**
+ * StreamScenario.cpp
+ *  Dynamic (checkweigher) mode: every sample streamed to the web clients and the weight of the items that
+ *  pass over the platform on a conveyor.
+ *    - streaming: one WebSocket message per sample against batches of 16 (StreamBatcher, SampleRing), for
+ *      1..8 clients: messages and bytes per second, time Task3 spends sending, samples lost, the oldest
+ *      sample of a batch when it is sent, the highest sample rate still sent without a loss; every client
+ *      decodes every batch and checks that no sample is missing,
+ *    - the checkweigher (PeakDetector) on simulated items: items found, weight error of the plateau mean
+ *      against the peak, a faster belt where the items do not settle, a drifting zero.
+ *  The cost of a send is an estimate for the ESP32-S3 (lwIP + WebSockets, per message and client, plus the
+ *  bytes on a ~10 Mbit/s WiFi link), Task3 may use half of the network core (WiFi, Task5). The simulation
+ *  steps the sample clock, it runs much faster than real time.
+ *  Returns 1 if a check fails.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "Check.h"
+#include "Checkweigher.h"
+#include "SampleStream.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+#include "Telemetry.h"
+
+namespace
+{
+
+// estimated cost of a send on the ESP32-S3, per client.
+const double sendMessageUs = 300.0;   // broadcastBIN: lwIP tcp_write + WebSocket header, per message
+const double sendByteUs = 0.8;        // ~10 Mbit/s of WiFi
+const double task3Share = 0.5;        // Task3 gets half of the network core
+const uint32_t flushUs = 250000;      // STREAM_FLUSH_MS
+
+// the web clients: every batch is decoded, the samples must follow each other.
+class CheckingTransport : public SimTransport
+{
+public:
+  explicit CheckingTransport(size_t clients) : SimTransport(clients, 512) {}
+
+  bool broadcastBinary(const uint8_t *data, size_t length) override
+  {
+    StreamSample samples[TELEMETRY_BATCH_MAX];
+    uint32_t lost = 0;
+    const size_t count = decodeSampleBatch(data, length, samples, TELEMETRY_BATCH_MAX, lost);
+    if (count == 0)
+    {
+      badFrames++;
+    }
+    else
+    {
+      // a gap the header does not announce is a sample lost without notice.
+      if (samples[0].seq != nextSeq + lost)
+      {
+        unannounced++;
+      }
+      announced += lost;
+      nextSeq = samples[count - 1].seq + 1;
+      received += count;
+    }
+    return SimTransport::broadcastBinary(data, length);
+  }
+
+  uint32_t nextSeq = 0;
+  uint64_t received = 0;
+  uint64_t announced = 0;
+  uint32_t unannounced = 0;
+  uint32_t badFrames = 0;
+};
+
+struct StreamRun
+{
+  double messagesPerS;
+  double bytesPerS;         // all clients
+  double task3Percent;      // of the network core
+  uint32_t lost;
+  uint32_t maxLatencyUs;
+  uint32_t unannounced;
+  uint32_t badFrames;
+  double deliveredPerS;     // samples per second, per client
+};
+
+/**
+ * Task3 is woken for every full batch (every sample with batch 1) and at least every flushUs, sends what is
+ * due and is busy for the cost of the sends; the producer keeps pushing into the ring meanwhile.
+ */
+StreamRun runStream(uint32_t sps, uint8_t batch, size_t clients, uint32_t seconds)
+{
+  StreamRing ring;
+  StreamBatcher batcher(batch, flushUs);
+  CheckingTransport transport(clients);
+  const double periodUs = 1e6 / sps;
+  const uint32_t samples = sps * seconds;
+  double busyUntilUs = 0;
+  double busyUs = 0;
+  double lastWakeUs = 0;
+  bool pending = false;
+  for (uint32_t k = 0; k < samples; k++)
+  {
+    const double nowUs = k * periodUs;
+    StreamSample sample;
+    sample.weightMg = static_cast<int32_t>(k * 37u % 100000u);
+    sample.timestampUs = static_cast<uint32_t>(nowUs);
+    sample.seq = k;
+    ring.push(sample);
+    pending |= (k + 1) % batch == 0 || nowUs - lastWakeUs >= flushUs;
+    if (pending && busyUntilUs <= nowUs)
+    {
+      const uint64_t bytes = transport.bytesSent();
+      const uint32_t frames = transport.framesSent();
+      batcher.service(ring, transport, sample.timestampUs);
+      const double costUs = (transport.framesSent() - frames) * sendMessageUs +
+                            static_cast<double>(transport.bytesSent() - bytes) * sendByteUs;
+      busyUs += costUs;
+      busyUntilUs = nowUs + costUs / task3Share;
+      lastWakeUs = nowUs;
+      pending = false;
+    }
+  }
+  StreamRun run;
+  run.messagesPerS = static_cast<double>(batcher.messagesSent()) / seconds;
+  run.bytesPerS = static_cast<double>(transport.bytesSent()) / seconds;
+  run.task3Percent = 100.0 * busyUs / (seconds * 1e6);
+  run.lost = batcher.lost();
+  run.maxLatencyUs = batcher.maxLatencyUs();
+  run.unannounced = transport.unannounced;
+  run.badFrames = transport.badFrames;
+  run.deliveredPerS = static_cast<double>(transport.received) / seconds;
+  return run;
+}
+
+// highest sample rate (doubling from 80) still sent without a loss.
+uint32_t maxRate(uint8_t batch, size_t clients)
+{
+  uint32_t best = 0;
+  for (uint32_t sps = 80; sps <= 81920; sps *= 2)
+  {
+    if (runStream(sps, batch, clients, 10).lost != 0)
+    {
+      break;
+    }
+    best = sps;
+  }
+  return best;
+}
+
+// a conveyor: the item slides on (rampMs), rings (damped, 9 Hz) and slides off after dwellMs.
+struct Belt
+{
+  double noiseMg = 400.0;
+  double zeroDriftMgPerS = 0.0;
+  double rampMs = 60.0;
+  std::minstd_rand rng{17};
+  std::normal_distribution<double> noise{0.0, 1.0};
+
+  double load(double grams, double sinceMs, double dwellMs)
+  {
+    if (sinceMs < 0 || sinceMs > dwellMs + rampMs)
+    {
+      return 0;
+    }
+    if (sinceMs > dwellMs)
+    {
+      return grams * (1.0 - (sinceMs - dwellMs) / rampMs);
+    }
+    if (sinceMs < rampMs)
+    {
+      return grams * sinceMs / rampMs;
+    }
+    const double t = (sinceMs - rampMs) / 1000.0;
+    return grams * (1.0 + 0.2 * std::exp(-t / 0.045) * std::cos(2 * 3.14159265 * 9.0 * t));
+  }
+};
+
+struct WeighRun
+{
+  uint32_t items;
+  uint32_t found;
+  uint32_t plateaus;
+  double meanErrorG;
+  double maxErrorG;
+  double maxPeakErrorG;   // what a peak hold would report
+};
+
+WeighRun runBelt(Belt &belt, uint32_t items, double dwellMs, double gapMs, uint32_t sps)
+{
+  PeakDetector detector;
+  std::uniform_real_distribution<double> weights(50.0, 1000.0);
+  std::minstd_rand rng(23);
+  WeighRun run = {items, 0, 0, 0, 0, 0};
+  const double periodMs = 1000.0 / sps;
+  const double itemMs = dwellMs + gapMs;
+  double grams = weights(rng);
+  uint32_t item = 0;
+  double errorSum = 0;
+  for (uint32_t k = 0; item < items; k++)
+  {
+    const double nowMs = k * periodMs;
+    // the first item arrives after one gap (the zero of the empty belt first).
+    const uint32_t current = static_cast<uint32_t>((nowMs - gapMs) / itemMs);
+    if (nowMs >= gapMs && current != item)
+    {
+      if (current >= items)
+      {
+        break;
+      }
+      item = current;
+      grams = weights(rng);
+    }
+    const double since = nowMs - gapMs - item * itemMs;
+    StreamSample sample;
+    sample.weightMg = static_cast<int32_t>(std::lround(belt.load(grams, since, dwellMs) * 1000.0 +
+                                                       belt.zeroDriftMgPerS * nowMs / 1000.0 +
+                                                       belt.noiseMg * belt.noise(belt.rng)));
+    sample.timestampUs = static_cast<uint32_t>(nowMs * 1000.0);
+    sample.seq = k;
+    CheckweighResult result;
+    if (detector.onSample(sample, result))
+    {
+      run.found++;
+      run.plateaus += (result.flags & CHECKWEIGH_PLATEAU) != 0 ? 1 : 0;
+      const double error = std::fabs(result.weightMg / 1000.0 - grams);
+      const double peakError = std::fabs(result.peakMg / 1000.0 - grams);
+      errorSum += error;
+      run.maxErrorG = error > run.maxErrorG ? error : run.maxErrorG;
+      run.maxPeakErrorG = peakError > run.maxPeakErrorG ? peakError : run.maxPeakErrorG;
+    }
+  }
+  run.meanErrorG = run.found != 0 ? errorSum / run.found : 0;
+  return run;
+}
+
+}  // namespace
+
+int runStreamScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 60));
+  const size_t maxClients = static_cast<size_t>(options.get("clients", 8));
+  const uint32_t items = static_cast<uint32_t>(options.get("items", 200));
+  const double noiseMg = static_cast<double>(options.get("noise", 400));
+  const double dwellMs = static_cast<double>(options.get("dwell", 600));
+  bool ok = true;
+
+  std::printf("stream: %u SPS, %u s, send %.0f us/message + %.1f us/byte per client, Task3 %.0f %% of the core\n",
+              sps, seconds, sendMessageUs, sendByteUs, task3Share * 100);
+  std::printf("  %-7s %-5s %9s %10s %8s %6s %11s %9s %12s\n", "clients", "batch", "msgs/s", "bytes/s", "task3 %",
+              "lost", "latency ms", "samples/s", "max SPS");
+  StreamRun single8 = {}, batched8 = {};
+  for (size_t clients = 1; clients <= maxClients; clients *= 2)
+  {
+    for (uint8_t batch : {static_cast<uint8_t>(1), static_cast<uint8_t>(16)})
+    {
+      const StreamRun run = runStream(sps, batch, clients, seconds);
+      std::printf("  %-7zu %-5u %9.1f %10.0f %8.1f %6u %11.1f %9.1f %12u\n", clients, batch, run.messagesPerS,
+                  run.bytesPerS, run.task3Percent, run.lost, run.maxLatencyUs / 1000.0, run.deliveredPerS,
+                  maxRate(batch, clients));
+      ok &= run.unannounced == 0 && run.badFrames == 0;
+      if (clients == maxClients || clients * 2 > maxClients)
+      {
+        (batch == 1 ? single8 : batched8) = run;
+      }
+    }
+  }
+
+  // encode cost of a full batch on this host (the bytes are copied once per message, not per client).
+  StreamSample samples[16];
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    samples[i] = {static_cast<int32_t>(i * 1000), i * 12500u, i};
+  }
+  uint8_t frame[TELEMETRY_BATCH_SIZE(16)];
+  const uint32_t encodes = 1000000;
+  size_t bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < encodes; i++)
+  {
+    samples[0].weightMg = static_cast<int32_t>(i);
+    bytes += encodeSampleBatch(samples, 16, 0, frame, sizeof(frame));
+  }
+  const double encodeNs =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / encodes;
+  StreamSample decoded[16];
+  uint32_t lost = 0;
+  const bool roundTrip = decodeSampleBatch(frame, sizeof(frame), decoded, 16, lost) == 16 && lost == 0 &&
+                         decoded[15].weightMg == samples[15].weightMg &&
+                         decoded[15].timestampUs == samples[15].timestampUs && decoded[15].seq == 15;
+  std::printf("  batch of 16: %zu bytes, encode %.1f ns (host), round trip %s\n", bytes / encodes, encodeNs,
+              roundTrip ? "ok" : "FAIL");
+
+  // the checkweigher.
+  Belt belt;
+  belt.noiseMg = noiseMg;
+  const WeighRun normal = runBelt(belt, items, dwellMs, 400.0, sps);
+  Belt fast;
+  fast.noiseMg = noiseMg;
+  const WeighRun quick = runBelt(fast, items, 150.0, 150.0, sps);
+  Belt drifting;
+  drifting.noiseMg = noiseMg;
+  drifting.zeroDriftMgPerS = 50.0;   // 3 g per minute
+  const WeighRun drift = runBelt(drifting, items, dwellMs, 400.0, sps);
+  std::printf("checkweigher: %u items of 50..1000 g, noise %.0f mg per sample\n", items, noiseMg);
+  std::printf("  %-26s %6s %9s %12s %11s %15s\n", "belt", "found", "plateau", "mean err g", "max err g", "peak max err g");
+  const WeighRun *runs[] = {&normal, &quick, &drift};
+  char name[32];
+  std::snprintf(name, sizeof(name), "on the platform %.0f ms", dwellMs);
+  const char *names[] = {name, "fast: 150 ms", "zero drift 3 g/min"};
+  for (size_t i = 0; i < 3; i++)
+  {
+    std::printf("  %-26s %6u %9u %12.3f %11.3f %15.3f\n", names[i], runs[i]->found, runs[i]->plateaus,
+                runs[i]->meanErrorG, runs[i]->maxErrorG, runs[i]->maxPeakErrorG);
+  }
+
+  const bool batchedNoLoss = batched8.lost == 0 && batched8.deliveredPerS >= sps * 0.99;
+  const bool cheaper = batched8.task3Percent * 4 <= single8.task3Percent;
+  // Task3 wakes at least every flush time, a partial batch waits for the wake after it is due.
+  const bool latency = batched8.maxLatencyUs <= 2 * flushUs;
+  const bool allFound = normal.found == items && quick.found == items && drift.found == items;
+  const bool accurate = normal.plateaus == items && normal.maxErrorG <= 1.0 && drift.maxErrorG <= 1.0;
+  const bool better = normal.maxErrorG < normal.maxPeakErrorG;
+  const bool announced = ok;   // every run above
+  printChecks();
+  ok &= check(batchedNoLoss, "most clients, batches of 16: every sample delivered, none lost");
+  ok &= check(cheaper, "batches take at most 1/4 of the Task3 time of one message per sample");
+  ok &= check(latency, "oldest sample of a batch sent within twice the flush time");
+  ok &= check(announced, "clients see every loss announced, every batch decodes");
+  ok &= check(roundTrip, "batch round trip");
+  ok &= check(allFound, "every item found (normal, fast, drifting belt)");
+  ok &= check(accurate, "plateau weight within 1 g, also with a drifting zero");
+  ok &= check(better, "plateau weight better than the peak");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+/**
+ * TasksScenario.cpp
+ *  The acquisition task next to a busy network: a periodic acquisition thread (the HX711 period, 80 SPS by
+ *  default) runs the filter chain on every cycle and measures itself with TaskTiming, the way the firmware
+ *  tasks do, while "network" threads serve bursts of work (encoding weight messages) like Task3/Task5 under load.
+ *  The same run is repeated with the placements the task table can express:
+ *    - idle      : no network load (the reference),
+ *    - shared    : network load, every thread at the same priority on the same CPUs,
+ *    - priority  : network load, the acquisition thread has a higher (real-time) priority,
+ *    - pinned    : network load, acquisition alone on the last CPU and the network threads on the others.
+ *  It reports cycles, deadline misses, release jitter and run time per placement. A placement the host does
+ *  not allow (real-time priority without the rights, pinning with one CPU) is reported as skipped.
+ *  Returns 1 if the acquisition misses a deadline at nominal load (no network threads) in three runs.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "HostClock.h"
+#include "Hx711Acquisition.h"
+#include "Scenarios.h"
+#include "Stats.h"
+#include "TaskTiming.h"
+#include "Telemetry.h"
+#include "WeightProcessor.h"
+
+namespace
+{
+
+enum class Placement
+{
+  Idle,
+  Shared,
+  Priority,
+  Pinned
+};
+
+const char *placementName(Placement placement)
+{
+  switch (placement)
+  {
+  case Placement::Idle:
+    return "idle";
+  case Placement::Shared:
+    return "shared";
+  case Placement::Priority:
+    return "priority";
+  case Placement::Pinned:
+    return "pinned";
+  }
+  return "?";
+}
+
+struct RunResult
+{
+  bool skipped = false;
+  const char *why = "";
+  TaskTimingReport timing = {};
+  uint32_t jitterP99Us = 0;
+  uint64_t networkMessages = 0;
+};
+
+bool pinToCpu(pthread_t thread, unsigned first, unsigned count)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu = first; cpu < first + count; cpu++)
+  {
+    CPU_SET(cpu, &set);
+  }
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+// a network thread: bursts of busy work (encoding weight messages), then a short pause, like a busy web server.
+void networkLoad(std::atomic<bool> &running, uint32_t burstUs, uint32_t pauseUs, std::atomic<uint64_t> &messages)
+{
+  char json[32];
+  ScaleState state = {};
+  uint64_t count = 0;
+  while (running)
+  {
+    const uint32_t start = hostMicros();
+    while (static_cast<uint32_t>(hostMicros() - start) < burstUs)
+    {
+      state.weight = static_cast<int32_t>(count & 0xfff);
+      encodeWeightJson(state, json, sizeof(json));
+      count++;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(pauseUs));
+  }
+  messages += count;
+}
+
+RunResult runPlacement(Placement placement, uint32_t periodUs, uint32_t seconds, unsigned networkThreads,
+                       uint32_t burstUs, uint32_t pauseUs)
+{
+  RunResult result;
+  const unsigned cpus = std::thread::hardware_concurrency();
+  if (placement == Placement::Pinned && cpus < 2)
+  {
+    result.skipped = true;
+    result.why = "needs 2 CPUs";
+    return result;
+  }
+
+  std::atomic<bool> running{true};
+  std::atomic<bool> failed{false};
+  std::atomic<uint64_t> messages{0};
+  TaskTiming timing(periodUs);
+  LatencyStats jitter;
+  jitter.reserve(seconds * (1000000u / periodUs) + 16);
+
+  std::thread acquire([&]() {
+    if (placement == Placement::Priority)
+    {
+      sched_param param = {};
+      param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+      if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+      {
+        failed = true;
+        return;
+      }
+    }
+    WeightProcessor processor(5000, 500000);
+    Hx711Acquisition acquisition;
+    processor.filter().converter().setCalibration(0, -396.99f);
+    int32_t raw = -396990;   // 1 kg
+    uint32_t release = hostMicros();
+    const uint32_t end = release + seconds * 1000000u;
+    while (static_cast<int32_t>(end - release) > 0)
+    {
+      // vTaskDelayUntil(): sleep until the next release, no drift.
+      release += periodUs;
+      hostSleepUntilMicros(release);
+      timing.begin(hostMicros());
+      jitter.add(timing.lastJitterUs());
+      raw += (raw & 1) ? 397 : -396;
+      acquisition.onSample(raw, release);
+      processor.update(acquisition, 0, release);
+      timing.end(hostMicros());
+    }
+  });
+  if (placement == Placement::Pinned)
+  {
+    pinToCpu(acquire.native_handle(), cpus - 1, 1);
+  }
+
+  std::vector<std::thread> network;
+  if (placement != Placement::Idle)
+  {
+    for (unsigned i = 0; i < networkThreads; i++)
+    {
+      network.emplace_back(networkLoad, std::ref(running), burstUs, pauseUs, std::ref(messages));
+      if (placement == Placement::Pinned)
+      {
+        pinToCpu(network.back().native_handle(), 0, cpus - 1);
+      }
+    }
+  }
+  acquire.join();
+  running = false;
+  for (std::thread &thread : network)
+  {
+    thread.join();
+  }
+  if (failed)
+  {
+    result.skipped = true;
+    result.why = "real-time priority not permitted";
+    return result;
+  }
+  result.timing = timing.report();
+  result.jitterP99Us = jitter.percentile(99);
+  result.networkMessages = messages;
+  return result;
+}
+
+}  // namespace
+
+int runTasksScenario(const Options &options)
+{
+  const uint32_t sps = static_cast<uint32_t>(options.get("sps", 80));
+  const uint32_t seconds = static_cast<uint32_t>(options.get("seconds", 3));
+  const unsigned networkThreads = static_cast<unsigned>(options.get("network", 2));
+  const uint32_t burstUs = static_cast<uint32_t>(options.get("burstus", 20000));
+  const uint32_t pauseUs = static_cast<uint32_t>(options.get("pauseus", 1000));
+  const uint32_t periodUs = 1000000u / (sps ? sps : 1);
+
+  std::printf("tasks: acquisition every %u us (%u SPS) for %u s, %u network threads (%u us bursts, %u us pauses), "
+              "%u CPUs\n",
+              periodUs, sps, seconds, networkThreads, burstUs, pauseUs, std::thread::hardware_concurrency());
+  std::printf("  %-9s %7s %7s %18s %10s %16s %14s\n", "placement", "cycles", "misses", "jitter avg/max us",
+              "p99 us", "run avg/max us", "net messages");
+  const Placement placements[] = {Placement::Idle, Placement::Shared, Placement::Priority, Placement::Pinned};
+  TaskTimingReport nominal = {};
+  for (Placement placement : placements)
+  {
+    RunResult r = runPlacement(placement, periodUs, seconds, networkThreads, burstUs, pauseUs);
+    // the reference may be preempted by the host itself (other processes, a shared VM): it is run again, a real
+    // overrun misses every time.
+    for (int retry = 0; placement == Placement::Idle && r.timing.misses != 0 && retry < 2; retry++)
+    {
+      r = runPlacement(placement, periodUs, seconds, networkThreads, burstUs, pauseUs);
+    }
+    if (placement == Placement::Idle)
+    {
+      nominal = r.timing;
+    }
+    if (r.skipped)
+    {
+      std::printf("  %-9s skipped (%s)\n", placementName(placement), r.why);
+      continue;
+    }
+    std::printf("  %-9s %7u %7u %8u/%-9u %10u %7u/%-8u %14llu\n", placementName(placement), r.timing.cycles,
+                r.timing.misses, r.timing.jitterAvgUs, r.timing.jitterMaxUs, r.jitterP99Us, r.timing.runAvgUs,
+                r.timing.runMaxUs, static_cast<unsigned long long>(r.networkMessages));
+  }
+
+  bool ok = true;
+  printChecks();
+  ok &= check(nominal.cycles + 1 >= sps * seconds, "idle: the acquisition runs every period");
+  ok &= check(nominal.misses == 0, "idle: no deadline miss at nominal load");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/**
+ * TelemetryScenario.cpp
+ *  Compares the JSON and the binary telemetry messages:
+ *    - encode time,
+ *    - bytes on the wire per message (WebSocket header included),
+ *    - heap allocations per broadcast (the goal is zero),
+ *  and checks that a binary frame decodes back to the same state.
+ *  Returns 1 if a broadcast allocates or the round trip fails.
+ */
+#include <chrono>
+#include <cstdio>
+
+#include "AllocCounter.h"
+#include "Scenarios.h"
+#include "SimHal.h"
+#include "Telemetry.h"
+
+namespace
+{
+
+ScaleState makeState(uint32_t i)
+{
+  ScaleState state = {};
+  state.weightMg = static_cast<int32_t>((i * 7919u) % 5000000u);
+  state.weight = (state.weightMg + 500) / 1000;
+  state.seq = i;
+  state.timestampUs = i * 12500u;
+  state.flags = (i & 8u) ? SCALE_FLAG_STABLE : 0;
+  return state;
+}
+
+template <typename Body>
+double meanNanos(uint32_t count, Body body)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+  {
+    body(i);
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+}  // namespace
+
+int runTelemetryScenario(const Options &options)
+{
+  const uint32_t count = static_cast<uint32_t>(options.get("count", 1000000));
+  const size_t clients = static_cast<size_t>(options.get("clients", 4));
+  bool ok = true;
+
+  // preallocated like in the firmware: one JSON buffer and one frame.
+  char json[32];
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  SimTransport transport(clients);
+  size_t jsonBytes = 0;
+  size_t frameBytes = 0;
+
+  const double tJson = meanNanos(count, [&](uint32_t i) { jsonBytes += encodeWeightJson(makeState(i), json, sizeof(json)); });
+  const double tFrame = meanNanos(count, [&](uint32_t i) { frameBytes += encodeWeightFrame(makeState(i), frame, sizeof(frame)); });
+
+  std::printf("telemetry: %u messages, %zu clients\n", count, clients);
+  std::printf("  %-8s encode %6.1f ns  payload %5.1f bytes  on the wire %5.1f bytes\n", "json", tJson,
+              static_cast<double>(jsonBytes) / count, static_cast<double>(jsonBytes) / count + 2);
+  std::printf("  %-8s encode %6.1f ns  payload %5.1f bytes  on the wire %5.1f bytes\n", "binary", tFrame,
+              static_cast<double>(frameBytes) / count, static_cast<double>(frameBytes) / count + 2);
+  // the binary frame also carries the sequence number, timestamp and status bits; this is what
+  // the same content costs as JSON.
+  size_t fullJsonBytes = 0;
+  char fullJson[96];
+  const double tFullJson = meanNanos(count, [&](uint32_t i) {
+    const ScaleState state = makeState(i);
+    fullJsonBytes += static_cast<size_t>(std::snprintf(fullJson, sizeof(fullJson),
+                                                       "{\"seq\":%u,\"ts\":%u,\"weight\":%.3f,\"status\":%u}", state.seq,
+                                                       state.timestampUs, state.weightMg / 1000.0, state.flags));
+  });
+  std::printf("  %-8s encode %6.1f ns  payload %5.1f bytes  (JSON with the fields of the binary frame)\n", "json+",
+              tFullJson, static_cast<double>(fullJsonBytes) / count);
+
+  // heap allocations per broadcast (encode + send to every client).
+  const uint32_t broadcasts = count / 10;
+  uint64_t before = allocationCount();
+  for (uint32_t i = 0; i < broadcasts; i++)
+  {
+    const size_t length = encodeWeightJson(makeState(i), json, sizeof(json));
+    transport.broadcastText(json, length);
+  }
+  const uint64_t jsonAllocations = allocationCount() - before;
+  before = allocationCount();
+  for (uint32_t i = 0; i < broadcasts; i++)
+  {
+    const size_t length = encodeWeightFrame(makeState(i), frame, sizeof(frame));
+    transport.broadcastBinary(frame, length);
+  }
+  const uint64_t frameAllocations = allocationCount() - before;
+  std::printf("  heap allocations per broadcast: json %.3f, binary %.3f\n",
+              static_cast<double>(jsonAllocations) / broadcasts, static_cast<double>(frameAllocations) / broadcasts);
+  ok &= jsonAllocations == 0 && frameAllocations == 0;
+
+  // what a client gets back from the binary frame.
+  size_t length = 0;
+  const uint8_t *received = transport.lastPayload(0, length);
+  ScaleState decoded;
+  const ScaleState expected = makeState(broadcasts - 1);
+  const bool roundTrip = decodeWeightFrame(received, length, decoded) && decoded.weightMg == expected.weightMg &&
+                         decoded.seq == expected.seq && decoded.timestampUs == expected.timestampUs &&
+                         decoded.flags == expected.flags;
+  std::printf("  binary frame round trip: %s\n", roundTrip ? "ok" : "FAIL");
+  ok &= roundTrip;
+  return ok ? 0 : 1;
+}
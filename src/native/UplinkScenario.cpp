@@ -0,0 +1,154 @@
+/**
+ * UplinkScenario.cpp
+ *  Compares the old cloud upload (BlynkTimer, V0 and V1 written every second, one message each, lost while
+ *  offline) with the UplinkQueue (deadband, rate limit, one batch per round trip, backlog while offline),
+ *  against a stand-in cloud that counts round trips and goes offline for a while.
+ *  The simulation steps a millisecond clock, it runs much faster than real time.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "Scenarios.h"
+#include "UplinkQueue.h"
+
+namespace
+{
+
+// the stand-in cloud: one sendBatch() is one round trip, offline between offlineFromMs and offlineToMs.
+class StandInCloud : public UplinkSink
+{
+public:
+  StandInCloud(uint32_t offlineFromMs, uint32_t offlineToMs) : offlineFromMs_(offlineFromMs), offlineToMs_(offlineToMs) {}
+
+  void setNow(uint32_t nowMs) { nowMs_ = nowMs; }
+  bool connected() override { return nowMs_ < offlineFromMs_ || nowMs_ >= offlineToMs_; }
+
+  bool sendBatch(const UplinkPoint *points, size_t count) override
+  {
+    if (!connected())
+    {
+      return false;
+    }
+    roundTrips++;
+    for (size_t i = 0; i < count; i++)
+    {
+      points_++;
+      if (points[i].timestampMs >= offlineFromMs_ && points[i].timestampMs < offlineToMs_)
+      {
+        recovered++;   // taken while offline, delivered after the reconnect
+      }
+      if (points[i].timestampMs < lastTimestampMs_)
+      {
+        outOfOrder++;
+      }
+      lastTimestampMs_ = points[i].timestampMs;
+    }
+    return true;
+  }
+
+  uint32_t points() const { return points_; }
+
+  uint32_t roundTrips = 0;
+  uint32_t recovered = 0;
+  uint32_t outOfOrder = 0;
+
+private:
+  uint32_t offlineFromMs_;
+  uint32_t offlineToMs_;
+  uint32_t nowMs_ = 0;
+  uint32_t points_ = 0;
+  uint32_t lastTimestampMs_ = 0;
+};
+
+// the weight in grams at time t: a few loads put on and taken off, plus the 1 g flicker of the rounding.
+class WeightTrace
+{
+public:
+  explicit WeightTrace(uint32_t durationMs) : rng_(7)
+  {
+    std::uniform_int_distribution<uint32_t> when(0, durationMs);
+    std::uniform_int_distribution<int32_t> grams(0, 2000);
+    for (int i = 0; i < 12; i++)
+    {
+      changes_.push_back({when(rng_), grams(rng_)});
+    }
+  }
+
+  int32_t at(uint32_t nowMs)
+  {
+    int32_t weight = 0;
+    uint32_t latest = 0;
+    for (const Change &change : changes_)
+    {
+      if (change.atMs <= nowMs && change.atMs >= latest)
+      {
+        latest = change.atMs;
+        weight = change.grams;
+      }
+    }
+    std::uniform_int_distribution<int32_t> noise(0, 1);
+    return weight + noise(rng_);
+  }
+
+private:
+  struct Change
+  {
+    uint32_t atMs;
+    int32_t grams;
+  };
+  std::minstd_rand rng_;
+  std::vector<Change> changes_;
+};
+
+}  // namespace
+
+int runUplinkScenario(const Options &options)
+{
+  const uint32_t minutes = static_cast<uint32_t>(options.get("minutes", 30));
+  const uint32_t offlineS = static_cast<uint32_t>(options.get("offline", 120));
+  const uint32_t periodMs = static_cast<uint32_t>(options.get("periodms", 100));
+  const int32_t deadband = static_cast<int32_t>(options.get("deadband", 2));
+  const uint32_t durationMs = minutes * 60000u;
+  const uint32_t offlineFromMs = durationMs / 2;
+  const uint32_t offlineToMs = offlineFromMs + offlineS * 1000u;
+
+  // old path: every second V0 and V1 are written, each write is its own message; nothing is sent offline.
+  uint32_t naiveMessages = 0;
+  uint32_t naiveLost = 0;
+  for (uint32_t now = 0; now < durationMs; now += 1000)
+  {
+    const bool online = now < offlineFromMs || now >= offlineToMs;
+    (online ? naiveMessages : naiveLost) += 2;
+  }
+
+  // new path: Task4 offers the weight every periodMs, the queue decides.
+  UplinkConfig config;
+  config.deadband = deadband;
+  UplinkQueue queue(config);
+  StandInCloud cloud(offlineFromMs, offlineToMs);
+  WeightTrace trace(durationMs);
+  size_t maxBacklog = 0;
+  for (uint32_t now = 0; now < durationMs; now += periodMs)
+  {
+    cloud.setNow(now);
+    const int32_t weight = trace.at(now);
+    queue.offer(0, weight, now);
+    queue.offer(1, weight, now);
+    queue.service(cloud, now);
+    maxBacklog = queue.backlogCount() > maxBacklog ? queue.backlogCount() : maxBacklog;
+  }
+
+  std::printf("uplink: %u min, cloud offline for %u s, Task4 every %u ms, deadband %d g\n", minutes, offlineS,
+              periodMs, deadband);
+  std::printf("  fixed 1 s timer   %6u round trips  %6u points  %6u lost while offline\n", naiveMessages,
+              naiveMessages, naiveLost);
+  std::printf("  uplink queue      %6u round trips  %6u points  %6u dropped (backlog full)\n", cloud.roundTrips,
+              cloud.points(), queue.droppedCount());
+  std::printf("  pending values replaced/withdrawn %u\n", queue.coalescedCount());
+  std::printf("  taken offline, sent on reconnect  %u (max backlog %zu of %u, left %zu)\n", cloud.recovered, maxBacklog,
+              static_cast<unsigned>(UplinkQueue::backlogCapacity), queue.backlogCount());
+  std::printf("  points out of order               %u\n", cloud.outOfOrder);
+  return cloud.outOfOrder == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/**
+ * Native (host) entry point of the Smart Scale project.
+ *  Runs the weighing pipeline against simulated hardware so it can be measured on a PC or a CI box:
+ *
+ *    pio run -e native
+ *    .pio/build/native/program <scenario> [key=value ...]
+ *
+ *  Run without arguments to list the scenarios.
+ */
+#include <cstdio>
+#include <cstring>
+
+#include "Scenarios.h"
+
+struct Scenario
+{
+  const char *name;
+  const char *help;
+  int (*run)(const Options &options);
+};
+
+static const Scenario scenarios[] = {
+  {"acquisition", "HX711 data-ready -> ring buffer: sample loss and reader latency [sps= seconds= readers= pollms=]",
+   runAcquisitionScenario},
+  {"snapshot", "scale state snapshot under a full-rate writer: reader latency vs a mutex [readers= ms=]",
+   runSnapshotScenario},
+  {"filter", "fixed-point filter chain: throughput vs the float path, spike/step checks, settle time [samples= sps= noise=]",
+   runFilterScenario},
+  {"pipeline", "sample->filter->publish latency, JSON encode time and per-client broadcast cost [samples= sps= clients=]",
+   runPipelineScenario},
+  {"telemetry", "JSON vs binary telemetry: encode time, bytes on the wire, heap allocations per broadcast [count= clients=]",
+   runTelemetryScenario},
+  {"notify", "fixed 1 s broadcasting vs change-driven publishing: latency and idle traffic [sps= changes= idle= deadband= heartbeat=]",
+   runNotifyScenario},
+  {"uplink", "cloud upload: fixed 1 s timer vs the coalescing uplink queue with an offline window [minutes= offline= periodms= deadband=]",
+   runUplinkScenario},
+  {"history", "flash history store on a file-backed stand-in: append cost, bytes per point, days kept, query throughput [days= weighings= segments= segkb= dir=]",
+   runHistoryScenario},
+  {"cells", "multi load cell platform: aggregate samples/s, frames and skew for 1..8 HX711s, corner balancing [sps= seconds= channels=]",
+   runCellsScenario},
+  {"tasks", "acquisition period under network load: deadline misses and jitter, shared vs priority vs pinned [sps= seconds= network= burstus= pauseus=]",
+   runTasksScenario},
+  {"metrics", "runtime metrics: recording cost per event, consistent copies under a writer, Prometheus text and frame [count= copies=]",
+   runMetricsScenario},
+  {"log", "deferred logging: cost per log call vs synchronous output, multi-producer ring, compile-time levels [count= producers= records= burst= drainus=]",
+   runLogScenario},
+  {"display", "7-segment display: reset + full rewrite vs changed digits only, bus transactions and flicker, g/kg formatting [sps= seconds= noise=]",
+   runDisplayScenario},
+  {"calibration", "multi-point calibration: fit accuracy vs one 50 g point, temperature drift, failures, boot time with stored offsets [sps= noise=]",
+   runCalibrationScenario},
+  {"boot", "staged startup: display and weight before the network, WiFi/web/cloud in the background with backoff, boot timeline [seconds=]",
+   runBootScenario},
+  {"stream", "dynamic mode: every sample to 1..8 clients, one message per sample vs batches, checkweigher item weights [sps= seconds= clients= items= noise= dwell=]",
+   runStreamScenario},
+  {"commands", "typed command queue: decoder, network handler time, request->ack latency, queued vs blocking tare [sps= seconds= interval=]",
+   runCommandsScenario},
+  {"fanout", "per client subscriptions for 1, 8 and 32 clients: old broadcast, per client encoding, shared encoding; a client that stops reading [seconds=]",
+   runFanOutScenario},
+  {"mqtt", "MQTT uplink vs Blynk through a WiFi outage: msg/s, bytes per sample, QoS 0/1 delivery, retained status, burst rate [seconds= offline= burst= broker=host:port]",
+   runMqttScenario},
+  {"replay", "raw HX711 trace replayed through the Task1 pipeline: error vs known weights, settle time, CPU per sample, bytes per sample [file= out= sps= channels= rounds= hold= noise= median= ema= settle= tolerance= maxsettle=]",
+   runReplayScenario},
+  {"soak", "no heap after boot: millions of conversions through every task, allocations per task after the warm-up, C heap growth and fragmentation [cycles= sps= warmup= dir=]",
+   runSoakScenario},
+  {"profiles", "compile-time scale profiles: the profile filter chains against the run-time chain, identical states, ns and cycles per sample, RAM [samples= noise= runs=]",
+   runProfilesScenario},
+  {"power", "low-power mode vs the current firmware on a simulated clock: wake-ups, duty cycle, HX711 and display on-time, reaction to every load [hours= sessions= noise= sps= file= reaction= batch= idle= down= band=]",
+   runPowerScenario},
+};
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+  {
+    for (const Scenario &scenario : scenarios)
+    {
+      if (std::strcmp(argv[1], scenario.name) == 0)
+      {
+        return scenario.run(Options(argc - 2, argv + 2));
+      }
+    }
+  }
+  std::printf("usage: %s <scenario> [key=value ...]\n", argv[0]);
+  for (const Scenario &scenario : scenarios)
+  {
+    std::printf("  %-14s %s\n", scenario.name, scenario.help);
+  }
+  return argc >= 2 ? 1 : 0;
+}
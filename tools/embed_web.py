@@ -0,0 +1,57 @@
+"""
+embed_web.py
+  Turns the web interface (web/index.html) into a gzip-compressed const byte array in flash
+  (include/WebUiData.h), so the web server can stream it straight from flash without a heap copy.
+  The ETag is a hash of the compressed page: browsers revalidate with If-None-Match and get a 304
+  as long as the page did not change.
+
+  Runs before every build of the firmware (platformio.ini: extra_scripts = pre:tools/embed_web.py)
+  and can be run by hand to see the page size:  python tools/embed_web.py
+"""
+import gzip
+import hashlib
+import os
+import sys
+
+SOURCE = os.path.join("web", "index.html")
+TARGET = os.path.join("include", "WebUiData.h")
+
+
+def generate(project_dir):
+    source = os.path.join(project_dir, SOURCE)
+    target = os.path.join(project_dir, TARGET)
+    with open(source, "rb") as f:
+        html = f.read()
+    # mtime=0 keeps the output (and the ETag) identical for the same page.
+    compressed = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = '"%s"' % hashlib.sha1(compressed).hexdigest()[:16]
+
+    lines = [
+        "// Generated by tools/embed_web.py from %s, do not edit." % SOURCE.replace(os.sep, "/"),
+        "#pragma once",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "#define WEB_UI_ETAG      \"%s\"" % etag.replace('"', '\\"'),
+        "#define WEB_UI_RAW_SIZE  %d      // bytes before compression" % len(html),
+        "",
+        "static const uint8_t WEB_UI_GZ[%d] PROGMEM = {" % len(compressed),
+    ]
+    for i in range(0, len(compressed), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in compressed[i:i + 16]) + ",")
+    lines.append("};")
+    content = "\n".join(lines) + "\n"
+
+    # only touch the header when the page changed, so the firmware is not rebuilt for nothing.
+    if not os.path.exists(target) or open(target).read() != content:
+        with open(target, "w") as f:
+            f.write(content)
+    print("web UI: %s %d bytes -> %d bytes gzip (%.0f%%), ETag %s"
+          % (SOURCE, len(html), len(compressed), 100.0 * len(compressed) / len(html), etag))
+
+
+try:
+    Import("env")  # noqa: F821 (defined when PlatformIO runs the script)
+    generate(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    generate(os.path.dirname(os.path.dirname(os.path.abspath(sys.argv[0]))))